@@ -0,0 +1,1050 @@
+#!/usr/bin/python3
+"""Benchmark suite for ember, driven by the stand-in C2 over loopback.
+
+Runs a fixed set of scenarios against a built binary, writes the results as JSON and compares them to a stored
+baseline. Exits non-zero when any metric regressed by more than the threshold, or when there is no baseline to compare
+with; --update-baseline stores one. Against a reference build with an optimisation switched off it also exits non-zero
+when the build under test pays more for it than its budget in REFERENCES.
+"""
+
+import argparse
+import contextlib
+import ctypes
+import json
+import mmap
+import os
+import pathlib
+import shlex
+import socket
+import statistics
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+from collections.abc import Callable
+
+from standin_c2 import (
+    ARCHIVE_FILE,
+    CANCELLED,
+    NO_MEMORY,
+    OUTPUT,
+    TIMED_OUT,
+    ExecFlags,
+    OpCodes,
+    SettingsFlags,
+    Session,
+    StandinC2,
+    content_digest,
+    crc32c,
+    decode_hash,
+    decode_list,
+    encode_callbacks,
+    encode_exec,
+    encode_task,
+    exec_flags,
+)
+
+MIB = 1024 * 1024
+CRC_VERIFY_LIMIT = MIB  # The pure Python CRC32C is too slow to check larger transfers
+EXIT_TIMEOUT = 10  # Seconds the implant gets to exit after EXIT, an instrumented build writes its profile then
+POOL_MAX_THREADS = 8  # Threads of the implant's worker pools, see src/ember/include/pool.h
+POLL_BOUNDS = (100, 60 * 1000)  # Initial bounds of follow-up callbacks in ms, see src/ember/main.c
+MEM_DEFAULT_BUDGET = 64 * MIB  # Initial memory budget, see src/ember/include/mem.h
+JOB_RING_LEN = MIB  # Output a job holds, see src/ember/include/job.h
+SPARSE_EXTENTS = 8  # Data extents of the sparse_transfers file
+
+SCENARIOS: dict[str, Callable] = {}
+
+
+def scenario(func: Callable) -> Callable:
+    SCENARIOS[func.__name__] = func
+    return func
+
+
+def metric(value: float, unit: str, higher_is_better: bool = True, noise: float = 0.0) -> dict:
+    """noise is an absolute change that never counts as a regression, for sub-millisecond latencies."""
+    return {"value": round(value, 3), "unit": unit, "higher_is_better": higher_is_better, "noise": noise}
+
+
+def median_of(repeat: int, func: Callable[[], float]) -> float:
+    return statistics.median(func() for _ in range(repeat))
+
+
+class Context:
+    def __init__(
+        self, args: argparse.Namespace, c2: StandinC2, session: Session, workdir: pathlib.Path, pid: int, b_crc: bool
+    ):
+        self.args = args
+        self.c2 = c2
+        self.session = session
+        self.workdir = workdir
+        self.pid = pid  # The implant, or the emulator running it
+        self.b_crc = b_crc  # False for a -DTRANSFER_CRC=OFF build, whose digests are all 0
+        self.reference: tuple[int, Session] | None = None  # Implant of a paired reference build, see REFERENCES
+        self.reference_results: dict = {}  # What scenarios measured on it
+
+    def payload(self, size: int) -> bytes:
+        # Deterministic and incompressible enough for throughput numbers
+        return (bytes(range(256)) * (size // 256 + 1))[:size]
+
+    def write_file(self, path: pathlib.Path, size: int):
+        block = self.payload(min(size, 64 * MIB))
+        with open(path, "wb") as file:
+            for offset in range(0, size, max(len(block), 1)):
+                file.write(block[: size - offset])
+
+
+@scenario
+def settings_storm(ctx: Context) -> dict:
+    """Pipelined SETTINGS tasks in one session, measures task decode/dispatch throughput."""
+    count = ctx.args.storm_count
+    task = encode_task(OpCodes.SETTINGS, struct.pack(">I", 0), flags=SettingsFlags.WINDOW)
+
+    def run() -> float:
+        start = time.perf_counter()
+        ctx.session.send_raw(task * count)
+        for _ in range(count):
+            ctx.session.recv_response()
+        return count / (time.perf_counter() - start)
+
+    return {"settings_storm": metric(median_of(ctx.args.repeat, run), "tasks/s")}
+
+
+@scenario
+def task_rtt(ctx: Context) -> dict:
+    """Round trip of one small task at a time."""
+    task = encode_task(OpCodes.SETTINGS, struct.pack(">I", 0), flags=SettingsFlags.WINDOW)
+    samples = []
+    for _ in range(ctx.args.rtt_count):
+        start = time.perf_counter()
+        ctx.session.send_raw(task)
+        ctx.session.recv_response()
+        samples.append((time.perf_counter() - start) * 1e6)
+    return {"task_rtt_p50": metric(statistics.median(samples), "us", False, noise=50)}
+
+
+def cpu_ns(pid: int) -> int:
+    """CPU time all threads of a process have run for, from the scheduler's own accounting."""
+    return sum(int((task / "schedstat").read_text().split()[0]) for task in pathlib.Path(f"/proc/{pid}/task").iterdir())
+
+
+@scenario
+def task_cpu(ctx: Context) -> dict:
+    """Implant CPU time per pipelined small task. Unlike the wall clock of settings_storm it leaves out the stand-in C2
+    and the scheduler, per task overheads in the implant show at their own size. With a paired reference the two
+    implants take turns, so both see the same load from the rest of the system."""
+    count = ctx.args.storm_count
+    task = encode_task(OpCodes.SETTINGS, struct.pack(">I", 0), flags=SettingsFlags.WINDOW)
+
+    def run(pid: int, session: Session) -> float:
+        start = cpu_ns(pid)
+        session.send_raw(task * count)
+        for _ in range(count):
+            session.recv_response()
+        return (cpu_ns(pid) - start) / count
+
+    implants = [(ctx.pid, ctx.session)] + ([ctx.reference] if ctx.reference else [])
+    samples = []
+    for idx in range(ctx.args.cpu_rounds):
+        # Each round the other implant goes first, neither keeps the caches warm for the other
+        order = implants if idx % 2 else implants[::-1]
+        sample = {pid: run(pid, session) for pid, session in order}
+        samples.append([sample[pid] for pid, _ in implants])
+    # The lowest, that load only ever adds CPU time
+    tested = min(sample[0] for sample in samples)
+    if ctx.reference:
+        # The load drifts by more between rounds than the two implants differ, so the reference is held to the build
+        # under test by the median of their ratio within each round
+        ratio = statistics.median(sample[0] / sample[1] for sample in samples)
+        ctx.reference_results["task_cpu"] = metric(tested / ratio, "ns", False)
+    return {"task_cpu": metric(tested, "ns", False)}
+
+
+@scenario
+def exec_spawn(ctx: Context) -> dict:
+    count = ctx.args.exec_count
+
+    def run() -> float:
+        start = time.perf_counter()
+        for _ in range(count):
+            ctx.session.execute("/bin/true", ["true"])
+        return count / (time.perf_counter() - start)
+
+    return {"exec_spawn": metric(median_of(ctx.args.repeat, run), "execs/s")}
+
+
+@scenario
+def transfers(ctx: Context) -> dict:
+    results = {}
+    for size in ctx.args.sizes:
+        contents = ctx.payload(size)
+        path = ctx.workdir / f"download-{size}"
+        path.write_bytes(contents)
+        # Once up front, the pure Python CRC32C would dwarf the transfers it checks
+        expected = crc32c(contents) if ctx.b_crc and (size <= CRC_VERIFY_LIMIT) else None
+
+        def download() -> float:
+            start = time.perf_counter()
+            received, digest = ctx.session.download(str(path))
+            elapsed = time.perf_counter() - start
+            if received != contents or expected not in (None, digest):
+                raise RuntimeError(f"DOWNLOAD of {size} bytes did not verify")
+            return size / MIB / elapsed
+
+        def upload() -> float:
+            start = time.perf_counter()
+            digest = ctx.session.upload(str(path) + ".up", contents)
+            elapsed = time.perf_counter() - start
+            if expected not in (None, digest):
+                raise RuntimeError(f"UPLOAD of {size} bytes did not verify")
+            return size / MIB / elapsed
+
+        results[f"download_{size}"] = metric(median_of(ctx.args.repeat, download), "MiB/s")
+        results[f"upload_{size}"] = metric(median_of(ctx.args.repeat, upload), "MiB/s")
+        if pathlib.Path(str(path) + ".up").read_bytes() != contents:
+            raise RuntimeError(f"UPLOAD of {size} bytes wrote the wrong contents")
+    return results
+
+
+@scenario
+def sparse_transfers(ctx: Context) -> dict:
+    """DOWNLOAD and UPLOAD with FileFlags.SPARSE of a large file that is mostly holes. Throughput is of the file's
+    logical size, the wire metrics are what its extents took on the socket, headers included."""
+    size, allocated = ctx.args.sparse_size, ctx.args.sparse_allocated
+    path = ctx.workdir / "sparse"
+    # Evenly spread extents, each starting a stride into the file
+    stride = size // SPARSE_EXTENTS
+    extent_len = allocated // SPARSE_EXTENTS
+    block = ctx.payload(min(extent_len, 64 * MIB))
+    with open(path, "wb") as file:
+        file.truncate(size)
+        for extent in range(SPARSE_EXTENTS):
+            file.seek(extent * stride)
+            for offset in range(0, extent_len, len(block)):
+                file.write(block[: extent_len - offset])
+
+    downloads = []
+
+    def download() -> float:
+        start = time.perf_counter()
+        received, wire_len, digest = ctx.session.download_sparse_into(str(path), lambda offset, chunk: None)
+        elapsed = time.perf_counter() - start
+        if received != size:
+            raise RuntimeError(f"sparse DOWNLOAD of {size} bytes returned {received}")
+        downloads.append((wire_len, digest))
+        return size / MIB / elapsed
+
+    uploads = []
+
+    def upload() -> float:
+        start = time.perf_counter()
+        uploads.append(ctx.session.upload_sparse(str(path) + ".up", str(path)))
+        return size / MIB / (time.perf_counter() - start)
+
+    download_rate = median_of(ctx.args.repeat, download)
+    upload_rate = median_of(ctx.args.repeat, upload)
+    uploaded = (path.parent / (path.name + ".up")).stat()
+    path.unlink()
+    (path.parent / (path.name + ".up")).unlink()
+    if 1 != len(set(downloads + uploads)):
+        raise RuntimeError("sparse DOWNLOADs and UPLOADs of the same file disagree on its extents or CRC32C")
+    if (size != uploaded.st_size) or (uploaded.st_blocks * 512 > 2 * allocated):
+        raise RuntimeError(f"sparse UPLOAD wrote {uploaded.st_size} bytes with {uploaded.st_blocks * 512} allocated")
+    wire_len = downloads[0][0]
+    return {
+        "sparse_download": metric(download_rate, "MiB/s"),
+        "sparse_download_wire": metric(wire_len / MIB, "MiB", False),
+        "sparse_upload": metric(upload_rate, "MiB/s"),
+        "sparse_upload_wire": metric(uploads[0][0] / MIB, "MiB", False),
+    }
+
+
+def cached_bytes(path: pathlib.Path) -> int:
+    """Bytes of the file held in the page cache, through mincore(2) on a mapping that never faults a page in."""
+    libc = ctypes.CDLL(None, use_errno=True)
+    libc.mmap.restype = ctypes.c_void_p
+    libc.mmap.argtypes = (ctypes.c_void_p, ctypes.c_size_t, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_long)
+    libc.munmap.argtypes = (ctypes.c_void_p, ctypes.c_size_t)
+    libc.mincore.argtypes = (ctypes.c_void_p, ctypes.c_size_t, ctypes.c_void_p)
+    page_len = os.sysconf("SC_PAGE_SIZE")
+    size = path.stat().st_size
+    with open(path, "rb") as file:
+        addr = libc.mmap(None, size, mmap.PROT_READ, mmap.MAP_SHARED, file.fileno(), 0)
+    if ctypes.c_void_p(-1).value == addr:
+        raise OSError(ctypes.get_errno(), "mmap")
+    try:
+        residency = (ctypes.c_ubyte * ((size + page_len - 1) // page_len))()
+        if 0 != libc.mincore(addr, size, residency):
+            raise OSError(ctypes.get_errno(), "mincore")
+        return sum(page & 1 for page in residency) * page_len
+    finally:
+        libc.munmap(addr, size)
+
+
+@scenario
+def large_download(ctx: Context) -> dict:
+    """DOWNLOAD of a file far larger than the implant's read windows, from a cold page cache. Measures the hash and send
+    path's throughput and how much of the file the transfer left in the page cache. A file of READSOURCE_MMAP_MIN and
+    up is mapped, the -DMMAP_READS=OFF reference reads it."""
+    size = ctx.args.large_size
+    path = ctx.workdir / "large"
+    ctx.write_file(path, size)
+    with open(path, "rb") as file:
+        os.fsync(file.fileno())
+
+    cached = []
+    digests = set()
+
+    def download() -> float:
+        with open(path, "rb") as file:
+            os.posix_fadvise(file.fileno(), 0, 0, os.POSIX_FADV_DONTNEED)
+        start = time.perf_counter()
+        received, digest = ctx.session.download_into(str(path), lambda chunk: None)
+        elapsed = time.perf_counter() - start
+        if received != size:
+            raise RuntimeError(f"DOWNLOAD of {size} bytes returned {received}")
+        cached.append(cached_bytes(path))
+        digests.add(digest)
+        return size / MIB / elapsed
+
+    throughput = median_of(ctx.args.repeat, download)
+    path.unlink()
+    if 1 != len(digests):
+        raise RuntimeError("DOWNLOADs of the same file reported different CRC32Cs")
+    return {
+        "large_download": metric(throughput, "MiB/s"),
+        "large_download_cached": metric(statistics.median(cached) / MIB, "MiB", False, noise=64),
+    }
+
+
+def proc_usage(pid: int) -> tuple[int, int, int]:
+    """Open fds, child processes (zombies included) and resident KiB of a process."""
+    children = 0
+    for task in pathlib.Path(f"/proc/{pid}/task").iterdir():
+        children += len((task / "children").read_text().split())
+    rss = next(line for line in pathlib.Path(f"/proc/{pid}/status").read_text().splitlines() if line.startswith("VmRSS"))
+    return len(os.listdir(f"/proc/{pid}/fd")), children, int(rss.split()[1])
+
+
+@scenario
+def exec_cancel(ctx: Context) -> dict:
+    """Cancels running EXECs, timing each CANCEL until the EXEC's final response, and times how late a TIMEOUT kills.
+    Every cancelled child must be reaped and its pipes closed, the implant's fds and children are checked after."""
+    start = encode_task(OpCodes.EXEC, encode_exec("/bin/sh", ["sh", "-c", "echo started; exec sleep 60"]), flags=exec_flags())
+    cancel = encode_task(OpCodes.CANCEL)
+    fds, children, rss = proc_usage(ctx.pid)
+
+    samples = []
+    for _ in range(ctx.args.cancel_count):
+        ctx.session.send_raw(start)
+        if OUTPUT != ctx.session.recv_response().code:
+            raise RuntimeError("EXEC to cancel did not start")
+        sent = time.perf_counter()
+        ctx.session.send_raw(cancel)
+        response = ctx.session.recv_exec()
+        samples.append((time.perf_counter() - sent) * 1e6)
+        if (-CANCELLED != response.code) or (0 != ctx.session.recv_response().code):
+            raise RuntimeError(f"CANCEL was answered with {response.code}")
+
+    after_fds, after_children, after_rss = proc_usage(ctx.pid)
+    if (after_fds, after_children) != (fds, children):
+        raise RuntimeError(f"cancelled EXECs leaked {after_fds - fds} fds and {after_children - children} children")
+
+    timeout_ms = 100
+    overshoot = []
+    for _ in range(ctx.args.repeat):
+        started = time.perf_counter()
+        response = ctx.session.execute("/bin/sleep", ["sleep", "60"], timeout_ms=timeout_ms)
+        overshoot.append((time.perf_counter() - started) * 1000 - timeout_ms)
+        if -TIMED_OUT != response.code:
+            raise RuntimeError(f"EXEC with a TIMEOUT was answered with {response.code}")
+
+    return {
+        "cancel_p50": metric(statistics.median(samples), "us", False, noise=50),
+        "cancel_p99": metric(statistics.quantiles(samples, n=100)[98], "us", False, noise=200),
+        "cancel_rss_growth": metric(after_rss - rss, "KiB", False, noise=256),
+        "timeout_overshoot": metric(statistics.median(overshoot), "ms", False, noise=2),
+    }
+
+
+def rss_kib(pid: int) -> int:
+    return proc_usage(pid)[2]
+
+
+def peak_rss_kib(pid: int, reset: bool = False) -> int:
+    """Peak resident KiB of a process since it started, or since the last reset."""
+    if reset:
+        pathlib.Path(f"/proc/{pid}/clear_refs").write_text("5")
+    hwm = next(line for line in pathlib.Path(f"/proc/{pid}/status").read_text().splitlines() if line.startswith("VmHWM"))
+    return int(hwm.split()[1])
+
+
+def set_mem_budget(ctx: Context, budget: int):
+    if 0 != ctx.session.task(OpCodes.SETTINGS, struct.pack(">Q", budget), flags=SettingsFlags.MEM_BUDGET).code:
+        raise RuntimeError(f"SETTINGS memory budget {budget} was rejected")
+
+
+@scenario
+def jobs(ctx: Context) -> dict:
+    """A background job writing --job-flood-bytes must leave the implant's memory flat, its output ring is all it may
+    cost. Then --job-count jobs hold output at once and each is fetched, alone and pipelined all together, measuring
+    what fetching and servicing that many jobs costs a task. The memory budget is lifted meanwhile, the rings of that
+    many jobs need more than its default."""
+    set_mem_budget(ctx, 0)
+    before = rss_kib(ctx.pid)
+    peak = before
+    started = time.perf_counter()
+    flood = ctx.session.start_job("/usr/bin/head", ["head", "-c", str(ctx.args.job_flood_bytes), "/dev/zero"])
+    while next(job for job in ctx.session.jobs() if job.id == flood).running:
+        peak = max(peak, rss_kib(ctx.pid))
+        time.sleep(0.01)
+    elapsed = time.perf_counter() - started
+    peak = max(peak, rss_kib(ctx.pid))
+    output = ctx.session.job_output(flood)
+    if (output.start + len(output.data) != ctx.args.job_flood_bytes) or (0 != output.status):
+        raise RuntimeError(f"flood job ended at {output.start + len(output.data)} with status {output.status}")
+    if peak - before > 4 * 1024:
+        raise RuntimeError(f"flood job grew the implant by {peak - before} KiB")
+
+    held = 64 * 1024
+    command = ["sh", "-c", f"head -c {held} /dev/zero; exec sleep 60"]
+    ids = [ctx.session.start_job("/bin/sh", command) for _ in range(ctx.args.job_count)]
+    while any(job.written < held for job in ctx.session.jobs()):
+        time.sleep(0.01)
+
+    samples = []
+    for job_id in ids:
+        start = time.perf_counter()
+        ctx.session.job_output(job_id)
+        samples.append((time.perf_counter() - start) * 1e6)
+
+    tasks = b"".join(encode_task(OpCodes.JOB_OUTPUT, struct.pack(">IQ", job_id, 0)) for job_id in ids)
+    start = time.perf_counter()
+    ctx.session.send_raw(tasks)
+    fetched = sum(len(ctx.session.recv_response().data) for _ in ids)
+    batch = time.perf_counter() - start
+
+    for job_id in ids:
+        ctx.session.kill_job(job_id)
+    while any(job.running for job in ctx.session.jobs()):
+        time.sleep(0.01)
+    for job_id in ids:
+        ctx.session.job_output(job_id)
+    if ctx.session.jobs():
+        raise RuntimeError("killed jobs were not released")
+    set_mem_budget(ctx, MEM_DEFAULT_BUDGET)
+
+    return {
+        "job_flood": metric(ctx.args.job_flood_bytes / MIB / elapsed, "MiB/s"),
+        "job_flood_rss_growth": metric(peak - before, "KiB", False, noise=256),
+        "job_fetch_p50": metric(statistics.median(samples), "us", False, noise=50),
+        "job_fetch_all": metric(fetched / MIB / batch, "MiB/s"),
+    }
+
+
+@scenario
+def memory_budget(ctx: Context) -> dict:
+    """Pushes ten times --mem-budget through the implant at once: jobs writing output until their rings fill the
+    budget, a DOWNLOAD of four budgets while the rings are held, then payloads of a budget each pipelined behind one
+    another. Whatever the budget has no room for must be answered with NO_MEMORY and the session must go on. Reports
+    how far the implant's peak RSS grew over the run, as a share of the budget, which it must stay within."""
+    budget = ctx.args.mem_budget
+    set_mem_budget(ctx, budget)
+    path = ctx.workdir / "budget"
+    ctx.write_file(path, 4 * budget)
+    base = peak_rss_kib(ctx.pid, reset=True)
+
+    output_len = 2 * JOB_RING_LEN
+    command = encode_exec("/usr/bin/head", ["head", "-c", str(output_len), "/dev/zero"])
+    ids = []
+    while (response := ctx.session.task(OpCodes.EXEC, command, flags=exec_flags() | ExecFlags.BACKGROUND)).code == 0:
+        ids.append(struct.unpack(">I", response.data)[0])
+    if (-NO_MEMORY != response.code) or not ids:
+        raise RuntimeError(f"background EXEC {len(ids)} was answered with {response.code}")
+    while any(job.running for job in ctx.session.jobs()):
+        time.sleep(0.01)
+
+    received = 0
+
+    def sink(view: memoryview):
+        nonlocal received
+        received += len(view)
+
+    ctx.session.download_into(str(path), sink)
+    if 4 * budget != received:
+        raise RuntimeError(f"DOWNLOAD under the budget received {received} bytes")
+    path.unlink()
+
+    pushed = len(ids) * output_len + received
+    payload = encode_task(OpCodes.STATS, bytes(budget))
+    num_payloads = max(1, -(-(10 * budget - pushed) // budget))
+    for _ in range(num_payloads):
+        ctx.session.send_raw(payload)
+    codes = [ctx.session.recv_response().code for _ in range(num_payloads)]
+    if any(-NO_MEMORY != code for code in codes):
+        raise RuntimeError(f"payloads larger than the budget were answered with {codes}")
+    pushed += num_payloads * budget
+
+    for job_id in ids:
+        output = ctx.session.job_output(job_id)
+        if (output.start + len(output.data) != output_len) or (JOB_RING_LEN != len(output.data)):
+            raise RuntimeError(f"job under the budget held {len(output.data)} bytes up to {output.start + len(output.data)}")
+    if ctx.session.jobs():
+        raise RuntimeError("fetched jobs were not released")
+
+    growth = peak_rss_kib(ctx.pid) - base
+    set_mem_budget(ctx, MEM_DEFAULT_BUDGET)
+    if growth * 1024 > budget:
+        raise RuntimeError(f"peak RSS grew by {growth} KiB pushing {pushed / budget:.1f}x a budget of {budget} bytes")
+    print(f"pushed {pushed / budget:.1f}x the budget, {len(ids)} jobs held output", file=sys.stderr)
+    return {"mem_peak_growth": metric(growth * 1024 / budget * 100, "%", False, noise=5)}
+
+
+def make_tree(ctx: Context, root: pathlib.Path, num_files: int, fanout: int = 1000, file_size: int = 0) -> int:
+    """num_files files of file_size bytes, fanout per directory, in two levels of directories. Returns the number of
+    entries below root."""
+    dirs = set()
+    contents = ctx.payload(file_size)
+    for idx in range(0, num_files, fanout):
+        leaf = root / f"d{idx // (fanout * fanout)}" / f"e{idx // fanout % fanout}"
+        leaf.mkdir(parents=True)
+        dirs.update((leaf, leaf.parent))
+        for name in range(min(fanout, num_files - idx)):
+            fd = os.open(leaf / f"f{name}", os.O_CREAT | os.O_WRONLY, 0o644)
+            if contents:
+                os.write(fd, contents)
+            os.close(fd)
+    return num_files + len(dirs)
+
+
+@scenario
+def listing(ctx: Context) -> dict:
+    """LIST of a --list-files tree against the EXEC of find -printf an operator would use otherwise, both with the tree
+    in the page cache. Times from the request to the last entry, parsing on the C2 side is left out of both."""
+    root = ctx.workdir / "tree"
+    expected = make_tree(ctx, root, ctx.args.list_files)
+    find_format = "%y %m %U %G %s %T@ %P\\n"
+    counts = set()
+
+    def run_list() -> float:
+        start = time.perf_counter()
+        entries, count, truncated = ctx.session.list_dir(str(root))
+        elapsed = time.perf_counter() - start
+        counts.add((len(entries), count, truncated))
+        return count / elapsed
+
+    def run_find() -> float:
+        start = time.perf_counter()
+        response = ctx.session.execute("/usr/bin/find", ["find", str(root), "-mindepth", "1", "-printf", find_format])
+        elapsed = time.perf_counter() - start
+        if 0 != response.code:
+            raise RuntimeError(f"find over EXEC failed: {response.code}")
+        return response.data.count(b"\n") / elapsed
+
+    list_rate = median_of(ctx.args.repeat, run_list)
+    find_rate = median_of(ctx.args.repeat, run_find)
+
+    entries = decode_list(ctx.session.list_dir(str(root))[0])
+    if (1 != len(counts)) or (len(entries) != expected) or any(entry.error for entry in entries):
+        raise RuntimeError(f"LIST returned {len(entries)} entries, expected {expected} without errors")
+    limit, pattern = 1000, "f1*"
+    matches = sum(1 for _ in root.rglob(pattern))
+    _, count, truncated = ctx.session.list_dir(str(root), limit=limit, pattern=pattern)
+    if (min(limit, matches) != count) or (truncated != (limit < matches)):
+        raise RuntimeError(
+            f"LIST of {pattern} with a limit of {limit} returned {count} of {matches} entries, truncated {truncated}"
+        )
+
+    if 0 != ctx.session.execute("/bin/rm", ["rm", "-rf", str(root)]).code:
+        raise RuntimeError("removing the tree failed")
+    return {
+        "list_entries": metric(list_rate, "entries/s"),
+        "list_find_entries": metric(find_rate, "entries/s"),
+    }
+
+
+@scenario
+def archive_download(ctx: Context) -> dict:
+    """ARCHIVE DOWNLOAD of a tree of --archive-files small files against a DOWNLOAD round trip per file, in files
+    fetched per second with the tree in the page cache."""
+    root = ctx.workdir / "archive"
+    num_files = ctx.args.archive_files
+    make_tree(ctx, root, num_files, file_size=ctx.args.archive_file_size)
+    paths = sorted(str(pathlib.Path(dirpath) / name) for dirpath, _, names in os.walk(root) for name in names)
+    contents = ctx.payload(ctx.args.archive_file_size)
+    archived = set()
+
+    def run_archive() -> float:
+        start = time.perf_counter()
+        entries, _ = ctx.session.download_archive([str(root)])
+        elapsed = time.perf_counter() - start
+        files = [entry for entry in entries if ARCHIVE_FILE == entry.type]
+        archived.add((len(files), all(contents == entry.data for entry in files)))
+        return len(files) / elapsed
+
+    def run_per_file() -> float:
+        start = time.perf_counter()
+        for path in paths:
+            if ctx.session.download(path)[0] != contents:
+                raise RuntimeError(f"DOWNLOAD of {path} returned the wrong contents")
+        return len(paths) / (time.perf_counter() - start)
+
+    archive_rate = median_of(ctx.args.repeat, run_archive)
+    per_file_rate = median_of(ctx.args.repeat, run_per_file)
+    if {(num_files, True)} != archived:
+        raise RuntimeError(f"ARCHIVE DOWNLOADs returned {archived} files and contents, expected {num_files} intact")
+
+    if 0 != ctx.session.execute("/bin/rm", ["rm", "-rf", str(root)]).code:
+        raise RuntimeError("removing the tree failed")
+    return {
+        "archive_download_files": metric(archive_rate, "files/s"),
+        "archive_per_file_files": metric(per_file_rate, "files/s"),
+    }
+
+
+def thread_counts() -> list[int]:
+    """1, 2, 4... up to the threads the implant would use on its own."""
+    most = min(os.cpu_count() or 1, POOL_MAX_THREADS)
+    return sorted({1 << shift for shift in range(most.bit_length()) if (1 << shift) <= most} | {most})
+
+
+@scenario
+def hashing(ctx: Context) -> dict:
+    """HASH of one --hash-size file and of a tree of --hash-files small files, at each thread count up to one per CPU.
+    The large file does not fit in the page cache on most hosts and is read from disk, the small files are cached. Times
+    from the request to the final response."""
+    large = ctx.workdir / "hash-large"
+    ctx.write_file(large, ctx.args.hash_size)
+    with open(large, "rb") as file:
+        os.fsync(file.fileno())
+    root = ctx.workdir / "hash-tree"
+    make_tree(ctx, root, ctx.args.hash_files, file_size=ctx.args.hash_file_size)
+    small_bytes = ctx.args.hash_files * ctx.args.hash_file_size
+    digests = set()
+    results = {}
+
+    def run(path: pathlib.Path, num_bytes: int, num_threads: int) -> float:
+        start = time.perf_counter()
+        entries, count = ctx.session.hash_files([str(path)], num_threads)
+        elapsed = time.perf_counter() - start
+        digests.add((path, entries))
+        return num_bytes / elapsed / 10**9
+
+    # Nothing is sent while one large file is hashed, which can take longer than the session's socket timeout
+    timeout = ctx.session.sock.gettimeout()
+    ctx.session.sock.settimeout(None)
+    try:
+        for num_threads in thread_counts():
+            rate = median_of(ctx.args.repeat, lambda: run(large, ctx.args.hash_size, num_threads))
+            results[f"hash_large_{num_threads}t"] = metric(rate, "GB/s")
+            rate = median_of(ctx.args.repeat, lambda: run(root, small_bytes, num_threads))
+            results[f"hash_small_{num_threads}t"] = metric(rate, "GB/s")
+    finally:
+        ctx.session.sock.settimeout(timeout)
+
+    if 2 != len(digests):
+        raise RuntimeError("HASHes of the same files differ between runs or thread counts")
+    entries = decode_hash(next(entries for path, entries in digests if path == root))
+    if (ctx.args.hash_files != len(entries)) or any(entry.error for entry in entries):
+        raise RuntimeError(f"HASH returned {len(entries)} entries, expected {ctx.args.hash_files} without errors")
+    if entries[0].digest != content_digest(entries[0].path.decode()):
+        raise RuntimeError("HASH digest of a small file differs from its SHA-256")
+
+    large.unlink()
+    if 0 != ctx.session.execute("/bin/rm", ["rm", "-rf", str(root)]).code:
+        raise RuntimeError("removing the tree failed")
+    return results
+
+
+def rate_label(rate: int) -> str:
+    for unit, scale in (("GB", 10**9), ("MB", 10**6), ("KB", 10**3)):
+        if rate >= scale:
+            return f"{rate / scale:g}{unit}"
+    return f"{rate}B"
+
+
+@scenario
+def rate_limit(ctx: Context) -> dict:
+    """DOWNLOADs shaped by the per-task bucket at each rate, and by the global bucket at one of them. Reports how far
+    the achieved throughput is from the configured rate. Rates the unshaped transfer cannot reach are left out."""
+    drain = memoryview(bytearray(MIB))
+
+    def configure(flag: SettingsFlags, rate: int):
+        if 0 != ctx.session.task(OpCodes.SETTINGS, struct.pack(">QQ", rate, 0), flags=flag).code:
+            raise RuntimeError(f"SETTINGS rate limit {rate} was rejected")
+
+    def throughput(size: int) -> float:
+        """Time from the request to the last byte of contents, discarding them so the receiving end is never what
+        limits the rate. The final frame is left out."""
+        path = ctx.workdir / f"rate-{size}"
+        ctx.write_file(path, size)
+        start = time.perf_counter()
+        if 0 != ctx.session.task(OpCodes.DOWNLOAD, str(path).encode()).code:
+            raise RuntimeError(f"DOWNLOAD of {size} bytes failed")
+        remaining = size
+        while remaining:
+            count = ctx.session.sock.recv_into(drain, min(remaining, MIB))
+            if 0 == count:
+                raise RuntimeError("connection closed by implant")
+            remaining -= count
+        elapsed = time.perf_counter() - start
+        if 0 != ctx.session.recv_response().code:
+            raise RuntimeError(f"DOWNLOAD of {size} bytes failed after transfer")
+        path.unlink()
+        return size / elapsed
+
+    def error(flag: SettingsFlags, rate: int) -> float:
+        configure(flag, rate)
+        achieved = throughput(int(rate * ctx.args.rate_seconds))
+        configure(flag, 0)
+        return abs(achieved - rate) / rate * 100
+
+    capacity = throughput(256 * MIB)
+    results = {}
+    for rate in ctx.args.rates:
+        label = rate_label(rate)
+        if rate > capacity * 0.9:
+            print(f"skipping {label}/s, unshaped DOWNLOAD only reaches {capacity / 1e6:.0f}MB/s", file=sys.stderr)
+            continue
+        results[f"rate_error_{label}"] = metric(error(SettingsFlags.TASK_RATE_LIMIT, rate), "%", False, noise=5)
+    results["rate_error_global_10MB"] = metric(error(SettingsFlags.RATE_LIMIT, 10**7), "%", False, noise=5)
+    return results
+
+
+def blackhole(port: int) -> list[socket.socket]:
+    """A listener whose accept queue is full, the kernel drops further SYNs as it would for a host that is down."""
+    listener = socket.create_server(("127.0.0.1", port), backlog=0)
+    filler = socket.create_connection(("127.0.0.1", port))
+    return [listener, filler]
+
+
+@scenario
+def failover(ctx: Context) -> dict:
+    """Puts an unreachable IPv4 endpoint ahead of a live IPv6 one. The first beacon after that pays for trying the dead
+    endpoint, and once ranked the following beacons should go straight to the live one. Beacons are scheduled on a
+    fixed grid, so a beacon's delay shows as how much shorter the following period is than the rest."""
+    interval = 1
+    live_port = ctx.args.port + 1
+    sockets = blackhole(ctx.args.port + 2)
+    live = StandinC2("::1", live_port)
+
+    try:
+        callbacks = encode_callbacks([("127.0.0.1", ctx.args.port + 2), ("::1", live_port)])
+        flags = SettingsFlags.INTERVAL | SettingsFlags.CALLBACK
+        ctx.session.task(OpCodes.SETTINGS, struct.pack(">I", interval) + callbacks, flags=flags)
+        ctx.session.disconnect()
+
+        session, last_accepted = live.accept(timeout=interval * 10)
+        periods = []
+        for _ in range(ctx.args.beacon_count + 1):
+            session.disconnect()
+            session, accepted = live.accept(timeout=interval * 10)
+            periods.append((accepted - last_accepted) * 1000)
+            last_accepted = accepted
+
+        # Hand the implant back to the main stand-in
+        callbacks = encode_callbacks([("127.0.0.1", ctx.args.port)])
+        session.task(OpCodes.SETTINGS, callbacks, flags=SettingsFlags.CALLBACK)
+        session.disconnect()
+        ctx.session, _ = ctx.c2.accept(timeout=interval * 10)
+    finally:
+        live.close()
+        for sock in sockets:
+            sock.close()
+
+    steady = statistics.median(periods[1:])
+    return {
+        "failover_delay": metric(steady - periods[0], "ms", False, noise=20),
+        "failover_steady_delay": metric(max(abs(period - steady) for period in periods[1:]), "ms", False, noise=5),
+    }
+
+
+@scenario
+def adaptive_polling(ctx: Context) -> dict:
+    """An operator working in bursts: each task of a burst is queued a think time after the result of the one before,
+    and bursts are an idle gap apart. Every session that ran a task asks for a follow-up callback, once with the hints
+    honoured and once with them turned off through POLL_BOUNDS, which leaves the implant on its fixed interval. Reports
+    the median time from queueing a task to running it and the callbacks made per hour."""
+    args = ctx.args
+    interval_ms = args.poll_interval * 1000
+    settings = struct.pack(">II", args.poll_interval, 0)
+    ctx.session.task(OpCodes.SETTINGS, settings, flags=SettingsFlags.INTERVAL | SettingsFlags.WINDOW)
+    ctx.session.disconnect()
+    ctx.session, _ = ctx.c2.accept(timeout=args.poll_interval * 10)
+
+    def operate(bounds: tuple[int, int]) -> tuple[float, float]:
+        if 0 != ctx.session.task(OpCodes.SETTINGS, struct.pack(">II", *bounds), flags=SettingsFlags.POLL_BOUNDS).code:
+            raise RuntimeError(f"SETTINGS poll bounds {bounds} were rejected")
+        waits = [args.poll_think if task % args.poll_burst_len else args.poll_idle for task in range(args.poll_tasks)]
+        start = time.monotonic()
+        queued = start + waits.pop(0)
+        latencies = []
+        callbacks = 0
+        while queued is not None:
+            delay_ms = None
+            if time.monotonic() >= queued:
+                latencies.append((time.monotonic() - queued) * 1000)
+                ctx.session.task(OpCodes.SETTINGS, struct.pack(">I", 0), flags=SettingsFlags.WINDOW)
+                queued = time.monotonic() + waits.pop(0) if waits else None
+                delay_ms = args.poll_follow_up
+            ctx.session.disconnect(delay_ms)
+            ctx.session, _ = ctx.c2.accept(timeout=args.poll_interval * 10)
+            callbacks += 1
+        return statistics.median(latencies), callbacks / (time.monotonic() - start) * 3600
+
+    fixed_latency, fixed_rate = operate((0, 0))
+    adaptive_latency, adaptive_rate = operate(POLL_BOUNDS)
+    ctx.session.task(OpCodes.SETTINGS, struct.pack(">I", 1), flags=SettingsFlags.INTERVAL)
+    return {
+        "poll_latency_fixed": metric(fixed_latency, "ms", False, noise=interval_ms / 4),
+        "poll_latency_adaptive": metric(adaptive_latency, "ms", False, noise=args.poll_follow_up),
+        "poll_callbacks_fixed": metric(fixed_rate, "/h", False, noise=3600 / args.poll_interval / 10),
+        "poll_callbacks_adaptive": metric(adaptive_rate, "/h", False, noise=3600 / args.poll_interval / 10),
+    }
+
+
+@scenario
+def beacon_loop(ctx: Context) -> dict:
+    """Ends the session and times the following beacons against the configured interval. Must run last."""
+    interval = 1
+    ctx.session.task(OpCodes.SETTINGS, struct.pack(">I", interval), flags=SettingsFlags.INTERVAL)
+    ctx.session.disconnect()
+    ctx.session, last_accepted = ctx.c2.accept(timeout=interval * 10)
+
+    task = encode_task(OpCodes.SETTINGS, struct.pack(">I", 0), flags=SettingsFlags.WINDOW)
+    periods = []
+    session_times = []
+    first_task = []
+    for _ in range(ctx.args.beacon_count):
+        ctx.session.disconnect()
+        session_times.append((time.monotonic() - last_accepted) * 1000)
+        ctx.session, accepted = ctx.c2.accept(timeout=interval * 10)
+        # Check-in plus one task round trip, the first thing an operator waits for after a beacon
+        ctx.session.send_raw(task)
+        ctx.session.recv_response()
+        first_task.append((time.monotonic() - accepted) * 1e6)
+        periods.append((accepted - last_accepted) * 1000)
+        last_accepted = accepted
+    return {
+        "beacon_period": metric(statistics.median(periods), "ms", False, noise=5),
+        "beacon_session": metric(statistics.median(session_times), "ms", False, noise=1),
+        "beacon_first_task": metric(statistics.median(first_task), "us", False, noise=50),
+    }
+
+
+def spawn(args: argparse.Namespace, binary: str) -> subprocess.Popen:
+    command = shlex.split(args.emulator) + [str(pathlib.Path(binary).absolute())]
+    return subprocess.Popen(command, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)  # pylint: disable=R1732
+
+
+def run_scenarios(
+    args: argparse.Namespace, binary: str, scenarios: list[str], b_crc: bool = True, reference_binary: str | None = None
+) -> tuple[dict, dict, dict]:
+    """Results and telemetry of the scenarios on binary, and the results they measured on reference_binary when it is
+    given, see Context.reference."""
+    c2 = StandinC2(port=args.port)
+    implants = [spawn(args, binary)]
+    results = {}
+    telemetry = {}
+    reference_results = {}
+    try:
+        with tempfile.TemporaryDirectory(prefix="ember-bench-") as workdir:
+            session, _ = c2.accept()
+            ctx = Context(args, c2, session, pathlib.Path(workdir), implants[0].pid, b_crc)
+            if reference_binary:
+                # Started once the first session is up, the next one to call back is the reference
+                implants.append(spawn(args, reference_binary))
+                ctx.reference = (implants[1].pid, c2.accept()[0])
+            for name in scenarios:
+                print(f"running {name}", file=sys.stderr)
+                results.update(SCENARIOS[name](ctx))
+            telemetry = ctx.session.stats()
+            reference_results = ctx.reference_results
+            for session in [ctx.session] + ([ctx.reference[1]] if ctx.reference else []):
+                session.exit()
+    finally:
+        # Exiting on EXIT is what makes an instrumented build write its profile. One still running after that, a
+        # scenario failed before sending it, is killed.
+        for implant in implants:
+            with contextlib.suppress(subprocess.TimeoutExpired):
+                implant.wait(timeout=EXIT_TIMEOUT)
+            implant.kill()
+            implant.wait()
+        c2.close()
+    return results, telemetry, reference_results
+
+
+# Reference builds, each with one optimisation switched off: the option that takes the binary, the name its metrics are
+# reported under, the scenarios the optimisation shows in, the most in % it may cost any of their metrics (None to only
+# report it) and whether the scenarios run the reference paired with the build under test, see Context.reference
+REFERENCES = (
+    ("no_crc_binary", "crc", ["transfers"], 5.0, False),
+    ("no_mmap_binary", "mmap", ["large_download"], None, False),  # Only ranges of READSOURCE_MMAP_MIN and up are mapped
+    ("no_stats_binary", "stats", ["task_cpu"], 1.0, True),
+    ("no_tuning_binary", "tuning", ["task_rtt", "beacon_loop"], None, False),
+    ("release_binary", "trace", ["transfers"], None, False),  # The build under test is a traced Debug build
+)
+
+
+def switch_cost(results: dict, reference: dict, switch: str) -> dict:
+    """Each metric of a reference build with switch off, and the share of it switch costs the build under test. A
+    negative cost is what the switch gains."""
+    costs = {}
+    for name, without in reference.items():
+        if (name in results) and without["value"]:
+            costs[f"{name}_no_{switch}"] = metric(without["value"], without["unit"], without["higher_is_better"])
+            change = results[name]["value"] / without["value"] - 1
+            cost = 100 * (-change if without["higher_is_better"] else change)
+            costs[f"{name}_{switch}_cost"] = metric(cost, "%", False, noise=10)
+    return costs
+
+
+def keep_best(best: dict, results: dict):
+    """Fold results into best, each metric keeps its best value so far."""
+    for name, current in results.items():
+        old = best.get(name)
+        if (old is None) or ((current["value"] > old["value"]) == current["higher_is_better"]):
+            best[name] = current
+
+
+def measure_reference(
+    args: argparse.Namespace, results: dict, option: str, switch: str, scenarios: list[str], b_paired: bool
+) -> dict:
+    """Costs of switch, from runs alternating the reference build with the build under test, each keeping its best, or
+    from one run of them paired. The load on the rest of the system drifts by more between two runs than the budgets
+    allow."""
+    tested, reference = dict(results), {}
+    if b_paired:
+        paired, _, reference = run_scenarios(args, args.binary, scenarios, reference_binary=getattr(args, option))
+        tested.update(paired)
+    for idx in range(0 if b_paired else args.reference_rounds):
+        if idx:
+            keep_best(tested, run_scenarios(args, args.binary, scenarios)[0])
+        keep_best(reference, run_scenarios(args, getattr(args, option), scenarios, b_crc=("crc" != switch))[0])
+    costs = switch_cost(tested, reference, switch)
+    results.update({name: tested[name] for name in reference if name in tested})
+    return costs
+
+
+def over_budget(costs: dict, switch: str, budget: float | None) -> list[str]:
+    if budget is None:
+        return []
+    return [
+        f"{name} is {cost['value']:.1f}% (budget {budget:g}%)"
+        for name, cost in costs.items()
+        if name.endswith(f"_{switch}_cost") and (cost["value"] > budget)
+    ]
+
+
+def compare(results: dict, baseline: dict, threshold: float) -> list[str]:
+    regressions = []
+    for name, current in results.items():
+        if name not in baseline:
+            continue
+        old, new = baseline[name]["value"], current["value"]
+        change = (new - old) / old if old else 0.0
+        worse = -change if current["higher_is_better"] else change
+        print(f"{name:24} {old:>12.3f} -> {new:>12.3f} {current['unit']:8} {change:+.1%}", file=sys.stderr)
+        if worse > threshold and abs(new - old) > current.get("noise", 0.0):
+            regressions.append(f"{name} regressed {worse:.1%} (threshold {threshold:.0%})")
+    return regressions
+
+
+def check_baseline(args: argparse.Namespace, results: dict, report: str) -> int:
+    """Store report as the baseline with --update-baseline, otherwise compare results with it. Returns the exit code,
+    non-zero on a regression or a missing baseline, so a bench run never passes without one to hold it to."""
+    if not args.baseline:
+        return 0
+    baseline_path = pathlib.Path(args.baseline)
+    if args.update_baseline:
+        baseline_path.parent.mkdir(parents=True, exist_ok=True)
+        baseline_path.write_text(report + "\n")
+        return 0
+    if not baseline_path.exists():
+        print(f"no baseline at {args.baseline}, run with --update-baseline to store one", file=sys.stderr)
+        return 1
+
+    regressions = compare(results, json.loads(baseline_path.read_text())["results"], args.threshold)
+    for regression in regressions:
+        print(f"REGRESSION: {regression}", file=sys.stderr)
+    return 1 if regressions else 0
+
+
+def parse_args() -> argparse.Namespace:
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--binary", required=True, help="ember binary to benchmark")
+    parser.add_argument("--emulator", default="", help="command prefix to run the binary, e.g. qemu-arm-static")
+    parser.add_argument("--port", type=int, default=31337, help="port the binary calls back to")
+    parser.add_argument("--output", help="write results JSON here (default stdout)")
+    parser.add_argument("--baseline", help="baseline JSON to compare against")
+    parser.add_argument("--update-baseline", action="store_true", help="overwrite the baseline with these results")
+    parser.add_argument("--threshold", type=float, default=0.10, help="allowed regression as a fraction")
+    parser.add_argument("--no-crc-binary", help="the binary built with -DTRANSFER_CRC=OFF, to measure what CRC32C costs")
+    parser.add_argument("--no-mmap-binary", help="the binary built with -DMMAP_READS=OFF, to measure what mmap gains")
+    parser.add_argument("--no-stats-binary", help="the binary built with -DTASK_STATS=OFF, to measure what telemetry costs")
+    parser.add_argument("--no-tuning-binary", help="the binary built with -DSOCKET_TUNING=OFF, to measure what it gains")
+    parser.add_argument("--release-binary", help="a MinSizeRel build, to measure what tracing costs a Debug build")
+    parser.add_argument("--reference-rounds", type=int, default=3, help="runs of each reference build, alternating")
+    parser.add_argument("--scenarios", nargs="+", default=list(SCENARIOS), choices=list(SCENARIOS))
+    parser.add_argument("--repeat", type=int, default=5)
+    parser.add_argument("--sizes", type=int, nargs="+", default=[4096, MIB, 64 * MIB])
+    parser.add_argument("--storm-count", type=int, default=5000)
+    parser.add_argument("--rtt-count", type=int, default=1000)
+    parser.add_argument("--cpu-rounds", type=int, default=20, help="batches of --storm-count tasks task_cpu times")
+    parser.add_argument("--exec-count", type=int, default=200)
+    parser.add_argument("--beacon-count", type=int, default=3)
+    parser.add_argument("--cancel-count", type=int, default=10000, help="EXECs started and cancelled")
+    parser.add_argument("--job-count", type=int, default=100, help="background jobs holding output at once")
+    parser.add_argument("--job-flood-bytes", type=int, default=1 << 30, help="output of the flooding background job")
+    parser.add_argument("--list-files", type=int, default=10**4, help="files in the tree the listing scenario walks")
+    parser.add_argument("--hash-size", type=int, default=10**9, help="bytes of the hashing scenario's large file")
+    parser.add_argument("--hash-files", type=int, default=10**4, help="files in the tree the hashing scenario hashes")
+    parser.add_argument("--hash-file-size", type=int, default=4096, help="bytes of each of those files")
+    parser.add_argument("--sparse-size", type=int, default=2 << 30, help="logical bytes of the sparse_transfers file")
+    parser.add_argument("--sparse-allocated", type=int, default=256 * MIB, help="bytes of it allocated, the rest holes")
+    parser.add_argument("--archive-files", type=int, default=10**4, help="files in the tree archive_download fetches")
+    parser.add_argument("--archive-file-size", type=int, default=4096, help="bytes of each of those files")
+    parser.add_argument("--large-size", type=int, default=1 << 30, help="bytes of the large_download file, on disk")
+    parser.add_argument("--rates", type=int, nargs="+", default=[10**5, 10**6, 10**7, 10**8, 10**9], help="bytes/s")
+    parser.add_argument("--rate-seconds", type=float, default=1.5, help="length of each shaped transfer")
+    parser.add_argument("--mem-budget", type=int, default=16 * MIB, help="bytes of the memory_budget scenario's budget")
+    parser.add_argument("--poll-interval", type=int, default=5, help="seconds between adaptive_polling's callbacks")
+    parser.add_argument("--poll-follow-up", type=int, default=200, help="ms of the delay a session that ran tasks asks for")
+    parser.add_argument("--poll-tasks", type=int, default=12, help="tasks adaptive_polling queues in each mode")
+    parser.add_argument("--poll-burst-len", type=int, default=4, help="tasks of each burst")
+    parser.add_argument("--poll-think", type=float, default=1.0, help="seconds from a result to the next task of a burst")
+    parser.add_argument("--poll-idle", type=float, default=12.0, help="seconds between bursts")
+    args = parser.parse_args()
+
+    # beacon_loop ends the session it was given, keep it last
+    args.scenarios.sort(key=lambda name: name == "beacon_loop")
+    return args
+
+
+def main() -> int:
+    args = parse_args()
+    results, telemetry, _ = run_scenarios(args, args.binary, args.scenarios)
+    failures = []
+    for option, switch, scenarios, budget, b_paired in REFERENCES:
+        scenarios = [name for name in scenarios if name in args.scenarios]
+        if getattr(args, option) and scenarios:
+            print(f"running {' '.join(scenarios)} without {switch}", file=sys.stderr)
+            costs = measure_reference(args, results, option, switch, scenarios, b_paired)
+            results.update(costs)
+            failures += over_budget(costs, switch, budget)
+    report = json.dumps({"binary": os.path.basename(args.binary), "results": results, "telemetry": telemetry}, indent=2)
+
+    if args.output:
+        pathlib.Path(args.output).parent.mkdir(parents=True, exist_ok=True)
+        pathlib.Path(args.output).write_text(report + "\n")
+    else:
+        print(report)
+
+    for failure in failures:
+        print(f"OVER BUDGET: {failure}", file=sys.stderr)
+    return check_baseline(args, results, report) or (1 if failures else 0)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
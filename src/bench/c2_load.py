@@ -0,0 +1,213 @@
+#!/usr/bin/python3
+"""Load test for the C2 dispatch engine in src/c2/c2.py, driven by the implant simulator.
+
+Hundreds of simulated implants beacon at once. Every check-in is queued a fixed set of tasks, and the C2 side measures
+completed sessions per second, DOWNLOAD throughput and how late the event loop runs its callbacks while an operator
+thread hammers the CLI-side queries. The ingest scenario compares the CPU cost of verifying DOWNLOADs with the pure
+Python CRC32C against the ember_accel extension. Results use the same JSON layout and baseline comparison as bench.py.
+"""
+
+import argparse
+import asyncio
+import dataclasses
+import json
+import os
+import pathlib
+import statistics
+import struct
+import sys
+import threading
+import time
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "c2"))
+
+from bench import check_baseline, metric  # noqa: E402 pylint: disable=C0413
+from c2 import (  # noqa: E402 pylint: disable=C0413
+    C2Server,
+    ImplantInfo,
+    OpCodes,
+    SettingsFlags,
+    Task,
+    TaskResult,
+    native_crc32c,
+    py_crc32c,
+)
+
+MB = 1000 * 1000
+IMPLANT_SIM = pathlib.Path(__file__).with_name("implant_sim.py")
+LAG_PROBE_INTERVAL = 0.001
+
+
+@dataclasses.dataclass
+class Load:
+    elapsed: float
+    server: C2Server
+    lag_ms: list[float]  # How late each loop lag probe woke up
+    queries: int = 0
+    results: list[TaskResult] = dataclasses.field(default_factory=list)
+
+
+async def probe_lag(samples: list[float], stop: asyncio.Event):
+    while not stop.is_set():
+        start = time.perf_counter()
+        await asyncio.sleep(LAG_PROBE_INTERVAL)
+        samples.append((time.perf_counter() - start - LAG_PROBE_INTERVAL) * 1000)
+
+
+def operator(server: C2Server, stop: threading.Event, load: Load, interval: float):
+    """Stand-in for the CLI thread: snapshot reads, with a threadsafe task submission every tenth query."""
+    while not stop.is_set():
+        guids = server.get_implants()
+        server.get_checkins()
+        if guids and (0 == load.queries % 10):
+            server.configure_implant_threadsafe(guids[load.queries % len(guids)], 1)
+        load.queries += 1
+        time.sleep(interval)
+
+
+async def run_load(
+    args: argparse.Namespace, num_sessions: int, make_tasks, with_operator: bool = False, server: C2Server | None = None
+) -> Load:
+    """Run num_sessions simulated sessions, queueing make_tasks() on every check-in. server is a C2Server configured by
+    the caller, by default one with the default settings."""
+    server = server or C2Server(port=args.port)
+    await server.start()
+    load = Load(0.0, server, [])
+
+    results = []
+
+    def queue_tasks(implant: ImplantInfo):
+        for task in make_tasks():
+            results.append(server.submit(implant.guid, task))
+
+    server.checkin_hooks.append(queue_tasks)
+
+    stop_probe = asyncio.Event()
+    probe = asyncio.create_task(probe_lag(load.lag_ms, stop_probe))
+    stop_operator = threading.Event()
+    operator_thread = threading.Thread(target=operator, args=(server, stop_operator, load, args.query_interval))
+    if with_operator:
+        operator_thread.start()
+
+    start = time.perf_counter()
+    simulator = await asyncio.create_subprocess_exec(
+        sys.executable,
+        str(IMPLANT_SIM),
+        f"--port={args.port}",
+        f"--sessions={num_sessions}",
+        f"--concurrency={args.concurrency}",
+    )
+    if 0 != await simulator.wait():
+        raise RuntimeError("implant simulator failed")
+    load.results = await asyncio.gather(*results)
+    load.elapsed = time.perf_counter() - start
+
+    stop_probe.set()
+    stop_operator.set()
+    await probe
+    if with_operator:
+        operator_thread.join()
+    await server.close()
+
+    if server.sessions_closed != num_sessions:
+        raise RuntimeError(f"{server.sessions_closed} of {num_sessions} sessions completed")
+    return load
+
+
+async def sessions(args: argparse.Namespace) -> dict:
+    """Short sessions, one SETTINGS task each: check-in and dispatch overhead."""
+    settings = struct.pack(">I", 0)
+    load = await run_load(args, args.sessions, lambda: [Task(OpCodes.SETTINGS, settings, flags=SettingsFlags.WINDOW)])
+    return {"c2_sessions": metric(args.sessions / load.elapsed, "sessions/s")}
+
+
+async def downloads(args: argparse.Namespace) -> dict:
+    """One DOWNLOAD per session, read into a preallocated buffer shared by every session."""
+    sink = memoryview(bytearray(args.download_size))
+    path = str(args.download_size).encode()
+    load = await run_load(args, args.download_sessions, lambda: [Task(OpCodes.DOWNLOAD, path, sink=sink)])
+    return {"c2_download": metric(load.server.bytes_in / MB / load.elapsed, "MB/s")}
+
+
+async def operator_queries(args: argparse.Namespace) -> dict:
+    """The sessions load twice, without and with an operator thread querying and tasking through the threadsafe API.
+    Loop lag is how late a 1ms sleep on the loop wakes up, i.e. the delay before the loop gets to dispatch work."""
+    settings = struct.pack(">I", 0)
+
+    def make_tasks():
+        return [Task(OpCodes.SETTINGS, settings, flags=SettingsFlags.WINDOW)]
+
+    quiet = await run_load(args, args.sessions, make_tasks)
+    busy = await run_load(args, args.sessions, make_tasks, with_operator=True)
+
+    def p99(samples: list[float]) -> float:
+        return statistics.quantiles(samples, n=100)[98]
+
+    return {
+        "c2_loop_lag_p99": metric(p99(quiet.lag_ms), "ms", False, noise=20),
+        "c2_loop_lag_p99_operator": metric(p99(busy.lag_ms), "ms", False, noise=20),
+        "c2_operator_queries": metric(busy.queries / busy.elapsed, "queries/s"),
+    }
+
+
+async def ingest(args: argparse.Namespace) -> dict:
+    """DOWNLOADs verified as they arrive, with py_crc32c() and with ember_accel. Ingest is MB received per second of
+    C2 CPU time across all its threads, i.e. what one core can take in. Loop lag shows the GIL the checksums hold, the
+    executor runs them in both cases but only ember_accel releases the GIL."""
+    path = str(args.ingest_size).encode()
+    results = {}
+    for name, crc32c in (("python", py_crc32c), ("native", native_crc32c)):
+        if crc32c is None:
+            print("ember_accel is not built, skipping the native ingest run", file=sys.stderr)
+            continue
+        server = C2Server(port=args.port)
+        server.crc32c = crc32c
+        cpu_start = time.process_time()
+        load = await run_load(args, args.ingest_sessions, lambda: [Task(OpCodes.DOWNLOAD, path)], server=server)
+        cpu = time.process_time() - cpu_start
+        downloads = [result for result in load.results if result.contents is not None]
+        if (len(downloads) != args.ingest_sessions) or not all(result.verified for result in downloads):
+            raise RuntimeError(f"{name} ingest did not verify every DOWNLOAD")
+        results[f"c2_ingest_{name}"] = metric(server.bytes_in / MB / cpu, "MB/s")
+        results[f"c2_ingest_{name}_loop_lag_p99"] = metric(
+            statistics.quantiles(load.lag_ms, n=100)[98], "ms", False, noise=20
+        )
+    return results
+
+
+def parse_args() -> argparse.Namespace:
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--port", type=int, default=31338, help="port the C2 listens on")
+    parser.add_argument("--output", help="write results JSON here (default stdout)")
+    parser.add_argument("--baseline", help="baseline JSON to compare against")
+    parser.add_argument("--update-baseline", action="store_true", help="overwrite the baseline with these results")
+    parser.add_argument("--threshold", type=float, default=0.10, help="allowed regression as a fraction")
+    parser.add_argument("--sessions", type=int, default=2000)
+    parser.add_argument("--concurrency", type=int, default=256)
+    parser.add_argument("--download-sessions", type=int, default=256)
+    parser.add_argument("--download-size", type=int, default=4 * 1024 * 1024)
+    parser.add_argument("--ingest-sessions", type=int, default=16, help="DOWNLOADs per ingest run")
+    parser.add_argument("--ingest-size", type=int, default=4 * 1024 * 1024)
+    parser.add_argument("--query-interval", type=float, default=0.0005, help="operator thread pause between queries")
+    return parser.parse_args()
+
+
+def main() -> int:
+    args = parse_args()
+    results = {}
+    for scenario in (sessions, downloads, operator_queries, ingest):
+        print(f"running {scenario.__name__}", file=sys.stderr)
+        results.update(asyncio.run(scenario(args)))
+    report = json.dumps({"binary": "c2", "results": results}, indent=2)
+
+    if args.output:
+        pathlib.Path(args.output).parent.mkdir(parents=True, exist_ok=True)
+        pathlib.Path(args.output).write_text(report + "\n")
+    else:
+        print(report)
+
+    return check_baseline(args, results, report)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,106 @@
+#!/usr/bin/python3
+"""Stand-in implant for load testing the C2 without running hundreds of real binaries.
+
+Each worker beacons with its own GUID, answers every task with the framing from src/ember/include/task.h and beacons
+again straight after DISCONNECT until the requested number of sessions has been run. Task data is not acted on:
+DOWNLOAD paths are read as the decimal number of bytes to send, with the CRC32C of what was sent as the digest,
+UPLOAD contents are discarded and EXEC produces one OUTPUT frame.
+"""
+
+import argparse
+import asyncio
+import os
+import struct
+import sys
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "c2"))
+
+from c2 import RESPONSE_HDR, TASK_HDR, OpCodes, ResponseCodes, native_crc32c, py_crc32c  # noqa: E402 pylint: disable=C0413
+
+SEND_CHUNK = 256 * 1024
+DIGEST = struct.pack(">I", 0)
+
+
+class Simulator:
+    def __init__(self, args: argparse.Namespace):
+        self.args = args
+        self.sessions_left = args.sessions
+        self.payload = memoryview(os.urandom(SEND_CHUNK))
+        self.digests: dict[int, bytes] = {}  # By DOWNLOAD size, every file is the payload repeated
+
+    def digest(self, size: int) -> bytes:
+        if size not in self.digests:
+            crc32c = native_crc32c or py_crc32c
+            crc = 0
+            for offset in range(0, size, SEND_CHUNK):
+                crc = crc32c(self.payload[: min(SEND_CHUNK, size - offset)], crc)
+            self.digests[size] = struct.pack(">I", crc)
+        return self.digests[size]
+
+    def frame(self, writer: asyncio.StreamWriter, code: int, data: bytes = b""):
+        writer.write(RESPONSE_HDR.pack(code, len(data)))
+        if data:
+            writer.write(data)
+
+    async def send_file(self, writer: asyncio.StreamWriter, size: int):
+        self.frame(writer, ResponseCodes.SUCCESS, struct.pack(">Q", size))
+        for offset in range(0, size, SEND_CHUNK):
+            writer.write(self.payload[: min(SEND_CHUNK, size - offset)])
+            await writer.drain()
+        self.frame(writer, ResponseCodes.SUCCESS, self.digest(size))
+
+    async def recv_file(self, reader: asyncio.StreamReader, writer: asyncio.StreamWriter, size: int):
+        self.frame(writer, ResponseCodes.SUCCESS)
+        while size:
+            chunk = await reader.read(min(size, SEND_CHUNK))
+            if not chunk:
+                raise ConnectionError("C2 closed the connection during UPLOAD")
+            size -= len(chunk)
+        self.frame(writer, ResponseCodes.SUCCESS, DIGEST)
+
+    async def session(self, guid: bytes):
+        reader, writer = await asyncio.open_connection(self.args.ip, self.args.port)
+        writer.write(guid + b"\0")
+        try:
+            while True:
+                op_code, _, _, _, data_len, file_len = TASK_HDR.unpack(await reader.readexactly(TASK_HDR.size))
+                data = await reader.readexactly(data_len)
+                if OpCodes.DOWNLOAD == op_code:
+                    await self.send_file(writer, int(data))
+                elif OpCodes.UPLOAD == op_code:
+                    await self.recv_file(reader, writer, file_len)
+                elif OpCodes.EXEC == op_code:
+                    self.frame(writer, ResponseCodes.OUTPUT, b"simulated\n")
+                    self.frame(writer, ResponseCodes.SUCCESS)
+                else:
+                    self.frame(writer, ResponseCodes.SUCCESS)
+                await writer.drain()
+                if OpCodes.DISCONNECT == op_code:
+                    break
+        finally:
+            writer.close()
+            await writer.wait_closed()
+
+    async def worker(self):
+        guid = os.urandom(16)
+        while self.sessions_left > 0:
+            self.sessions_left -= 1
+            await self.session(guid)
+
+    async def run(self):
+        await asyncio.gather(*(self.worker() for _ in range(self.args.concurrency)))
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--ip", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=31337)
+    parser.add_argument("--sessions", type=int, default=1000, help="total sessions across all workers")
+    parser.add_argument("--concurrency", type=int, default=256, help="simulated implants beaconing at once")
+    args = parser.parse_args()
+    asyncio.run(Simulator(args).run())
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,540 @@
+"""Deterministic stand-in C2 that speaks ember's task protocol over loopback.
+
+Only what the benchmarks need is implemented: accepting a beacon, reading the check-in, and driving tasks with the
+framing from src/ember/include/task.h. Everything is blocking and single threaded so runs are reproducible.
+"""
+
+import contextlib
+import dataclasses
+import enum
+import errno
+import hashlib
+import ipaddress
+import os
+import socket
+import struct
+import time
+from collections.abc import Callable
+
+# [op_code u8][pad_len u8][flags u16][perms u16][data_len u32][file_len u64]
+TASK_HDR = struct.Struct(">BBHHIQ")
+# [response_code i8][data_len u64]
+RESPONSE_HDR = struct.Struct(">bQ")
+EXTENT_HDR = struct.Struct(">QQ")
+# STATS payload, see src/ember/include/stats.h
+STATS_OP = struct.Struct(">BIQQQ")
+STATS_PHASE = struct.Struct(">QB")
+STATS_BUCKET = struct.Struct(">BI")
+STATS_PHASES = ("recv_hdr", "recv_body", "decode", "execute", "send")
+# JOB_LIST entry before the command, and the JOB_OUTPUT header, see src/ember/include/job.h
+JOB_ENTRY = struct.Struct(">IIBiQB")
+JOB_OUTPUT_HDR = struct.Struct(">QBi")
+# LIST entry before its path, and the final response, see src/ember/include/list.h
+LIST_ENTRY = struct.Struct(">BBHIIIQQ")
+LIST_FINAL = struct.Struct(">IB")
+# HASH entry before its path, and the final response, see src/ember/include/hash.h
+ARCHIVE_ENTRY = struct.Struct(">BHIQQ")
+ARCHIVE_END = 0
+ARCHIVE_FILE = 1
+HASH_ENTRY = struct.Struct(">BHQ32s")
+HASH_FINAL = struct.Struct(">I")
+HASH_CHUNK_LEN = 8 * 1024 * 1024
+CHECKIN_LEN = 17
+OUTPUT = 2
+TIMED_OUT = 4  # Sent negated, like every error
+CANCELLED = 5
+JOB_ERROR = 6
+NO_MEMORY = 7
+FASTOPEN_QUEUE_LEN = 256
+
+
+class OpCodes(enum.IntEnum):
+    SETTINGS = 1
+    EXEC = enum.auto()
+    DOWNLOAD = enum.auto()
+    UPLOAD = enum.auto()
+    DISCONNECT = enum.auto()
+    EXIT = enum.auto()
+    STATS = enum.auto()
+    CANCEL = enum.auto()
+    JOB_LIST = enum.auto()
+    JOB_OUTPUT = enum.auto()
+    JOB_KILL = enum.auto()
+    LIST = enum.auto()
+    HASH = enum.auto()
+
+
+class SettingsFlags(enum.IntFlag):
+    INTERVAL = 1
+    WINDOW = 2
+    CALLBACK = 4
+    MODE = 16
+    SEED = 32
+    RATE_LIMIT = 64
+    TASK_RATE_LIMIT = 128
+    POLL_BOUNDS = 256
+    MEM_BUDGET = 512
+
+
+class DisconnectFlags(enum.IntFlag):
+    MORE_WORK = 1
+
+
+class ExecFlags(enum.IntFlag):
+    IN_MEM = 1
+    BACKGROUND = 4
+    STDIN = 8
+    PATH = 16
+    ARGV = 32
+    ENVP = 64
+    TIMEOUT = 128
+
+
+class FileFlags(enum.IntFlag):
+    OVERWRITE = 1
+    SPARSE = 2
+    ARCHIVE = 4
+
+
+class ProtocolError(Exception):
+    pass
+
+
+@dataclasses.dataclass
+class Response:
+    code: int
+    data: bytes
+    status: int | None = None  # EXEC exit status, 128 + N when killed by signal N
+
+
+@dataclasses.dataclass
+class Job:
+    id: int
+    pid: int
+    running: bool
+    status: int
+    written: int  # Bytes of output so far, held or not
+    command: str
+
+
+@dataclasses.dataclass
+class JobOutput:
+    start: int  # Cursor of the first byte of data, past the one asked for when older output was overwritten
+    running: bool
+    status: int
+    data: bytes
+
+
+@dataclasses.dataclass
+class ListEntry:
+    error: bool  # mode is the errno
+    depth: int
+    path: bytes
+    mode: int
+    uid: int
+    gid: int
+    size: int
+    mtime: int
+
+
+@dataclasses.dataclass
+class HashEntry:
+    error: bool  # size is the errno
+    path: bytes
+    size: int
+    digest: bytes
+
+
+@dataclasses.dataclass
+class ArchiveEntry:
+    type: int
+    path: bytes
+    mode: int
+    mtime: int
+    data: bytes
+
+
+def crc32c(data: bytes, crc: int = 0) -> int:
+    """Bitwise CRC32C, only meant for verifying small transfers."""
+    crc ^= 0xFFFFFFFF
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = (crc >> 1) ^ (0x82F63B78 & -(crc & 1))
+    return crc ^ 0xFFFFFFFF
+
+
+def encode_task(op_code: int, data: bytes = b"", flags: int = 0, perms: int = 0, file_len: int = 0) -> bytes:
+    return TASK_HDR.pack(op_code, 0, flags, perms, len(data), file_len) + data
+
+
+def encode_callbacks(endpoints: list[tuple[str, int]]) -> bytes:
+    """CALLBACK payload: [count u8] then per endpoint [family u8, 4 or 6][address 4 or 16 bytes][port u16]."""
+    data = bytearray([len(endpoints)])
+    for host, port in endpoints:
+        addr = ipaddress.ip_address(host)
+        data += bytes([addr.version]) + addr.packed + struct.pack(">H", port)
+    return bytes(data)
+
+
+def encode_exec(path: str, argv: list[str], timeout_ms: int = 0) -> bytes:
+    """PATH and ARGV, then the TIMEOUT in milliseconds when one is given."""
+    path_bytes = path.encode()
+    data = struct.pack(">H", len(path_bytes)) + path_bytes
+    data += struct.pack(">B", len(argv)) + b"".join(arg.encode() + b"\0" for arg in argv)
+    if timeout_ms:
+        data += struct.pack(">I", timeout_ms)
+    return data
+
+
+def exec_flags(timeout_ms: int = 0) -> int:
+    return ExecFlags.PATH | ExecFlags.ARGV | (ExecFlags.TIMEOUT if timeout_ms else 0)
+
+
+def encode_list(path: str, max_depth: int = 0, limit: int = 0, pattern: str = "") -> bytes:
+    pattern_bytes = pattern.encode()
+    return struct.pack(">BIB", max_depth, limit, len(pattern_bytes)) + pattern_bytes + path.encode()
+
+
+def decode_list(data: bytes) -> list[ListEntry]:
+    entries = []
+    offset = 0
+    while offset < len(data):
+        entry_type, depth, path_len, *meta = LIST_ENTRY.unpack_from(data, offset)
+        offset += LIST_ENTRY.size
+        entries.append(ListEntry(bool(entry_type), depth, data[offset : offset + path_len], *meta))
+        offset += path_len
+    return entries
+
+
+def encode_hash(paths: list[str], max_threads: int = 0) -> bytes:
+    return bytes([max_threads]) + b"\0".join(path.encode() for path in paths)
+
+
+def decode_hash(data: bytes) -> list[HashEntry]:
+    entries = []
+    offset = 0
+    while offset < len(data):
+        entry_type, path_len, size, digest = HASH_ENTRY.unpack_from(data, offset)
+        offset += HASH_ENTRY.size
+        entries.append(HashEntry(bool(entry_type), data[offset : offset + path_len], size, digest))
+        offset += path_len
+    return entries
+
+
+def content_digest(path: str) -> bytes:
+    """The digest HASH reports for a file: its SHA-256, or above HASH_CHUNK_LEN the SHA-256 of its chunks' SHA-256s."""
+    chunk_digests = []
+    with open(path, "rb") as file:
+        while chunk := file.read(HASH_CHUNK_LEN):
+            chunk_digests.append(hashlib.sha256(chunk).digest())
+    if 1 >= len(chunk_digests):
+        return chunk_digests[0] if chunk_digests else hashlib.sha256(b"").digest()
+    return hashlib.sha256(b"".join(chunk_digests)).digest()
+
+
+def decode_jobs(data: bytes) -> list[Job]:
+    jobs = []
+    offset = 1
+    for _ in range(data[0]):
+        job_id, pid, running, status, written, cmd_len = JOB_ENTRY.unpack_from(data, offset)
+        offset += JOB_ENTRY.size
+        jobs.append(Job(job_id, pid, bool(running), status, written, data[offset : offset + cmd_len].decode()))
+        offset += cmd_len
+    return jobs
+
+
+def bucket_upper_us(bucket: int) -> int:
+    """Exclusive upper bound in microseconds of a log-linear STATS histogram bucket."""
+    if bucket < 2:
+        return bucket + 1
+    msb, half = bucket >> 1, bucket & 1
+    return (1 << msb) + ((half + 1) << (msb - 1))
+
+
+def decode_stats(data: bytes) -> dict:
+    ops = {}
+    offset = 1
+    for _ in range(data[0]):
+        op_code, count, bytes_in, bytes_out, syscalls = STATS_OP.unpack_from(data, offset)
+        offset += STATS_OP.size
+        phases = {}
+        for phase in STATS_PHASES:
+            total_us, num_buckets = STATS_PHASE.unpack_from(data, offset)
+            offset += STATS_PHASE.size
+            buckets = {}
+            for _ in range(num_buckets):
+                bucket, bucket_count = STATS_BUCKET.unpack_from(data, offset)
+                offset += STATS_BUCKET.size
+                buckets[bucket_upper_us(bucket)] = bucket_count
+            phases[phase] = {"total_us": total_us, "histogram_us": buckets}
+        name = OpCodes(op_code).name if op_code in OpCodes.__members__.values() else str(op_code)
+        timed = sum(phases[STATS_PHASES[0]]["histogram_us"].values())  # The rest were not timed, see stats.h
+        ops[name] = {
+            "count": count,
+            "timed": timed,
+            "bytes_in": bytes_in,
+            "bytes_out": bytes_out,
+            "syscalls": syscalls,
+            "phases": phases,
+        }
+    return ops
+
+
+class Session:
+    """One accepted beacon. Tasks may be pipelined with send_raw() before their responses are read."""
+
+    def __init__(self, sock: socket.socket):
+        self.sock = sock
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        checkin = self.recv_exactly(CHECKIN_LEN)
+        self.guid = checkin[:16]
+        self.recv_exactly(checkin[16])  # random padding
+
+    def close(self):
+        self.sock.close()
+
+    def recv_exactly(self, num_bytes: int) -> bytes:
+        buf = bytearray(num_bytes)
+        view = memoryview(buf)
+        received = 0
+        while received < num_bytes:
+            count = self.sock.recv_into(view[received:], num_bytes - received)
+            if 0 == count:
+                raise ProtocolError("connection closed by implant")
+            received += count
+        return bytes(buf)
+
+    def send_raw(self, data: bytes):
+        self.sock.sendall(data)
+
+    def recv_response(self) -> Response:
+        code, data_len = RESPONSE_HDR.unpack(self.recv_exactly(RESPONSE_HDR.size))
+        return Response(code, self.recv_exactly(data_len))
+
+    def task(self, op_code: int, data: bytes = b"", **kwargs) -> Response:
+        self.send_raw(encode_task(op_code, data, **kwargs))
+        return self.recv_response()
+
+    def stats(self, reset: bool = False) -> dict:
+        return decode_stats(self.task(OpCodes.STATS, flags=1 if reset else 0).data)
+
+    def exit(self):
+        """EXIT, the implant answers it and exits instead of calling back."""
+        self.task(OpCodes.EXIT)
+        self.close()
+
+    def disconnect(self, delay_ms: int | None = None):
+        """With a delay_ms, asks for the next callback after it instead of the interval, see poll_t in settings.h."""
+        if delay_ms is None:
+            self.task(OpCodes.DISCONNECT)
+        else:
+            self.task(OpCodes.DISCONNECT, struct.pack(">I", delay_ms), flags=DisconnectFlags.MORE_WORK)
+        self.close()
+
+    def execute(self, path: str, argv: list[str], flags: int = 0, timeout_ms: int = 0) -> Response:
+        """Run a command, returns the final response with all OUTPUT frames before it joined as its data."""
+        self.send_raw(encode_task(OpCodes.EXEC, encode_exec(path, argv, timeout_ms), flags=flags | exec_flags(timeout_ms)))
+        return self.recv_exec()
+
+    def recv_exec(self) -> Response:
+        """Read the OUTPUT frames and final response of an EXEC already sent."""
+        output = bytearray()
+        response = self.recv_response()
+        while OUTPUT == response.code:
+            output += response.data
+            response = self.recv_response()
+        status = struct.unpack(">I", response.data)[0] if 4 == len(response.data) else None
+        return Response(response.code, bytes(output), status)
+
+    def start_job(self, path: str, argv: list[str]) -> int:
+        """Run a command in the background, returns its job id."""
+        response = self.task(OpCodes.EXEC, encode_exec(path, argv), flags=exec_flags() | ExecFlags.BACKGROUND)
+        if 0 != response.code:
+            raise ProtocolError(f"background EXEC {path} failed: {response.code}")
+        return struct.unpack(">I", response.data)[0]
+
+    def jobs(self) -> list[Job]:
+        return decode_jobs(self.task(OpCodes.JOB_LIST).data)
+
+    def job_output(self, job_id: int, cursor: int = 0) -> JobOutput:
+        """The output held from cursor on. Fetching an exited job's output releases it."""
+        response = self.task(OpCodes.JOB_OUTPUT, struct.pack(">IQ", job_id, cursor))
+        if 0 != response.code:
+            raise ProtocolError(f"JOB_OUTPUT {job_id} failed: {response.code}")
+        start, running, status = JOB_OUTPUT_HDR.unpack_from(response.data)
+        return JobOutput(start, bool(running), status, response.data[JOB_OUTPUT_HDR.size :])
+
+    def kill_job(self, job_id: int) -> int:
+        return self.task(OpCodes.JOB_KILL, struct.pack(">I", job_id)).code
+
+    def list_dir(self, path: str, max_depth: int = 0, limit: int = 0, pattern: str = "") -> tuple[bytes, int, bool]:
+        """Returns the entries as sent, see decode_list(), their count and whether the limit cut the listing short."""
+        response = self.task(OpCodes.LIST, encode_list(path, max_depth, limit, pattern))
+        entries = bytearray()
+        while OUTPUT == response.code:
+            entries += response.data
+            response = self.recv_response()
+        if 0 != response.code:
+            raise ProtocolError(f"LIST {path} failed: {response.code}")
+        count, truncated = LIST_FINAL.unpack(response.data)
+        return bytes(entries), count, bool(truncated)
+
+    def hash_files(self, paths: list[str], max_threads: int = 0) -> tuple[bytes, int]:
+        """Returns the entries as sent, see decode_hash(), and their count."""
+        response = self.task(OpCodes.HASH, encode_hash(paths, max_threads))
+        entries = bytearray()
+        while OUTPUT == response.code:
+            entries += response.data
+            response = self.recv_response()
+        if 0 != response.code:
+            raise ProtocolError(f"HASH {paths} failed: {response.code}")
+        (count,) = HASH_FINAL.unpack(response.data)
+        return bytes(entries), count
+
+    def download(self, path: str, flags: int = 0) -> tuple[bytes, int]:
+        """Returns the file contents and the CRC32C reported by the implant."""
+        response = self.task(OpCodes.DOWNLOAD, path.encode(), flags=flags)
+        if 0 != response.code:
+            raise ProtocolError(f"DOWNLOAD {path} failed: {response.code}")
+        (size,) = struct.unpack(">Q", response.data)
+        contents = self.recv_exactly(size) if not flags & FileFlags.SPARSE else self._recv_sparse(size)
+        final = self.recv_response()
+        if 0 != final.code:
+            raise ProtocolError(f"DOWNLOAD {path} failed after transfer: {final.code}")
+        return contents, struct.unpack(">I", final.data)[0]
+
+    def download_into(self, path: str, sink: Callable[[memoryview], object], chunk_len: int = 1 << 20) -> tuple[int, int]:
+        """DOWNLOAD without holding the file, each chunk received goes to sink. Returns the size and the CRC32C reported
+        by the implant."""
+        response = self.task(OpCodes.DOWNLOAD, path.encode())
+        if 0 != response.code:
+            raise ProtocolError(f"DOWNLOAD {path} failed: {response.code}")
+        (size,) = struct.unpack(">Q", response.data)
+        view = memoryview(bytearray(chunk_len))
+        remaining = size
+        while remaining:
+            count = self.sock.recv_into(view, min(remaining, chunk_len))
+            if 0 == count:
+                raise ProtocolError("connection closed by implant")
+            sink(view[:count])
+            remaining -= count
+        final = self.recv_response()
+        if 0 != final.code:
+            raise ProtocolError(f"DOWNLOAD {path} failed after transfer: {final.code}")
+        return size, struct.unpack(">I", final.data)[0]
+
+    def download_sparse_into(
+        self, path: str, sink: Callable[[int, memoryview], object], chunk_len: int = 1 << 20
+    ) -> tuple[int, int, int]:
+        """Sparse DOWNLOAD without holding the file, each chunk of an extent goes to sink with its offset. Returns the
+        size, the bytes the extents took on the wire, headers included, and the CRC32C reported by the implant."""
+        response = self.task(OpCodes.DOWNLOAD, path.encode(), flags=FileFlags.SPARSE)
+        if 0 != response.code:
+            raise ProtocolError(f"DOWNLOAD {path} failed: {response.code}")
+        (size,) = struct.unpack(">Q", response.data)
+        view = memoryview(bytearray(chunk_len))
+        wire_len = 0
+        while True:
+            offset, length = EXTENT_HDR.unpack(self.recv_exactly(EXTENT_HDR.size))
+            wire_len += EXTENT_HDR.size + length
+            if 0 == length:
+                break
+            end = offset + length
+            while offset < end:
+                count = self.sock.recv_into(view, min(end - offset, chunk_len))
+                if 0 == count:
+                    raise ProtocolError("connection closed by implant")
+                sink(offset, view[:count])
+                offset += count
+        final = self.recv_response()
+        if 0 != final.code:
+            raise ProtocolError(f"DOWNLOAD {path} failed after transfer: {final.code}")
+        return size, wire_len, struct.unpack(">I", final.data)[0]
+
+    def download_archive(self, paths: list[str]) -> tuple[list[ArchiveEntry], int]:
+        """ARCHIVE DOWNLOAD of files and directories, returns its entries and the CRC32C reported by the implant."""
+        response = self.task(OpCodes.DOWNLOAD, b"\0".join(path.encode() for path in paths), flags=FileFlags.ARCHIVE)
+        if 0 != response.code:
+            raise ProtocolError(f"DOWNLOAD {paths} failed: {response.code}")
+        entries = []
+        while True:
+            entry_type, path_len, mode, mtime, size = ARCHIVE_ENTRY.unpack(self.recv_exactly(ARCHIVE_ENTRY.size))
+            if ARCHIVE_END == entry_type:
+                break
+            path = self.recv_exactly(path_len)
+            entries.append(ArchiveEntry(entry_type, path, mode, mtime, self.recv_exactly(size)))
+        final = self.recv_response()
+        if 0 != final.code:
+            raise ProtocolError(f"DOWNLOAD {paths} failed after transfer: {final.code}")
+        return entries, struct.unpack(">I", final.data)[0]
+
+    def _recv_sparse(self, size: int) -> bytes:
+        contents = bytearray(size)
+        while True:
+            offset, length = EXTENT_HDR.unpack(self.recv_exactly(EXTENT_HDR.size))
+            if 0 == length:
+                return bytes(contents)
+            contents[offset : offset + length] = self.recv_exactly(length)
+
+    def upload(self, path: str, contents: bytes, perms: int = 0o644) -> int:
+        """Returns the CRC32C reported by the implant."""
+        response = self.task(OpCodes.UPLOAD, path.encode(), flags=FileFlags.OVERWRITE, perms=perms, file_len=len(contents))
+        if 0 != response.code:
+            raise ProtocolError(f"UPLOAD {path} failed: {response.code}")
+        self.send_raw(contents)
+        final = self.recv_response()
+        if 0 != final.code:
+            raise ProtocolError(f"UPLOAD {path} failed after transfer: {final.code}")
+        return struct.unpack(">I", final.data)[0]
+
+    def upload_sparse(self, path: str, source: str, perms: int = 0o644) -> tuple[int, int]:
+        """Sparse UPLOAD of the local file source, only its data extents are sent. Returns the bytes they took on the
+        wire, headers included, and the CRC32C reported by the implant."""
+        with open(source, "rb") as file:
+            size = os.fstat(file.fileno()).st_size
+            response = self.task(
+                OpCodes.UPLOAD, path.encode(), flags=FileFlags.OVERWRITE | FileFlags.SPARSE, perms=perms, file_len=size
+            )
+            if 0 != response.code:
+                raise ProtocolError(f"UPLOAD {path} failed: {response.code}")
+            wire_len = 0
+            offset = 0
+            while offset < size:
+                try:
+                    offset = os.lseek(file.fileno(), offset, os.SEEK_DATA)
+                except OSError as exc:
+                    if errno.ENXIO != exc.errno:
+                        raise
+                    break  # Only a hole is left
+                end = os.lseek(file.fileno(), offset, os.SEEK_HOLE)
+                self.send_raw(EXTENT_HDR.pack(offset, end - offset))
+                self.sock.sendfile(file, offset, end - offset)
+                wire_len += EXTENT_HDR.size + end - offset
+                offset = end
+        self.send_raw(EXTENT_HDR.pack(size, 0))
+        final = self.recv_response()
+        if 0 != final.code:
+            raise ProtocolError(f"UPLOAD {path} failed after transfer: {final.code}")
+        return wire_len + EXTENT_HDR.size, struct.unpack(">I", final.data)[0]
+
+
+class StandinC2:
+    """Loopback listener handing out one Session per beacon."""
+
+    def __init__(self, ip: str = "127.0.0.1", port: int = 31337):
+        family = socket.AF_INET6 if 6 == ipaddress.ip_address(ip).version else socket.AF_INET
+        self.listener = socket.create_server((ip, port), family=family)
+        with contextlib.suppress(OSError):  # Fast Open check-ins, when net.ipv4.tcp_fastopen allows a server
+            self.listener.setsockopt(socket.IPPROTO_TCP, socket.TCP_FASTOPEN, FASTOPEN_QUEUE_LEN)
+
+    def close(self):
+        self.listener.close()
+
+    def accept(self, timeout: float = 30.0) -> tuple[Session, float]:
+        """Wait for the next beacon, returns the session and the monotonic time the connection was accepted."""
+        self.listener.settimeout(timeout)
+        sock, _ = self.listener.accept()
+        accepted = time.monotonic()
+        sock.settimeout(timeout)
+        return Session(sock), accepted
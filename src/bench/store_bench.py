@@ -0,0 +1,106 @@
+#!/usr/bin/python3
+"""Ingest and recovery benchmark for the C2 task/result store in src/c2/store.py.
+
+Fills a fresh store with pending tasks and results, then reopens it the way the C2 does after a restart. Results use
+the same JSON layout and baseline comparison as bench.py.
+"""
+
+import argparse
+import json
+import os
+import pathlib
+import sys
+import tempfile
+import time
+import uuid
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "c2"))
+
+from bench import check_baseline, metric  # noqa: E402 pylint: disable=C0413
+from c2 import OpCodes, Task, TaskResult  # noqa: E402 pylint: disable=C0413
+from store import TaskStore  # noqa: E402 pylint: disable=C0413
+
+
+def ingest(args: argparse.Namespace, path: pathlib.Path) -> tuple[dict, list[uuid.UUID]]:
+    """Queue args.results results as fast as the loop would hand them over, then wait for the last commit."""
+    store = TaskStore(path)
+    store.open()
+    guids = [uuid.uuid4() for _ in range(args.implants)]
+    result = TaskResult(0, memoryview(os.urandom(args.result_size)))
+
+    for idx in range(args.pending):
+        store.add_task(guids[idx % len(guids)], Task(OpCodes.SETTINGS, b"\0\0\0\0", flags=2))
+
+    task_ids = []
+    start = time.perf_counter()
+    for idx in range(args.results):
+        task_ids.append(uuid.uuid4())
+        last = store.add_result(guids[idx % len(guids)], task_ids[-1], result)
+    last.result()
+    elapsed = time.perf_counter() - start
+    commits = store.commits
+    store.close()
+
+    return {
+        "store_ingest": metric(args.results / elapsed, "results/s"),
+        "store_results_per_commit": metric(args.results / max(commits, 1), "results"),
+    }, task_ids
+
+
+def recover(args: argparse.Namespace, path: pathlib.Path, task_ids: list[uuid.UUID]) -> dict:
+    start = time.perf_counter()
+    store = TaskStore(path)
+    implants, pending = store.open()
+    elapsed = time.perf_counter() - start
+
+    if (len(implants) != 0) or (len(pending) != args.pending):
+        raise RuntimeError(f"recovered {len(pending)} of {args.pending} pending tasks")
+
+    lookups = task_ids[:: max(1, len(task_ids) // 1000)]
+    lookup_start = time.perf_counter()
+    for task_id in lookups:
+        if store.get_result(task_id) is None:
+            raise RuntimeError(f"result {task_id} was not recovered")
+    lookup_us = (time.perf_counter() - lookup_start) / len(lookups) * 1e6
+    store.close()
+
+    return {
+        "store_recovery": metric(elapsed * 1000, "ms", False, noise=50),
+        "store_result_lookup": metric(lookup_us, "us", False, noise=50),
+    }
+
+
+def parse_args() -> argparse.Namespace:
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--dir", help="directory for the store (default a temporary directory)")
+    parser.add_argument("--output", help="write results JSON here (default stdout)")
+    parser.add_argument("--baseline", help="baseline JSON to compare against")
+    parser.add_argument("--update-baseline", action="store_true", help="overwrite the baseline with these results")
+    parser.add_argument("--threshold", type=float, default=0.10, help="allowed regression as a fraction")
+    parser.add_argument("--results", type=int, default=1_000_000)
+    parser.add_argument("--result-size", type=int, default=64, help="bytes of response data per result")
+    parser.add_argument("--pending", type=int, default=10_000, help="tasks left pending for recovery")
+    parser.add_argument("--implants", type=int, default=1000)
+    return parser.parse_args()
+
+
+def main() -> int:
+    args = parse_args()
+    with tempfile.TemporaryDirectory(prefix="ember-store-", dir=args.dir) as workdir:
+        print("running ingest", file=sys.stderr)
+        results, task_ids = ingest(args, pathlib.Path(workdir))
+        print("running recover", file=sys.stderr)
+        results.update(recover(args, pathlib.Path(workdir), task_ids))
+    report = json.dumps({"binary": "c2-store", "results": results}, indent=2)
+
+    if args.output:
+        pathlib.Path(args.output).parent.mkdir(parents=True, exist_ok=True)
+        pathlib.Path(args.output).write_text(report + "\n")
+    else:
+        print(report)
+
+    return check_baseline(args, results, report)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
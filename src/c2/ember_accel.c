@@ -0,0 +1,71 @@
+/**
+ * @file ember_accel.c
+ * @author Kevin McKenzie
+ * @brief Native helpers for the C2's ingest path, built from the implant's own codec sources so both ends of a
+ * transfer compute the same digest the same way.
+ *
+ * Every function takes any contiguous buffer, a memoryview of the buffer a session received into included, and reads
+ * it in place. Large buffers are processed with the GIL released, so the C2 can run them on a thread pool while the
+ * event loop keeps serving other sessions.
+ */
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "crc32c.h"
+
+enum
+{
+    RELEASE_GIL_LEN = 4096, /**< Below this releasing and taking back the GIL costs more than it lets others run */
+};
+
+static PyObject *accel_crc32c(PyObject *p_module, PyObject *p_args)
+{
+    Py_buffer view = {0};
+    uint32_t crc = 0;
+
+    (void)p_module;
+    if (!PyArg_ParseTuple(p_args, "y*|I:crc32c", &view, &crc))
+    {
+        return NULL;
+    }
+
+    if (RELEASE_GIL_LEN <= view.len)
+    {
+        Py_BEGIN_ALLOW_THREADS;
+        crc = crc32c_update(crc, (const uint8_t *)view.buf, (size_t)view.len);
+        Py_END_ALLOW_THREADS;
+    }
+    else
+    {
+        crc = crc32c_update(crc, (const uint8_t *)view.buf, (size_t)view.len);
+    }
+
+    PyBuffer_Release(&view);
+    return PyLong_FromUnsignedLong(crc);
+}
+
+static PyMethodDef g_methods[] = {
+    {"crc32c", accel_crc32c, METH_VARARGS,
+     "crc32c(data, crc=0, /)\n--\n\nExtend the running CRC32C crc with data, like the implant's crc32c_update(). "
+     "Releases the GIL for buffers of 4 KiB and more."},
+    {NULL, NULL, 0, NULL},
+};
+
+static struct PyModuleDef g_module = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "ember_accel",
+    .m_doc = "Native ingest helpers for the ember C2, see src/c2/ember_accel.c.",
+    .m_size = -1,
+    .m_methods = g_methods,
+};
+
+PyMODINIT_FUNC PyInit_ember_accel(void)
+{
+    crc32c_init();
+    return PyModule_Create(&g_module);
+}
+
+/*** END OF FILE ***/
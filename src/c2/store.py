@@ -0,0 +1,431 @@
+"""Durable task/result store for the C2: SQLite in WAL mode behind a single group-committing writer thread.
+
+Writes are queued from the event loop and never wait on the disk there. The writer thread takes everything queued
+while its previous commit was syncing and applies it as one transaction, so a burst of N enqueues or results costs one
+fsync rather than N. Write futures resolve once their transaction is durable. Writes that could fail on their own, rows
+too large for SQLite and payloads whose blob cannot be written, fail alone instead of failing their transaction: rows
+are checked before they are queued, and writes with blobs get a future of their own.
+
+Payloads larger than INLINE_LIMIT (DOWNLOAD contents and archives, EXEC, LIST and HASH output, UPLOAD payloads) are not
+kept in the database. They go to content addressed files, blobs/<sha256[:2]>/<sha256>, so identical files are stored
+once. The C2 streams large DOWNLOADs into them as they arrive (see BlobWriter), smaller ones are written by the writer
+thread. Every blob is also indexed by the digest HASH reports for its contents, which for files larger than
+HASH_CHUNK_LEN is not their SHA-256, so find_blob() tells whether a file on an implant is already stored.
+
+Delivery is at least once: a task stays pending until its result is stored. Tasks that were sent when the C2 stopped
+are sent again after a restart.
+"""
+
+import concurrent.futures
+import dataclasses
+import hashlib
+import mmap
+import os
+import pathlib
+import sqlite3
+import threading
+import time
+import uuid
+from collections.abc import Callable
+
+INLINE_LIMIT = 64 * 1024
+HASH_CHUNK_LEN = 8 * 1024 * 1024  # HASH digests larger files as the SHA-256 of their chunks' SHA-256s
+
+# Write statements, in the order a transaction applies them
+CHECKIN, ADD_TASK, ADD_RESULT, RETIRE_TASK, INDEX_BLOB = range(5)
+STATEMENTS = (
+    "INSERT INTO implants (guid, first_seen, last_seen, num_checkins) VALUES (?, ?, ?, 1) "
+    "ON CONFLICT (guid) DO UPDATE SET last_seen = excluded.last_seen, num_checkins = num_checkins + 1",
+    "INSERT INTO tasks (id, guid, op_code, flags, perms, file_len, data, payload, payload_blob, created) "
+    "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?)",
+    "INSERT OR REPLACE INTO results (task_id, guid, code, data, output, output_blob, contents, contents_blob, finished) "
+    "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)",
+    "UPDATE tasks SET pending = 0 WHERE id = ?",
+    "INSERT OR IGNORE INTO blob_digests (digest, blob) VALUES (?, ?)",
+)
+
+SCHEMA = """
+CREATE TABLE IF NOT EXISTS implants (
+    guid BLOB PRIMARY KEY,
+    first_seen REAL,
+    last_seen REAL,
+    num_checkins INTEGER NOT NULL DEFAULT 0
+);
+CREATE TABLE IF NOT EXISTS tasks (
+    seq INTEGER PRIMARY KEY AUTOINCREMENT,
+    id BLOB NOT NULL UNIQUE,
+    guid BLOB NOT NULL,
+    op_code INTEGER NOT NULL,
+    flags INTEGER NOT NULL,
+    perms INTEGER NOT NULL,
+    file_len INTEGER NOT NULL,
+    data BLOB NOT NULL,
+    payload BLOB,
+    payload_blob TEXT,
+    pending INTEGER NOT NULL DEFAULT 1,
+    created REAL NOT NULL
+);
+CREATE INDEX IF NOT EXISTS tasks_pending ON tasks (guid, seq) WHERE pending;
+CREATE TABLE IF NOT EXISTS results (
+    task_id BLOB PRIMARY KEY,
+    guid BLOB NOT NULL,
+    code INTEGER NOT NULL,
+    data BLOB NOT NULL,
+    output BLOB,
+    output_blob TEXT,
+    contents BLOB,
+    contents_blob TEXT,
+    finished REAL NOT NULL
+);
+CREATE TABLE IF NOT EXISTS blob_digests (
+    digest BLOB PRIMARY KEY,
+    blob TEXT NOT NULL
+);
+"""
+
+
+@dataclasses.dataclass
+class StoredImplant:
+    guid: uuid.UUID
+    first_seen: float
+    last_seen: float
+    num_checkins: int
+
+
+@dataclasses.dataclass
+class StoredTask:
+    id: uuid.UUID
+    guid: uuid.UUID
+    op_code: int
+    flags: int
+    perms: int
+    file_len: int
+    data: bytes
+    payload: bytes | memoryview  # A read-only mmap of the blob for large UPLOAD payloads
+
+
+ZERO_CHUNK = bytes(1024 * 1024)  # Hashed in place of the holes of sparse files
+
+
+class BlobWriter:
+    """Streams one file into the blob directory, hashing as it goes. Besides the SHA-256 the blob is stored under it
+    computes the digest HASH reports for the same contents, see content_digest()."""
+
+    def __init__(self, store: "TaskStore"):
+        self.store = store
+        self.sha256 = hashlib.sha256()
+        self.size = 0
+        self._first_chunk = b""  # Digest of the first HASH_CHUNK_LEN, taken from sha256 on the way past it
+        self._chunk_digests: list[bytes] = []  # Of the chunks after the first completed so far
+        self._chunk = hashlib.sha256()  # Of the chunk being hashed after the first
+        fd, self.tmp_path = store.mkstemp()
+        self.file = os.fdopen(fd, "wb", buffering=0)
+
+    def write(self, *chunks: bytes | memoryview):
+        """Append chunks in order. Hashing and writing them blocks, run it in an executor from the loop. Once the
+        blob is past HASH_CHUNK_LEN, hash_chunks() must see the same chunks."""
+        for chunk in chunks:
+            self._hash_address(memoryview(chunk))
+            self.file.write(chunk)
+
+    def write_hole(self, length: int):
+        """length zero bytes, left as a hole in the file. Hashing them blocks, run it in an executor from the loop."""
+        zeros = memoryview(ZERO_CHUNK)
+        for offset in range(0, length, len(zeros)):
+            hole = zeros[: min(len(zeros), length - offset)]
+            self.hash_chunks(self.size, hole)
+            self._hash_address(hole)
+        self.file.seek(length, os.SEEK_CUR)
+
+    def _hash_address(self, data: memoryview):
+        if self.size < HASH_CHUNK_LEN <= self.size + len(data):
+            first = HASH_CHUNK_LEN - self.size
+            self.sha256.update(data[:first])
+            self._first_chunk = self.sha256.digest()
+            data = data[first:]
+            self.size += first
+        self.sha256.update(data)
+        self.size += len(data)
+
+    def hash_chunks(self, offset: int, *chunks: bytes | memoryview):
+        """Extend the digest HASH reports with chunks written at offset. Shares no state with write(), so both can
+        run on the same chunks in parallel. Chunks within the first HASH_CHUNK_LEN need not be passed."""
+        for chunk in chunks:
+            data = memoryview(chunk)
+            skip = min(len(data), max(0, HASH_CHUNK_LEN - offset))
+            data, offset = data[skip:], offset + skip
+            while data:
+                part = data[: HASH_CHUNK_LEN - (offset % HASH_CHUNK_LEN)]
+                self._chunk.update(part)
+                data, offset = data[len(part) :], offset + len(part)
+                if 0 == offset % HASH_CHUNK_LEN:
+                    self._chunk_digests.append(self._chunk.digest())
+                    self._chunk = hashlib.sha256()
+
+    def content_digest(self) -> bytes:
+        """What HASH reports for the contents: their SHA-256, past HASH_CHUNK_LEN the SHA-256 of their chunks'."""
+        if self.size <= HASH_CHUNK_LEN:
+            return self.sha256.digest()
+        partial = [self._chunk.digest()] if self.size % HASH_CHUNK_LEN else []
+        return hashlib.sha256(b"".join([self._first_chunk, *self._chunk_digests, *partial])).digest()
+
+    def finish(self) -> str:
+        """fsync and move the file to its content address, then index it. Blocks, run it in an executor from the
+        loop."""
+        os.ftruncate(self.file.fileno(), self.size)  # A hole at the end is not there until the file is extended
+        os.fsync(self.file.fileno())
+        self.file.close()
+        digest = self.sha256.hexdigest()
+        path = self.store.blob_path(digest)
+        path.parent.mkdir(exist_ok=True)
+        os.replace(self.tmp_path, path)
+        self.store.index_blob(self.content_digest(), digest)
+        return digest
+
+    def abort(self):
+        self.file.close()
+        os.unlink(self.tmp_path)
+
+
+class TaskStore:
+    def __init__(self, path: str | os.PathLike):
+        self.path = pathlib.Path(path)
+        self.blob_dir = self.path / "blobs"
+        self.commits = 0  # Transactions committed, each is one WAL fsync
+        self._cond = threading.Condition()
+        self._pending: list[list] = [[] for _ in STATEMENTS]
+        self._pending_future: concurrent.futures.Future = concurrent.futures.Future()
+        self._deferred: list[tuple[tuple, concurrent.futures.Future]] = []  # Writes with blobs, see _defer()
+        self._row_limit = 1_000_000_000  # SQLite's SQLITE_MAX_LENGTH, read from the database once it is open
+        self._b_closing = False
+        self._writer: threading.Thread | None = None
+        self._readers = threading.local()
+        self._tmp_seq = 0
+
+    # Lifecycle
+
+    def open(self) -> tuple[list[StoredImplant], list[StoredTask]]:
+        """Create or recover the store and start the writer. Returns every implant and every pending task, in the
+        order the tasks were queued."""
+        (self.blob_dir / "tmp").mkdir(parents=True, exist_ok=True)
+        for stale in (self.blob_dir / "tmp").iterdir():  # Unfinished blobs from before a crash
+            stale.unlink()
+
+        conn = self._connect()
+        conn.executescript(SCHEMA)
+        if "output_blob" not in {column[1] for column in conn.execute("PRAGMA table_info(results)")}:
+            conn.execute("ALTER TABLE results ADD COLUMN output_blob TEXT")  # Stores from before output went to blobs
+        self._row_limit = conn.getlimit(sqlite3.SQLITE_LIMIT_LENGTH)
+        implants = [
+            StoredImplant(uuid.UUID(bytes=row[0]), row[1], row[2], row[3])
+            for row in conn.execute("SELECT guid, first_seen, last_seen, num_checkins FROM implants")
+        ]
+        tasks = [
+            StoredTask(
+                uuid.UUID(bytes=row[0]), uuid.UUID(bytes=row[1]), *row[2:6], row[6], row[7] or self._map_blob(row[8])
+            )
+            for row in conn.execute(
+                "SELECT id, guid, op_code, flags, perms, file_len, data, payload, payload_blob FROM tasks "
+                "WHERE pending ORDER BY seq"
+            )
+        ]
+        conn.close()
+
+        self._b_closing = False
+        self._writer = threading.Thread(target=self._write_loop, name="c2-store", daemon=True)
+        self._writer.start()
+        return implants, tasks
+
+    def close(self):
+        """Flush everything queued and stop the writer."""
+        if self._writer is not None:
+            with self._cond:
+                self._b_closing = True
+                self._cond.notify()
+            self._writer.join()
+            self._writer = None
+
+    # Writes, safe from any thread. Most share one future per transaction, it resolves once the write is committed.
+
+    def record_checkin(self, guid: uuid.UUID, when: float) -> concurrent.futures.Future:
+        return self._submit(CHECKIN, (guid.bytes, when, when))
+
+    def add_task(self, guid: uuid.UUID, task) -> concurrent.futures.Future:
+        payload = memoryview(task.payload)
+        inline_len = len(payload) if len(payload) <= INLINE_LIMIT else 0
+        if len(task.data) + inline_len > self._row_limit:
+            return self._refuse(f"task data of {len(task.data)} bytes")
+        row = (task.id.bytes, guid.bytes, task.op_code, task.flags, task.perms, task.file_len, bytes(task.data))
+        if len(payload) <= INLINE_LIMIT:
+            return self._submit(ADD_TASK, (*row, bytes(payload), None, time.time()))
+        # Hashing and writing a large payload is left to the writer thread
+        return self._defer((ADD_TASK, lambda: (*row, None, self._put_blob(payload), time.time())))
+
+    def add_result(self, guid: uuid.UUID, task_id: uuid.UUID, result) -> concurrent.futures.Future:
+        """Store a TaskResult and retire its task, both land in the same transaction. Contents the C2 already streamed
+        to a blob are stored by its digest, a DOWNLOAD into a sink is copied here since the sink may be reused."""
+        output = b"".join(result.output) if result.output else None
+        contents = None
+        if result.blob is None:
+            contents = bytes(result.contents) if result.contents is not None else result.packed_entries()
+        inline_len = sum(len(data) for data in (output, contents) if (data is not None) and (len(data) <= INLINE_LIMIT))
+        if len(result.data) + inline_len > self._row_limit:
+            return self._refuse(f"response data of {len(result.data)} bytes")
+        head = (task_id.bytes, guid.bytes, result.code, bytes(result.data))
+        if max(len(output or b""), len(contents or b"")) > INLINE_LIMIT:
+            # Writing large payloads to blobs is left to the writer thread
+            def row() -> tuple:
+                contents_columns = self._inline_or_blob(contents) if result.blob is None else (None, result.blob)
+                return (*head, *self._inline_or_blob(output), *contents_columns, time.time())
+
+            return self._defer((ADD_RESULT, row), (RETIRE_TASK, lambda: (task_id.bytes,)))
+
+        with self._cond:
+            self._pending[ADD_RESULT].append((*head, output, None, contents, result.blob, time.time()))
+            self._pending[RETIRE_TASK].append((task_id.bytes,))
+            self._cond.notify()
+            return self._pending_future
+
+    # Reads, from any thread. Each thread gets its own connection, WAL readers never block the writer.
+
+    def get_result(self, task_id: uuid.UUID) -> dict | None:
+        row = self._reader().execute("SELECT * FROM results WHERE task_id = ?", (task_id.bytes,)).fetchone()
+        return dict(row) if row is not None else None
+
+    def find_blob(self, digest: bytes) -> str | None:
+        """The blob holding contents HASH reported digest for, None when no such blob is stored."""
+        row = self._reader().execute("SELECT blob FROM blob_digests WHERE digest = ?", (digest,)).fetchone()
+        return row[0] if row is not None else None
+
+    def index_blob(self, digest: bytes, blob: str) -> concurrent.futures.Future:
+        """Record a finished blob under the digest HASH reports for its contents."""
+        return self._submit(INDEX_BLOB, (digest, blob))
+
+    def count(self, table: str) -> int:
+        (num_rows,) = self._reader().execute(f"SELECT count(*) FROM {table}").fetchone()  # noqa: S608 (not user input)
+        return num_rows
+
+    def _reader(self) -> sqlite3.Connection:
+        if getattr(self._readers, "conn", None) is None:
+            self._readers.conn = self._connect()
+            self._readers.conn.row_factory = sqlite3.Row
+        return self._readers.conn
+
+    # Blobs
+
+    def blob_path(self, digest: str) -> pathlib.Path:
+        return self.blob_dir / digest[:2] / digest
+
+    def mkstemp(self) -> tuple[int, str]:
+        self._tmp_seq += 1
+        tmp_path = str(self.blob_dir / "tmp" / f"{os.getpid()}-{threading.get_ident()}-{self._tmp_seq}")
+        return os.open(tmp_path, os.O_WRONLY | os.O_CREAT | os.O_EXCL | os.O_CLOEXEC, 0o600), tmp_path
+
+    def _put_blob(self, data: memoryview) -> str:
+        writer = BlobWriter(self)
+        try:
+            writer.hash_chunks(0, data)
+            writer.write(data)
+            return writer.finish()
+        except BaseException:
+            writer.abort()
+            raise
+
+    def _inline_or_blob(self, data: bytes | None) -> tuple[bytes | None, str | None]:
+        """Column values for a payload: itself up to INLINE_LIMIT, the digest of its blob past that."""
+        if (data is None) or (len(data) <= INLINE_LIMIT):
+            return data, None
+        return None, self._put_blob(memoryview(data))
+
+    def _map_blob(self, digest: str | None) -> bytes | memoryview:
+        if digest is None:
+            return b""
+        with open(self.blob_path(digest), "rb") as blob:
+            if 0 == os.fstat(blob.fileno()).st_size:
+                return b""
+            return memoryview(mmap.mmap(blob.fileno(), 0, access=mmap.ACCESS_READ))
+
+    # Writer thread
+
+    def _connect(self) -> sqlite3.Connection:
+        conn = sqlite3.connect(self.path / "c2.db", isolation_level=None, check_same_thread=False)
+        conn.execute("PRAGMA journal_mode = WAL")
+        conn.execute("PRAGMA synchronous = FULL")  # Every commit is durable, group commit keeps their number down
+        conn.execute("PRAGMA cache_size = -65536")  # 64 MiB, random GUID keys touch pages all over the indexes
+        return conn
+
+    def _submit(self, statement: int, row: tuple) -> concurrent.futures.Future:
+        with self._cond:
+            self._pending[statement].append(row)
+            self._cond.notify()
+            return self._pending_future
+
+    def _defer(self, *entries: tuple[int, Callable[[], tuple]]) -> concurrent.futures.Future:
+        """Queue a write whose rows the writer thread makes, writing their blobs. It gets a future of its own, a blob
+        that cannot be written fails this write only and none of its rows are stored."""
+        future: concurrent.futures.Future = concurrent.futures.Future()
+        with self._cond:
+            self._deferred.append((entries, future))
+            self._cond.notify()
+        return future
+
+    @staticmethod
+    def _refuse(what: str) -> concurrent.futures.Future:
+        """A failed future for a row SQLite would refuse, queued it would fail the whole transaction it landed in."""
+        future: concurrent.futures.Future = concurrent.futures.Future()
+        future.set_exception(ValueError(f"{what} is too large to store"))
+        return future
+
+    def _write_loop(self):
+        conn = self._connect()
+        b_running = True
+        while b_running:
+            with self._cond:
+                while not any(self._pending) and not self._deferred and not self._b_closing:
+                    self._cond.wait()
+                batch, future, deferred = self._pending, self._pending_future, self._deferred
+                self._pending, self._pending_future = [[] for _ in STATEMENTS], concurrent.futures.Future()
+                self._deferred = []
+                b_running = not self._b_closing
+            self._commit(conn, batch, future, self._make_deferred(batch, deferred))
+        conn.close()
+
+    @staticmethod
+    def _make_deferred(batch: list[list], deferred: list[tuple[tuple, concurrent.futures.Future]]) -> list:
+        """Add the rows of deferred writes to the batch, outside the transaction. Returns the futures of those made."""
+        made = []
+        for entries, future in deferred:
+            try:
+                rows = [(statement, row()) for statement, row in entries]
+            except OSError as exc:
+                future.set_exception(exc)
+                continue
+            for statement, row in rows:
+                batch[statement].append(row)
+            made.append(future)
+        return made
+
+    def _commit(
+        self,
+        conn: sqlite3.Connection,
+        batch: list[list],
+        future: concurrent.futures.Future,
+        deferred: list[concurrent.futures.Future],
+    ):
+        """One transaction for everything queued since the last commit. Statements run in STATEMENTS order, which
+        keeps every task INSERT ahead of the UPDATE retiring it."""
+        futures = [future, *deferred]
+        try:
+            conn.execute("BEGIN")
+            for statement, rows in zip(STATEMENTS, batch):
+                if rows:
+                    conn.executemany(statement, rows)
+            conn.execute("COMMIT")
+            self.commits += 1
+            for done in futures:
+                done.set_result(None)
+        except sqlite3.Error as exc:
+            if conn.in_transaction:
+                conn.execute("ROLLBACK")
+            for done in futures:
+                done.set_exception(exc)
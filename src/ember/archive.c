@@ -0,0 +1,354 @@
+/**
+ * @file archive.c
+ * @author Kevin McKenzie
+ * @brief Bulk DOWNLOAD of directories and path lists as one streamed archive.
+ *
+ * Regular files are opened and given a POSIX_FADV_WILLNEED hint as soon as the walk finds them, but are only sent
+ * once the next one is found. The kernel reads the next file in while the current one goes out on the socket.
+ */
+#define _GNU_SOURCE // NOLINT AT_* and *at() syscalls
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "archive.h"
+#include "codes.h"
+#include "crc32c.h"
+#include "dir.h"
+#include "errors.h"
+#include "io_callback.h"
+#include "mem.h"
+#include "utils.h"
+
+enum
+{
+    ARCHIVE_MAX_DEPTH = 32,
+    ARCHIVE_CHUNK_LEN = 64 * 1024,
+    ENTRY_HDR_LEN = sizeof(uint8_t) + sizeof(uint16_t) + sizeof(uint32_t) + (2 * sizeof(uint64_t)),
+};
+
+typedef struct
+{
+    int fd;
+    struct stat stat;
+    char path[PATH_MAX];
+} pending_file_t;
+
+typedef struct
+{
+    const io_callback_t *p_sender;
+    uint8_t *chunk;
+    uint32_t crc;
+    size_t path_len;
+    char path[PATH_MAX]; /**< Path of the entry being visited, children are appended in place. */
+    pending_file_t pending;
+} archive_t;
+
+static int archive_visit(archive_t *p_ar, int dirfd, const char *name, uint32_t depth);
+
+static int send_bytes(archive_t *p_ar, const void *buf, size_t len)
+{
+    int err = EMBER_SUCCESS;
+
+    if ((0 < len) && ((int)len != p_ar->p_sender->func(p_ar->p_sender->data, (uint8_t *)buf, (ssize_t)len)))
+    {
+        err = -EMBER_ERROR;
+    }
+
+    return err;
+}
+
+static int send_entry_header(archive_t *p_ar, uint8_t type, const char *path, uint32_t mode, uint64_t mtime,
+                             uint64_t size)
+{
+    uint8_t hdr[ENTRY_HDR_LEN] = {0};
+    size_t path_len = strnlen(path, PATH_MAX);
+
+    uint16_t net_path_len = htons((uint16_t)path_len);
+    uint32_t net_mode = htonl(mode);
+    uint64_t net_mtime = utils_htonll(mtime);
+    uint64_t net_size = utils_htonll(size);
+
+    size_t bytes_copied = 0;
+    memcpy(hdr, &type, sizeof(uint8_t));
+    bytes_copied += sizeof(uint8_t);
+    memcpy(hdr + bytes_copied, &net_path_len, sizeof(uint16_t));
+    bytes_copied += sizeof(uint16_t);
+    memcpy(hdr + bytes_copied, &net_mode, sizeof(uint32_t));
+    bytes_copied += sizeof(uint32_t);
+    memcpy(hdr + bytes_copied, &net_mtime, sizeof(uint64_t));
+    bytes_copied += sizeof(uint64_t);
+    memcpy(hdr + bytes_copied, &net_size, sizeof(uint64_t));
+
+    int err = send_bytes(p_ar, hdr, ENTRY_HDR_LEN);
+    if (EMBER_SUCCESS == err)
+    {
+        err = send_bytes(p_ar, path, path_len);
+    }
+
+    return err;
+}
+
+static int send_stat_header(archive_t *p_ar, uint8_t type, const char *path, const struct stat *p_stat, uint64_t size)
+{
+    return send_entry_header(p_ar, type, path, (uint32_t)p_stat->st_mode, (uint64_t)p_stat->st_mtime, size);
+}
+
+static int send_error_entry(archive_t *p_ar, int err_num)
+{
+    return send_entry_header(p_ar, ARCHIVE_ERROR, p_ar->path, (uint32_t)err_num, 0, 0);
+}
+
+static int send_data(archive_t *p_ar, const uint8_t *buf, size_t len)
+{
+    p_ar->crc = crc32c_update(p_ar->crc, buf, len);
+    return send_bytes(p_ar, buf, len);
+}
+
+static int send_file_data(archive_t *p_ar, int read_fd, uint64_t size)
+{
+    int err = EMBER_SUCCESS;
+
+    while ((EMBER_SUCCESS == err) && (0 < size))
+    {
+        size_t chunk_len = (size_t)MIN(size, (uint64_t)ARCHIVE_CHUNK_LEN);
+
+        // The header already promised size bytes, a file that shrank since fstatat() is padded with zeros.
+        ssize_t num_read = utils_readall(read_fd, p_ar->chunk, chunk_len);
+        size_t num_valid = (0 < num_read) ? (size_t)num_read : 0;
+        memset(p_ar->chunk + num_valid, 0, chunk_len - num_valid);
+
+        err = send_data(p_ar, p_ar->chunk, chunk_len);
+        size -= chunk_len;
+    }
+
+    return err;
+}
+
+static int flush_pending(archive_t *p_ar)
+{
+    int err = EMBER_SUCCESS;
+    pending_file_t *p_pending = &p_ar->pending;
+
+    if (-1 != p_pending->fd)
+    {
+        uint64_t size = (uint64_t)p_pending->stat.st_size;
+        err = send_stat_header(p_ar, ARCHIVE_FILE, p_pending->path, &p_pending->stat, size);
+
+        if (EMBER_SUCCESS == err)
+        {
+            err = send_file_data(p_ar, p_pending->fd, size);
+        }
+
+        close(p_pending->fd);
+        p_pending->fd = -1;
+    }
+
+    return err;
+}
+
+static int visit_file(archive_t *p_ar, int dirfd, const char *name, const struct stat *p_stat)
+{
+    int err = EMBER_SUCCESS;
+
+    int read_fd = openat(dirfd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (-1 == read_fd)
+    {
+        err = send_error_entry(p_ar, errno);
+    }
+    else
+    {
+        (void)posix_fadvise(read_fd, 0, 0, POSIX_FADV_WILLNEED);
+
+        err = flush_pending(p_ar);
+
+        p_ar->pending.fd = read_fd;
+        memcpy(&p_ar->pending.stat, p_stat, sizeof(struct stat));
+        memcpy(p_ar->pending.path, p_ar->path, p_ar->path_len + 1);
+    }
+
+    return err;
+}
+
+static int visit_symlink(archive_t *p_ar, int dirfd, const char *name, const struct stat *p_stat)
+{
+    int err = EMBER_SUCCESS;
+
+    ssize_t target_len = readlinkat(dirfd, name, (char *)p_ar->chunk, ARCHIVE_CHUNK_LEN);
+    if (-1 == target_len)
+    {
+        err = send_error_entry(p_ar, errno);
+    }
+    else
+    {
+        err = send_stat_header(p_ar, ARCHIVE_SYMLINK, p_ar->path, p_stat, (uint64_t)target_len);
+
+        if (EMBER_SUCCESS == err)
+        {
+            err = send_data(p_ar, p_ar->chunk, (size_t)target_len);
+        }
+    }
+
+    return err;
+}
+
+static bool path_push(archive_t *p_ar, const char *name)
+{
+    bool b_pushed = false;
+    size_t name_len = strlen(name);
+    size_t sep_len = ('/' == p_ar->path[p_ar->path_len - 1]) ? 0 : 1;
+
+    if ((p_ar->path_len + sep_len + name_len) < PATH_MAX)
+    {
+        p_ar->path[p_ar->path_len] = '/';
+        memcpy(p_ar->path + p_ar->path_len + sep_len, name, name_len + 1);
+        p_ar->path_len += sep_len + name_len;
+        b_pushed = true;
+    }
+
+    return b_pushed;
+}
+
+static void path_pop(archive_t *p_ar, size_t path_len)
+{
+    p_ar->path_len = path_len;
+    p_ar->path[path_len] = '\0';
+}
+
+static int visit_dir(archive_t *p_ar, int dirfd, const char *name, const struct stat *p_stat, uint32_t depth)
+{
+    int err = send_stat_header(p_ar, ARCHIVE_DIR, p_ar->path, p_stat, 0);
+
+    dir_iter_t *p_iter = NULL;
+    if ((EMBER_SUCCESS == err) && (ARCHIVE_MAX_DEPTH > depth))
+    {
+        p_iter = (dir_iter_t *)malloc(sizeof(dir_iter_t));
+        if (NULL == p_iter)
+        {
+            DEBUG_PERROR("malloc");
+            err = -EMBER_ERROR;
+        }
+        else if (EMBER_SUCCESS != dir_iter_open(p_iter, dirfd, name))
+        {
+            err = send_error_entry(p_ar, errno);
+            utils_free(p_iter);
+        }
+    }
+
+    const char *child = NULL;
+    uint8_t child_type = 0;
+    while ((EMBER_SUCCESS == err) && (NULL != p_iter) && (1 == dir_iter_next(p_iter, &child, &child_type)))
+    {
+        size_t parent_len = p_ar->path_len;
+        if (path_push(p_ar, child))
+        {
+            err = archive_visit(p_ar, p_iter->fd, child, depth + 1);
+        }
+        path_pop(p_ar, parent_len);
+    }
+
+    dir_iter_close(p_iter);
+    utils_free(p_iter);
+
+    return err;
+}
+
+static int archive_visit(archive_t *p_ar, int dirfd, const char *name, uint32_t depth)
+{
+    int err = EMBER_SUCCESS;
+
+    // name may alias p_ar->path, it is only used before any child is appended to it.
+    struct stat entry_stat = {0};
+    if (-1 == fstatat(dirfd, name, &entry_stat, AT_SYMLINK_NOFOLLOW))
+    {
+        err = send_error_entry(p_ar, errno);
+    }
+    else if (S_ISDIR(entry_stat.st_mode))
+    {
+        err = visit_dir(p_ar, dirfd, name, &entry_stat, depth);
+    }
+    else if (S_ISREG(entry_stat.st_mode))
+    {
+        err = visit_file(p_ar, dirfd, name, &entry_stat);
+    }
+    else if (S_ISLNK(entry_stat.st_mode))
+    {
+        err = visit_symlink(p_ar, dirfd, name, &entry_stat);
+    }
+    // Devices, fifos and sockets are skipped
+
+    return err;
+}
+
+int archive_send(const io_callback_t *p_sender, const uint8_t *path_list, size_t list_len, uint32_t *p_digest,
+                 int8_t *p_res)
+{
+    assert((NULL != p_sender) && (NULL != p_digest) && (NULL != p_res));
+
+    int err = EMBER_SUCCESS;
+
+    archive_t *p_ar = (archive_t *)calloc(1, sizeof(archive_t));
+    if (NULL != p_ar)
+    {
+        p_ar->p_sender = p_sender;
+        p_ar->pending.fd = -1;
+        p_ar->chunk = (uint8_t *)mem_alloc_fixed(ARCHIVE_CHUNK_LEN);
+    }
+
+    if ((NULL == p_ar) || (NULL == p_ar->chunk))
+    {
+        DEBUG_PERROR("malloc");
+        err = -EMBER_ERROR;
+    }
+
+    size_t offset = 0;
+    while ((EMBER_SUCCESS == err) && (offset < list_len))
+    {
+        const char *root = (const char *)path_list + offset;
+        size_t root_len = strnlen(root, list_len - offset);
+        offset += root_len + 1;
+
+        if ((0 < root_len) && (PATH_MAX > root_len))
+        {
+            memcpy(p_ar->path, root, root_len);
+            path_pop(p_ar, root_len);
+            err = archive_visit(p_ar, AT_FDCWD, p_ar->path, 0);
+        }
+    }
+
+    if (EMBER_SUCCESS == err)
+    {
+        err = flush_pending(p_ar);
+    }
+
+    if (EMBER_SUCCESS == err)
+    {
+        err = send_entry_header(p_ar, ARCHIVE_END, "", 0, 0, 0);
+    }
+
+    if (NULL != p_ar)
+    {
+        if (-1 != p_ar->pending.fd)
+        {
+            close(p_ar->pending.fd);
+        }
+        *p_digest = p_ar->crc;
+        mem_free(p_ar->chunk);
+        utils_free(p_ar);
+    }
+
+    *p_res = (EMBER_SUCCESS == err) ? SUCCESS : -FILE_ERROR;
+    return err;
+}
+
+/*** END OF FILE ***/
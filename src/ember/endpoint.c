@@ -0,0 +1,365 @@
+/**
+ * @file endpoint.c
+ * @author Kevin McKenzie
+ * @brief Ranked callback endpoints and happy eyeballs connects, see endpoint.h.
+ */
+#define _POSIX_C_SOURCE 200809L // NOLINT
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/tcp.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "endpoint.h"
+#include "sockopt.h"
+#include "utils.h"
+
+enum
+{
+    NSEC_PER_SEC = 1000000000,
+    NSEC_PER_MSEC = 1000000,
+    NSEC_PER_USEC = 1000,
+    EWMA_SHIFT = 2, /**< Each sample moves the average a quarter of the way */
+    IPV4_ADDR_LEN = 4,
+    IPV6_ADDR_LEN = 16,
+};
+
+/** Connect time recorded for an attempt that failed outright */
+#define FAILURE_NS ((uint64_t)ENDPOINT_TIMEOUT_MSEC * NSEC_PER_MSEC)
+
+typedef struct
+{
+    struct pollfd polls[ENDPOINT_MAX]; /**< fd -1 once an attempt failed, poll() skips it */
+    uint8_t index[ENDPOINT_MAX];       /**< Table index of each attempt */
+    uint64_t started_ns[ENDPOINT_MAX];
+    nfds_t num_started;
+    nfds_t num_pending;
+    uint64_t next_start_ns; /**< When to start the next attempt if none has connected */
+} race_t;
+
+static uint64_t now_ns(void)
+{
+    struct timespec now = {0};
+    (void)clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * NSEC_PER_SEC) + (uint64_t)now.tv_nsec;
+}
+
+static void ewma_update(uint64_t *p_ewma, uint64_t sample)
+{
+    if (0 == *p_ewma)
+    {
+        *p_ewma = MAX(sample, 1); // 0 is reserved for unmeasured
+    }
+    else if (sample > *p_ewma)
+    {
+        *p_ewma += (sample - *p_ewma) >> EWMA_SHIFT;
+    }
+    else
+    {
+        *p_ewma -= (*p_ewma - sample) >> EWMA_SHIFT;
+    }
+}
+
+static uint64_t score(const endpoint_t *p_endpoint)
+{
+    return p_endpoint->connect_ewma_ns + p_endpoint->rtt_ewma_ns;
+}
+
+static void rank(const endpoint_table_t *p_table, uint8_t order[ENDPOINT_MAX])
+{
+    // Insertion sort, stable so unmeasured endpoints keep the C2's order
+    for (uint8_t idx = 0; idx < p_table->count; idx++)
+    {
+        uint8_t pos = idx;
+        while ((0 < pos) && (score(&p_table->entries[order[pos - 1]]) > score(&p_table->entries[idx])))
+        {
+            order[pos] = order[pos - 1];
+            pos--;
+        }
+        order[pos] = idx;
+    }
+}
+
+void endpoint_table_init(endpoint_table_t *p_table, const struct sockaddr *p_addr, socklen_t addr_len)
+{
+    memset(p_table, 0, sizeof(endpoint_table_t));
+    memcpy(&p_table->entries[0].addr, p_addr, MIN(addr_len, sizeof(struct sockaddr_storage)));
+    p_table->entries[0].addr_len = addr_len;
+    p_table->count = 1;
+}
+
+void endpoint_table_replace(endpoint_table_t *p_dest, const endpoint_table_t *p_src)
+{
+    endpoint_table_t merged = *p_src;
+
+    for (uint8_t new_idx = 0; new_idx < merged.count; new_idx++)
+    {
+        endpoint_t *p_new = &merged.entries[new_idx];
+        for (uint8_t old_idx = 0; old_idx < p_dest->count; old_idx++)
+        {
+            const endpoint_t *p_old = &p_dest->entries[old_idx];
+            if ((p_old->addr_len == p_new->addr_len) && (0 == memcmp(&p_old->addr, &p_new->addr, p_new->addr_len)))
+            {
+                p_new->connect_ewma_ns = p_old->connect_ewma_ns;
+                p_new->rtt_ewma_ns = p_old->rtt_ewma_ns;
+            }
+        }
+    }
+
+    merged.generation = p_dest->generation + 1;
+    *p_dest = merged;
+}
+
+static size_t deserialize_endpoint(endpoint_t *p_endpoint, const uint8_t *src, size_t remaining)
+{
+    size_t addr_len = 0;
+    if (0 < remaining)
+    {
+        addr_len = (ENDPOINT_FAMILY_IPV4 == src[0]) ? IPV4_ADDR_LEN : 0;
+        addr_len = (ENDPOINT_FAMILY_IPV6 == src[0]) ? IPV6_ADDR_LEN : addr_len;
+    }
+
+    size_t needed = sizeof(uint8_t) + addr_len + sizeof(uint16_t);
+    if ((0 == addr_len) || (remaining < needed))
+    {
+        return 0;
+    }
+
+    // Address and port are already in network order
+    uint16_t port = 0;
+    memcpy(&port, src + sizeof(uint8_t) + addr_len, sizeof(uint16_t));
+
+    if (IPV4_ADDR_LEN == addr_len)
+    {
+        struct sockaddr_in *p_addr = (struct sockaddr_in *)&p_endpoint->addr;
+        p_addr->sin_family = AF_INET;
+        p_addr->sin_port = port;
+        memcpy(&p_addr->sin_addr, src + sizeof(uint8_t), addr_len);
+        p_endpoint->addr_len = sizeof(struct sockaddr_in);
+    }
+    else
+    {
+        struct sockaddr_in6 *p_addr = (struct sockaddr_in6 *)&p_endpoint->addr;
+        p_addr->sin6_family = AF_INET6;
+        p_addr->sin6_port = port;
+        memcpy(&p_addr->sin6_addr, src + sizeof(uint8_t), addr_len);
+        p_endpoint->addr_len = sizeof(struct sockaddr_in6);
+    }
+
+    return needed;
+}
+
+size_t endpoint_table_deserialize(endpoint_table_t *p_table, const uint8_t *src, size_t len)
+{
+    memset(p_table, 0, sizeof(endpoint_table_t));
+
+    uint8_t count = (0 < len) ? src[0] : 0;
+    size_t num_bytes = sizeof(uint8_t);
+    bool b_is_valid = (0 < count) && (ENDPOINT_MAX >= count);
+
+    for (uint8_t idx = 0; b_is_valid && (idx < count); idx++)
+    {
+        size_t parsed = deserialize_endpoint(&p_table->entries[idx], src + num_bytes, len - num_bytes);
+        b_is_valid = (0 != parsed);
+        num_bytes += parsed;
+    }
+
+    p_table->count = count;
+    return b_is_valid ? num_bytes : len + 1;
+}
+
+static int connect_direct(endpoint_t *p_endpoint)
+{
+    uint64_t start = now_ns();
+
+    int sock = socket(p_endpoint->addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (-1 == sock)
+    {
+        DEBUG_PERROR("socket");
+    }
+    else
+    {
+        sockopt_before_connect(sock);
+        if (-1 == connect(sock, (struct sockaddr *)&p_endpoint->addr, p_endpoint->addr_len))
+        {
+            DEBUG_PERROR("connect");
+            close(sock);
+            sock = -1;
+        }
+    }
+
+    ewma_update(&p_endpoint->connect_ewma_ns, (-1 == sock) ? FAILURE_NS : now_ns() - start);
+    return sock;
+}
+
+static void start_attempt(race_t *p_race, endpoint_table_t *p_table, uint8_t index)
+{
+    endpoint_t *p_endpoint = &p_table->entries[index];
+
+    int sock = socket(p_endpoint->addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (-1 == sock)
+    {
+        DEBUG_PERROR("socket");
+    }
+    else if ((-1 == connect(sock, (struct sockaddr *)&p_endpoint->addr, p_endpoint->addr_len)) &&
+             (EINPROGRESS != errno))
+    {
+        DEBUG_PERROR("connect");
+        close(sock);
+        sock = -1;
+    }
+
+    uint64_t now = now_ns();
+    if (-1 == sock)
+    {
+        ewma_update(&p_endpoint->connect_ewma_ns, FAILURE_NS);
+        p_race->next_start_ns = now;
+    }
+    else
+    {
+        // Even a connect that completed at once is left for poll() to report, it has one code path that way
+        nfds_t slot = p_race->num_started;
+        p_race->polls[slot].fd = sock;
+        p_race->polls[slot].events = POLLOUT;
+        p_race->index[slot] = index;
+        p_race->started_ns[slot] = now;
+        p_race->num_started++;
+        p_race->num_pending++;
+        p_race->next_start_ns = now + ((uint64_t)ENDPOINT_STAGGER_MSEC * NSEC_PER_MSEC);
+    }
+}
+
+static int check_attempts(race_t *p_race, endpoint_table_t *p_table)
+{
+    for (nfds_t slot = 0; slot < p_race->num_started; slot++)
+    {
+        struct pollfd *p_poll = &p_race->polls[slot];
+        if ((-1 == p_poll->fd) || (0 == p_poll->revents))
+        {
+            continue;
+        }
+
+        int sock_err = 0;
+        socklen_t err_len = sizeof(int);
+        if ((0 == getsockopt(p_poll->fd, SOL_SOCKET, SO_ERROR, &sock_err, &err_len)) && (0 == sock_err))
+        {
+            return (int)slot;
+        }
+
+        // Failed, the next endpoint starts without waiting out the stagger delay
+        ewma_update(&p_table->entries[p_race->index[slot]].connect_ewma_ns, FAILURE_NS);
+        close(p_poll->fd);
+        p_poll->fd = -1;
+        p_race->num_pending--;
+        p_race->next_start_ns = now_ns();
+    }
+
+    return -1;
+}
+
+static int finish_race(race_t *p_race, endpoint_table_t *p_table, int winner, uint8_t *p_index)
+{
+    uint64_t now = now_ns();
+    uint64_t winner_ns = (-1 != winner) ? now - p_race->started_ns[winner] : 0;
+
+    for (nfds_t slot = 0; slot < p_race->num_started; slot++)
+    {
+        if ((-1 == p_race->polls[slot].fd) || ((int)slot == winner))
+        {
+            continue;
+        }
+
+        // Still connecting, so at least as slow as it has been so far and slower than the winner
+        uint64_t elapsed = now - p_race->started_ns[slot];
+        ewma_update(&p_table->entries[p_race->index[slot]].connect_ewma_ns, MAX(elapsed, winner_ns + 1));
+        close(p_race->polls[slot].fd);
+    }
+
+    int sock = -1;
+    if (-1 != winner)
+    {
+        sock = p_race->polls[winner].fd;
+        *p_index = p_race->index[winner];
+        ewma_update(&p_table->entries[*p_index].connect_ewma_ns, winner_ns);
+        (void)fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) & ~O_NONBLOCK);
+    }
+
+    return sock;
+}
+
+static int race(endpoint_table_t *p_table, const uint8_t order[ENDPOINT_MAX], uint8_t *p_index)
+{
+    race_t race = {0};
+    uint64_t deadline = now_ns() + ((uint64_t)ENDPOINT_TIMEOUT_MSEC * NSEC_PER_MSEC);
+    uint8_t next = 0;
+    int winner = -1;
+
+    for (uint64_t now = now_ns(); (-1 == winner) && (now < deadline); now = now_ns())
+    {
+        if ((next < p_table->count) && ((now >= race.next_start_ns) || (0 == race.num_pending)))
+        {
+            start_attempt(&race, p_table, order[next]);
+            next++;
+            continue;
+        }
+
+        if (0 == race.num_pending)
+        {
+            break; // Every endpoint failed
+        }
+
+        uint64_t wake = (next < p_table->count) ? MIN(race.next_start_ns, deadline) : deadline;
+        int ready = poll(race.polls, race.num_started, (int)(((wake - now) + NSEC_PER_MSEC - 1) / NSEC_PER_MSEC));
+        if (0 < ready)
+        {
+            winner = check_attempts(&race, p_table);
+        }
+        else if ((-1 == ready) && (EINTR != errno))
+        {
+            DEBUG_PERROR("poll");
+            break;
+        }
+    }
+
+    return finish_race(&race, p_table, winner, p_index);
+}
+
+int endpoint_connect(endpoint_table_t *p_table, uint8_t *p_index)
+{
+    int sock = -1;
+    *p_index = 0;
+
+    if (1 == p_table->count)
+    {
+        sock = connect_direct(&p_table->entries[0]);
+    }
+    else if (1 < p_table->count)
+    {
+        uint8_t order[ENDPOINT_MAX] = {0};
+        rank(p_table, order);
+        sock = race(p_table, order, p_index);
+    }
+
+    return sock;
+}
+
+void endpoint_record_rtt(endpoint_table_t *p_table, uint8_t index, int sock)
+{
+    struct tcp_info info = {0};
+    socklen_t info_len = sizeof(struct tcp_info);
+
+    if ((index < p_table->count) && (0 == getsockopt(sock, IPPROTO_TCP, TCP_INFO, &info, &info_len)))
+    {
+        ewma_update(&p_table->entries[index].rtt_ewma_ns, (uint64_t)info.tcpi_rtt * NSEC_PER_USEC);
+    }
+}
+
+/*** END OF FILE ***/
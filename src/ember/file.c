@@ -1,14 +1,29 @@
+#define _GNU_SOURCE // NOLINT SEEK_DATA/SEEK_HOLE
 
+#include <errno.h>
+#include <fcntl.h>
 #include <linux/limits.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include "codes.h"
+#include "crc32c.h"
 #include "errors.h"
 #include "file.h"
 #include "io_callback.h"
+#include "mem.h"
+#include "readsource.h"
+#include "utils.h"
+
+enum
+{
+    FILE_CHUNK_LEN = 64 * 1024,
+    EXTENT_HDR_LEN = 2 * sizeof(uint64_t),
+};
 
 int file_resolve_path(const char path[PATH_MAX], char resolved_path[PATH_MAX], bool b_file_is_new, int8_t *p_res)
 {
@@ -25,48 +40,298 @@ int file_resolve_path(const char path[PATH_MAX], char resolved_path[PATH_MAX], b
 int file_open_for_reading(const char resolved_path[PATH_MAX], struct stat *p_read_stat, uint64_t max_size,
                           int8_t *p_res, int *p_err)
 {
-    (void)(resolved_path);
-    (void)(p_read_stat);
-    (void)(max_size);
-    (void)(p_res);
-    (void)(p_err);
-
     *p_res = SUCCESS;
     *p_err = EMBER_SUCCESS;
-    return EMBER_SUCCESS;
+
+    int read_fd = open(resolved_path, O_RDONLY | O_CLOEXEC);
+    if (-1 == read_fd)
+    {
+        DEBUG_PERROR("open");
+        *p_res = -FILE_ERROR;
+    }
+
+    if ((SUCCESS == *p_res) && (-1 == fstat(read_fd, p_read_stat)))
+    {
+        DEBUG_PERROR("fstat");
+        *p_res = -FILE_ERROR;
+    }
+
+    // A max_size of 0 means the C2 did not set a limit
+    if ((SUCCESS == *p_res) &&
+        (!S_ISREG(p_read_stat->st_mode) || ((0 != max_size) && ((uint64_t)p_read_stat->st_size > max_size))))
+    {
+        DEBUG_MSG("not a regular file or too large");
+        *p_res = -FILE_ERROR;
+    }
+
+    if ((SUCCESS != *p_res) && (-1 != read_fd))
+    {
+        close(read_fd);
+        read_fd = -1;
+    }
+
+    return read_fd;
 }
 
 int file_open_for_writing(const char resolved_path[PATH_MAX], uint16_t perms, bool b_overwrite, int8_t *p_res,
                           int *p_err)
 {
-    (void)(resolved_path);
-    (void)(perms);
-    (void)(b_overwrite);
-    (void)(p_res);
-    (void)(p_err);
     *p_res = SUCCESS;
     *p_err = EMBER_SUCCESS;
-    return EMBER_SUCCESS;
+
+    int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (b_overwrite ? O_TRUNC : O_EXCL);
+
+    int write_fd = open(resolved_path, flags, (mode_t)(perms & MAX_PERMS));
+    if (-1 == write_fd)
+    {
+        DEBUG_PERROR("open");
+        *p_res = -FILE_ERROR;
+    }
+
+    return write_fd;
 }
 
-int file_read_in_chunks(const io_callback_t *p_reader, uint64_t num_bytes, int read_fd, int8_t *p_res)
+typedef struct
 {
-    (void)(p_reader);
-    (void)(num_bytes);
-    (void)(read_fd);
-    (void)(p_res);
+    const io_callback_t *p_reader;
+    uint32_t crc;
+} send_stage_t;
 
+/** Pipeline stage between the read source and the sender, checksums each span on its way out. */
+static int checksum_and_send(void *p_data, uint8_t *buf, ssize_t len)
+{
+    send_stage_t *p_send = (send_stage_t *)p_data;
+    p_send->crc = crc32c_update(p_send->crc, buf, (size_t)len);
+    return p_send->p_reader->func(p_send->p_reader->data, buf, len);
+}
+
+static int send_from_fd(const io_callback_t *p_reader, int read_fd, uint64_t offset, uint64_t num_bytes,
+                        uint32_t *p_crc)
+{
+    send_stage_t send = {.p_reader = p_reader, .crc = *p_crc};
+    io_callback_t stage = {.func = checksum_and_send, .data = &send};
+
+    int err = readsource_for_each(read_fd, offset, num_bytes, &stage);
+    *p_crc = send.crc;
+    return err;
+}
+
+static int recv_to_fd(const io_callback_t *p_writer, int write_fd, uint64_t num_bytes, uint8_t *chunk, uint32_t *p_crc,
+                      int8_t *p_res)
+{
+    int err = EMBER_SUCCESS;
+
+    while ((EMBER_SUCCESS == err) && (0 < num_bytes))
+    {
+        size_t chunk_len = (size_t)MIN(num_bytes, (uint64_t)FILE_CHUNK_LEN);
+
+        if ((int)chunk_len != p_writer->func(p_writer->data, chunk, (ssize_t)chunk_len))
+        {
+            err = -EMBER_ERROR;
+        }
+
+        // After a failed write keep draining the socket so the stream stays in sync, the response reports the error.
+        if ((EMBER_SUCCESS == err) && (SUCCESS == *p_res))
+        {
+            *p_crc = crc32c_update(*p_crc, chunk, chunk_len);
+
+            if ((ssize_t)chunk_len != utils_writeall(write_fd, chunk, chunk_len))
+            {
+                DEBUG_PERROR("write");
+                *p_res = -FILE_ERROR;
+            }
+        }
+        num_bytes -= chunk_len;
+    }
+
+    return err;
+}
+
+int file_read_in_chunks(const io_callback_t *p_reader, uint64_t num_bytes, int read_fd, uint32_t *p_digest,
+                        int8_t *p_res)
+{
+    uint32_t crc = 0;
+    int err = send_from_fd(p_reader, read_fd, 0, num_bytes, &crc);
+
+    *p_digest = crc;
+    *p_res = (EMBER_SUCCESS == err) ? SUCCESS : -FILE_ERROR;
+    return err;
+}
+
+int file_write_in_chunks(const io_callback_t *p_writer, uint64_t num_bytes, int write_fd, uint32_t *p_digest,
+                         int8_t *p_res)
+{
+    int err = EMBER_SUCCESS;
+    uint32_t crc = 0;
     *p_res = SUCCESS;
-    return EMBER_SUCCESS;
+
+    uint8_t *chunk = (uint8_t *)mem_alloc_fixed(FILE_CHUNK_LEN);
+    if (NULL == chunk)
+    {
+        DEBUG_PERROR("mem_alloc_fixed");
+        err = -EMBER_ERROR;
+    }
+
+    if (EMBER_SUCCESS == err)
+    {
+        err = recv_to_fd(p_writer, write_fd, num_bytes, chunk, &crc, p_res);
+    }
+
+    mem_free(chunk);
+
+    *p_digest = crc;
+    return err;
 }
 
-int file_write_in_chunks(const io_callback_t *p_writer, uint64_t num_bytes, int write_fd, int8_t *p_res)
+/**
+ * @brief Find the next data extent at or after *p_offset, clamped to file_len. A length of 0 means only holes remain.
+ * Filesystems without SEEK_DATA support report the whole file as data, which degrades to a normal transfer.
+ */
+static int next_data_extent(int read_fd, uint64_t file_len, uint64_t *p_offset, uint64_t *p_len)
 {
-    (void)(p_writer);
-    (void)(num_bytes);
-    (void)(write_fd);
-    (void)(p_res);
+    int err = EMBER_SUCCESS;
+    *p_len = 0;
+
+    off_t data_start = lseek(read_fd, (off_t)*p_offset, SEEK_DATA);
+    off_t hole_start = -1;
+    if (-1 == data_start)
+    {
+        if (ENXIO != errno)
+        {
+            DEBUG_PERROR("lseek SEEK_DATA");
+            err = -EMBER_ERROR;
+        }
+        data_start = (off_t)file_len;
+    }
+    else
+    {
+        hole_start = lseek(read_fd, data_start, SEEK_HOLE);
+        if (-1 == hole_start)
+        {
+            DEBUG_PERROR("lseek SEEK_HOLE");
+            err = -EMBER_ERROR;
+        }
+    }
+
+    if ((-1 != hole_start) && ((uint64_t)data_start < file_len))
+    {
+        *p_offset = (uint64_t)data_start;
+        *p_len = MIN((uint64_t)hole_start, file_len) - (uint64_t)data_start;
+    }
+
+    return err;
+}
+
+static int send_extent_header(const io_callback_t *p_reader, uint64_t offset, uint64_t len)
+{
+    uint64_t extent_hdr[2] = {utils_htonll(offset), utils_htonll(len)};
+
+    int err = EMBER_SUCCESS;
+    if ((int)EXTENT_HDR_LEN != p_reader->func(p_reader->data, (uint8_t *)extent_hdr, (ssize_t)EXTENT_HDR_LEN))
+    {
+        err = -EMBER_ERROR;
+    }
+
+    return err;
+}
+
+int file_read_sparse(const io_callback_t *p_reader, uint64_t num_bytes, int read_fd, uint32_t *p_digest, int8_t *p_res)
+{
+    int err = EMBER_SUCCESS;
+    uint32_t crc = 0;
+
+    uint64_t offset = 0;
+    uint64_t extent_len = 1;
+    while ((EMBER_SUCCESS == err) && (0 < extent_len))
+    {
+        err = next_data_extent(read_fd, num_bytes, &offset, &extent_len);
+
+        if ((EMBER_SUCCESS == err) && (0 < extent_len))
+        {
+            err = send_extent_header(p_reader, offset, extent_len);
+        }
+
+        if ((EMBER_SUCCESS == err) && (0 < extent_len))
+        {
+            err = send_from_fd(p_reader, read_fd, offset, extent_len, &crc);
+            offset += extent_len;
+        }
+    }
 
+    // Zero length extent at the logical end of the file terminates the map.
+    if (EMBER_SUCCESS == err)
+    {
+        err = send_extent_header(p_reader, num_bytes, 0);
+    }
+
+    *p_digest = crc;
+    *p_res = (EMBER_SUCCESS == err) ? SUCCESS : -FILE_ERROR;
+    return err;
+}
+
+static int recv_extent_header(const io_callback_t *p_writer, uint64_t file_len, uint64_t *p_offset, uint64_t *p_len)
+{
+    uint64_t extent_hdr[2] = {0};
+
+    int err = EMBER_SUCCESS;
+    if ((int)EXTENT_HDR_LEN != p_writer->func(p_writer->data, (uint8_t *)extent_hdr, (ssize_t)EXTENT_HDR_LEN))
+    {
+        err = -EMBER_ERROR;
+    }
+
+    *p_offset = utils_ntohll(extent_hdr[0]);
+    *p_len = utils_ntohll(extent_hdr[1]);
+
+    if ((EMBER_SUCCESS == err) && ((*p_offset > file_len) || (*p_len > (file_len - *p_offset))))
+    {
+        DEBUG_MSG("extent outside of file");
+        err = -EMBER_ERROR;
+    }
+
+    return err;
+}
+
+int file_write_sparse(const io_callback_t *p_writer, uint64_t num_bytes, int write_fd, uint32_t *p_digest,
+                      int8_t *p_res)
+{
+    int err = EMBER_SUCCESS;
+    uint32_t crc = 0;
     *p_res = SUCCESS;
-    return EMBER_SUCCESS;
+
+    uint8_t *chunk = (uint8_t *)mem_alloc_fixed(FILE_CHUNK_LEN);
+    if (NULL == chunk)
+    {
+        DEBUG_PERROR("mem_alloc_fixed");
+        err = -EMBER_ERROR;
+    }
+
+    // The file was just created or truncated, sizing it up front leaves everything not written below as a hole.
+    if ((EMBER_SUCCESS == err) && (-1 == ftruncate(write_fd, (off_t)num_bytes)))
+    {
+        DEBUG_PERROR("ftruncate");
+        *p_res = -FILE_ERROR;
+    }
+
+    uint64_t offset = 0;
+    uint64_t extent_len = 1;
+    while ((EMBER_SUCCESS == err) && (0 < extent_len))
+    {
+        err = recv_extent_header(p_writer, num_bytes, &offset, &extent_len);
+
+        if ((EMBER_SUCCESS == err) && (SUCCESS == *p_res) && (-1 == lseek(write_fd, (off_t)offset, SEEK_SET)))
+        {
+            DEBUG_PERROR("lseek");
+            *p_res = -FILE_ERROR;
+        }
+
+        if ((EMBER_SUCCESS == err) && (0 < extent_len))
+        {
+            err = recv_to_fd(p_writer, write_fd, extent_len, chunk, &crc, p_res);
+        }
+    }
+
+    mem_free(chunk);
+
+    *p_digest = crc;
+    return err;
 }
@@ -0,0 +1,579 @@
+/**
+ * @file hash.c
+ * @author Kevin McKenzie
+ * @brief Content digests of files and trees, see hash.h.
+ */
+#define _GNU_SOURCE // NOLINT DT_* types and the AT_* flags
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "codes.h"
+#include "dir.h"
+#include "errors.h"
+#include "file.h"
+#include "hash.h"
+#include "mem.h"
+#include "pool.h"
+#include "sha256.h"
+#include "utils.h"
+
+enum
+{
+    HASH_PATHS_LEN = 64 * 1024,
+    HASH_BATCH_DIRS = 16, /**< Directories a batch holds open, it is hashed early when its files span more */
+    HASH_READ_LEN = 64 * 1024, /**< Per read, on the stack of the hashing thread */
+    ENTRY_HDR_LEN = sizeof(uint8_t) + sizeof(uint16_t) + sizeof(uint64_t) + SHA256_DIGEST_LEN,
+    FINAL_LEN = sizeof(uint32_t),
+};
+
+typedef struct
+{
+    uint32_t path_offset; /**< Into the batch's paths */
+    uint16_t path_len;
+    uint16_t name_offset; /**< Of the name the file is opened by, within its path */
+    int dir_idx;          /**< Into the batch's dirfds, -1 for a root opened by its path */
+    int fd;               /**< Kept open for the chunks of a large file, -1 otherwise */
+    int err_num;          /**< 0 when the digest is valid */
+    uint64_t size;
+    uint8_t digest[SHA256_DIGEST_LEN];
+} hash_item_t;
+
+typedef struct
+{
+    size_t num_items;
+    size_t paths_len;
+    size_t num_dirs;
+    uint32_t dir_seq;            /**< Of the directory dirfds[num_dirs - 1] was taken from */
+    int dirfds[HASH_BATCH_DIRS]; /**< Of the directories the items are in, the walk closes its own as it moves on */
+    hash_item_t items[HASH_BATCH_LEN];
+    char paths[HASH_PATHS_LEN];
+} hash_batch_t;
+
+typedef struct
+{
+    int fd;
+    uint64_t size;
+    int err_num;      /**< Of a chunk that failed, any one */
+    uint8_t *digests; /**< One per chunk, in order */
+} hash_chunks_t;
+
+typedef struct
+{
+    const io_callback_t *p_sender;
+    pool_t *p_pool;
+    uint32_t count;
+    size_t frame_len;
+    uint8_t frame[HASH_FRAME_LEN];
+    uint32_t dirs_opened;
+    uint32_t dir_seq; /**< Of the directory being walked */
+    size_t path_len;
+    char path[PATH_MAX]; /**< Of the entry being visited, children are appended in place */
+    hash_batch_t batch;  /**< Files found but not hashed yet, across directories */
+} hash_t;
+
+/**
+ * @brief SHA-256 of len bytes of the file from offset on.
+ * @return int 0, or the errno of the read that failed. A file that shrank while it was read fails with EIO.
+ */
+static int hash_range(int read_fd, uint64_t offset, uint64_t len, uint8_t digest[SHA256_DIGEST_LEN])
+{
+    uint8_t buf[HASH_READ_LEN];
+    sha256_t ctx;
+
+    sha256_begin(&ctx);
+    while (0 < len)
+    {
+        ssize_t num_read = pread(read_fd, buf, (size_t)MIN(len, (uint64_t)HASH_READ_LEN), (off_t)offset);
+        if ((-1 == num_read) && (EINTR == errno))
+        {
+            continue;
+        }
+        if (0 >= num_read)
+        {
+            return (-1 == num_read) ? errno : EIO;
+        }
+        sha256_update(&ctx, buf, (size_t)num_read);
+        offset += (uint64_t)num_read;
+        len -= (uint64_t)num_read;
+    }
+    sha256_final(&ctx, digest);
+
+    return 0;
+}
+
+static void hash_chunk(void *p_data, size_t idx)
+{
+    hash_chunks_t *p_chunks = (hash_chunks_t *)p_data;
+    uint64_t offset = (uint64_t)idx * HASH_CHUNK_LEN;
+    uint64_t len = MIN(p_chunks->size - offset, (uint64_t)HASH_CHUNK_LEN);
+
+    // Each thread reads its own part of the file, readahead for one sequential reader would not cover them
+    (void)posix_fadvise(p_chunks->fd, (off_t)offset, (off_t)len, POSIX_FADV_WILLNEED);
+
+    int err_num = hash_range(p_chunks->fd, offset, len, p_chunks->digests + (idx * SHA256_DIGEST_LEN));
+    if (0 != err_num)
+    {
+        __atomic_store_n(&p_chunks->err_num, err_num, __ATOMIC_RELAXED);
+    }
+}
+
+static int hash_large_file(hash_t *p_hash, hash_item_t *p_item)
+{
+    size_t num_chunks = (size_t)((p_item->size + HASH_CHUNK_LEN - 1) / HASH_CHUNK_LEN);
+    hash_chunks_t chunks = {.fd = p_item->fd, .size = p_item->size};
+
+    chunks.digests = (uint8_t *)malloc(num_chunks * SHA256_DIGEST_LEN);
+    if (NULL == chunks.digests)
+    {
+        DEBUG_PERROR("malloc");
+        return -EMBER_ERROR;
+    }
+
+    pool_for_each(p_hash->p_pool, hash_chunk, &chunks, num_chunks);
+
+    p_item->err_num = chunks.err_num;
+    if (0 == p_item->err_num)
+    {
+        sha256_t ctx;
+        sha256_begin(&ctx);
+        sha256_update(&ctx, chunks.digests, num_chunks * SHA256_DIGEST_LEN);
+        sha256_final(&ctx, p_item->digest);
+    }
+
+    utils_free(chunks.digests);
+    return EMBER_SUCCESS;
+}
+
+/**
+ * @brief Open a file of the batch by its name in its directory. Below a root no symlink is followed, and O_NONBLOCK
+ * keeps a fifo swapped in since the walk from blocking the thread, it changes nothing for a regular file.
+ * @return int The fd, or -1 with the item's err_num set
+ */
+static int open_item(const hash_batch_t *p_batch, hash_item_t *p_item, struct stat *p_file_stat)
+{
+    int dirfd = (0 > p_item->dir_idx) ? AT_FDCWD : p_batch->dirfds[p_item->dir_idx];
+    int flags = O_RDONLY | O_CLOEXEC | O_NONBLOCK | ((AT_FDCWD == dirfd) ? 0 : O_NOFOLLOW);
+
+    int read_fd = openat(dirfd, p_batch->paths + p_item->path_offset + p_item->name_offset, flags);
+    if (-1 == read_fd)
+    {
+        p_item->err_num = errno;
+    }
+    else if (-1 == fstat(read_fd, p_file_stat))
+    {
+        p_item->err_num = errno;
+    }
+    else if (!S_ISREG(p_file_stat->st_mode))
+    {
+        p_item->err_num = EINVAL;
+    }
+
+    if ((0 != p_item->err_num) && (-1 != read_fd))
+    {
+        (void)close(read_fd);
+        read_fd = -1;
+    }
+
+    return read_fd;
+}
+
+static void hash_file(void *p_data, size_t idx)
+{
+    hash_batch_t *p_batch = (hash_batch_t *)p_data;
+    hash_item_t *p_item = &p_batch->items[idx];
+    struct stat file_stat;
+
+    int read_fd = open_item(p_batch, p_item, &file_stat);
+    if (-1 == read_fd)
+    {
+        return;
+    }
+
+    p_item->size = (uint64_t)file_stat.st_size;
+    if (HASH_CHUNK_LEN < p_item->size)
+    {
+        // Hashed once the batch is done, with the whole pool on its chunks
+        p_item->fd = read_fd;
+        return;
+    }
+
+    p_item->err_num = hash_range(read_fd, 0, p_item->size, p_item->digest);
+    if (-1 == close(read_fd))
+    {
+        DEBUG_PERROR("close");
+    }
+}
+
+static int flush_frame(hash_t *p_hash)
+{
+    int err = EMBER_SUCCESS;
+
+    if ((0 < p_hash->frame_len) &&
+        (EMBER_SUCCESS != p_hash->p_sender->func(p_hash->p_sender->data, p_hash->frame, (ssize_t)p_hash->frame_len)))
+    {
+        err = -EMBER_ERROR;
+    }
+    p_hash->frame_len = 0;
+
+    return err;
+}
+
+static size_t put_bytes(uint8_t *buf, size_t offset, const void *src, size_t len)
+{
+    memcpy(buf + offset, src, len);
+    return offset + len;
+}
+
+static int add_entry(hash_t *p_hash, const char *path, size_t path_len, const hash_item_t *p_item)
+{
+    int err = EMBER_SUCCESS;
+    if ((HASH_FRAME_LEN - p_hash->frame_len) < (ENTRY_HDR_LEN + path_len))
+    {
+        err = flush_frame(p_hash);
+    }
+
+    uint8_t type = (0 == p_item->err_num) ? HASH_FILE : HASH_ERROR;
+    uint16_t net_path_len = htons((uint16_t)path_len);
+    uint64_t net_size = utils_htonll((0 == p_item->err_num) ? p_item->size : (uint64_t)p_item->err_num);
+    uint8_t zero_digest[SHA256_DIGEST_LEN] = {0};
+
+    size_t offset = put_bytes(p_hash->frame, p_hash->frame_len, &type, sizeof(uint8_t));
+    offset = put_bytes(p_hash->frame, offset, &net_path_len, sizeof(uint16_t));
+    offset = put_bytes(p_hash->frame, offset, &net_size, sizeof(uint64_t));
+    offset = put_bytes(p_hash->frame, offset, (0 == p_item->err_num) ? p_item->digest : zero_digest,
+                       SHA256_DIGEST_LEN);
+    p_hash->frame_len = put_bytes(p_hash->frame, offset, path, path_len);
+    p_hash->count++;
+
+    return err;
+}
+
+static int add_error_entry(hash_t *p_hash, int err_num)
+{
+    hash_item_t error_item = {.err_num = err_num};
+    return add_entry(p_hash, p_hash->path, p_hash->path_len, &error_item);
+}
+
+static void close_batch_dirs(hash_batch_t *p_batch)
+{
+    for (size_t idx = 0; idx < p_batch->num_dirs; idx++)
+    {
+        if (-1 == close(p_batch->dirfds[idx]))
+        {
+            DEBUG_PERROR("close");
+        }
+    }
+    p_batch->num_dirs = 0;
+}
+
+/**
+ * @brief Hash the files of the batch and send their entries, in the order they were found.
+ */
+static int hash_batch(hash_t *p_hash)
+{
+    hash_batch_t *p_batch = &p_hash->batch;
+    int err = EMBER_SUCCESS;
+
+    pool_for_each(p_hash->p_pool, hash_file, p_batch, p_batch->num_items);
+
+    for (size_t idx = 0; idx < p_batch->num_items; idx++)
+    {
+        hash_item_t *p_item = &p_batch->items[idx];
+        if ((EMBER_SUCCESS == err) && (-1 != p_item->fd))
+        {
+            err = hash_large_file(p_hash, p_item);
+        }
+        if ((-1 != p_item->fd) && (-1 == close(p_item->fd)))
+        {
+            DEBUG_PERROR("close");
+        }
+        if (EMBER_SUCCESS == err)
+        {
+            err = add_entry(p_hash, p_batch->paths + p_item->path_offset, p_item->path_len, p_item);
+        }
+    }
+
+    // The batch's entries go out now rather than when the frame fills up
+    if (EMBER_SUCCESS == err)
+    {
+        err = flush_frame(p_hash);
+    }
+
+    p_batch->num_items = 0;
+    p_batch->paths_len = 0;
+    close_batch_dirs(p_batch);
+    return err;
+}
+
+static bool is_new_dir(const hash_t *p_hash, int dirfd)
+{
+    return (AT_FDCWD != dirfd) && ((0 == p_hash->batch.num_dirs) || (p_hash->dir_seq != p_hash->batch.dir_seq));
+}
+
+/**
+ * @brief Queue the file at the hash's path, opened later by its last name_len bytes in dirfd.
+ * @param dirfd Directory being walked, duplicated into the batch, or AT_FDCWD for a root
+ */
+static int add_file(hash_t *p_hash, int dirfd, size_t name_len)
+{
+    hash_batch_t *p_batch = &p_hash->batch;
+    int err = EMBER_SUCCESS;
+
+    if ((HASH_BATCH_LEN == p_batch->num_items) || ((HASH_PATHS_LEN - p_batch->paths_len) <= p_hash->path_len) ||
+        ((HASH_BATCH_DIRS == p_batch->num_dirs) && is_new_dir(p_hash, dirfd)))
+    {
+        err = hash_batch(p_hash);
+    }
+
+    if (is_new_dir(p_hash, dirfd))
+    {
+        int batch_fd = fcntl(dirfd, F_DUPFD_CLOEXEC, 0);
+        if (-1 == batch_fd)
+        {
+            DEBUG_PERROR("fcntl");
+            return add_error_entry(p_hash, errno);
+        }
+        p_batch->dirfds[p_batch->num_dirs++] = batch_fd;
+        p_batch->dir_seq = p_hash->dir_seq;
+    }
+
+    p_batch->items[p_batch->num_items++] = (hash_item_t){
+        .path_offset = (uint32_t)p_batch->paths_len,
+        .path_len = (uint16_t)p_hash->path_len,
+        .name_offset = (uint16_t)(p_hash->path_len - name_len),
+        .dir_idx = (AT_FDCWD == dirfd) ? -1 : (int)p_batch->num_dirs - 1,
+        .fd = -1,
+    };
+    memcpy(p_batch->paths + p_batch->paths_len, p_hash->path, p_hash->path_len + 1);
+    p_batch->paths_len += p_hash->path_len + 1;
+
+    return err;
+}
+
+static bool path_push(hash_t *p_hash, const char *name)
+{
+    bool b_pushed = false;
+    size_t name_len = strlen(name);
+    size_t sep_len = ('/' == p_hash->path[p_hash->path_len - 1]) ? 0 : 1;
+
+    if ((p_hash->path_len + sep_len + name_len) < PATH_MAX)
+    {
+        p_hash->path[p_hash->path_len] = '/';
+        memcpy(p_hash->path + p_hash->path_len + sep_len, name, name_len + 1);
+        p_hash->path_len += sep_len + name_len;
+        b_pushed = true;
+    }
+
+    return b_pushed;
+}
+
+static void path_pop(hash_t *p_hash, size_t path_len)
+{
+    p_hash->path_len = path_len;
+    p_hash->path[path_len] = '\0';
+}
+
+static int hash_dir(hash_t *p_hash, int dirfd, const char *name, uint32_t depth);
+
+/**
+ * @brief Queue a regular file or walk a directory found at depth, anything else is skipped.
+ */
+static int hash_child(hash_t *p_hash, int dirfd, const char *name, uint8_t type, uint32_t depth)
+{
+    // Only filesystems that withhold the type in getdents64 cost a stat call here
+    struct stat child_stat;
+    if ((DT_UNKNOWN == type) && (-1 == fstatat(dirfd, name, &child_stat, AT_SYMLINK_NOFOLLOW)))
+    {
+        return add_error_entry(p_hash, errno);
+    }
+    if (DT_UNKNOWN == type)
+    {
+        type = S_ISDIR(child_stat.st_mode) ? DT_DIR : (S_ISREG(child_stat.st_mode) ? DT_REG : DT_UNKNOWN);
+    }
+
+    int err = EMBER_SUCCESS;
+    if (DT_REG == type)
+    {
+        err = add_file(p_hash, dirfd, strlen(name));
+    }
+    else if ((DT_DIR == type) && (HASH_MAX_DEPTH > depth))
+    {
+        err = hash_dir(p_hash, dirfd, name, depth);
+    }
+
+    return err;
+}
+
+/**
+ * @brief Walk a directory at depth, its path is the hash's path.
+ */
+static int hash_dir(hash_t *p_hash, int dirfd, const char *name, uint32_t depth)
+{
+    // Per level of the walk, too large for the stack
+    dir_iter_t *p_iter = (dir_iter_t *)malloc(sizeof(dir_iter_t));
+    if (NULL == p_iter)
+    {
+        DEBUG_PERROR("malloc");
+        return -EMBER_ERROR;
+    }
+
+    if (EMBER_SUCCESS != dir_iter_open(p_iter, dirfd, name))
+    {
+        utils_free(p_iter);
+        return add_error_entry(p_hash, errno);
+    }
+
+    int err = EMBER_SUCCESS;
+    int ret = 1;
+    size_t parent_len = p_hash->path_len;
+    uint32_t dir_seq = ++p_hash->dirs_opened;
+    while ((EMBER_SUCCESS == err) && (1 == ret))
+    {
+        const char *child = NULL;
+        uint8_t child_type = DT_UNKNOWN;
+        p_hash->dir_seq = dir_seq; // Back from a subdirectory, files found here need this directory's fd again
+        ret = dir_iter_next(p_iter, &child, &child_type);
+        if ((1 == ret) && path_push(p_hash, child))
+        {
+            err = hash_child(p_hash, p_iter->fd, child, child_type, depth + 1);
+        }
+        path_pop(p_hash, parent_len);
+    }
+
+    // Whatever was read before the failure is kept
+    if ((EMBER_SUCCESS == err) && (0 > ret))
+    {
+        err = add_error_entry(p_hash, errno);
+    }
+
+    dir_iter_close(p_iter);
+    utils_free(p_iter);
+
+    return err;
+}
+
+static int hash_root(hash_t *p_hash, const char *root, size_t root_len)
+{
+    char root_path[PATH_MAX] = {0};
+    int8_t res = SUCCESS;
+
+    memcpy(root_path, root, root_len);
+    memset(p_hash->path, 0, sizeof(p_hash->path));
+    int err = file_resolve_path(root_path, p_hash->path, false, &res);
+    p_hash->path_len = strnlen(p_hash->path, PATH_MAX - 1);
+    if ((EMBER_SUCCESS != err) || (SUCCESS != res))
+    {
+        return add_error_entry(p_hash, EACCES);
+    }
+
+    // The root may be a symlink, below it nothing is followed
+    struct stat root_stat;
+    if (-1 == stat(p_hash->path, &root_stat))
+    {
+        return add_error_entry(p_hash, errno);
+    }
+
+    // Opening anything else, a fifo say, could block
+    if (S_ISREG(root_stat.st_mode))
+    {
+        return add_file(p_hash, AT_FDCWD, p_hash->path_len);
+    }
+    if (!S_ISDIR(root_stat.st_mode))
+    {
+        return add_error_entry(p_hash, EINVAL);
+    }
+
+    int root_fd = open(p_hash->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (-1 == root_fd)
+    {
+        return add_error_entry(p_hash, errno);
+    }
+
+    err = hash_dir(p_hash, root_fd, ".", 0);
+
+    if (-1 == close(root_fd))
+    {
+        DEBUG_PERROR("close");
+    }
+
+    return err;
+}
+
+static int final_response(const hash_t *p_hash, uint8_t **pp_buf, size_t *p_len)
+{
+    uint8_t *buf = (uint8_t *)mem_alloc_fixed(FINAL_LEN);
+    if (NULL == buf)
+    {
+        DEBUG_PERROR("mem_alloc_fixed");
+        return -EMBER_ERROR;
+    }
+
+    uint32_t net_count = htonl(p_hash->count);
+    memcpy(buf, &net_count, sizeof(uint32_t));
+
+    *pp_buf = buf;
+    *p_len = FINAL_LEN;
+    return EMBER_SUCCESS;
+}
+
+int hash_send(const io_callback_t *p_sender, const hash_request_t *p_request, uint8_t **pp_buf, size_t *p_len,
+              int8_t *p_res)
+{
+    assert((NULL != p_sender) && (NULL != p_request) && (NULL != p_res));
+
+    *p_res = SUCCESS;
+    hash_t *p_hash = (hash_t *)calloc(1, sizeof(hash_t));
+    if (NULL == p_hash)
+    {
+        DEBUG_PERROR("calloc");
+        return -EMBER_ERROR;
+    }
+
+    p_hash->p_sender = p_sender;
+    p_hash->p_pool = pool_create(p_request->max_threads);
+    int err = (NULL != p_hash->p_pool) ? EMBER_SUCCESS : -EMBER_ERROR;
+
+    size_t offset = 0;
+    while ((EMBER_SUCCESS == err) && (offset < p_request->list_len))
+    {
+        const char *root = (const char *)p_request->path_list + offset;
+        size_t root_len = strnlen(root, p_request->list_len - offset);
+        offset += root_len + 1;
+
+        if ((0 < root_len) && (PATH_MAX > root_len))
+        {
+            err = hash_root(p_hash, root, root_len);
+        }
+    }
+
+    // Files still waiting in the last batch
+    if (EMBER_SUCCESS == err)
+    {
+        err = hash_batch(p_hash);
+    }
+
+    pool_destroy(p_hash->p_pool);
+    close_batch_dirs(&p_hash->batch); // Left open when the walk failed
+
+    if (EMBER_SUCCESS == err)
+    {
+        err = final_response(p_hash, pp_buf, p_len);
+    }
+
+    utils_free(p_hash);
+    return err;
+}
+
+/*** END OF FILE ***/
@@ -0,0 +1,41 @@
+/**
+ * @file archive.h
+ * @author Kevin McKenzie
+ * @brief Bulk DOWNLOAD of directories and path lists as one streamed archive, instead of a task round trip per file.
+ *
+ * Each entry is [u8 type][u16 path_len][u32 mode][u64 mtime][u64 size][path][size bytes of data], integers in network
+ * order. Directories carry no data, symlinks carry their target and error entries carry the errno in the mode field.
+ * An entry of type ARCHIVE_END terminates the archive.
+ */
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "io_callback.h"
+
+enum archive_entry_types
+{
+    ARCHIVE_END = 0,
+    ARCHIVE_FILE,
+    ARCHIVE_DIR,
+    ARCHIVE_SYMLINK,
+    ARCHIVE_ERROR,
+};
+
+/**
+ * @brief Walk every path in a NULL separated list and stream all entries below them through p_sender.
+ * @param p_sender Callback the archive bytes are written to
+ * @param path_list NULL separated list of files and directories
+ * @param list_len Length of path_list
+ * @param p_digest CRC32C of the entry data (file contents and symlink targets) sent, in stream order
+ * @param p_res Response code for the task
+ * @return int EMBER_SUCCESS, or -EMBER_ERROR if the stream could not be completed
+ */
+int archive_send(const io_callback_t *p_sender, const uint8_t *path_list, size_t list_len, uint32_t *p_digest,
+                 int8_t *p_res);
+
+#endif /* ARCHIVE_H */
+
+/*** END OF FILE ***/
@@ -6,6 +6,11 @@ enum return_codes
     SUCCESS = 0,
     INVALID_CONFIG = 1,
     OUTPUT = 2,
+    FILE_ERROR = 3,
+    TIMED_OUT = 4,
+    CANCELLED = 5,
+    JOB_ERROR = 6,
+    NO_MEMORY = 7,
 };
 
 #endif
@@ -0,0 +1,38 @@
+/**
+ * @file crc32c.h
+ * @author Kevin McKenzie
+ * @brief CRC32C (Castagnoli) checksum used to verify file transfers inline, while the bytes stream through
+ * file.c, instead of re-reading the file in a second pass. Uses the SSE4.2 or ARMv8 CRC instructions when the CPU
+ * has them and a sliced-by-8 table otherwise.
+ *
+ * Building with -DTRANSFER_CRC=OFF leaves every digest at 0, the benchmarks use that build to measure what checksumming
+ * costs a transfer.
+ */
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef TRANSFER_CRC
+#define TRANSFER_CRC 1
+#endif
+
+/**
+ * @brief Build the lookup tables and select the fastest implementation for this CPU. Must be called once before any
+ * call to crc32c_update().
+ */
+void crc32c_init(void);
+
+/**
+ * @brief Extend a running CRC32C with more data. Start with a crc of 0, the result of the last call is the digest.
+ * @param crc Digest of all previous data (0 for the first call)
+ * @param buf Data to add to the digest
+ * @param len Length of buf
+ * @return uint32_t Digest of previous data followed by buf
+ */
+uint32_t crc32c_update(uint32_t crc, const uint8_t *buf, size_t len);
+
+#endif /* CRC32C_H */
+
+/*** END OF FILE ***/
@@ -0,0 +1,44 @@
+/**
+ * @file dir.h
+ * @author Kevin McKenzie
+ * @brief Directory iteration straight on getdents64 against a directory fd. Avoids the per-entry overhead and hidden
+ * allocations of opendir()/readdir() and lets callers resolve children relative to the fd with the *at() syscalls.
+ */
+#ifndef DIR_H
+#define DIR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum
+{
+    DIR_BUF_LEN = 32 * 1024,
+};
+
+typedef struct
+{
+    int fd;                     /**< Directory fd, usable as the dirfd of openat()/fstatat() for the entries. */
+    size_t buf_len;             /**< Number of valid bytes in buf from the last getdents64 call. */
+    size_t buf_pos;             /**< Offset of the next record in buf. */
+    uint8_t buf[DIR_BUF_LEN];   /**< Raw linux_dirent64 records. */
+} dir_iter_t;
+
+/**
+ * @brief Open name relative to dirfd as a directory. Symlinks are not followed.
+ * @return int EMBER_SUCCESS or -EMBER_ERROR with errno set by openat()
+ */
+int dir_iter_open(dir_iter_t *p_iter, int dirfd, const char *name);
+
+/**
+ * @brief Fetch the next entry, skipping "." and "..".
+ * @param p_name Set to the entry name, valid until the next call
+ * @param p_type Set to the DT_* type of the entry (DT_UNKNOWN on filesystems that do not report it)
+ * @return int 1 if an entry was returned, 0 at the end of the directory, -EMBER_ERROR on failure
+ */
+int dir_iter_next(dir_iter_t *p_iter, const char **p_name, uint8_t *p_type);
+
+void dir_iter_close(dir_iter_t *p_iter);
+
+#endif /* DIR_H */
+
+/*** END OF FILE ***/
@@ -3,6 +3,6 @@
 
 #include "settings.h"
 
-int ember_run(settings_t initial_settings);
+int ember_run(settings_t *p_settings);
 
 #endif
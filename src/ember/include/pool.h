@@ -0,0 +1,52 @@
+/**
+ * @file pool.h
+ * @author Kevin McKenzie
+ * @brief Small worker pool for the tasks that fan out independent syscalls or CPU work, e.g. the stat calls of a LIST.
+ *
+ * The pool runs one parallel loop at a time: pool_for_each() hands out the indexes of a range to the workers and the
+ * calling thread, which claim them one by one, and returns once every index has been run. A pool lives for one task,
+ * outside of it the implant stays single threaded. The workers block every signal, so signals keep being delivered to
+ * the main thread and fork() from it is unaffected.
+ */
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+enum
+{
+    POOL_MAX_THREADS = 8, /**< Threads per pool, the calling thread included */
+};
+
+typedef struct pool pool_t;
+
+/** Called once per index of a pool_for_each() range, from any thread of the pool. */
+typedef void (*pool_func_t)(void *p_data, size_t idx);
+
+/**
+ * @brief Start a pool sized to the online CPUs, capped at POOL_MAX_THREADS. On a single CPU no worker is started and
+ * the loops run on the calling thread alone.
+ * @param max_threads Lower cap set by the task, 0 for none
+ * @return pool_t* The pool, or NULL when it could not be allocated. Workers that fail to start only make it smaller.
+ */
+pool_t *pool_create(size_t max_threads);
+
+/**
+ * @brief Run func for every index in [0, count) across the pool and wait for all of them. Not reentrant, func must
+ * not call back into the pool.
+ */
+void pool_for_each(pool_t *p_pool, pool_func_t func, void *p_data, size_t count);
+
+/**
+ * @brief Number of threads that run a loop, the calling thread included.
+ */
+size_t pool_num_threads(const pool_t *p_pool);
+
+/**
+ * @brief Stop and join the workers and free the pool. NULL is ignored.
+ */
+void pool_destroy(pool_t *p_pool);
+
+#endif /* POOL_H */
+
+/*** END OF FILE ***/
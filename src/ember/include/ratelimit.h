@@ -0,0 +1,71 @@
+/**
+ * @file ratelimit.h
+ * @author Kevin McKenzie
+ * @brief Token bucket bandwidth shaping for DOWNLOAD/UPLOAD so a bulk transfer cannot saturate the host's uplink.
+ *
+ * A bucket refills at rate bytes per second up to burst bytes. Taking more than is available puts the bucket in debt
+ * and the caller sleeps on an absolute CLOCK_MONOTONIC deadline until the debt is repaid, so pacing never spins and
+ * the long-run throughput is exactly the rate whatever the chunk size. Transfers are shaped by a global bucket kept in
+ * settings_t, which persists across tasks, and a per-task bucket that starts full with every transfer.
+ */
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "io_callback.h"
+
+/** Highest configurable rate and burst, they keep the token arithmetic within 64 bits. About 17 GB/s and 1 TB. */
+#define RATELIMIT_MAX_RATE ((uint64_t)1 << 34)
+#define RATELIMIT_MAX_BURST ((uint64_t)1 << 40)
+
+typedef struct
+{
+    uint64_t rate;  /**< Bytes per second, 0 is unlimited. */
+    uint64_t burst; /**< Bytes that may be sent at once after an idle period. */
+} ratelimit_config_t;
+
+typedef struct
+{
+    ratelimit_config_t config;
+    int64_t tokens; /**< Negative while in debt. */
+    uint64_t last_ns;
+} ratelimit_t;
+
+typedef struct
+{
+    io_callback_t inner;
+    ratelimit_t *p_global;
+    ratelimit_t task;
+} ratelimit_io_t;
+
+/**
+ * @brief Start a bucket full.
+ */
+void ratelimit_init(ratelimit_t *p_bucket, const ratelimit_config_t *p_config);
+
+/**
+ * @brief Change the rate and burst of a bucket in use. Tokens above the new burst are dropped, debt is kept.
+ */
+void ratelimit_configure(ratelimit_t *p_bucket, const ratelimit_config_t *p_config);
+
+/**
+ * @brief Take bytes from a bucket, sleeping until the bucket is out of debt. Returns at once for unlimited buckets.
+ */
+void ratelimit_take(ratelimit_t *p_bucket, uint64_t bytes);
+
+/**
+ * @brief Wrap an io_callback_t so every call is paced by a global bucket and a fresh per-task bucket.
+ * @param p_io Wrapper state, must outlive the transfer
+ * @param p_inner Callback doing the actual IO
+ * @param p_global Bucket shared by all transfers
+ * @param p_task_config Configuration of the per-task bucket
+ * @return io_callback_t Callback to hand to the transfer instead of p_inner
+ */
+io_callback_t ratelimit_io_wrap(ratelimit_io_t *p_io, const io_callback_t *p_inner, ratelimit_t *p_global,
+                                const ratelimit_config_t *p_task_config);
+
+#endif /* RATELIMIT_H */
+
+/*** END OF FILE ***/
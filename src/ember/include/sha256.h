@@ -0,0 +1,47 @@
+/**
+ * @file sha256.h
+ * @author Kevin McKenzie
+ * @brief SHA-256 for the content digests of HASH, comparable with the digests the C2 addresses its stored files by.
+ * Uses the SHA extensions on x86 or the ARMv8 SHA2 instructions when the CPU has them and portable C otherwise.
+ * Contexts are independent, any number of threads may hash at once.
+ */
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum
+{
+    SHA256_DIGEST_LEN = 32,
+    SHA256_BLOCK_LEN = 64,
+};
+
+typedef struct
+{
+    uint32_t state[8];
+    uint64_t total_len;                /**< Bytes added so far */
+    size_t block_len;                  /**< Bytes waiting in block for it to fill up */
+    uint8_t block[SHA256_BLOCK_LEN];
+} sha256_t;
+
+/**
+ * @brief Select the fastest implementation for this CPU. Must be called once before any other sha256_*() call.
+ */
+void sha256_init(void);
+
+void sha256_begin(sha256_t *p_ctx);
+
+/**
+ * @brief Add data to the digest. Whole blocks in buf are hashed straight from it, without a copy.
+ */
+void sha256_update(sha256_t *p_ctx, const uint8_t *buf, size_t len);
+
+/**
+ * @brief Pad the data and write the digest. The context must be begun again before it is reused.
+ */
+void sha256_final(sha256_t *p_ctx, uint8_t digest[SHA256_DIGEST_LEN]);
+
+#endif /* SHA256_H */
+
+/*** END OF FILE ***/
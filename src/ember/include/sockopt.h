@@ -0,0 +1,50 @@
+/**
+ * @file sockopt.h
+ * @author Kevin McKenzie
+ * @brief TCP options for the callback socket. The check-in rides in the SYN through TCP Fast Open where the kernel and
+ * the C2 allow it, frames go out without waiting on Nagle, DOWNLOAD is corked so its frames fill whole segments and
+ * bulk transfers get socket buffers sized for them.
+ *
+ * Every option is best effort, a failure leaves the kernel default in place and the session carries on. Building with
+ * -DSOCKET_TUNING=OFF compiles all of it out, the benchmarks use that build as the untuned reference.
+ */
+#ifndef SOCKOPT_H
+#define SOCKOPT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef SOCKET_TUNING
+#define SOCKET_TUNING 1
+#endif
+
+/** Largest socket buffer asked for a bulk transfer, the kernel still caps it at net.core.[rw]mem_max. */
+#define SOCKOPT_BULK_BUF_LEN (4 * 1024 * 1024)
+
+/**
+ * @brief Options that must be set before connect(): TCP Fast Open, so connect() returns at once and the check-in is
+ * sent with the SYN. Without a Fast Open cookie for the C2 the kernel falls back to a normal handshake.
+ */
+void sockopt_before_connect(int sock);
+
+/**
+ * @brief Options for the connected socket: TCP_NODELAY, a response must not wait on the ACK of the previous one.
+ */
+void sockopt_after_connect(int sock);
+
+/**
+ * @brief Hold back partial segments between b_cork true and false, uncorking pushes out whatever is queued.
+ */
+void sockopt_cork(int sock, bool b_cork);
+
+/**
+ * @brief Grow the send or receive buffer for a bulk op before it starts. Other ops leave the buffers alone.
+ * @param sock Connected socket
+ * @param op_code Op about to run
+ * @param len Bytes the op will move, when known up front
+ */
+void sockopt_size_buffers(int sock, uint8_t op_code, uint64_t len);
+
+#endif /* SOCKOPT_H */
+
+/*** END OF FILE ***/
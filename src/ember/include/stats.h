@@ -0,0 +1,102 @@
+/**
+ * @file stats.h
+ * @author Kevin McKenzie
+ * @brief Always-on per-task telemetry. Each task is timed per phase with CLOCK_MONOTONIC and folded into fixed-bucket
+ * log-linear latency histograms per op code, along with the bytes and socket/file syscalls it caused. The STATS op
+ * returns everything to the C2.
+ *
+ * A clock read costs a good share of a small task, so only the first STATS_TIMED_FIRST tasks of a session are all
+ * timed, after those one in STATS_SAMPLE_PERIOD. Counts, bytes and syscalls cover every task, the histograms and phase
+ * totals the timed ones.
+ *
+ * Counters are plain integers, they must only be updated from the thread running the session.
+ *
+ * Building with -DTASK_STATS=OFF leaves every counter at 0 and STATS returns no ops, the benchmarks use that build to
+ * measure what the telemetry costs a task.
+ */
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifndef TASK_STATS
+#define TASK_STATS 1
+#endif
+
+enum stats_phases
+{
+    PHASE_RECV_HDR = 0,
+    PHASE_RECV_BODY,
+    PHASE_DECODE,
+    PHASE_EXECUTE,
+    PHASE_SEND,
+    NUM_PHASES,
+};
+
+enum stats_flags
+{
+    STATS_RESET = 1, /**< Clear all counters after they are returned. */
+};
+
+enum
+{
+    STATS_MAX_OPS = 16,
+    STATS_NUM_BUCKETS = 64,
+    STATS_TIMED_FIRST = 16,
+    STATS_SAMPLE_PERIOD = 64,
+};
+
+typedef struct
+{
+    bool b_timed;                       /**< Phases are only timed for a sample of the tasks. */
+    uint64_t mark_ns;                   /**< Time the current phase started. */
+    uint64_t phase_us[NUM_PHASES];      /**< Time spent in each phase. */
+    uint64_t syscalls;                  /**< Global counters when the task started, to attribute the difference. */
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+} stats_task_t;
+
+/**
+ * @brief Start of a session, its first STATS_TIMED_FIRST tasks are all timed.
+ */
+void stats_session_begin(void);
+
+/**
+ * @brief Start timing a task. Starts the PHASE_RECV_HDR phase.
+ */
+void stats_task_begin(stats_task_t *p_stats);
+
+/**
+ * @brief End a phase of a task, the next phase starts now.
+ */
+void stats_phase_end(stats_task_t *p_stats, uint8_t phase);
+
+/**
+ * @brief Fold a finished task into the histograms of its op code.
+ */
+void stats_task_end(const stats_task_t *p_stats, uint8_t op_code);
+
+/**
+ * @brief Count one read/write/send/recv syscall and the bytes it moved.
+ * @param bytes Return value of the syscall, errors count as a syscall moving nothing.
+ * @param b_inbound true for reads/recvs, false for writes/sends
+ */
+void stats_count_syscall(ssize_t bytes, bool b_inbound);
+
+/**
+ * @brief Serialize all op codes with recorded tasks. Per op: [u8 op][u32 count][u64 bytes_in][u64 bytes_out]
+ * [u64 syscalls], then per phase [u64 total_us][u8 num_buckets] followed by num_buckets x [u8 bucket][u32 count].
+ * Only non-empty buckets are sent, their counts add up to the op's timed tasks. The whole payload is prefixed with [u8 num_ops]. All integers in network order.
+ * @param pp_buf Set to a malloc'd buffer the caller frees
+ * @param p_len Set to the length of *pp_buf
+ * @param flags stats_flags
+ * @return int EMBER_SUCCESS or -EMBER_ERROR
+ */
+int stats_serialize(uint8_t **pp_buf, size_t *p_len, uint16_t flags);
+
+#endif /* STATS_H */
+
+/*** END OF FILE ***/
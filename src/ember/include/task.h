@@ -1,11 +1,16 @@
 #ifndef TASK_H
 #define TASK_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "exec.h"
 #include "file.h"
+#include "hash.h"
+#include "job.h"
+#include "list.h"
 #include "settings.h"
+#include "stats.h"
 
 #define TASK_HDR_LEN 18
 
@@ -16,7 +21,14 @@ enum op_codes
     DOWNLOAD,
     UPLOAD,
     DISCONNECT,
-    EXIT
+    EXIT,
+    STATS,
+    CANCEL,
+    JOB_LIST,
+    JOB_OUTPUT,
+    JOB_KILL,
+    LIST,
+    HASH,
 };
 
 typedef struct task_header_t
@@ -35,8 +47,17 @@ typedef struct task_t
     uint8_t *raw_data;
     settings_t settings;
     exec_t exec;
+    job_request_t job;
+    list_request_t list;
+    hash_request_t hash;
     file_t file;
+    stats_task_t stats;
+    uint32_t poll_delay_ms; /**< DISCONNECT with MORE_WORK, the delay it asks for before the next callback */
     int8_t response_code;
+    uint8_t *response_data; /**< Optional final response payload from mem_alloc(), freed with mem_free() once sent. */
+    size_t response_len;
+    bool b_cancel_received; /**< A CANCEL for this task was consumed while it ran and is answered after it. */
+    bool b_responded;       /**< The task sent its final response itself. */
 } task_t;
 
 int task_receive_and_execute(int sock, settings_t *p_settings);
@@ -0,0 +1,84 @@
+/**
+ * @file trace.h
+ * @author Kevin McKenzie
+ * @brief Binary event tracing for hot paths where DEBUG_PRINT's fprintf would distort timing. Events are fixed-size
+ * records written into a per-thread in-memory ring with no locks and no syscalls beyond the vDSO clock read. Rings
+ * are dumped to $EMBER_TRACE_FILE at exit or on SIGUSR1 and decoded offline by src/tools/trace_decode.py.
+ *
+ * Events above TRACE_LEVEL compile to nothing. TRACE_LEVEL defaults to TRACE_LEVEL_DEBUG in debug builds and
+ * TRACE_LEVEL_OFF under NDEBUG, so release binaries carry no tracing code at all.
+ */
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#define TRACE_LEVEL_OFF 0
+#define TRACE_LEVEL_ERROR 1
+#define TRACE_LEVEL_INFO 2
+#define TRACE_LEVEL_DEBUG 3
+
+#ifndef TRACE_LEVEL
+#ifdef NDEBUG
+#define TRACE_LEVEL TRACE_LEVEL_OFF
+#else
+#define TRACE_LEVEL TRACE_LEVEL_DEBUG
+#endif
+#endif
+
+/**
+ * @brief Event ids. trace_decode.py parses this enum for event names, keep one event per line. Events ending in
+ * _BEGIN/_END are paired into durations in Chrome trace output.
+ */
+enum trace_events
+{
+    TRACE_EV_RECV = 1,     /**< fd, requested, result */
+    TRACE_EV_SEND,         /**< fd, requested, result */
+    TRACE_EV_READ,         /**< fd, requested, result */
+    TRACE_EV_WRITE,        /**< fd, requested, result */
+    TRACE_EV_SYSCALL_FAIL, /**< line, errno, result */
+    TRACE_EV_TASK_BEGIN,   /**< 0, 0, 0 */
+    TRACE_EV_TASK_END,     /**< op_code, response_code, err */
+    TRACE_EV_RESPONSE,     /**< response_code, len, err */
+};
+
+typedef struct
+{
+    uint64_t ts_ns; /**< CLOCK_MONOTONIC */
+    uint16_t event;
+    uint16_t reserved;
+    uint32_t arg0;
+    int64_t arg1;
+    int64_t arg2;
+} trace_record_t;
+
+#if TRACE_LEVEL > TRACE_LEVEL_OFF
+void trace_init(void);
+void trace_emit(uint16_t event, uint32_t arg0, int64_t arg1, int64_t arg2);
+#define TRACE_INIT() trace_init()
+#else
+#define TRACE_INIT()
+#endif
+
+#define TRACE(level, event, arg0, arg1, arg2)                                                                          \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        if (TRACE_LEVEL >= (level))                                                                                    \
+        {                                                                                                              \
+            TRACE_EMIT((event), (uint32_t)(arg0), (int64_t)(arg1), (int64_t)(arg2));                                   \
+        }                                                                                                              \
+    } while (0)
+
+#if TRACE_LEVEL > TRACE_LEVEL_OFF
+#define TRACE_EMIT(event, arg0, arg1, arg2) trace_emit((event), (arg0), (arg1), (arg2))
+#else
+#define TRACE_EMIT(event, arg0, arg1, arg2) ((void)(event), (void)(arg0), (void)(arg1), (void)(arg2))
+#endif
+
+#define TRACE_ERROR(event, arg0, arg1, arg2) TRACE(TRACE_LEVEL_ERROR, event, arg0, arg1, arg2)
+#define TRACE_INFO(event, arg0, arg1, arg2) TRACE(TRACE_LEVEL_INFO, event, arg0, arg1, arg2)
+#define TRACE_DEBUG(event, arg0, arg1, arg2) TRACE(TRACE_LEVEL_DEBUG, event, arg0, arg1, arg2)
+
+#endif /* TRACE_H */
+
+/*** END OF FILE ***/
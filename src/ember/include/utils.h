@@ -14,6 +14,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 enum
@@ -75,6 +76,12 @@ ssize_t utils_recvall(int sock, void *dest, size_t num_bytes, int flags);
 
 ssize_t utils_sendall(int sock, void *src, size_t len, int flags);
 
+/**
+ * @brief utils_sendall() for data gathered from several buffers, sent with as few sendmsg() calls as the socket allows.
+ * The iovecs are advanced past what was sent and left in an unspecified state.
+ */
+ssize_t utils_sendall_iov(int sock, struct iovec *iov, size_t iov_len, int flags);
+
 #endif /* UTILS_H */
 
 /*** END OF FILE ***/
@@ -0,0 +1,371 @@
+/**
+ * @file job.c
+ * @author Kevin McKenzie
+ * @brief Background jobs with bounded output rings, see job.h.
+ */
+#define _GNU_SOURCE // NOLINT MAP_NORESERVE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "codes.h"
+#include "errors.h"
+#include "exec.h"
+#include "job.h"
+#include "mem.h"
+#include "utils.h"
+
+enum
+{
+    NSEC_PER_MSEC = 1000000,
+    MSEC_PER_SEC = 1000,
+    JOB_LIST_ENTRY_LEN = (2 * sizeof(uint32_t)) + sizeof(uint8_t) + sizeof(int32_t) + sizeof(uint64_t) +
+                         sizeof(uint8_t) + JOB_CMD_LEN,
+};
+
+typedef struct
+{
+    uint32_t id; /**< 0 for a free slot */
+    exec_process_t process;
+    uint8_t *ring;
+    uint64_t written; /**< Bytes the job has written, i.e. the cursor of its next byte */
+    bool b_running;   /**< Not reaped yet */
+    int32_t exit_status;
+    char cmd[JOB_CMD_LEN + 1];
+} job_t;
+
+static job_t g_jobs[JOB_MAX] = {0};
+static uint32_t g_next_id = 1;
+
+static uint64_t now_ms(void)
+{
+    struct timespec now = {0};
+    (void)clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * MSEC_PER_SEC) + ((uint64_t)now.tv_nsec / NSEC_PER_MSEC);
+}
+
+static void close_fd(int *p_fd)
+{
+    if ((-1 != *p_fd) && (-1 == close(*p_fd)))
+    {
+        DEBUG_PERROR("close");
+    }
+    *p_fd = -1;
+}
+
+static job_t *find_job(uint32_t id)
+{
+    for (size_t idx = 0; (0 != id) && (idx < JOB_MAX); idx++)
+    {
+        if (id == g_jobs[idx].id)
+        {
+            return &g_jobs[idx];
+        }
+    }
+    return NULL;
+}
+
+static void release_job(job_t *p_job)
+{
+    if (NULL != p_job->ring)
+    {
+        if (-1 == munmap(p_job->ring, JOB_RING_LEN))
+        {
+            DEBUG_PERROR("munmap");
+        }
+        mem_release(JOB_RING_LEN);
+    }
+    memset(p_job, 0, sizeof(job_t));
+}
+
+static void drain_output(job_t *p_job)
+{
+    // At most one ring's worth per call, so one chatty job cannot starve the others or the session
+    for (size_t total = 0; (-1 != p_job->process.out_fd) && (total < JOB_RING_LEN);)
+    {
+        size_t offset = p_job->written % JOB_RING_LEN;
+        ssize_t num_read = read(p_job->process.out_fd, p_job->ring + offset, JOB_RING_LEN - offset);
+        if (0 < num_read)
+        {
+            p_job->written += (uint64_t)num_read;
+            total += (size_t)num_read;
+            continue;
+        }
+
+        if ((0 == num_read) || ((EAGAIN != errno) && (EINTR != errno)))
+        {
+            close_fd(&p_job->process.out_fd);
+        }
+        break;
+    }
+}
+
+static void reap_job(job_t *p_job, int options)
+{
+    int status = 0;
+    pid_t ret = waitpid(p_job->process.pid, &status, options);
+    if (p_job->process.pid != ret)
+    {
+        if (-1 == ret)
+        {
+            DEBUG_PERROR("waitpid");
+        }
+        return;
+    }
+
+    // Keep what the job wrote before it exited, anything it started is on its own from here
+    drain_output(p_job);
+    close_fd(&p_job->process.out_fd);
+    close_fd(&p_job->process.pidfd);
+    p_job->b_running = false;
+    p_job->exit_status = exec_exit_status(status);
+}
+
+static void service_job(job_t *p_job, short out_events, short exit_events)
+{
+    if (0 != out_events)
+    {
+        drain_output(p_job);
+
+        // Without a pidfd, EOF on the output is the best sign of the exit there is
+        if ((-1 == p_job->process.out_fd) && (-1 == p_job->process.pidfd))
+        {
+            reap_job(p_job, 0);
+        }
+    }
+    if (0 != exit_events)
+    {
+        reap_job(p_job, WNOHANG);
+    }
+}
+
+int job_start(exec_t *p_exec, uint16_t flags, uint32_t *p_id, int8_t *p_res)
+{
+    job_t *p_job = NULL;
+    for (size_t idx = 0; (NULL == p_job) && (idx < JOB_MAX); idx++)
+    {
+        p_job = (0 == g_jobs[idx].id) ? &g_jobs[idx] : NULL;
+    }
+
+    *p_res = SUCCESS;
+    if (NULL == p_job)
+    {
+        *p_res = -JOB_ERROR;
+        return EMBER_SUCCESS;
+    }
+
+    // Reserved in full, a chatty job reaches every page of its ring
+    if (!mem_reserve(JOB_RING_LEN))
+    {
+        *p_res = -NO_MEMORY;
+        return EMBER_SUCCESS;
+    }
+
+    p_job->ring = (uint8_t *)mmap(NULL, JOB_RING_LEN, PROT_READ | PROT_WRITE,
+                                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (MAP_FAILED == p_job->ring)
+    {
+        DEBUG_PERROR("mmap");
+        p_job->ring = NULL;
+        mem_release(JOB_RING_LEN);
+        return -EMBER_ERROR;
+    }
+
+    if (EMBER_SUCCESS != exec_spawn(p_exec, flags, &p_job->process))
+    {
+        release_job(p_job);
+        *p_res = -FILE_ERROR;
+        return EMBER_SUCCESS;
+    }
+
+    p_job->id = g_next_id;
+    g_next_id = (UINT32_MAX == g_next_id) ? 1 : (g_next_id + 1);
+    p_job->b_running = true;
+    memcpy(p_job->cmd, p_exec->path, strnlen(p_exec->path, JOB_CMD_LEN));
+    *p_id = p_job->id;
+    return EMBER_SUCCESS;
+}
+
+size_t job_running_count(void)
+{
+    size_t count = 0;
+    for (size_t idx = 0; idx < JOB_MAX; idx++)
+    {
+        count += g_jobs[idx].b_running ? 1 : 0;
+    }
+    return count;
+}
+
+static int poll_jobs(int fd, int timeout_ms)
+{
+    // Per job its output and its pidfd, -1 entries are ignored by poll()
+    struct pollfd fds[(2 * JOB_MAX) + 1] = {0};
+    for (size_t idx = 0; idx < JOB_MAX; idx++)
+    {
+        bool b_running = g_jobs[idx].b_running;
+        fds[2 * idx] = (struct pollfd){.fd = b_running ? g_jobs[idx].process.out_fd : -1, .events = POLLIN};
+        fds[(2 * idx) + 1] = (struct pollfd){.fd = b_running ? g_jobs[idx].process.pidfd : -1, .events = POLLIN};
+    }
+    fds[2 * JOB_MAX] = (struct pollfd){.fd = fd, .events = POLLIN};
+
+    int ready = poll(fds, ARRAY_LEN(fds), timeout_ms);
+    if (-1 == ready)
+    {
+        return (EINTR == errno) ? 0 : -EMBER_ERROR;
+    }
+
+    for (size_t idx = 0; (0 < ready) && (idx < JOB_MAX); idx++)
+    {
+        if (fds[2 * idx].revents || fds[(2 * idx) + 1].revents)
+        {
+            service_job(&g_jobs[idx], fds[2 * idx].revents, fds[(2 * idx) + 1].revents);
+        }
+    }
+
+    return (0 != fds[2 * JOB_MAX].revents) ? 1 : 0;
+}
+
+int job_wait(int fd, int timeout_ms)
+{
+    uint64_t deadline = now_ms() + (uint64_t)timeout_ms;
+    int ret = 0;
+
+    while ((0 == ret) && (0 < job_running_count()))
+    {
+        int wait_ms = -1;
+        if (0 <= timeout_ms)
+        {
+            uint64_t now = now_ms();
+            if (now >= deadline)
+            {
+                return 0;
+            }
+            wait_ms = (int)MIN(deadline - now, (uint64_t)INT32_MAX);
+        }
+        ret = poll_jobs(fd, wait_ms);
+    }
+
+    return (0 == ret) ? 1 : ret;
+}
+
+static size_t put_u8(uint8_t *buf, size_t offset, uint8_t value)
+{
+    buf[offset] = value;
+    return offset + sizeof(uint8_t);
+}
+
+static size_t put_u32(uint8_t *buf, size_t offset, uint32_t value)
+{
+    uint32_t net_value = htonl(value);
+    memcpy(buf + offset, &net_value, sizeof(uint32_t));
+    return offset + sizeof(uint32_t);
+}
+
+static size_t put_u64(uint8_t *buf, size_t offset, uint64_t value)
+{
+    uint64_t net_value = utils_htonll(value);
+    memcpy(buf + offset, &net_value, sizeof(uint64_t));
+    return offset + sizeof(uint64_t);
+}
+
+int job_list(uint8_t **pp_buf, size_t *p_len)
+{
+    uint8_t *buf = (uint8_t *)mem_alloc_fixed(sizeof(uint8_t) + ((size_t)JOB_MAX * JOB_LIST_ENTRY_LEN));
+    if (NULL == buf)
+    {
+        DEBUG_PERROR("mem_alloc_fixed");
+        return -EMBER_ERROR;
+    }
+
+    size_t offset = sizeof(uint8_t);
+    uint8_t count = 0;
+    for (size_t idx = 0; idx < JOB_MAX; idx++)
+    {
+        const job_t *p_job = &g_jobs[idx];
+        if (0 == p_job->id)
+        {
+            continue;
+        }
+
+        uint8_t cmd_len = (uint8_t)strnlen(p_job->cmd, JOB_CMD_LEN);
+        offset = put_u32(buf, offset, p_job->id);
+        offset = put_u32(buf, offset, (uint32_t)p_job->process.pid);
+        offset = put_u8(buf, offset, p_job->b_running ? 1 : 0);
+        offset = put_u32(buf, offset, (uint32_t)p_job->exit_status);
+        offset = put_u64(buf, offset, p_job->written);
+        offset = put_u8(buf, offset, cmd_len);
+        memcpy(buf + offset, p_job->cmd, cmd_len);
+        offset += cmd_len;
+        count++;
+    }
+    (void)put_u8(buf, 0, count);
+
+    *pp_buf = buf;
+    *p_len = offset;
+    return EMBER_SUCCESS;
+}
+
+void job_output(const job_request_t *p_request, job_output_t *p_output, int8_t *p_res)
+{
+    job_t *p_job = find_job(p_request->id);
+    *p_res = (NULL == p_job) ? -JOB_ERROR : SUCCESS;
+    if (NULL == p_job)
+    {
+        return;
+    }
+
+    // Pick up what arrived since the job was last serviced
+    if (p_job->b_running)
+    {
+        drain_output(p_job);
+    }
+
+    uint64_t held_from = (p_job->written > JOB_RING_LEN) ? (p_job->written - JOB_RING_LEN) : 0;
+    uint64_t start = MIN(MAX(p_request->cursor, held_from), p_job->written);
+    size_t len = (size_t)(p_job->written - start);
+
+    size_t offset = put_u64(p_output->hdr, 0, start);
+    offset = put_u8(p_output->hdr, offset, p_job->b_running ? 1 : 0);
+    (void)put_u32(p_output->hdr, offset, (uint32_t)p_job->exit_status);
+
+    // The held output may wrap around the end of the ring
+    size_t ring_offset = start % JOB_RING_LEN;
+    size_t first_len = MIN(len, JOB_RING_LEN - ring_offset);
+    p_output->spans[0] = (struct iovec){.iov_base = p_job->ring + ring_offset, .iov_len = first_len};
+    p_output->spans[1] = (struct iovec){.iov_base = p_job->ring, .iov_len = len - first_len};
+}
+
+void job_output_done(const job_request_t *p_request)
+{
+    job_t *p_job = find_job(p_request->id);
+    if ((NULL != p_job) && !p_job->b_running)
+    {
+        release_job(p_job);
+    }
+}
+
+void job_kill(const job_request_t *p_request, int8_t *p_res)
+{
+    job_t *p_job = find_job(p_request->id);
+    *p_res = (NULL == p_job) ? -JOB_ERROR : SUCCESS;
+
+    if ((NULL != p_job) && p_job->b_running)
+    {
+        exec_kill(&p_job->process);
+    }
+    else if (NULL != p_job)
+    {
+        release_job(p_job);
+    }
+}
+
+/*** END OF FILE ***/
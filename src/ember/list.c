@@ -0,0 +1,422 @@
+/**
+ * @file list.c
+ * @author Kevin McKenzie
+ * @brief Directory listings with metadata, see list.h.
+ */
+#define _GNU_SOURCE // NOLINT statx() and the AT_* flags
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <linux/limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "codes.h"
+#include "dir.h"
+#include "errors.h"
+#include "list.h"
+#include "mem.h"
+#include "pool.h"
+#include "utils.h"
+
+enum
+{
+    LIST_NAMES_LEN = 16 * 1024,
+    LIST_PARALLEL_MIN = 64, /**< Smaller batches are stat'd on the calling thread, waking the pool costs more */
+    ENTRY_HDR_LEN = (2 * sizeof(uint8_t)) + sizeof(uint16_t) + (3 * sizeof(uint32_t)) + (2 * sizeof(uint64_t)),
+    FINAL_LEN = sizeof(uint32_t) + sizeof(uint8_t),
+};
+
+typedef struct
+{
+    uint16_t name_offset; /**< Into the batch's names */
+    uint8_t d_type;
+    bool b_send; /**< The name matches the pattern */
+    bool b_dir;  /**< Walked once the batch is sent */
+    int err_num; /**< errno of the stat call, 0 when the metadata is valid */
+    uint32_t mode;
+    uint32_t uid;
+    uint32_t gid;
+    uint64_t size;
+    uint64_t mtime;
+} list_item_t;
+
+typedef struct
+{
+    int dirfd;
+    size_t num_items;
+    size_t names_len;
+    list_item_t items[LIST_BATCH_LEN];
+    char names[LIST_NAMES_LEN];
+} list_batch_t;
+
+typedef struct
+{
+    const io_callback_t *p_sender;
+    const char *pattern; /**< NULL to send every entry */
+    uint32_t max_depth;
+    uint32_t limit;
+    uint32_t count;
+    bool b_truncated; /**< An entry past the limit was found, the walk stops */
+    pool_t *p_pool;   /**< NULL stats every batch on the calling thread */
+    size_t frame_len;
+    uint8_t frame[LIST_FRAME_LEN];
+    size_t path_len;
+    char path[PATH_MAX]; /**< Of the entry being visited relative to the root, children are appended in place */
+} list_t;
+
+static int list_dir(list_t *p_list, int dirfd, const char *name, uint32_t depth);
+
+static bool g_b_no_statx = false; /**< Set once statx() turned out to be missing, e.g. on kernels before 4.11 */
+
+static int stat_entry(int dirfd, const char *name, list_item_t *p_item)
+{
+#ifdef STATX_TYPE
+    struct statx entry_statx;
+    if (!__atomic_load_n(&g_b_no_statx, __ATOMIC_RELAXED))
+    {
+        // Only the fields sent are asked for, and cached attributes are good enough on network filesystems
+        unsigned int mask = STATX_TYPE | STATX_MODE | STATX_UID | STATX_GID | STATX_SIZE | STATX_MTIME;
+        if (0 == statx(dirfd, name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC, mask, &entry_statx))
+        {
+            p_item->mode = entry_statx.stx_mode;
+            p_item->uid = entry_statx.stx_uid;
+            p_item->gid = entry_statx.stx_gid;
+            p_item->size = entry_statx.stx_size;
+            p_item->mtime = (uint64_t)entry_statx.stx_mtime.tv_sec;
+            return 0;
+        }
+        if (ENOSYS != errno)
+        {
+            return errno;
+        }
+        __atomic_store_n(&g_b_no_statx, true, __ATOMIC_RELAXED);
+    }
+#endif
+
+    struct stat entry_stat;
+    if (-1 == fstatat(dirfd, name, &entry_stat, AT_SYMLINK_NOFOLLOW))
+    {
+        return errno;
+    }
+    p_item->mode = (uint32_t)entry_stat.st_mode;
+    p_item->uid = (uint32_t)entry_stat.st_uid;
+    p_item->gid = (uint32_t)entry_stat.st_gid;
+    p_item->size = (uint64_t)entry_stat.st_size;
+    p_item->mtime = (uint64_t)entry_stat.st_mtime;
+    return 0;
+}
+
+static void stat_item(void *p_data, size_t idx)
+{
+    list_batch_t *p_batch = (list_batch_t *)p_data;
+    list_item_t *p_item = &p_batch->items[idx];
+
+    // Entries that are not sent only need their type, which getdents64 already gave unless the filesystem withheld it
+    p_item->b_dir = (DT_DIR == p_item->d_type);
+    if (p_item->b_send || (DT_UNKNOWN == p_item->d_type))
+    {
+        p_item->err_num = stat_entry(p_batch->dirfd, p_batch->names + p_item->name_offset, p_item);
+        p_item->b_dir = (0 == p_item->err_num) && S_ISDIR(p_item->mode);
+    }
+}
+
+static void stat_batch(list_t *p_list, list_batch_t *p_batch)
+{
+    if ((NULL != p_list->p_pool) && (LIST_PARALLEL_MIN <= p_batch->num_items))
+    {
+        pool_for_each(p_list->p_pool, stat_item, p_batch, p_batch->num_items);
+        return;
+    }
+
+    for (size_t idx = 0; idx < p_batch->num_items; idx++)
+    {
+        stat_item(p_batch, idx);
+    }
+}
+
+static int flush_frame(list_t *p_list)
+{
+    int err = EMBER_SUCCESS;
+
+    if ((0 < p_list->frame_len) &&
+        (EMBER_SUCCESS != p_list->p_sender->func(p_list->p_sender->data, p_list->frame, (ssize_t)p_list->frame_len)))
+    {
+        err = -EMBER_ERROR;
+    }
+    p_list->frame_len = 0;
+
+    return err;
+}
+
+static size_t put_bytes(uint8_t *buf, size_t offset, const void *src, size_t len)
+{
+    memcpy(buf + offset, src, len);
+    return offset + len;
+}
+
+static int add_entry(list_t *p_list, uint8_t type, uint32_t depth, const list_item_t *p_item)
+{
+    if ((0 != p_list->limit) && (p_list->limit == p_list->count))
+    {
+        p_list->b_truncated = true;
+        return EMBER_SUCCESS;
+    }
+
+    int err = EMBER_SUCCESS;
+    if ((LIST_FRAME_LEN - p_list->frame_len) < (ENTRY_HDR_LEN + p_list->path_len))
+    {
+        err = flush_frame(p_list);
+    }
+
+    uint8_t net_depth = (uint8_t)depth;
+    uint16_t net_path_len = htons((uint16_t)p_list->path_len);
+    uint32_t net_ids[3] = {htonl(p_item->mode), htonl(p_item->uid), htonl(p_item->gid)};
+    uint64_t net_size = utils_htonll(p_item->size);
+    uint64_t net_mtime = utils_htonll(p_item->mtime);
+
+    size_t offset = put_bytes(p_list->frame, p_list->frame_len, &type, sizeof(uint8_t));
+    offset = put_bytes(p_list->frame, offset, &net_depth, sizeof(uint8_t));
+    offset = put_bytes(p_list->frame, offset, &net_path_len, sizeof(uint16_t));
+    offset = put_bytes(p_list->frame, offset, net_ids, sizeof(net_ids));
+    offset = put_bytes(p_list->frame, offset, &net_size, sizeof(uint64_t));
+    offset = put_bytes(p_list->frame, offset, &net_mtime, sizeof(uint64_t));
+    p_list->frame_len = put_bytes(p_list->frame, offset, p_list->path, p_list->path_len);
+    p_list->count++;
+
+    return err;
+}
+
+static int add_error_entry(list_t *p_list, uint32_t depth, int err_num)
+{
+    list_item_t error_item = {.mode = (uint32_t)err_num};
+    return add_entry(p_list, LIST_ERROR, depth, &error_item);
+}
+
+static bool path_push(list_t *p_list, const char *name)
+{
+    bool b_pushed = false;
+    size_t name_len = strlen(name);
+    size_t sep_len = (0 < p_list->path_len) ? 1 : 0;
+
+    if ((p_list->path_len + sep_len + name_len) < PATH_MAX)
+    {
+        p_list->path[p_list->path_len] = '/';
+        memcpy(p_list->path + p_list->path_len + sep_len, name, name_len + 1);
+        p_list->path_len += sep_len + name_len;
+        b_pushed = true;
+    }
+
+    return b_pushed;
+}
+
+static void path_pop(list_t *p_list, size_t path_len)
+{
+    p_list->path_len = path_len;
+    p_list->path[path_len] = '\0';
+}
+
+static int fill_batch(const list_t *p_list, dir_iter_t *p_iter, list_batch_t *p_batch)
+{
+    int ret = 1;
+
+    p_batch->dirfd = p_iter->fd;
+    p_batch->num_items = 0;
+    p_batch->names_len = 0;
+
+    // Stop while the longest possible name still fits, names are only valid until the next dir_iter_next()
+    while ((1 == ret) && (LIST_BATCH_LEN > p_batch->num_items) &&
+           ((p_batch->names_len + NAME_MAX + 1) <= LIST_NAMES_LEN))
+    {
+        const char *name = NULL;
+        uint8_t type = DT_UNKNOWN;
+        ret = dir_iter_next(p_iter, &name, &type);
+        if (1 == ret)
+        {
+            size_t name_len = strnlen(name, NAME_MAX);
+            p_batch->items[p_batch->num_items++] = (list_item_t){
+                .name_offset = (uint16_t)p_batch->names_len,
+                .d_type = type,
+                .b_send = (NULL == p_list->pattern) || (0 == fnmatch(p_list->pattern, name, 0)),
+            };
+            memcpy(p_batch->names + p_batch->names_len, name, name_len);
+            p_batch->names[p_batch->names_len + name_len] = '\0';
+            p_batch->names_len += name_len + 1;
+        }
+    }
+
+    return ret;
+}
+
+static int send_batch(list_t *p_list, const list_batch_t *p_batch, uint32_t depth)
+{
+    int err = EMBER_SUCCESS;
+    size_t parent_len = p_list->path_len;
+
+    for (size_t idx = 0; (EMBER_SUCCESS == err) && !p_list->b_truncated && (idx < p_batch->num_items); idx++)
+    {
+        const list_item_t *p_item = &p_batch->items[idx];
+        if (p_item->b_send && path_push(p_list, p_batch->names + p_item->name_offset))
+        {
+            err = (0 == p_item->err_num) ? add_entry(p_list, LIST_ENTRY, depth, p_item)
+                                         : add_error_entry(p_list, depth, p_item->err_num);
+        }
+        path_pop(p_list, parent_len);
+    }
+
+    return err;
+}
+
+static int walk_batch(list_t *p_list, const list_batch_t *p_batch, uint32_t depth)
+{
+    int err = EMBER_SUCCESS;
+    size_t parent_len = p_list->path_len;
+
+    for (size_t idx = 0; (EMBER_SUCCESS == err) && !p_list->b_truncated && (idx < p_batch->num_items); idx++)
+    {
+        const list_item_t *p_item = &p_batch->items[idx];
+        const char *name = p_batch->names + p_item->name_offset;
+        if (p_item->b_dir && (depth < p_list->max_depth) && path_push(p_list, name))
+        {
+            err = list_dir(p_list, p_batch->dirfd, name, depth);
+        }
+        path_pop(p_list, parent_len);
+    }
+
+    return err;
+}
+
+/**
+ * @brief List the entries of a directory at depth + 1 and walk on below it.
+ * @param depth Depth of the directory, its path is the list's path
+ */
+static int list_dir(list_t *p_list, int dirfd, const char *name, uint32_t depth)
+{
+    int err = EMBER_SUCCESS;
+
+    // Per level of the walk, too large for the stack
+    dir_iter_t *p_iter = (dir_iter_t *)malloc(sizeof(dir_iter_t));
+    list_batch_t *p_batch = (list_batch_t *)malloc(sizeof(list_batch_t));
+    if ((NULL == p_iter) || (NULL == p_batch))
+    {
+        DEBUG_PERROR("malloc");
+        utils_free(p_iter); // Never opened, dir_iter_close() would close whatever its fd field holds
+        err = -EMBER_ERROR;
+    }
+    else if (EMBER_SUCCESS != dir_iter_open(p_iter, dirfd, name))
+    {
+        err = add_error_entry(p_list, depth, errno);
+        utils_free(p_iter);
+    }
+
+    int ret = 1;
+    while ((EMBER_SUCCESS == err) && (NULL != p_iter) && !p_list->b_truncated && (1 == ret))
+    {
+        ret = fill_batch(p_list, p_iter, p_batch);
+        int iter_err_num = (0 > ret) ? errno : 0;
+
+        // A batch is sent before its subdirectories are walked, the walk reuses nothing of it but the names
+        stat_batch(p_list, p_batch);
+        err = send_batch(p_list, p_batch, depth + 1);
+        if (EMBER_SUCCESS == err)
+        {
+            err = walk_batch(p_list, p_batch, depth + 1);
+        }
+
+        // Whatever was read before the failure is kept
+        if ((EMBER_SUCCESS == err) && (0 != iter_err_num))
+        {
+            err = add_error_entry(p_list, depth, iter_err_num);
+        }
+    }
+
+    dir_iter_close(p_iter);
+    utils_free(p_iter);
+    utils_free(p_batch);
+
+    return err;
+}
+
+static int send_root(list_t *p_list, const char *root)
+{
+    // The root may be a symlink to the directory, below it nothing is followed
+    int root_fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (-1 == root_fd)
+    {
+        return add_error_entry(p_list, 0, errno);
+    }
+
+    int err = list_dir(p_list, root_fd, ".", 0);
+
+    if (-1 == close(root_fd))
+    {
+        DEBUG_PERROR("close");
+    }
+
+    return err;
+}
+
+static int final_response(const list_t *p_list, uint8_t **pp_buf, size_t *p_len)
+{
+    uint8_t *buf = (uint8_t *)mem_alloc_fixed(FINAL_LEN);
+    if (NULL == buf)
+    {
+        DEBUG_PERROR("mem_alloc_fixed");
+        return -EMBER_ERROR;
+    }
+
+    uint32_t net_count = htonl(p_list->count);
+    memcpy(buf, &net_count, sizeof(uint32_t));
+    buf[sizeof(uint32_t)] = p_list->b_truncated ? 1 : 0;
+
+    *pp_buf = buf;
+    *p_len = FINAL_LEN;
+    return EMBER_SUCCESS;
+}
+
+int list_send(const io_callback_t *p_sender, const list_request_t *p_request, uint8_t **pp_buf, size_t *p_len,
+              int8_t *p_res)
+{
+    assert((NULL != p_sender) && (NULL != p_request) && (NULL != p_res));
+
+    *p_res = SUCCESS;
+    list_t *p_list = (list_t *)calloc(1, sizeof(list_t));
+    if (NULL == p_list)
+    {
+        DEBUG_PERROR("calloc");
+        return -EMBER_ERROR;
+    }
+
+    p_list->p_sender = p_sender;
+    p_list->pattern = ('\0' != p_request->pattern[0]) ? p_request->pattern : NULL;
+    p_list->max_depth = (0 != p_request->max_depth) ? MIN(p_request->max_depth, LIST_MAX_DEPTH) : LIST_MAX_DEPTH;
+    p_list->limit = p_request->limit;
+    p_list->p_pool = pool_create(0);
+
+    int err = send_root(p_list, p_request->path);
+    pool_destroy(p_list->p_pool);
+
+    if (EMBER_SUCCESS == err)
+    {
+        err = flush_frame(p_list);
+    }
+
+    if (EMBER_SUCCESS == err)
+    {
+        err = final_response(p_list, pp_buf, p_len);
+    }
+
+    utils_free(p_list);
+    return err;
+}
+
+/*** END OF FILE ***/
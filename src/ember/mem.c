@@ -0,0 +1,103 @@
+/**
+ * @file mem.c
+ * @author Kevin McKenzie
+ * @brief Memory budget shared by the implant's large buffers, see mem.h.
+ */
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "mem.h"
+#include "utils.h"
+
+/** Put in front of every buffer so mem_free() knows how much to give back, aligned like malloc()'s memory. */
+typedef union
+{
+    size_t len;
+    max_align_t align;
+} mem_hdr_t;
+
+// size_t, not uint64_t: the counters are atomics and 32-bit targets have no lock-free 64-bit ones
+static size_t g_budget = 0; /**< 0 for no limit */
+static size_t g_reserved = 0;
+
+void mem_set_budget(uint64_t budget)
+{
+    __atomic_store_n(&g_budget, (size_t)MIN(budget, (uint64_t)SIZE_MAX), __ATOMIC_RELAXED);
+}
+
+/**
+ * @param kept_len Of the end of the budget, which this reservation may not use
+ */
+static bool reserve(size_t len, size_t kept_len)
+{
+    size_t budget = __atomic_load_n(&g_budget, __ATOMIC_RELAXED);
+    size_t limit = (budget > kept_len) ? (budget - kept_len) : 0;
+    size_t reserved = __atomic_load_n(&g_reserved, __ATOMIC_RELAXED);
+
+    do
+    {
+        if ((0 != budget) && ((len > limit) || (reserved > (limit - len))))
+        {
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(&g_reserved, &reserved, reserved + len, true, __ATOMIC_RELAXED,
+                                          __ATOMIC_RELAXED));
+
+    return true;
+}
+
+bool mem_reserve(size_t len)
+{
+    return reserve(len, MEM_FIXED_LEN);
+}
+
+void mem_release(size_t len)
+{
+    (void)__atomic_fetch_sub(&g_reserved, len, __ATOMIC_RELAXED);
+}
+
+static void *alloc(size_t len, size_t kept_len)
+{
+    if ((len > (SIZE_MAX - sizeof(mem_hdr_t))) || !reserve(len, kept_len))
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    mem_hdr_t *p_hdr = (mem_hdr_t *)malloc(sizeof(mem_hdr_t) + len);
+    if (NULL == p_hdr)
+    {
+        mem_release(len);
+        return NULL;
+    }
+
+    p_hdr->len = len;
+    return p_hdr + 1;
+}
+
+void *mem_alloc(size_t len)
+{
+    return alloc(len, MEM_FIXED_LEN);
+}
+
+void *mem_alloc_fixed(size_t len)
+{
+    return alloc(len, 0);
+}
+
+void mem_free_ptr(void *ptr)
+{
+    if (NULL == ptr)
+    {
+        return;
+    }
+
+    mem_hdr_t *p_hdr = (mem_hdr_t *)ptr - 1;
+    mem_release(p_hdr->len);
+    free(p_hdr);
+}
+
+/*** END OF FILE ***/
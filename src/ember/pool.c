@@ -0,0 +1,190 @@
+/**
+ * @file pool.c
+ * @author Kevin McKenzie
+ * @brief Small worker pool running one parallel loop at a time, see pool.h.
+ */
+#define _GNU_SOURCE // NOLINT sysconf(_SC_NPROCESSORS_ONLN)
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "pool.h"
+#include "utils.h"
+
+enum
+{
+    POOL_STACK_LEN = 256 * 1024, /**< The loops are shallow, and musl's default of 128 KiB is not assumed */
+};
+
+struct pool
+{
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond; /**< Signalled when a loop starts or the pool stops */
+    pthread_cond_t done_cond; /**< Signalled when the last thread leaves a loop */
+    pthread_t workers[POOL_MAX_THREADS - 1];
+    size_t num_workers;
+    uint64_t generation; /**< Bumped per loop, a worker joins each one once */
+    size_t active;       /**< Threads inside the current loop */
+    bool b_stopping;
+
+    pool_func_t func;
+    void *p_data;
+    size_t count;
+    size_t next; /**< Next unclaimed index */
+};
+
+static void run_loop(pool_t *p_pool)
+{
+    // The loop's fields only change while no thread is inside it, only the claims race
+    for (size_t idx = __atomic_fetch_add(&p_pool->next, 1, __ATOMIC_RELAXED); idx < p_pool->count;
+         idx = __atomic_fetch_add(&p_pool->next, 1, __ATOMIC_RELAXED))
+    {
+        p_pool->func(p_pool->p_data, idx);
+    }
+}
+
+static void leave_loop(pool_t *p_pool)
+{
+    p_pool->active--;
+    if (0 == p_pool->active)
+    {
+        (void)pthread_cond_broadcast(&p_pool->done_cond);
+    }
+}
+
+static void wait_idle(pool_t *p_pool)
+{
+    while (0 < p_pool->active)
+    {
+        (void)pthread_cond_wait(&p_pool->done_cond, &p_pool->lock);
+    }
+}
+
+static void *worker_main(void *p_arg)
+{
+    pool_t *p_pool = (pool_t *)p_arg;
+    uint64_t joined = 0;
+
+    (void)pthread_mutex_lock(&p_pool->lock);
+    while (!p_pool->b_stopping)
+    {
+        if (joined == p_pool->generation)
+        {
+            (void)pthread_cond_wait(&p_pool->work_cond, &p_pool->lock);
+            continue;
+        }
+
+        // A worker that wakes after the loop is done joins it anyway, it finds nothing left to claim
+        joined = p_pool->generation;
+        p_pool->active++;
+        (void)pthread_mutex_unlock(&p_pool->lock);
+        run_loop(p_pool);
+        (void)pthread_mutex_lock(&p_pool->lock);
+        leave_loop(p_pool);
+    }
+    (void)pthread_mutex_unlock(&p_pool->lock);
+
+    return NULL;
+}
+
+static void start_workers(pool_t *p_pool, size_t num_threads)
+{
+    pthread_attr_t attr;
+    sigset_t all_signals;
+    sigset_t old_mask;
+
+    // Workers inherit the creating thread's signal mask
+    (void)sigfillset(&all_signals);
+    (void)pthread_sigmask(SIG_SETMASK, &all_signals, &old_mask);
+    (void)pthread_attr_init(&attr);
+    (void)pthread_attr_setstacksize(&attr, POOL_STACK_LEN);
+
+    while ((p_pool->num_workers + 1) < num_threads)
+    {
+        if (0 != pthread_create(&p_pool->workers[p_pool->num_workers], &attr, worker_main, p_pool))
+        {
+            DEBUG_MSG("pthread_create failed");
+            break;
+        }
+        p_pool->num_workers++;
+    }
+
+    (void)pthread_attr_destroy(&attr);
+    (void)pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+}
+
+pool_t *pool_create(size_t max_threads)
+{
+    pool_t *p_pool = (pool_t *)calloc(1, sizeof(pool_t));
+    if (NULL == p_pool)
+    {
+        DEBUG_PERROR("calloc");
+        return NULL;
+    }
+
+    (void)pthread_mutex_init(&p_pool->lock, NULL);
+    (void)pthread_cond_init(&p_pool->work_cond, NULL);
+    (void)pthread_cond_init(&p_pool->done_cond, NULL);
+
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t num_threads = (0 < num_cpus) ? MIN((size_t)num_cpus, (size_t)POOL_MAX_THREADS) : 1;
+    start_workers(p_pool, (0 != max_threads) ? MIN(num_threads, max_threads) : num_threads);
+
+    return p_pool;
+}
+
+void pool_for_each(pool_t *p_pool, pool_func_t func, void *p_data, size_t count)
+{
+    (void)pthread_mutex_lock(&p_pool->lock);
+    wait_idle(p_pool); // A late worker may still be inside the previous loop
+    p_pool->func = func;
+    p_pool->p_data = p_data;
+    p_pool->count = count;
+    p_pool->next = 0;
+    p_pool->generation++;
+    p_pool->active++;
+    (void)pthread_cond_broadcast(&p_pool->work_cond);
+    (void)pthread_mutex_unlock(&p_pool->lock);
+
+    run_loop(p_pool);
+
+    (void)pthread_mutex_lock(&p_pool->lock);
+    leave_loop(p_pool);
+    wait_idle(p_pool);
+    (void)pthread_mutex_unlock(&p_pool->lock);
+}
+
+size_t pool_num_threads(const pool_t *p_pool)
+{
+    return p_pool->num_workers + 1;
+}
+
+void pool_destroy(pool_t *p_pool)
+{
+    if (NULL == p_pool)
+    {
+        return;
+    }
+
+    (void)pthread_mutex_lock(&p_pool->lock);
+    p_pool->b_stopping = true;
+    (void)pthread_cond_broadcast(&p_pool->work_cond);
+    (void)pthread_mutex_unlock(&p_pool->lock);
+
+    for (size_t idx = 0; idx < p_pool->num_workers; idx++)
+    {
+        (void)pthread_join(p_pool->workers[idx], NULL);
+    }
+
+    (void)pthread_cond_destroy(&p_pool->done_cond);
+    (void)pthread_cond_destroy(&p_pool->work_cond);
+    (void)pthread_mutex_destroy(&p_pool->lock);
+    utils_free(p_pool);
+}
+
+/*** END OF FILE ***/
@@ -0,0 +1,112 @@
+/**
+ * @file ratelimit.c
+ * @author Kevin McKenzie
+ * @brief Token bucket pacing of transfers, see ratelimit.h.
+ */
+#define _POSIX_C_SOURCE 200809L // NOLINT
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "ratelimit.h"
+#include "utils.h"
+
+enum
+{
+    NSEC_PER_SEC = 1000000000,
+    MSEC_PER_SEC = 1000,
+    CATCH_UP_MSEC = 10,
+};
+
+static int ratelimit_io_callback(void *p_data, uint8_t *buf, ssize_t len);
+
+static uint64_t now_ns(void)
+{
+    struct timespec now = {0};
+    (void)clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * NSEC_PER_SEC) + (uint64_t)now.tv_nsec;
+}
+
+static void refill(ratelimit_t *p_bucket, uint64_t now, uint64_t capacity)
+{
+    uint64_t elapsed = now - p_bucket->last_ns;
+    p_bucket->last_ns = now;
+
+    // Split so neither product can overflow with rate <= RATELIMIT_MAX_RATE
+    uint64_t earned = ((elapsed / NSEC_PER_SEC) * p_bucket->config.rate) +
+                      (((elapsed % NSEC_PER_SEC) * p_bucket->config.rate) / NSEC_PER_SEC);
+
+    uint64_t room = (uint64_t)((int64_t)capacity - p_bucket->tokens);
+    p_bucket->tokens += (int64_t)MIN(earned, room);
+}
+
+void ratelimit_init(ratelimit_t *p_bucket, const ratelimit_config_t *p_config)
+{
+    p_bucket->config.rate = MIN(p_config->rate, RATELIMIT_MAX_RATE);
+    p_bucket->config.burst = MIN(p_config->burst, RATELIMIT_MAX_BURST);
+    p_bucket->tokens = (int64_t)p_bucket->config.burst;
+    p_bucket->last_ns = now_ns();
+}
+
+void ratelimit_configure(ratelimit_t *p_bucket, const ratelimit_config_t *p_config)
+{
+    refill(p_bucket, now_ns(), p_bucket->config.burst);
+    p_bucket->config.rate = MIN(p_config->rate, RATELIMIT_MAX_RATE);
+    p_bucket->config.burst = MIN(p_config->burst, RATELIMIT_MAX_BURST);
+    p_bucket->tokens = MIN(p_bucket->tokens, (int64_t)p_bucket->config.burst);
+}
+
+void ratelimit_take(ratelimit_t *p_bucket, uint64_t bytes)
+{
+    if (0 == p_bucket->config.rate)
+    {
+        return;
+    }
+
+    // Beyond the burst the bucket may hold one take, or CATCH_UP_MSEC worth of the rate when that is more. Otherwise
+    // time spent in the IO between takes, or stalled on a full socket, would never be earned back and a small burst
+    // would pace well under the rate. At 1 GB/s a 64 KiB take lasts 65us, shorter than a scheduling hiccup.
+    uint64_t catch_up = MAX(MIN(bytes, RATELIMIT_MAX_BURST), (p_bucket->config.rate / MSEC_PER_SEC) * CATCH_UP_MSEC);
+    refill(p_bucket, now_ns(), MAX(p_bucket->config.burst, catch_up));
+    p_bucket->tokens -= (int64_t)bytes;
+
+    if (0 > p_bucket->tokens)
+    {
+        // Sleep until the refill covers the debt. The time slept is earned back by the next refill.
+        uint64_t debt = (uint64_t)(-p_bucket->tokens);
+        uint64_t rate = p_bucket->config.rate;
+        uint64_t wake_ns =
+            p_bucket->last_ns + ((debt / rate) * NSEC_PER_SEC) + (((debt % rate) * NSEC_PER_SEC) / rate);
+
+        struct timespec wake_time = {.tv_sec = (time_t)(wake_ns / NSEC_PER_SEC),
+                                     .tv_nsec = (long)(wake_ns % NSEC_PER_SEC)};
+        while (EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake_time, NULL))
+        {
+        }
+    }
+}
+
+io_callback_t ratelimit_io_wrap(ratelimit_io_t *p_io, const io_callback_t *p_inner, ratelimit_t *p_global,
+                                const ratelimit_config_t *p_task_config)
+{
+    p_io->inner = *p_inner;
+    p_io->p_global = p_global;
+    ratelimit_init(&p_io->task, p_task_config);
+
+    io_callback_t wrapped = {.func = ratelimit_io_callback, .data = p_io};
+    return wrapped;
+}
+
+static int ratelimit_io_callback(void *p_data, uint8_t *buf, ssize_t len)
+{
+    ratelimit_io_t *p_io = (ratelimit_io_t *)p_data;
+
+    ratelimit_take(p_io->p_global, (uint64_t)len);
+    ratelimit_take(&p_io->task, (uint64_t)len);
+
+    return p_io->inner.func(p_io->inner.data, buf, len);
+}
+
+/*** END OF FILE ***/
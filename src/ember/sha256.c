@@ -0,0 +1,346 @@
+/**
+ * @file sha256.c
+ * @author Kevin McKenzie
+ * @brief SHA-256 (FIPS 180-4) with hardware acceleration where available.
+ */
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define SHA256_HAVE_HW 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#define SHA256_HAVE_HW 1
+#ifndef HWCAP_SHA2
+#define HWCAP_SHA2 (1 << 6)
+#endif
+#endif
+
+#include "sha256.h"
+
+enum
+{
+    NUM_ROUNDS = 64,
+    SCHEDULE_WORDS = 16, /**< Message words per block */
+    LEN_FIELD_LEN = 8,   /**< Bit length at the end of the padding */
+    BYTE_BITS = 8,
+};
+
+typedef void (*sha256_blocks_func_t)(uint32_t state[8], const uint8_t *buf, size_t num_blocks);
+
+static const uint32_t K[NUM_ROUNDS] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const uint32_t INITIAL_STATE[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+static sha256_blocks_func_t g_sha256_blocks_func = NULL;
+
+static inline uint32_t rotr(uint32_t word, unsigned int bits)
+{
+    return (word >> bits) | (word << (32 - bits)); // NOLINT
+}
+
+static inline uint32_t load_be32(const uint8_t *buf)
+{
+    // Assembled byte by byte so the result is the same on big endian targets (mips)
+    return ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) | ((uint32_t)buf[2] << 8) | (uint32_t)buf[3]; // NOLINT
+}
+
+static void sha256_blocks_sw(uint32_t state[8], const uint8_t *buf, size_t num_blocks)
+{
+    uint32_t w[NUM_ROUNDS];
+
+    for (; 0 < num_blocks; num_blocks--, buf += SHA256_BLOCK_LEN)
+    {
+        for (size_t idx = 0; idx < SCHEDULE_WORDS; idx++)
+        {
+            w[idx] = load_be32(buf + (idx * sizeof(uint32_t)));
+        }
+        for (size_t idx = SCHEDULE_WORDS; idx < NUM_ROUNDS; idx++)
+        {
+            uint32_t s0 = rotr(w[idx - 15], 7) ^ rotr(w[idx - 15], 18) ^ (w[idx - 15] >> 3);  // NOLINT
+            uint32_t s1 = rotr(w[idx - 2], 17) ^ rotr(w[idx - 2], 19) ^ (w[idx - 2] >> 10); // NOLINT
+            w[idx] = w[idx - 16] + s0 + w[idx - 7] + s1;                                    // NOLINT
+        }
+
+        uint32_t a = state[0];
+        uint32_t b = state[1];
+        uint32_t c = state[2];
+        uint32_t d = state[3];
+        uint32_t e = state[4];
+        uint32_t f = state[5];
+        uint32_t g = state[6];
+        uint32_t h = state[7];
+        for (size_t idx = 0; idx < NUM_ROUNDS; idx++)
+        {
+            uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[idx] + w[idx]; // NOLINT
+            uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));           // NOLINT
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SHA256_TARGET __attribute__((target("sha,sse4.1,ssse3")))
+
+/** Four rounds on the state kept as ABEF and CDGH, the layout sha256rnds2 works on. */
+SHA256_TARGET static inline __attribute__((always_inline)) void rounds4(__m128i *p_abef, __m128i *p_cdgh, __m128i w,
+                                                                         size_t step)
+{
+    __m128i msg = _mm_add_epi32(w, _mm_loadu_si128((const __m128i *)&K[step * 4]));
+    *p_cdgh = _mm_sha256rnds2_epu32(*p_cdgh, *p_abef, msg);
+    *p_abef = _mm_sha256rnds2_epu32(*p_abef, *p_cdgh, _mm_shuffle_epi32(msg, 0x0E)); // NOLINT
+}
+
+/** The next four message words from the last sixteen, oldest first. */
+SHA256_TARGET static inline __attribute__((always_inline)) __m128i schedule4(__m128i w0, __m128i w1, __m128i w2,
+                                                                             __m128i w3)
+{
+    __m128i next = _mm_add_epi32(_mm_sha256msg1_epu32(w0, w1), _mm_alignr_epi8(w3, w2, 4)); // NOLINT
+    return _mm_sha256msg2_epu32(next, w3);
+}
+
+SHA256_TARGET static void sha256_blocks_hw(uint32_t state[8], const uint8_t *buf, size_t num_blocks)
+{
+    const __m128i byte_swap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL); // NOLINT
+
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xB1);   // NOLINT CDAB
+    __m128i cdgh = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1B);  // NOLINT EFGH
+    __m128i abef = _mm_alignr_epi8(tmp, cdgh, 8);                                         // NOLINT
+    cdgh = _mm_blend_epi16(cdgh, tmp, 0xF0);                                              // NOLINT
+
+    for (; 0 < num_blocks; num_blocks--, buf += SHA256_BLOCK_LEN)
+    {
+        __m128i abef_save = abef;
+        __m128i cdgh_save = cdgh;
+
+        __m128i w0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)buf), byte_swap);
+        __m128i w1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(buf + 16)), byte_swap); // NOLINT
+        __m128i w2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(buf + 32)), byte_swap); // NOLINT
+        __m128i w3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(buf + 48)), byte_swap); // NOLINT
+        rounds4(&abef, &cdgh, w0, 0);
+        rounds4(&abef, &cdgh, w1, 1);
+        rounds4(&abef, &cdgh, w2, 2);
+        rounds4(&abef, &cdgh, w3, 3);
+
+        for (size_t step = 4; step < (NUM_ROUNDS / 4); step += 4)
+        {
+            w0 = schedule4(w0, w1, w2, w3);
+            rounds4(&abef, &cdgh, w0, step);
+            w1 = schedule4(w1, w2, w3, w0);
+            rounds4(&abef, &cdgh, w1, step + 1);
+            w2 = schedule4(w2, w3, w0, w1);
+            rounds4(&abef, &cdgh, w2, step + 2);
+            w3 = schedule4(w3, w0, w1, w2);
+            rounds4(&abef, &cdgh, w3, step + 3);
+        }
+
+        abef = _mm_add_epi32(abef, abef_save);
+        cdgh = _mm_add_epi32(cdgh, cdgh_save);
+    }
+
+    tmp = _mm_shuffle_epi32(abef, 0x1B);                                         // NOLINT FEBA
+    cdgh = _mm_shuffle_epi32(cdgh, 0xB1);                                        // NOLINT DCHG
+    _mm_storeu_si128((__m128i *)&state[0], _mm_blend_epi16(tmp, cdgh, 0xF0));    // NOLINT DCBA
+    _mm_storeu_si128((__m128i *)&state[4], _mm_alignr_epi8(cdgh, tmp, 8));       // NOLINT HGFE
+}
+
+static int sha256_hw_supported(void)
+{
+    unsigned int eax = 0;
+    unsigned int ebx = 0;
+    unsigned int ecx = 0;
+    unsigned int edx = 0;
+
+    // Every CPU with the SHA extensions has SSE4.1, it is checked anyway for emulators that mix and match
+    if ((0 == __get_cpuid(1, &eax, &ebx, &ecx, &edx)) || (0 == (ecx & bit_SSE4_1)) || (0 == (ecx & bit_SSSE3)))
+    {
+        return 0;
+    }
+
+    return __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (0 != (ebx & bit_SHA)); // NOLINT
+}
+#elif defined(__aarch64__)
+#define SHA256_TARGET __attribute__((target("+sha2")))
+
+/** Four rounds on the state kept as ABCD and EFGH. */
+SHA256_TARGET static inline __attribute__((always_inline)) void rounds4(uint32x4_t *p_abcd, uint32x4_t *p_efgh,
+                                                                         uint32x4_t w, size_t step)
+{
+    uint32x4_t msg = vaddq_u32(w, vld1q_u32(&K[step * 4]));
+    uint32x4_t abcd = *p_abcd;
+    *p_abcd = vsha256hq_u32(abcd, *p_efgh, msg);
+    *p_efgh = vsha256h2q_u32(*p_efgh, abcd, msg);
+}
+
+/** The next four message words from the last sixteen, oldest first. */
+SHA256_TARGET static inline __attribute__((always_inline)) uint32x4_t schedule4(uint32x4_t w0, uint32x4_t w1,
+                                                                                uint32x4_t w2, uint32x4_t w3)
+{
+    return vsha256su1q_u32(vsha256su0q_u32(w0, w1), w2, w3);
+}
+
+SHA256_TARGET static void sha256_blocks_hw(uint32_t state[8], const uint8_t *buf, size_t num_blocks)
+{
+    uint32x4_t abcd = vld1q_u32(&state[0]);
+    uint32x4_t efgh = vld1q_u32(&state[4]);
+
+    for (; 0 < num_blocks; num_blocks--, buf += SHA256_BLOCK_LEN)
+    {
+        uint32x4_t abcd_save = abcd;
+        uint32x4_t efgh_save = efgh;
+
+        uint32x4_t w0 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(buf)));
+        uint32x4_t w1 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(buf + 16))); // NOLINT
+        uint32x4_t w2 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(buf + 32))); // NOLINT
+        uint32x4_t w3 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(buf + 48))); // NOLINT
+        rounds4(&abcd, &efgh, w0, 0);
+        rounds4(&abcd, &efgh, w1, 1);
+        rounds4(&abcd, &efgh, w2, 2);
+        rounds4(&abcd, &efgh, w3, 3);
+
+        for (size_t step = 4; step < (NUM_ROUNDS / 4); step += 4)
+        {
+            w0 = schedule4(w0, w1, w2, w3);
+            rounds4(&abcd, &efgh, w0, step);
+            w1 = schedule4(w1, w2, w3, w0);
+            rounds4(&abcd, &efgh, w1, step + 1);
+            w2 = schedule4(w2, w3, w0, w1);
+            rounds4(&abcd, &efgh, w2, step + 2);
+            w3 = schedule4(w3, w0, w1, w2);
+            rounds4(&abcd, &efgh, w3, step + 3);
+        }
+
+        abcd = vaddq_u32(abcd, abcd_save);
+        efgh = vaddq_u32(efgh, efgh_save);
+    }
+
+    vst1q_u32(&state[0], abcd);
+    vst1q_u32(&state[4], efgh);
+}
+
+static int sha256_hw_supported(void)
+{
+    return 0 != (getauxval(AT_HWCAP) & HWCAP_SHA2);
+}
+#endif
+
+void sha256_init(void)
+{
+    g_sha256_blocks_func = sha256_blocks_sw;
+
+#ifdef SHA256_HAVE_HW
+    if (sha256_hw_supported())
+    {
+        g_sha256_blocks_func = sha256_blocks_hw;
+    }
+#endif
+}
+
+void sha256_begin(sha256_t *p_ctx)
+{
+    assert(NULL != p_ctx);
+
+    memcpy(p_ctx->state, INITIAL_STATE, sizeof(INITIAL_STATE));
+    p_ctx->total_len = 0;
+    p_ctx->block_len = 0;
+}
+
+void sha256_update(sha256_t *p_ctx, const uint8_t *buf, size_t len)
+{
+    assert((NULL != g_sha256_blocks_func) && (NULL != p_ctx) && ((NULL != buf) || (0 == len)));
+
+    p_ctx->total_len += len;
+
+    if (0 < p_ctx->block_len)
+    {
+        size_t fill_len = SHA256_BLOCK_LEN - p_ctx->block_len;
+        fill_len = (len < fill_len) ? len : fill_len;
+        memcpy(p_ctx->block + p_ctx->block_len, buf, fill_len);
+        p_ctx->block_len += fill_len;
+        buf += fill_len;
+        len -= fill_len;
+
+        if (SHA256_BLOCK_LEN > p_ctx->block_len)
+        {
+            return;
+        }
+        g_sha256_blocks_func(p_ctx->state, p_ctx->block, 1);
+        p_ctx->block_len = 0;
+    }
+
+    size_t num_blocks = len / SHA256_BLOCK_LEN;
+    if (0 < num_blocks)
+    {
+        g_sha256_blocks_func(p_ctx->state, buf, num_blocks);
+        buf += num_blocks * SHA256_BLOCK_LEN;
+        len -= num_blocks * SHA256_BLOCK_LEN;
+    }
+
+    memcpy(p_ctx->block, buf, len);
+    p_ctx->block_len = len;
+}
+
+void sha256_final(sha256_t *p_ctx, uint8_t digest[SHA256_DIGEST_LEN])
+{
+    assert((NULL != g_sha256_blocks_func) && (NULL != p_ctx) && (NULL != digest));
+
+    uint64_t total_bits = p_ctx->total_len * BYTE_BITS;
+
+    // 0x80, then zeros up to the length field, in a second block when the first has no room left for it
+    p_ctx->block[p_ctx->block_len++] = 0x80; // NOLINT
+    if ((SHA256_BLOCK_LEN - LEN_FIELD_LEN) < p_ctx->block_len)
+    {
+        memset(p_ctx->block + p_ctx->block_len, 0, SHA256_BLOCK_LEN - p_ctx->block_len);
+        g_sha256_blocks_func(p_ctx->state, p_ctx->block, 1);
+        p_ctx->block_len = 0;
+    }
+    memset(p_ctx->block + p_ctx->block_len, 0, SHA256_BLOCK_LEN - LEN_FIELD_LEN - p_ctx->block_len);
+
+    for (size_t idx = 0; idx < LEN_FIELD_LEN; idx++)
+    {
+        p_ctx->block[SHA256_BLOCK_LEN - 1 - idx] = (uint8_t)(total_bits >> (idx * BYTE_BITS));
+    }
+    g_sha256_blocks_func(p_ctx->state, p_ctx->block, 1);
+
+    for (size_t idx = 0; idx < 8; idx++) // NOLINT
+    {
+        digest[(idx * 4) + 0] = (uint8_t)(p_ctx->state[idx] >> 24); // NOLINT
+        digest[(idx * 4) + 1] = (uint8_t)(p_ctx->state[idx] >> 16); // NOLINT
+        digest[(idx * 4) + 2] = (uint8_t)(p_ctx->state[idx] >> 8);  // NOLINT
+        digest[(idx * 4) + 3] = (uint8_t)p_ctx->state[idx];
+    }
+}
+
+/*** END OF FILE ***/
@@ -0,0 +1,97 @@
+/**
+ * @file sockopt.c
+ * @author Kevin McKenzie
+ * @brief TCP options for the callback socket, see sockopt.h.
+ */
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "sockopt.h"
+#include "task.h"
+#include "utils.h"
+
+#if SOCKET_TUNING
+
+static void set_int_option(int sock, int level, int option, int value)
+{
+    if (-1 == setsockopt(sock, level, option, &value, sizeof(int)))
+    {
+        DEBUG_PERROR("setsockopt");
+    }
+}
+
+static void grow_buffer(int sock, int option, uint64_t len)
+{
+    int wanted = (int)MIN(len, (uint64_t)SOCKOPT_BULK_BUF_LEN);
+    int current = 0;
+    socklen_t option_len = sizeof(int);
+
+    // Setting a size turns off the kernel's autotuning for that buffer, only do it when it is a step up
+    if ((0 == getsockopt(sock, SOL_SOCKET, option, &current, &option_len)) && (current < wanted))
+    {
+        set_int_option(sock, SOL_SOCKET, option, wanted);
+    }
+}
+
+void sockopt_before_connect(int sock)
+{
+#ifdef TCP_FASTOPEN_CONNECT
+    set_int_option(sock, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, 1);
+#else
+    (void)sock;
+#endif
+}
+
+void sockopt_after_connect(int sock)
+{
+    set_int_option(sock, IPPROTO_TCP, TCP_NODELAY, 1);
+}
+
+void sockopt_cork(int sock, bool b_cork)
+{
+    set_int_option(sock, IPPROTO_TCP, TCP_CORK, b_cork ? 1 : 0);
+}
+
+void sockopt_size_buffers(int sock, uint8_t op_code, uint64_t len)
+{
+    if (DOWNLOAD == op_code)
+    {
+        grow_buffer(sock, SO_SNDBUF, len);
+    }
+    else if (UPLOAD == op_code)
+    {
+        grow_buffer(sock, SO_RCVBUF, len);
+    }
+}
+
+#else
+
+void sockopt_before_connect(int sock)
+{
+    (void)sock;
+}
+
+void sockopt_after_connect(int sock)
+{
+    (void)sock;
+}
+
+void sockopt_cork(int sock, bool b_cork)
+{
+    (void)sock;
+    (void)b_cork;
+}
+
+void sockopt_size_buffers(int sock, uint8_t op_code, uint64_t len)
+{
+    (void)sock;
+    (void)op_code;
+    (void)len;
+}
+
+#endif /* SOCKET_TUNING */
+
+/*** END OF FILE ***/
@@ -0,0 +1,259 @@
+/**
+ * @file stats.c
+ * @author Kevin McKenzie
+ * @brief Always-on per-task telemetry and its STATS op serialization.
+ */
+#define _POSIX_C_SOURCE 200809L // NOLINT
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "errors.h"
+#include "mem.h"
+#include "stats.h"
+#include "utils.h"
+
+enum
+{
+    NSEC_PER_USEC = 1000,
+    NSEC_PER_SEC = 1000000000,
+    OP_HDR_LEN = sizeof(uint8_t) + sizeof(uint32_t) + (3 * sizeof(uint64_t)),
+    PHASE_HDR_LEN = sizeof(uint64_t) + sizeof(uint8_t),
+    BUCKET_LEN = sizeof(uint8_t) + sizeof(uint32_t),
+    PHASE_STATS_LEN = PHASE_HDR_LEN + (STATS_NUM_BUCKETS * BUCKET_LEN),
+    MAX_STATS_LEN = sizeof(uint8_t) + (STATS_MAX_OPS * (OP_HDR_LEN + (NUM_PHASES * PHASE_STATS_LEN))),
+};
+
+typedef struct
+{
+    uint32_t count;
+    uint64_t syscalls;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t total_us[NUM_PHASES];
+    uint32_t buckets[NUM_PHASES][STATS_NUM_BUCKETS];
+} op_stats_t;
+
+typedef struct
+{
+    uint64_t syscalls;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+} io_stats_t;
+
+static op_stats_t g_op_stats[STATS_MAX_OPS] = {0};
+static io_stats_t g_io_stats = {0};
+static uint32_t g_session_tasks = 0; /**< Tasks begun in the current session, picks the ones that are timed */
+
+static uint64_t now_ns(void)
+{
+    struct timespec now = {0};
+    (void)clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * NSEC_PER_SEC) + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * @brief Values below 2us get their own bucket, above that every power of two is split into two halves. 64 buckets
+ * cover up to 2^32us (~71 minutes) with at most ~40% relative error.
+ */
+static uint8_t bucket_index(uint64_t usec)
+{
+    uint64_t idx = usec;
+
+    if (2 <= usec)
+    {
+        uint64_t msb = 63 - (uint64_t)__builtin_clzll(usec); // NOLINT
+        idx = (msb << 1) | ((usec >> (msb - 1)) & 1);
+    }
+
+    return (uint8_t)MIN(idx, (uint64_t)STATS_NUM_BUCKETS - 1);
+}
+
+void stats_session_begin(void)
+{
+    g_session_tasks = 0;
+}
+
+void stats_task_begin(stats_task_t *p_stats)
+{
+    assert(NULL != p_stats);
+    if (!TASK_STATS)
+    {
+        return;
+    }
+
+    p_stats->b_timed = (STATS_TIMED_FIRST > g_session_tasks) || (0 == (g_session_tasks % STATS_SAMPLE_PERIOD));
+    g_session_tasks++;
+    if (p_stats->b_timed)
+    {
+        memset(p_stats->phase_us, 0, sizeof(p_stats->phase_us));
+        p_stats->mark_ns = now_ns();
+    }
+    p_stats->syscalls = g_io_stats.syscalls;
+    p_stats->bytes_in = g_io_stats.bytes_in;
+    p_stats->bytes_out = g_io_stats.bytes_out;
+}
+
+void stats_phase_end(stats_task_t *p_stats, uint8_t phase)
+{
+    assert((NULL != p_stats) && (NUM_PHASES > phase));
+    if (!TASK_STATS || !p_stats->b_timed)
+    {
+        return;
+    }
+
+    uint64_t now = now_ns();
+    p_stats->phase_us[phase] += (now - p_stats->mark_ns) / NSEC_PER_USEC;
+    p_stats->mark_ns = now;
+}
+
+void stats_task_end(const stats_task_t *p_stats, uint8_t op_code)
+{
+    assert(NULL != p_stats);
+
+    if (TASK_STATS && (STATS_MAX_OPS > op_code))
+    {
+        op_stats_t *p_op = &g_op_stats[op_code];
+
+        p_op->count++;
+        p_op->syscalls += g_io_stats.syscalls - p_stats->syscalls;
+        p_op->bytes_in += g_io_stats.bytes_in - p_stats->bytes_in;
+        p_op->bytes_out += g_io_stats.bytes_out - p_stats->bytes_out;
+
+        for (uint8_t phase = 0; p_stats->b_timed && (phase < NUM_PHASES); phase++)
+        {
+            p_op->total_us[phase] += p_stats->phase_us[phase];
+            p_op->buckets[phase][bucket_index(p_stats->phase_us[phase])]++;
+        }
+    }
+}
+
+void stats_count_syscall(ssize_t bytes, bool b_inbound)
+{
+    if (!TASK_STATS)
+    {
+        return;
+    }
+
+    g_io_stats.syscalls++;
+
+    if (0 < bytes)
+    {
+        if (b_inbound)
+        {
+            g_io_stats.bytes_in += (uint64_t)bytes;
+        }
+        else
+        {
+            g_io_stats.bytes_out += (uint64_t)bytes;
+        }
+    }
+}
+
+static size_t put_u8(uint8_t *buf, size_t offset, uint8_t value)
+{
+    buf[offset] = value;
+    return offset + sizeof(uint8_t);
+}
+
+static size_t put_u32(uint8_t *buf, size_t offset, uint32_t value)
+{
+    uint32_t net_value = htonl(value);
+    memcpy(buf + offset, &net_value, sizeof(uint32_t));
+    return offset + sizeof(uint32_t);
+}
+
+static size_t put_u64(uint8_t *buf, size_t offset, uint64_t value)
+{
+    uint64_t net_value = utils_htonll(value);
+    memcpy(buf + offset, &net_value, sizeof(uint64_t));
+    return offset + sizeof(uint64_t);
+}
+
+static size_t serialize_phase(uint8_t *buf, size_t offset, const op_stats_t *p_op, uint8_t phase)
+{
+    offset = put_u64(buf, offset, p_op->total_us[phase]);
+
+    size_t num_buckets_offset = offset;
+    uint8_t num_buckets = 0;
+    offset += sizeof(uint8_t);
+
+    for (uint8_t bucket = 0; bucket < STATS_NUM_BUCKETS; bucket++)
+    {
+        if (0 != p_op->buckets[phase][bucket])
+        {
+            offset = put_u8(buf, offset, bucket);
+            offset = put_u32(buf, offset, p_op->buckets[phase][bucket]);
+            num_buckets++;
+        }
+    }
+
+    (void)put_u8(buf, num_buckets_offset, num_buckets);
+    return offset;
+}
+
+static size_t serialize_op(uint8_t *buf, size_t offset, uint8_t op_code)
+{
+    const op_stats_t *p_op = &g_op_stats[op_code];
+
+    offset = put_u8(buf, offset, op_code);
+    offset = put_u32(buf, offset, p_op->count);
+    offset = put_u64(buf, offset, p_op->bytes_in);
+    offset = put_u64(buf, offset, p_op->bytes_out);
+    offset = put_u64(buf, offset, p_op->syscalls);
+
+    for (uint8_t phase = 0; phase < NUM_PHASES; phase++)
+    {
+        offset = serialize_phase(buf, offset, p_op, phase);
+    }
+
+    return offset;
+}
+
+int stats_serialize(uint8_t **pp_buf, size_t *p_len, uint16_t flags)
+{
+    assert((NULL != pp_buf) && (NULL != p_len));
+
+    int err = EMBER_SUCCESS;
+
+    uint8_t *buf = (uint8_t *)mem_alloc_fixed(MAX_STATS_LEN);
+    if (NULL == buf)
+    {
+        DEBUG_PERROR("mem_alloc_fixed");
+        err = -EMBER_ERROR;
+    }
+
+    if (EMBER_SUCCESS == err)
+    {
+        uint8_t num_ops = 0;
+        size_t offset = sizeof(uint8_t);
+
+        for (uint8_t op_code = 0; op_code < STATS_MAX_OPS; op_code++)
+        {
+            if (0 != g_op_stats[op_code].count)
+            {
+                offset = serialize_op(buf, offset, op_code);
+                num_ops++;
+            }
+        }
+
+        (void)put_u8(buf, 0, num_ops);
+        *pp_buf = buf;
+        *p_len = offset;
+    }
+
+    if ((EMBER_SUCCESS == err) && ((uint16_t)STATS_RESET & flags))
+    {
+        memset(g_op_stats, 0, sizeof(g_op_stats));
+    }
+
+    return err;
+}
+
+/*** END OF FILE ***/
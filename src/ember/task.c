@@ -1,5 +1,8 @@
+#include <arpa/inet.h>
 #include <assert.h>
+#include <errno.h>
 #include <linux/limits.h>
+#include <poll.h>
 #include <settings.h>
 #include <stdbool.h>
 #include <stddef.h>
@@ -9,22 +12,34 @@
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include "archive.h"
 #include "codes.h"
 #include "errors.h"
 #include "exec.h"
 #include "file.h"
 #include "io_callback.h"
+#include "job.h"
+#include "hash.h"
+#include "list.h"
+#include "mem.h"
+#include "ratelimit.h"
 #include "serialization.h"
+#include "sockopt.h"
+#include "stats.h"
 #include "task.h"
+#include "trace.h"
 #include "utils.h"
 
 enum
 {
     MAX_DATA_LEN = 9 * 1024 * 1024, // 9 megabytes
     MAX_ENV_NUM = 128,
-    PAD_BUF_LEN = 255
+    PAD_BUF_LEN = 255,
+    DISCARD_BUF_LEN = 16 * 1024,
+    RESPONSE_HDR_LEN = sizeof(int8_t) + sizeof(uint64_t),
 };
 
 static int send_response_io_callback_wrapper(void *p_data, uint8_t *send_buffer, ssize_t len);
@@ -32,35 +47,108 @@ static int network_recv_all_io_callback_wrapper(void *p_data, uint8_t *recv_buff
 static int network_send_all_io_callback_wrapper(void *p_data, uint8_t *send_buffer, ssize_t len);
 static int receive_task(int sock, task_t *p_task);
 static int handle_exec_do(int sock, task_t *p_task);
-static int handle_file_download(int sock, task_t *p_task);
-static int handle_file_upload(int sock, task_t *p_task);
+static int handle_exec_background(task_t *p_task);
+static int handle_download(int sock, task_t *p_task, settings_t *p_settings);
+static int handle_file_download(int sock, task_t *p_task, settings_t *p_settings);
+static int handle_archive_download(int sock, task_t *p_task, settings_t *p_settings);
+static int handle_file_upload(int sock, task_t *p_task, settings_t *p_settings);
+static int handle_list(int sock, task_t *p_task);
+static int handle_hash(int sock, task_t *p_task);
+static int handle_job_output(int sock, task_t *p_task);
+static int do_extended_task(int sock, task_t *p_task);
 static int do_task(int sock, task_t *p_task, settings_t *p_settings);
 
+/**
+ * @brief Send a response whose data is gathered from iov[1] to iov[iov_len - 1], iov[0] is set to its header. The
+ * data is sent from where it is, a frame is never copied into a buffer of its own.
+ */
+static int send_response_iov(int sock, int8_t op_code, struct iovec *iov, size_t iov_len)
+{
+    int err = EMBER_SUCCESS;
+
+    uint64_t len = 0;
+    for (size_t idx = 1; idx < iov_len; idx++)
+    {
+        len += iov[idx].iov_len;
+    }
+
+    uint8_t hdr[RESPONSE_HDR_LEN] = {0};
+    uint64_t net_len = utils_htonll(len);
+    memcpy(hdr, &op_code, sizeof(int8_t));
+    memcpy(hdr + sizeof(int8_t), &net_len, sizeof(uint64_t));
+    iov[0] = (struct iovec){.iov_base = hdr, .iov_len = RESPONSE_HDR_LEN};
+
+    if ((ssize_t)(RESPONSE_HDR_LEN + len) != utils_sendall_iov(sock, iov, iov_len, MSG_NOSIGNAL))
+    {
+        err = -EMBER_ERROR;
+    }
+
+    TRACE_DEBUG(TRACE_EV_RESPONSE, (uint8_t)op_code, len, err);
+    return err;
+}
+
 static int send_response(int sock, int8_t op_code, void *data, size_t len)
+{
+    struct iovec iov[2] = {{0}, {.iov_base = data, .iov_len = len}};
+    return send_response_iov(sock, op_code, iov, ARRAY_LEN(iov));
+}
+
+static int send_final_response(int sock, task_t *p_task)
 {
     int err = EMBER_SUCCESS;
 
-    size_t send_len = sizeof(int8_t) + sizeof(uint64_t) + len;
-    uint8_t *send_buf = (uint8_t *)malloc(send_len);
+    // Completed transfers carry the CRC32C of the file contents so the C2 can verify them without re-reading.
+    if (((DOWNLOAD == p_task->hdr.op_code) || (UPLOAD == p_task->hdr.op_code)) && (SUCCESS == p_task->response_code))
+    {
+        uint32_t net_digest = htonl(p_task->file.digest);
+        err = send_response(sock, p_task->response_code, &net_digest, sizeof(uint32_t));
+    }
+    else if (NULL != p_task->response_data)
+    {
+        err = send_response(sock, p_task->response_code, p_task->response_data, p_task->response_len);
+    }
+    else
+    {
+        err = send_response(sock, p_task->response_code, NULL, 0);
+    }
 
-    uint64_t net_len = len;
-    net_len = utils_htonll(net_len);
+    return err;
+}
 
-    size_t bytes_copied = 0;
-    memcpy(send_buf, &op_code, sizeof(uint8_t));
-    bytes_copied += sizeof(uint8_t);
+static int execute_and_respond(int sock, task_t *p_task, settings_t *p_settings)
+{
+    // The payload did not fit the memory budget, the task is answered without running it
+    if (-NO_MEMORY == p_task->response_code)
+    {
+        return send_final_response(sock, p_task);
+    }
 
-    memcpy(send_buf + bytes_copied, &net_len, sizeof(uint64_t));
-    bytes_copied += sizeof(uint64_t);
+    // The frames around DOWNLOAD contents are small, corked they share segments with the contents
+    bool b_cork = (DOWNLOAD == p_task->hdr.op_code);
+    if (b_cork)
+    {
+        sockopt_cork(sock, true);
+    }
 
-    memcpy(send_buf + bytes_copied, data, len);
+    int err = do_task(sock, p_task, p_settings);
+    stats_phase_end(&p_task->stats, PHASE_EXECUTE);
 
-    if ((ssize_t)send_len != utils_sendall(sock, send_buf, send_len, MSG_NOSIGNAL))
+    if ((EMBER_SUCCESS == err) && !p_task->b_responded)
     {
-        err = -EMBER_ERROR;
+        err = send_final_response(sock, p_task);
+        stats_phase_end(&p_task->stats, PHASE_SEND);
+    }
+
+    if ((EMBER_SUCCESS == err) && p_task->b_cancel_received)
+    {
+        err = send_response(sock, SUCCESS, NULL, 0);
+    }
+
+    if (b_cork)
+    {
+        sockopt_cork(sock, false);
     }
 
-    DEBUG_PRINT("exit %d", err);
     return err;
 }
 
@@ -72,29 +160,38 @@ int task_receive_and_execute(int sock, settings_t *p_settings)
     }
 
     int err = EMBER_SUCCESS;
+    stats_session_begin();
 
     while (EMBER_SUCCESS == err)
     {
         task_t task = {0};
+        stats_task_begin(&task.stats);
 
         err = receive_task(sock, &task);
 
         if (EMBER_SUCCESS == err)
         {
-            err = do_task(sock, &task, p_settings);
+            err = execute_and_respond(sock, &task, p_settings);
         }
+        TRACE_INFO(TRACE_EV_TASK_END, task.hdr.op_code, task.response_code, err);
 
         if (EMBER_SUCCESS == err)
         {
-            DEBUG_PERROR("no response");
-            err = send_response(sock, task.response_code, NULL, 0);
+            stats_task_end(&task.stats, task.hdr.op_code);
         }
-        DEBUG_PERROR("post response");
 
-        if (DISCONNECT == task.response_code)
+        mem_free(task.raw_data);
+        mem_free(task.response_data);
+
+        if (DISCONNECT == task.hdr.op_code)
         {
             break;
         }
+
+        if ((EMBER_SUCCESS == err) && (EXIT == task.hdr.op_code))
+        {
+            err = -EMBER_EXIT;
+        }
     }
     DEBUG_PRINT("exit %d", err);
     return err;
@@ -118,59 +215,161 @@ static int network_send_all_io_callback_wrapper(void *p_data, uint8_t *send_buff
     return (int)utils_sendall(*((int *)p_data), send_buffer, (size_t)len, MSG_NOSIGNAL);
 }
 
+static int wait_for_task(int sock)
+{
+    // The C2 sends the next task when it has one, however long that takes. RECV_TIMEOUT bounds stalls within a task,
+    // a C2 that is gone between tasks is found by the session's keepalive probes. Background jobs are serviced until
+    // the task arrives.
+    if ((0 < job_running_count()) && (1 != job_wait(sock, -1)))
+    {
+        return -EMBER_ERROR;
+    }
+
+    struct pollfd pfd = {.fd = sock, .events = POLLIN};
+    while (-1 == poll(&pfd, 1, -1))
+    {
+        if (EINTR != errno)
+        {
+            DEBUG_PERROR("poll");
+            return -EMBER_ERROR;
+        }
+    }
+    return EMBER_SUCCESS;
+}
+
+static bool discard_bytes(int sock, size_t len)
+{
+    uint8_t discard_buf[DISCARD_BUF_LEN];
+    bool b_ok = true;
+    while (b_ok && (0 < len))
+    {
+        size_t chunk_len = MIN(len, sizeof(discard_buf));
+        b_ok = ((ssize_t)chunk_len == utils_recvall(sock, discard_buf, chunk_len, 0));
+        len -= chunk_len;
+    }
+    return b_ok;
+}
+
+/**
+ * @brief Receive the payload and padding that follow the header. A payload the memory budget has no room for is read
+ * and dropped, the task is then answered with -NO_MEMORY and the session goes on.
+ */
+static int receive_payload(int sock, task_t *p_task)
+{
+    p_task->raw_data = (uint8_t *)mem_alloc(p_task->hdr.data_len);
+    if (NULL == p_task->raw_data)
+    {
+        DEBUG_PERROR("mem_alloc");
+        p_task->response_code = -NO_MEMORY;
+        return discard_bytes(sock, (size_t)p_task->hdr.data_len + p_task->hdr.pad_len) ? EMBER_SUCCESS : -EMBER_ERROR;
+    }
+
+    uint8_t pad_buf[PAD_BUF_LEN] = {0};
+    if (((ssize_t)p_task->hdr.data_len != utils_recvall(sock, p_task->raw_data, (size_t)p_task->hdr.data_len, 0)) ||
+        ((ssize_t)p_task->hdr.pad_len != utils_recvall(sock, pad_buf, (size_t)p_task->hdr.pad_len, 0)))
+    {
+        return -EMBER_ERROR;
+    }
+    return EMBER_SUCCESS;
+}
+
 static int receive_task(int sock, task_t *p_task)
 {
-    int err = EMBER_SUCCESS;
+    int err = wait_for_task(sock);
 
-    DEBUG_PERROR("enter");
+    TRACE_INFO(TRACE_EV_TASK_BEGIN, 0, 0, 0);
 
     // replace with header-specific receiving function
     uint8_t hdr_buf[TASK_HDR_LEN] = {0};
-    if (TASK_HDR_LEN != utils_recvall(sock, hdr_buf, TASK_HDR_LEN, 0))
+    if ((EMBER_SUCCESS == err) && (TASK_HDR_LEN != utils_recvall(sock, hdr_buf, TASK_HDR_LEN, 0)))
     {
-        DEBUG_MSG("hdr recv");
         err = -EMBER_ERROR;
     }
 
     // Validate task, check lengths and such
     if (EMBER_SUCCESS == err)
     {
+        stats_phase_end(&p_task->stats, PHASE_RECV_HDR);
         deserialize_task_header(&p_task->hdr, hdr_buf);
-        p_task->raw_data = (uint8_t *)malloc(p_task->hdr.data_len);
-        if (NULL == p_task->raw_data)
-        {
-            DEBUG_PERROR("malloc");
-            err = -EMBER_ERROR;
-        }
+        err = receive_payload(sock, p_task);
     }
 
-    if (EMBER_SUCCESS == err)
+    if ((EMBER_SUCCESS == err) && (NULL != p_task->raw_data))
     {
-        uint8_t pad_buf[PAD_BUF_LEN] = {0};
-        if (((ssize_t)p_task->hdr.data_len != utils_recvall(sock, p_task->raw_data, (size_t)p_task->hdr.data_len, 0)) ||
-            ((ssize_t)p_task->hdr.pad_len != utils_recvall(sock, pad_buf, (size_t)p_task->hdr.pad_len, 0)))
-        {
-            err = -EMBER_ERROR;
-        }
+        stats_phase_end(&p_task->stats, PHASE_RECV_BODY);
+        err = deserialize_task(p_task);
+        stats_phase_end(&p_task->stats, PHASE_DECODE);
     }
 
-    if (EMBER_SUCCESS == err)
+    if (EMBER_SUCCESS != err)
     {
-        err = deserialize_task(p_task);
+        mem_free(p_task->raw_data);
     }
 
-    if ((EMBER_SUCCESS != err) && (NULL != p_task->raw_data))
+    return err;
+}
+
+static exec_cancel_state_t receive_cancel(int sock, void *p_data)
+{
+    task_t *p_task = (task_t *)p_data;
+    uint8_t hdr_buf[TASK_HDR_LEN] = {0};
+
+    ssize_t peeked = recv(sock, hdr_buf, TASK_HDR_LEN, MSG_PEEK | MSG_DONTWAIT);
+    if ((-1 == peeked) && ((EAGAIN == errno) || (EINTR == errno)))
+    {
+        return EXEC_CANCEL_PENDING;
+    }
+    if (0 >= peeked)
+    {
+        // The C2 is gone, nobody is left to take the output
+        return EXEC_CANCEL_REQUESTED;
+    }
+    if (CANCEL != hdr_buf[0])
     {
-        utils_free(p_task->raw_data);
+        return EXEC_CANCEL_NONE;
+    }
+    if (TASK_HDR_LEN != peeked)
+    {
+        return EXEC_CANCEL_PENDING;
     }
 
-    DEBUG_PERROR("exit");
+    // Consume the CANCEL, it is answered after the task it cancelled
+    task_header_t hdr = {0};
+    deserialize_task_header(&hdr, hdr_buf);
+    p_task->b_cancel_received = (TASK_HDR_LEN == utils_recvall(sock, hdr_buf, TASK_HDR_LEN, 0)) &&
+                                discard_bytes(sock, (size_t)hdr.data_len + hdr.pad_len);
+    return EXEC_CANCEL_REQUESTED;
+}
+
+static int handle_exec_background(task_t *p_task)
+{
+    uint32_t id = 0;
+    int err = job_start(&p_task->exec, p_task->hdr.flags, &id, &p_task->response_code);
+
+    // The final response carries the new job's id
+    if ((EMBER_SUCCESS == err) && (SUCCESS == p_task->response_code))
+    {
+        p_task->response_data = (uint8_t *)mem_alloc_fixed(sizeof(uint32_t));
+        if (NULL == p_task->response_data)
+        {
+            DEBUG_PERROR("mem_alloc_fixed");
+            return -EMBER_ERROR;
+        }
+        uint32_t net_id = htonl(id);
+        memcpy(p_task->response_data, &net_id, sizeof(uint32_t));
+        p_task->response_len = sizeof(uint32_t);
+    }
 
     return err;
 }
 
 static int handle_exec_do(int sock, task_t *p_task)
 {
+    if ((uint16_t)BACKGROUND & p_task->hdr.flags)
+    {
+        return handle_exec_background(p_task);
+    }
+
     int err = EMBER_SUCCESS;
 
     if ((uint16_t)IN_MEM & p_task->hdr.flags)
@@ -182,13 +381,40 @@ static int handle_exec_do(int sock, task_t *p_task)
     if (EMBER_SUCCESS == err)
     {
         io_callback_t sender = {.func = send_response_io_callback_wrapper, .data = &sock};
+        p_task->exec.cancel = (exec_cancel_t){.fd = sock, .func = receive_cancel, .data = p_task};
         err = exec_run(&sender, p_task->hdr.flags, &p_task->exec, &p_task->response_code);
     }
 
+    // The final response carries the exit status whenever the command ran, killed or not
+    if ((EMBER_SUCCESS == err) && p_task->exec.b_reaped)
+    {
+        p_task->response_data = (uint8_t *)mem_alloc_fixed(sizeof(uint32_t));
+        if (NULL == p_task->response_data)
+        {
+            DEBUG_PERROR("mem_alloc_fixed");
+            err = -EMBER_ERROR;
+        }
+        else
+        {
+            uint32_t net_status = htonl((uint32_t)p_task->exec.exit_status);
+            memcpy(p_task->response_data, &net_status, sizeof(uint32_t));
+            p_task->response_len = sizeof(uint32_t);
+        }
+    }
+
     return err;
 }
 
-static int handle_file_download(int sock, task_t *p_task)
+static int handle_download(int sock, task_t *p_task, settings_t *p_settings)
+{
+    if ((uint16_t)ARCHIVE & p_task->hdr.flags)
+    {
+        return handle_archive_download(sock, p_task, p_settings);
+    }
+    return handle_file_download(sock, p_task, p_settings);
+}
+
+static int handle_file_download(int sock, task_t *p_task, settings_t *p_settings)
 {
     char resolved_path[PATH_MAX] = {0};
     int8_t *p_res = &p_task->response_code;
@@ -199,19 +425,31 @@ static int handle_file_download(int sock, task_t *p_task)
     struct stat download_stat = {0};
     if ((EMBER_SUCCESS == err) && (SUCCESS == *p_res))
     {
-        download_fd = file_open_for_reading(resolved_path, &download_stat, p_task->hdr.data_len, p_res, &err);
+        download_fd = file_open_for_reading(resolved_path, &download_stat, p_task->hdr.file_len, p_res, &err);
     }
 
     if (EMBER_SUCCESS == err)
     {
-        int64_t file_size = download_stat.st_size;
-        err = send_response(sock, *p_res, &file_size, (size_t)sizeof(uint64_t));
+        sockopt_size_buffers(sock, DOWNLOAD, (uint64_t)download_stat.st_size);
+        uint64_t net_file_size = utils_htonll((uint64_t)download_stat.st_size);
+        err = send_response(sock, *p_res, &net_file_size, sizeof(uint64_t));
     }
 
     if ((EMBER_SUCCESS == err) && (SUCCESS == *p_res))
     {
-        io_callback_t reader = {.func = network_send_all_io_callback_wrapper, .data = &sock};
-        err = file_read_in_chunks(&reader, (size_t)download_stat.st_size, download_fd, p_res);
+        io_callback_t sender = {.func = network_send_all_io_callback_wrapper, .data = &sock};
+        ratelimit_io_t shaper = {0};
+        io_callback_t reader =
+            ratelimit_io_wrap(&shaper, &sender, &p_settings->rate_limit, &p_settings->task_rate_limit);
+        if ((uint16_t)SPARSE & p_task->hdr.flags)
+        {
+            err = file_read_sparse(&reader, (uint64_t)download_stat.st_size, download_fd, &p_task->file.digest, p_res);
+        }
+        else
+        {
+            err = file_read_in_chunks(&reader, (uint64_t)download_stat.st_size, download_fd, &p_task->file.digest,
+                                      p_res);
+        }
     }
 
     if ((-1 != download_fd) && (-1 == close(download_fd)))
@@ -223,7 +461,28 @@ static int handle_file_download(int sock, task_t *p_task)
     return err;
 }
 
-static int handle_file_upload(int sock, task_t *p_task)
+static int handle_archive_download(int sock, task_t *p_task, settings_t *p_settings)
+{
+    int8_t *p_res = &p_task->response_code;
+    *p_res = SUCCESS;
+
+    // No size up front, the archive is terminated by an ARCHIVE_END entry.
+    sockopt_size_buffers(sock, DOWNLOAD, UINT64_MAX);
+    int err = send_response(sock, *p_res, NULL, 0);
+
+    if (EMBER_SUCCESS == err)
+    {
+        io_callback_t network = {.func = network_send_all_io_callback_wrapper, .data = &sock};
+        ratelimit_io_t shaper = {0};
+        io_callback_t sender =
+            ratelimit_io_wrap(&shaper, &network, &p_settings->rate_limit, &p_settings->task_rate_limit);
+        err = archive_send(&sender, p_task->raw_data, p_task->hdr.data_len, &p_task->file.digest, p_res);
+    }
+
+    return err;
+}
+
+static int handle_file_upload(int sock, task_t *p_task, settings_t *p_settings)
 {
     char resolved_path[PATH_MAX] = {0};
     int8_t *p_res = &p_task->response_code;
@@ -239,13 +498,24 @@ static int handle_file_upload(int sock, task_t *p_task)
 
     if (EMBER_SUCCESS == err)
     {
+        sockopt_size_buffers(sock, UPLOAD, p_task->hdr.file_len);
         err = send_response(sock, *p_res, NULL, 0);
     }
 
     if ((EMBER_SUCCESS == err) && (SUCCESS == *p_res))
     {
-        io_callback_t reader = {.func = network_recv_all_io_callback_wrapper, .data = &sock};
-        err = file_write_in_chunks(&reader, p_task->hdr.file_len, upload_fd, p_res);
+        io_callback_t receiver = {.func = network_recv_all_io_callback_wrapper, .data = &sock};
+        ratelimit_io_t shaper = {0};
+        io_callback_t reader =
+            ratelimit_io_wrap(&shaper, &receiver, &p_settings->rate_limit, &p_settings->task_rate_limit);
+        if ((uint16_t)SPARSE & p_task->hdr.flags)
+        {
+            err = file_write_sparse(&reader, p_task->hdr.file_len, upload_fd, &p_task->file.digest, p_res);
+        }
+        else
+        {
+            err = file_write_in_chunks(&reader, p_task->hdr.file_len, upload_fd, &p_task->file.digest, p_res);
+        }
     }
 
     // TODO(user): unlink on error here based on what error happened
@@ -272,15 +542,88 @@ static int do_task(int sock, task_t *p_task, settings_t *p_settings)
         err = handle_exec_do(sock, p_task);
         break;
     case DOWNLOAD:
-        err = handle_file_download(sock, p_task);
+        err = handle_download(sock, p_task, p_settings);
         break;
     case UPLOAD:
-        err = handle_file_upload(sock, p_task);
+        err = handle_file_upload(sock, p_task, p_settings);
         break;
-    case DISCONNECT: // NOLINT (bugprone-branch-clone)
+    case DISCONNECT:
+        settings_poll_hint(&p_settings->poll, p_task->hdr.flags, p_task->poll_delay_ms);
         break;
     case EXIT: // NOLINT (bugprone-branch-clone)
         break;
+    case STATS:
+        err = stats_serialize(&p_task->response_data, &p_task->response_len, p_task->hdr.flags);
+        break;
+    case CANCEL:
+        // Nothing was running, the CANCEL came too late
+        break;
+    default:
+        err = do_extended_task(sock, p_task);
+        break;
+    }
+
+    return err;
+}
+
+static int handle_list(int sock, task_t *p_task)
+{
+    io_callback_t sender = {.func = send_response_io_callback_wrapper, .data = &sock};
+    return list_send(&sender, &p_task->list, &p_task->response_data, &p_task->response_len, &p_task->response_code);
+}
+
+static int handle_hash(int sock, task_t *p_task)
+{
+    io_callback_t sender = {.func = send_response_io_callback_wrapper, .data = &sock};
+    return hash_send(&sender, &p_task->hash, &p_task->response_data, &p_task->response_len, &p_task->response_code);
+}
+
+static int handle_job_output(int sock, task_t *p_task)
+{
+    job_output_t output = {0};
+    job_output(&p_task->job, &output, &p_task->response_code);
+    if (SUCCESS != p_task->response_code)
+    {
+        return EMBER_SUCCESS;
+    }
+
+    // The final response is sent from the job's ring, the output is not copied
+    struct iovec iov[] = {
+        {0}, {.iov_base = output.hdr, .iov_len = JOB_OUTPUT_HDR_LEN}, output.spans[0], output.spans[1]};
+    int err = send_response_iov(sock, SUCCESS, iov, ARRAY_LEN(iov));
+    p_task->b_responded = true;
+    if (EMBER_SUCCESS == err)
+    {
+        job_output_done(&p_task->job);
+    }
+
+    return err;
+}
+
+/**
+ * @brief Ops past the core ones, kept apart so neither switch outgrows the complexity limit.
+ */
+static int do_extended_task(int sock, task_t *p_task)
+{
+    int err = EMBER_SUCCESS;
+
+    switch (p_task->hdr.op_code)
+    {
+    case JOB_LIST:
+        err = job_list(&p_task->response_data, &p_task->response_len);
+        break;
+    case JOB_OUTPUT:
+        err = handle_job_output(sock, p_task);
+        break;
+    case JOB_KILL:
+        job_kill(&p_task->job, &p_task->response_code);
+        break;
+    case LIST:
+        err = handle_list(sock, p_task);
+        break;
+    case HASH:
+        err = handle_hash(sock, p_task);
+        break;
     default:
         DEBUG_MSG("Invalid op_code");
         err = -EMBER_ERROR;
@@ -0,0 +1,175 @@
+/**
+ * @file trace.c
+ * @author Kevin McKenzie
+ * @brief Per-thread lock-free trace rings and their dump. Compiled out entirely when TRACE_LEVEL is off.
+ *
+ * Each thread owns its ring, so writers never contend: a record is filled in and then published by a release store
+ * of the ring head. The dump may race with a writer and catch one torn record, which is acceptable for a debugging
+ * aid. The dump only uses open/write/close so it is safe to run from the SIGUSR1 handler.
+ *
+ * Dump layout, in the byte order of the target (the decoder detects it from the magic):
+ * [u32 magic][u16 version][u16 record_size][u32 ring_len][u32 num_rings], then per ring
+ * [u32 tid][u32 head][ring_len x trace_record_t]. head counts every record ever written, records[head % ring_len]
+ * is the oldest one once the ring has wrapped.
+ */
+#define _GNU_SOURCE // NOLINT syscall(SYS_gettid)
+
+#include "trace.h"
+
+#if TRACE_LEVEL > TRACE_LEVEL_OFF
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "utils.h"
+
+enum
+{
+    TRACE_RING_LEN = 4096, // Must be a power of two
+    TRACE_MAX_THREADS = 64,
+    TRACE_FILE_VERSION = 1,
+    TRACE_FILE_PERMS = 0600,
+    NSEC_PER_SEC = 1000000000,
+};
+
+static const uint32_t TRACE_MAGIC = 0x52544D45; // "EMTR" when read little endian
+
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+    uint32_t ring_len;
+    uint32_t num_rings;
+} trace_file_hdr_t;
+
+typedef struct
+{
+    uint32_t tid;
+    uint32_t head;
+    trace_record_t records[TRACE_RING_LEN];
+} trace_ring_t;
+
+static trace_ring_t *g_rings[TRACE_MAX_THREADS] = {0};
+static uint32_t g_num_rings = 0;
+static const char *g_trace_path = NULL;
+
+static _Thread_local trace_ring_t *tp_ring = NULL;
+static _Thread_local bool tp_b_untraced = false;
+
+static trace_ring_t *ring_register(void)
+{
+    trace_ring_t *p_ring = NULL;
+
+    uint32_t slot = __atomic_fetch_add(&g_num_rings, 1, __ATOMIC_RELAXED);
+    if (TRACE_MAX_THREADS > slot)
+    {
+        p_ring = (trace_ring_t *)calloc(1, sizeof(trace_ring_t));
+    }
+
+    if (NULL != p_ring)
+    {
+        p_ring->tid = (uint32_t)syscall(SYS_gettid);
+        __atomic_store_n(&g_rings[slot], p_ring, __ATOMIC_RELEASE);
+    }
+
+    return p_ring;
+}
+
+void trace_emit(uint16_t event, uint32_t arg0, int64_t arg1, int64_t arg2)
+{
+    trace_ring_t *p_ring = tp_ring;
+
+    if ((NULL == p_ring) && !tp_b_untraced)
+    {
+        p_ring = ring_register();
+        tp_ring = p_ring;
+        tp_b_untraced = (NULL == p_ring);
+    }
+
+    if (NULL != p_ring)
+    {
+        uint32_t head = p_ring->head;
+        trace_record_t *p_record = &p_ring->records[head & (TRACE_RING_LEN - 1)];
+
+        struct timespec now = {0};
+        (void)clock_gettime(CLOCK_MONOTONIC, &now);
+
+        p_record->ts_ns = ((uint64_t)now.tv_sec * NSEC_PER_SEC) + (uint64_t)now.tv_nsec;
+        p_record->event = event;
+        p_record->arg0 = arg0;
+        p_record->arg1 = arg1;
+        p_record->arg2 = arg2;
+
+        __atomic_store_n(&p_ring->head, head + 1, __ATOMIC_RELEASE);
+    }
+}
+
+static void trace_dump(void)
+{
+    int dump_fd = open(g_trace_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, TRACE_FILE_PERMS);
+    if (-1 == dump_fd)
+    {
+        return;
+    }
+
+    uint32_t num_rings = MIN(__atomic_load_n(&g_num_rings, __ATOMIC_ACQUIRE), (uint32_t)TRACE_MAX_THREADS);
+    trace_file_hdr_t hdr = {TRACE_MAGIC, TRACE_FILE_VERSION, sizeof(trace_record_t), TRACE_RING_LEN, 0};
+
+    for (uint32_t idx = 0; idx < num_rings; idx++)
+    {
+        hdr.num_rings += (NULL != __atomic_load_n(&g_rings[idx], __ATOMIC_ACQUIRE)) ? 1 : 0;
+    }
+
+    bool b_ok = (sizeof(hdr) == (size_t)write(dump_fd, &hdr, sizeof(hdr)));
+
+    for (uint32_t idx = 0; b_ok && (idx < num_rings); idx++)
+    {
+        trace_ring_t *p_ring = __atomic_load_n(&g_rings[idx], __ATOMIC_ACQUIRE);
+        if (NULL != p_ring)
+        {
+            uint32_t ring_hdr[2] = {p_ring->tid, __atomic_load_n(&p_ring->head, __ATOMIC_ACQUIRE)};
+            b_ok = (sizeof(ring_hdr) == (size_t)write(dump_fd, ring_hdr, sizeof(ring_hdr))) &&
+                   (sizeof(p_ring->records) == (size_t)write(dump_fd, p_ring->records, sizeof(p_ring->records)));
+        }
+    }
+
+    close(dump_fd);
+}
+
+static void trace_dump_signal_handler(int signum)
+{
+    (void)signum;
+    int saved_errno = errno;
+    trace_dump();
+    errno = saved_errno;
+}
+
+void trace_init(void)
+{
+    g_trace_path = getenv("EMBER_TRACE_FILE");
+
+    if (NULL != g_trace_path)
+    {
+        (void)atexit(trace_dump);
+
+        struct sigaction action = {0};
+        action.sa_handler = trace_dump_signal_handler;
+        action.sa_flags = SA_RESTART;
+        (void)sigemptyset(&action.sa_mask);
+        (void)sigaction(SIGUSR1, &action, NULL);
+    }
+}
+
+#endif /* TRACE_LEVEL > TRACE_LEVEL_OFF */
+
+/*** END OF FILE ***/
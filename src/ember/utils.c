@@ -8,13 +8,17 @@
 #define _POSIX_C_SOURCE 200809L // NOLINT
 
 #include <arpa/inet.h>
+#include <errno.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include "stats.h"
+#include "trace.h"
 #include "utils.h"
 
 /**
@@ -53,6 +57,8 @@ ssize_t utils_writeall(int write_fd, void *src, size_t len)
     while ((size_t)total_written < len)
     {
         ssize_t written = write(write_fd, (uint8_t *)src + total_written, len - (size_t)total_written);
+        stats_count_syscall(written, false);
+        TRACE_DEBUG(TRACE_EV_WRITE, write_fd, len - (size_t)total_written, written);
         if (0 < written)
         {
             total_written += written;
@@ -61,6 +67,7 @@ ssize_t utils_writeall(int write_fd, void *src, size_t len)
         {
             if (-1 == written)
             {
+                TRACE_ERROR(TRACE_EV_SYSCALL_FAIL, __LINE__, errno, written);
                 total_written = -1;
             }
             break;
@@ -76,6 +83,8 @@ ssize_t utils_readall(int read_fd, void *dest, size_t read_size)
     while ((size_t)total_read < read_size)
     {
         ssize_t this_read = read(read_fd, (uint8_t *)dest + total_read, read_size - (size_t)total_read);
+        stats_count_syscall(this_read, true);
+        TRACE_DEBUG(TRACE_EV_READ, read_fd, read_size - (size_t)total_read, this_read);
         if (0 < this_read)
         {
             total_read += this_read;
@@ -84,6 +93,7 @@ ssize_t utils_readall(int read_fd, void *dest, size_t read_size)
         {
             if (-1 == this_read)
             {
+                TRACE_ERROR(TRACE_EV_SYSCALL_FAIL, __LINE__, errno, this_read);
                 total_read = -1;
             }
             break;
@@ -98,15 +108,16 @@ ssize_t utils_recvall(int sock, void *dest, size_t num_bytes, int flags)
     ssize_t total_recvd = 0;
     while ((size_t)total_recvd < num_bytes)
     {
-        DEBUG_PRINT("%d %lu", sock, num_bytes - (size_t)total_recvd);
         ssize_t recvd = recv(sock, (uint8_t *)dest + total_recvd, num_bytes - (size_t)total_recvd, flags);
+        stats_count_syscall(recvd, true);
+        TRACE_DEBUG(TRACE_EV_RECV, sock, num_bytes - (size_t)total_recvd, recvd);
         if (0 < recvd)
         {
             total_recvd += recvd;
         }
         else
         {
-            DEBUG_PERROR("recv");
+            TRACE_ERROR(TRACE_EV_SYSCALL_FAIL, __LINE__, errno, recvd);
             total_recvd = -1;
             break;
         }
@@ -122,6 +133,8 @@ ssize_t utils_sendall(int sock, void *src, size_t len, int flags)
     while ((size_t)total_sent < len)
     {
         ssize_t sent = send(sock, (uint8_t *)src + total_sent, len - (size_t)total_sent, flags);
+        stats_count_syscall(sent, false);
+        TRACE_DEBUG(TRACE_EV_SEND, sock, len - (size_t)total_sent, sent);
 
         if (0 < sent)
         {
@@ -129,7 +142,7 @@ ssize_t utils_sendall(int sock, void *src, size_t len, int flags)
         }
         else
         {
-            DEBUG_PERROR("send");
+            TRACE_ERROR(TRACE_EV_SYSCALL_FAIL, __LINE__, errno, sent);
             total_sent = -1;
             break;
         }
@@ -138,6 +151,42 @@ ssize_t utils_sendall(int sock, void *src, size_t len, int flags)
     return total_sent;
 }
 
+ssize_t utils_sendall_iov(int sock, struct iovec *iov, size_t iov_len, int flags)
+{
+    ssize_t total_sent = 0;
+    struct msghdr msg = {.msg_iov = iov, .msg_iovlen = iov_len};
+
+    while (0 < msg.msg_iovlen)
+    {
+        ssize_t sent = sendmsg(sock, &msg, flags);
+        stats_count_syscall(sent, false);
+        TRACE_DEBUG(TRACE_EV_SEND, sock, msg.msg_iov[0].iov_len, sent);
+
+        if (0 >= sent)
+        {
+            TRACE_ERROR(TRACE_EV_SYSCALL_FAIL, __LINE__, errno, sent);
+            return -1;
+        }
+        total_sent += sent;
+
+        // Skip the buffers that went out whole, and the part of the one the send stopped in
+        size_t left = (size_t)sent;
+        while ((0 < msg.msg_iovlen) && (left >= msg.msg_iov[0].iov_len))
+        {
+            left -= msg.msg_iov[0].iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (0 < msg.msg_iovlen)
+        {
+            msg.msg_iov[0].iov_base = (uint8_t *)msg.msg_iov[0].iov_base + left;
+            msg.msg_iov[0].iov_len -= left;
+        }
+    }
+
+    return total_sent;
+}
+
 uint64_t utils_ntohll(uint64_t net_long)
 {
     uint64_t result = 0;
@@ -0,0 +1,119 @@
+#!/usr/bin/python3
+"""Decode an ember trace ring dump ($EMBER_TRACE_FILE) into text or Chrome trace JSON.
+
+Event names are read from the trace_events enum in src/ember/include/trace.h so the two never drift apart. The dump
+is written in the byte order of the target, which is detected from the magic.
+"""
+
+import argparse
+import json
+import pathlib
+import re
+import struct
+import sys
+
+TRACE_MAGIC = 0x52544D45
+TRACE_VERSION = 1
+TRACE_H = pathlib.Path(__file__).resolve().parents[1] / "ember" / "include" / "trace.h"
+
+FILE_HDR = "IHHII"
+RING_HDR = "II"
+RECORD = "QHHIqq"
+
+
+def parse_events(header: pathlib.Path) -> dict[int, str]:
+    """Parse `TRACE_EV_NAME[ = value],` lines of the trace_events enum, C numbering rules."""
+    body = re.search(r"enum trace_events\s*\{(.*?)\};", header.read_text(), re.S)
+    if body is None:
+        raise ValueError(f"no trace_events enum in {header}")
+
+    events = {}
+    value = -1
+    for match in re.finditer(r"TRACE_EV_(\w+)\s*(?:=\s*(\w+))?\s*,", body.group(1)):
+        value = int(match.group(2), 0) if match.group(2) else value + 1
+        events[value] = match.group(1)
+    return events
+
+
+def read_dump(data: bytes) -> list[dict]:
+    """Return every record of every ring, oldest first within a ring."""
+    for order in "<>":
+        if struct.unpack_from(order + "I", data)[0] == TRACE_MAGIC:
+            break
+    else:
+        raise ValueError("not an ember trace dump")
+
+    _, version, record_size, ring_len, num_rings = struct.unpack_from(order + FILE_HDR, data)
+    if version != TRACE_VERSION or record_size != struct.calcsize(order + RECORD):
+        raise ValueError(f"unsupported trace dump version {version} record size {record_size}")
+
+    offset = struct.calcsize(order + FILE_HDR)
+    records = []
+    for _ in range(num_rings):
+        tid, head = struct.unpack_from(order + RING_HDR, data, offset)
+        offset += struct.calcsize(order + RING_HDR)
+        ring = list(struct.iter_unpack(order + RECORD, data[offset : offset + ring_len * record_size]))
+        offset += ring_len * record_size
+
+        # head counts every record ever written, once wrapped the oldest record is at head % ring_len
+        if head > ring_len:
+            ring = ring[head % ring_len :] + ring[: head % ring_len]
+        else:
+            ring = ring[:head]
+
+        for ts_ns, event, _, arg0, arg1, arg2 in ring:
+            records.append({"tid": tid, "ts_ns": ts_ns, "event": event, "args": (arg0, arg1, arg2)})
+    return records
+
+
+def to_text(records: list[dict], events: dict[int, str]) -> str:
+    start = min((record["ts_ns"] for record in records), default=0)
+    lines = []
+    for record in sorted(records, key=lambda record: record["ts_ns"]):
+        name = events.get(record["event"], f"EVENT_{record['event']}")
+        elapsed_us = (record["ts_ns"] - start) / 1000
+        args = " ".join(str(arg) for arg in record["args"])
+        lines.append(f"{elapsed_us:14.3f} {record['tid']:>7} {name:16} {args}")
+    return "\n".join(lines)
+
+
+def to_chrome(records: list[dict], events: dict[int, str]) -> str:
+    """Chrome trace event format, load in chrome://tracing or Perfetto. _BEGIN/_END pairs become durations."""
+    trace_events = []
+    for record in sorted(records, key=lambda record: record["ts_ns"]):
+        name = events.get(record["event"], f"EVENT_{record['event']}")
+        phase = "i"
+        if name.endswith("_BEGIN"):
+            name, phase = name[: -len("_BEGIN")], "B"
+        elif name.endswith("_END"):
+            name, phase = name[: -len("_END")], "E"
+
+        trace_event = {
+            "name": name,
+            "ph": phase,
+            "ts": record["ts_ns"] / 1000,
+            "pid": 0,
+            "tid": record["tid"],
+            "args": dict(zip(("arg0", "arg1", "arg2"), record["args"])),
+        }
+        if "i" == phase:
+            trace_event["s"] = "t"
+        trace_events.append(trace_event)
+    return json.dumps({"traceEvents": trace_events, "displayTimeUnit": "ns"})
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("dump", type=pathlib.Path, help="trace dump written by ember")
+    parser.add_argument("--format", choices=["text", "chrome"], default="text")
+    parser.add_argument("--header", type=pathlib.Path, default=TRACE_H, help="trace.h to read event names from")
+    args = parser.parse_args()
+
+    events = parse_events(args.header)
+    records = read_dump(args.dump.read_bytes())
+    print(to_chrome(records, events) if "chrome" == args.format else to_text(records, events))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
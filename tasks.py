@@ -1,4 +1,6 @@
+import json
 import pathlib
+import struct
 
 import invoke
 
@@ -56,6 +58,68 @@ TARGETS = {
 }
 
 
+BUILD_TYPES = ("Debug", "MinSizeRel", "Release-LTO", "Release-PGO")
+SPEED_BUILD_TYPES = ("Release-LTO", "Release-PGO")
+SANITIZER_TARGETS = ("asan", "valgrind")
+# Benchmark scenarios the instrumented Release-PGO build is trained on: task decode, transfers and exec spawning
+PGO_TRAINING_SCENARIOS = "settings_storm task_rtt transfers exec_spawn"
+# bench.py's defaults keep a run to minutes and its files to a few GiB, also under an emulator. --full-size runs the
+# sizes the scenarios were written for: files larger than the page cache of most hosts and a tree of a million files.
+FULL_SIZE_ARGS = (
+    f"--large-size={10 << 30} --sparse-size={20 << 30} --sparse-allocated={2 << 30} --hash-size={10 * 10**9} "
+    f"--hash-files={10**5} --list-files={10**6} "
+)
+# Reference builds inv bench measures the build under test against, each with one optimisation switched off: the build()
+# parameter that switches it, the build name suffix, the CMake define and the bench.py option that takes the binary
+REFERENCE_BUILDS = {
+    "transfer_crc": ("-nocrc", "-DTRANSFER_CRC=OFF", "--no-crc-binary"),
+    "mmap_reads": ("-nommap", "-DMMAP_READS=OFF", "--no-mmap-binary"),
+    "task_stats": ("-nostats", "-DTASK_STATS=OFF", "--no-stats-binary"),
+    "socket_tuning": ("-notuning", "-DSOCKET_TUNING=OFF", "--no-tuning-binary"),
+}
+
+
+def build_config(target: str, release: bool, build_type: str) -> tuple[str, str, str]:
+    """Linking, build type and build name of a target. A build type given by name overrides release."""
+    if target not in TARGETS:
+        raise invoke.Exit(
+            f"Invalid target: {target} must be one of {list(TARGETS.keys())}"
+        )
+    if build_type and build_type not in BUILD_TYPES:
+        raise invoke.Exit(
+            f"Invalid build type: {build_type} must be one of {list(BUILD_TYPES)}"
+        )
+
+    linking = TARGETS[target].get("linking", "static")
+    build_type = build_type or ("MinSizeRel" if release else "Debug")
+    return linking, build_type, f"{target}-{linking}-{build_type.lower()}"
+
+
+def bin_path(build_name: str) -> str:
+    return pathlib.Path(f"./dist/bin/{PROJECT_NAME}-{build_name}").absolute().as_posix()
+
+
+def bench_command(target: str, build_name: str, full_size: bool = False) -> str:
+    emulator = TARGETS[target].get("emulator", "")
+    command = f'python3 src/bench/bench.py --binary="{bin_path(build_name)}" --emulator="{emulator}" '
+    return command + (FULL_SIZE_ARGS if full_size else "")
+
+
+def image_size(path: str) -> int:
+    """Bytes of an ELF binary's loadable segments in the file. The file size hides most changes in section
+    alignment padding, statically linked binaries in particular."""
+    data = pathlib.Path(path).read_bytes()
+    order = "<" if 1 == data[5] else ">"
+    if 1 == data[4]:  # ELFCLASS32
+        phoff, phentsize, phnum = struct.unpack_from(f"{order}28xI10xHH", data)
+        segment = f"{order}I12xI"  # p_type, p_filesz
+    else:
+        phoff, phentsize, phnum = struct.unpack_from(f"{order}32xQ14xHH", data)
+        segment = f"{order}I28xQ"
+    headers = (struct.unpack_from(segment, data, phoff + idx * phentsize) for idx in range(phnum))
+    return sum(filesz for p_type, filesz in headers if 1 == p_type)  # PT_LOAD
+
+
 def filenames_string(*patterns) -> str:
     files = []
     for pattern in patterns:
@@ -88,15 +152,10 @@ def analyze(
     ctx: invoke.context,
     target: str = "local",
     release: bool = False,
+    build_type: str = "",
 ):
     """Perform static analysis using CodeChecker on an already built target. See `inv build --list-targets` for valid targets."""
-    if target not in TARGETS:
-        raise invoke.Exit(
-            f"Invalid target: {target} must be one of {list(TARGETS.keys())}"
-        )
-    linking = TARGETS[target].get("linking", "static")
-    build_type = "MinSizeRel" if release else "Debug"
-    build_name = f"{target}-{linking}-{build_type.lower()}"
+    _, _, build_name = build_config(target, release, build_type)
     build_dir = f"build-{build_name}"
 
     ctx.run(f"mkdir -p dist/reports/analysis/{build_dir}")
@@ -120,21 +179,29 @@ def build(
     ctx: invoke.context,
     target: str = "local",
     release: bool = False,
+    build_type: str = "",
     list_targets: bool = False,
+    transfer_crc: bool = True,
+    mmap_reads: bool = True,
+    task_stats: bool = True,
+    socket_tuning: bool = True,
 ):
-    """Build the project using CMake. See inv build --list-targets for valid targets."""
-    if target not in TARGETS:
-        raise invoke.Exit(
-            f"Invalid target: {target} must be one of {list(TARGETS.keys())}"
-        )
+    """Build the project using CMake, --release for MinSizeRel or --build-type for any of BUILD_TYPES. --no-transfer-crc, --no-mmap-reads, --no-task-stats and --no-socket-tuning build the benchmarks' references, named with the suffixes in REFERENCE_BUILDS. See inv build --list-targets for valid targets."""
+    linking, build_type, build_name = build_config(target, release, build_type)
+    switches = (
+        ("transfer_crc", transfer_crc),
+        ("mmap_reads", mmap_reads),
+        ("task_stats", task_stats),
+        ("socket_tuning", socket_tuning),
+    )
+    switches_off = [switch for switch, b_on in switches if not b_on]
+    for switch in switches_off:
+        build_name += REFERENCE_BUILDS[switch][0]
 
     if list_targets:
         print(f"Available targets: {list(TARGETS.keys())}")
         return
 
-    linking = TARGETS[target].get("linking", "static")
-    build_type = "MinSizeRel" if release else "Debug"
-    build_name = f"{target}-{linking}-{build_type.lower()}"
     build_dir = f"build-{build_name}"
 
     cmake_defines = (
@@ -145,40 +212,146 @@ def build(
     )
 
     if "asan" == target:
-        cmake_defines += "-DASAN=ON"
+        cmake_defines += "-DASAN=ON "
+
+    for switch in switches_off:
+        cmake_defines += f"{REFERENCE_BUILDS[switch][1]} "
 
     if "toolchain_file" in TARGETS[target]:
         cmake_defines += f"-DCMAKE_TOOLCHAIN_FILE={TARGETS[target]['toolchain_file']} "
 
     if linking != "static":
-        cmake_defines += "-DBUILD_SHARED_LIBS=ON"
+        cmake_defines += "-DBUILD_SHARED_LIBS=ON "
+
+    if "Release-PGO" == build_type:
+        train_pgo(ctx, target, build_name, cmake_defines)
+        cmake_defines += "-DPGO_PHASE=use "
 
     ctx.run(f"cmake {cmake_defines} -S . -B {build_dir}")
     ctx.run(f"cmake --build {build_dir} --target install")
 
 
+def train_pgo(ctx: invoke.context, target: str, build_name: str, cmake_defines: str):
+    """Build the instrumented Release-PGO binary and run the training workload on it, under the target's emulator for
+    cross targets. The profiles land in the build directory, where the PGO_PHASE=use rebuild looks for them. Each run
+    adds its counts to the profiles it finds, so they start out empty here and further runs of the instrumented binary
+    before the rebuild are merged in. Fails when the training left no profiles, the rebuild would silently be an
+    unprofiled Release-PGO build."""
+    build_dir = f"build-{build_name}"
+    ctx.run(f"rm -fdr {build_dir}/pgo")
+    ctx.run(f"cmake {cmake_defines} -DPGO_PHASE=generate -S . -B {build_dir}")
+    ctx.run(f"cmake --build {build_dir} --target install")
+    ctx.run(
+        bench_command(target, build_name)
+        + f"--scenarios {PGO_TRAINING_SCENARIOS} --repeat=1 --output=dist/reports/pgo/{build_name}.json"
+    )
+    if not any(pathlib.Path(f"{build_dir}/pgo").rglob("*.gcda")):
+        raise invoke.Exit(f"Training left no profiles in {build_dir}/pgo")
+
+
 @invoke.task
 def test(
     ctx: invoke.context,
     target: str = "local",
     k: str = "",
     release: bool = False,
+    build_type: str = "",
 ):
     """Run tests using pytest on an already built target. See inv build --list-targets for valid targets."""
-    if target not in TARGETS:
-        raise invoke.Exit(
-            f"Invalid target: {target} must be one of {list(TARGETS.keys())}"
+    _, _, build_name = build_config(target, release, build_type)
+
+    emulator = TARGETS[target].get("emulator", "")
+
+    ctx.run(
+        f'PYTHON_PATH=test EMULATOR="{emulator}" BIN_PATH="{bin_path(build_name)}" pytest . -k={k} -vv'
+    )
+
+
+@invoke.task
+def bench(
+    ctx: invoke.context,
+    target: str = "local",
+    release: bool = False,
+    build_type: str = "",
+    update_baseline: bool = False,
+    threshold: float = 0.10,
+    crc_reference: bool = True,
+    mmap_reference: bool = True,
+    stats_reference: bool = True,
+    tuning_reference: bool = True,
+    full_size: bool = False,
+):
+    """Benchmark an already built target against the stand-in C2 and compare with its stored baseline. The target is also built with optimisations switched off, see REFERENCE_BUILDS, to report what they gain: without transfer checksums for what CRC32C costs transfers, failing over 5%, unless --no-crc-reference, reading every file with pread() for what mapping large ones gains unless --no-mmap-reference, and without task telemetry for what it costs each task, failing over 1%, unless --no-stats-reference, and without socket tuning for what it gains small task round trips and the first task after a beacon unless --no-tuning-reference. --full-size runs the scenarios at FULL_SIZE_ARGS, against a baseline of its own. See inv build --list-targets for valid targets."""
+    _, _, build_name = build_config(target, release, build_type)
+    report_name = build_name + ("-full" if full_size else "")
+    baseline = f"src/bench/baselines/{report_name}.json"
+
+    command = bench_command(target, build_name, full_size)
+    references = (
+        ("transfer_crc", crc_reference),
+        ("mmap_reads", mmap_reference),
+        ("task_stats", stats_reference),
+        ("socket_tuning", tuning_reference),
+    )
+    for switch, b_reference in references:
+        if b_reference:
+            suffix, _, option = REFERENCE_BUILDS[switch]
+            build(ctx, target=target, release=release, build_type=build_type, **{switch: False})
+            command += f'{option}="{bin_path(build_name + suffix)}" '
+    ctx.run(
+        command
+        + f"--output=dist/reports/bench/{report_name}.json --baseline={baseline} --threshold={threshold} "
+        f"{'--update-baseline' if update_baseline else ''}"
+    )
+
+
+@invoke.task
+def bench_speed(ctx: invoke.context, target: str = "local", full_size: bool = False):
+    """Build and benchmark a target as MinSizeRel and each speed build type, report sizes and benchmark changes against MinSizeRel. --full-size runs the scenarios at FULL_SIZE_ARGS."""
+    _, _, reference_name = build_config(target, True, "")
+    build(ctx, target=target, release=True)
+    ctx.run(bench_command(target, reference_name, full_size) + f"--output=dist/reports/bench/{reference_name}.json")
+    reference = json.loads(pathlib.Path(f"dist/reports/bench/{reference_name}.json").read_text())["results"]
+    reference_size = image_size(f"dist/bin/{PROJECT_NAME}-{reference_name}")
+
+    report = {"reference": reference_name, "size": reference_size, "builds": {}}
+    for build_type in SPEED_BUILD_TYPES:
+        _, _, build_name = build_config(target, False, build_type)
+        build(ctx, target=target, build_type=build_type)
+        # The comparison prints every metric's change, a slower metric is reported rather than failing the task
+        ctx.run(
+            bench_command(target, build_name, full_size)
+            + f"--output=dist/reports/bench/{build_name}.json "
+            f"--baseline=dist/reports/bench/{reference_name}.json",
+            warn=True,
         )
+        results = json.loads(pathlib.Path(f"dist/reports/bench/{build_name}.json").read_text())["results"]
+        size = image_size(f"dist/bin/{PROJECT_NAME}-{build_name}")
 
-    linking = TARGETS[target].get("linking", "static")
-    build_type = "MinSizeRel" if release else "Debug"
-    build_name = f"{target}-{linking}-{build_type.lower()}"
+        # Positive is better whichever way the metric points
+        gains = {}
+        for name, current in results.items():
+            old = reference.get(name, {}).get("value")
+            if old:
+                change = (current["value"] - old) / old
+                gains[name] = round(change if current["higher_is_better"] else -change, 4)
+        report["builds"][build_type] = {"size": size, "size_change": round(size / reference_size - 1, 4), "gains": gains}
+        print(f"{build_type}: {size} bytes, {size / reference_size - 1:+.1%} against MinSizeRel")
 
-    bin_path = pathlib.Path(f"./dist/bin/{PROJECT_NAME}-{build_name}").absolute().as_posix()
-    emulator = TARGETS[target].get("emulator", "")
+    pathlib.Path(f"dist/reports/bench/{target}-speed.json").write_text(json.dumps(report, indent=2) + "\n")
 
+
+@invoke.task
+def bench_trace(ctx: invoke.context, target: str = "local"):
+    """Build a target as Debug, which traces at TRACE_LEVEL_DEBUG, and as MinSizeRel, and report what the traced build's transfers cost against the release build. Both builds take turns over several runs, see bench.py --reference-rounds."""
+    _, _, debug_name = build_config(target, False, "")
+    _, _, release_name = build_config(target, True, "")
+    build(ctx, target=target)
+    build(ctx, target=target, release=True)
     ctx.run(
-        f'PYTHON_PATH=test EMULATOR="{emulator}" BIN_PATH="{bin_path}" pytest . -k={k} -vv'
+        bench_command(target, debug_name)
+        + f'--scenarios transfers --release-binary="{bin_path(release_name)}" '
+        f"--output=dist/reports/bench/{target}-trace.json"
     )
 
 
@@ -195,6 +368,9 @@ def build_all(ctx):
     for target in TARGETS:
         build(ctx, target=target, release=False)
         build(ctx, target=target, release=True)
+        if target not in SANITIZER_TARGETS:
+            for build_type in SPEED_BUILD_TYPES:
+                build(ctx, target=target, build_type=build_type)
 
 
 @invoke.task